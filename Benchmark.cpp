@@ -0,0 +1,485 @@
+//--------------------------------------------------------------------------------------
+// Benchmarks for the soft body pipeline
+//--------------------------------------------------------------------------------------
+
+#include "Benchmark.h"
+#include "Model.h"
+#include "SoftBodyWorld.h"
+#include "SpatialHash.h"
+#include "CollisionPipeline.h"
+#include "TaskPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <ctime>
+#include <random>
+
+
+namespace
+{
+    const std::string BENCHMARK_MESHES[] = { "Cube.x", "Sphere.x", "HoverTank01.x", "cat_01_color05.FBX" };
+    const int BENCHMARK_CUBE_DIVISIONS[] = { 4, 8, 16, 32 };
+
+    const float BENCHMARK_FRAME_TIME = 1.0f / 60.0f;
+    const CVector3 BENCHMARK_GRAVITY = CVector3(0.0f, -30.0f, 0.0f);
+
+    //Steps between putting the nodes back to rest so long runs don't drift into a different (or exploded) state.
+    const int BENCHMARK_RESET_INTERVAL = 256;
+
+    //The collider sits this fraction of the body's width along, so the two overlap and contacts are found, but never
+    //further than half of Collision_Range so the face against face check always runs
+    const float BENCHMARK_COLLIDER_OFFSET = 0.5f;
+
+    const long long BENCHMARK_MAX_ITERATIONS = 1000000000;
+
+    //Spatial hash cases, on random points in a cube with about BENCHMARK_POINTS_PER_CELL to each cell
+    const int BENCHMARK_POINT_COUNTS[] = { 10000, 100000, 1000000 };
+    const float BENCHMARK_POINT_SPREAD = 100.0f;
+    const float BENCHMARK_POINTS_PER_CELL = 4.0f;
+    const int BENCHMARK_QUERY_COUNT = 1024;   //Queries cycled through, one per iteration
+    const int BENCHMARK_NEAREST_COUNT = 8;
+
+    //Float rounding allowed on top of a check's limit, in units in the last place of the largest coordinate
+    const float BENCHMARK_ROUNDING_ULPS = 2.0f;
+
+
+    // Writes a string with the characters JSON needs escaped
+    void WriteJsonString(std::ofstream& file, const std::string& text)
+    {
+        file << '"';
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')  file << '\\';
+            file << c;
+        }
+        file << '"';
+    }
+}
+
+
+template <typename Func>
+void BenchmarkSuite::Measure(const std::string& name, const std::string& meshName, Mesh* mesh, Func func)
+{
+    Measure(name, meshName, mesh->VertexData.getSize(), mesh->getSpringSize(), func);
+}
+
+
+template <typename Func>
+void BenchmarkSuite::Measure(const std::string& name, const std::string& meshName, int particles, int springs, Func func)
+{
+    using Clock = std::chrono::steady_clock;
+
+    //Warm up caches and any lazily sized buffers first
+    func();
+
+    long long iterations = 1;
+    double elapsed = 0;
+    while (true)
+    {
+        auto start = Clock::now();
+        for (long long i = 0; i < iterations; ++i)
+        {
+            func();
+        }
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+        if (elapsed >= mMinTime || iterations >= BENCHMARK_MAX_ITERATIONS)  break;
+
+        //Aim a little past the minimum time from what this run took, growing by at most 10x like Google Benchmark does
+        double multiplier = (elapsed > 0) ? mMinTime * 1.4 / elapsed : 10.0;
+        if (multiplier > 10.0)  multiplier = 10.0;
+        long long next = static_cast<long long>(iterations * multiplier);
+        iterations = (next > iterations) ? next : iterations + 1;
+    }
+
+    BenchmarkResult result;
+    result.name = name + "/" + meshName;
+    result.mesh = meshName;
+    result.particles = particles;
+    result.springs = springs;
+    result.iterations = iterations;
+    result.realTime = elapsed * 1e9 / iterations;
+    mResults.push_back(result);
+}
+
+
+template <typename CreateMesh>
+void BenchmarkSuite::RunMeshCases(const std::string& meshName, CreateMesh create)
+{
+    //Loading - each iteration builds the whole soft body (nodes, welding, springs and GPU buffers)
+    {
+        std::unique_ptr<Mesh> sample(create());
+        Measure("MeshLoad", meshName, sample.get(), [&]() { std::unique_ptr<Mesh> mesh(create()); });
+    }
+
+    std::unique_ptr<Mesh> mesh(create());
+    std::unique_ptr<Mesh> colliderMesh(create());
+
+    Measure("SetupSpring", meshName, mesh.get(), [&]() { mesh->rebuildSprings(); });
+
+    //Simulation step
+    mesh->VertexData.resetPoints();
+    int steps = 0;
+    Measure("ApplyForce", meshName, mesh.get(), [&]()
+    {
+        if (++steps == BENCHMARK_RESET_INTERVAL)
+        {
+            mesh->VertexData.resetPoints();
+            steps = 0;
+        }
+        mesh->VertexData.applyForce(BENCHMARK_FRAME_TIME, BENCHMARK_GRAVITY);
+    });
+
+    //The same step through the batched world solver
+    mesh->VertexData.resetPoints();
+    SoftBodyWorld world;
+    world.AddBody(mesh.get());
+    world.Build();
+    world.SetExternalForce(0, BENCHMARK_GRAVITY);
+    steps = 0;
+    Measure("WorldStep", meshName, mesh.get(), [&]()
+    {
+        if (++steps == BENCHMARK_RESET_INTERVAL)
+        {
+            mesh->VertexData.resetPoints();
+            steps = 0;
+        }
+        world.Step(BENCHMARK_FRAME_TIME);
+    });
+
+    //The same again with the springs stepped implicitly through the multigrid
+    mesh->VertexData.resetPoints();
+    world.SetSolver(HierarchicalSolver);
+    steps = 0;
+    Measure("HierarchicalStep", meshName, mesh.get(), [&]()
+    {
+        if (++steps == BENCHMARK_RESET_INTERVAL)
+        {
+            mesh->VertexData.resetPoints();
+            steps = 0;
+        }
+        world.Step(BENCHMARK_FRAME_TIME);
+    });
+    world.SetSolver(ExplicitSolver);
+
+    //Collision between a pair of bodies
+    mesh->VertexData.resetPoints();
+    CVector3 boundsMin, boundsMax;
+    mesh->VertexData.getRenderBounds(boundsMin, boundsMax);
+    const float colliderDistance = std::min((boundsMax.x - boundsMin.x) * BENCHMARK_COLLIDER_OFFSET, Collision_Range * 0.5f);
+    Model model(mesh.get(), CVector3(0, 0, 0));
+    Model collider(colliderMesh.get(), CVector3(colliderDistance, 0, 0));
+    steps = 0;
+    Measure("IsCollision", meshName, mesh.get(), [&]()
+    {
+        if (++steps == BENCHMARK_RESET_INTERVAL)
+        {
+            mesh->VertexData.resetPoints();
+            colliderMesh->VertexData.resetPoints();
+            steps = 0;
+        }
+        model.isCollision(&collider);
+    });
+
+    //A step and its collisions, searched once the step is done and then alongside it from a snapshot (see CollisionPipeline)
+    mesh->VertexData.resetPoints();
+    colliderMesh->VertexData.resetPoints();
+    steps = 0;
+    Measure("StepThenCollide", meshName, mesh.get(), [&]()
+    {
+        if (++steps == BENCHMARK_RESET_INTERVAL)
+        {
+            mesh->VertexData.resetPoints();
+            colliderMesh->VertexData.resetPoints();
+            steps = 0;
+        }
+        world.Step(BENCHMARK_FRAME_TIME);
+        model.isCollision(&collider);
+    });
+
+    mesh->VertexData.resetPoints();
+    colliderMesh->VertexData.resetPoints();
+    Model* pair[] = { &model, &collider };
+    CollisionPipeline pipeline;
+    pipeline.SetBodies(pair, 2);
+    steps = 0;
+    Measure("StepWithPipelinedCollide", meshName, mesh.get(), [&]()
+    {
+        if (++steps == BENCHMARK_RESET_INTERVAL)
+        {
+            mesh->VertexData.resetPoints();
+            colliderMesh->VertexData.resetPoints();
+            steps = 0;
+        }
+        pipeline.Capture();
+        std::atomic<int> pending{ 0 };
+        GetTaskPool().Submit([&]() { if (model.IsInCollisionRange(&collider))  pipeline.Detect(0, 1); }, pending);
+        world.Step(BENCHMARK_FRAME_TIME);
+        GetTaskPool().Wait(pending);
+        pipeline.Commit(1);
+    });
+
+    //Packing the nodes into the vertex layout, as done after every step ready for Mesh::Render to upload
+    mesh->VertexData.resetPoints();
+    Measure("VertexPack", meshName, mesh.get(), [&]() { mesh->VertexData.updateRenderVertices(); });
+
+    //Compacting the packed nodes for upload, as Mesh::PublishRenderVertices does
+    std::vector<CompactVertex> compactVertices(mesh->VertexData.getRenderVertexCount());
+    Measure("CompactPack", meshName, mesh.get(), [&]()
+    {
+        CVector3 boundsMin, boundsMax;
+        mesh->VertexData.getRenderBounds(boundsMin, boundsMax);
+        PackCompactVertices(mesh->VertexData.getRenderVertices(), static_cast<int>(compactVertices.size()), boundsMin, boundsMax, compactVertices.data());
+    });
+    CheckCompactRoundTrip(meshName, mesh.get());
+
+    //Recalculating every normal, the worst case for Mesh::Render when the whole body has moved
+    Measure("NormalUpdate", meshName, mesh.get(), [&]() { mesh->GetNormals().UpdateAll(mesh->VertexData); });
+
+    //The world step again with the body filled with tetrahedra in place of its springs
+    if (mesh->setSoftBodyModel(VolumeModel))
+    {
+        world.Build();
+        steps = 0;
+        Measure("VolumeStep", meshName, mesh.get(), [&]()
+        {
+            if (++steps == BENCHMARK_RESET_INTERVAL)
+            {
+                mesh->resetSoftBody();
+                steps = 0;
+            }
+            world.Step(BENCHMARK_FRAME_TIME);
+        });
+        mesh->setSoftBodyModel(SpringModel);
+    }
+}
+
+
+void BenchmarkSuite::CheckCompactRoundTrip(const std::string& meshName, Mesh* mesh)
+{
+    const BasicNode* nodes = mesh->VertexData.getRenderVertices();
+    const int count = mesh->VertexData.getRenderVertexCount();
+    CVector3 boundsMin, boundsMax;
+    mesh->VertexData.getRenderBounds(boundsMin, boundsMax);
+
+    std::vector<CompactVertex> compact(count);
+    PackCompactVertices(nodes, count, boundsMin, boundsMax, compact.data());
+
+    //Each position as the input assembler reads it, 0 to 1, then through the matrix Model::RenderMatrix puts first
+    const CMatrix4x4 toLocal = CompactPositionMatrix(boundsMin, boundsMax);
+    double maxError = 0;
+    for (int i = 0; i < count; ++i)
+    {
+        const float x = compact[i].position[0] / COMPACT_POSITION_STEPS;
+        const float y = compact[i].position[1] / COMPACT_POSITION_STEPS;
+        const float z = compact[i].position[2] / COMPACT_POSITION_STEPS;
+        const CVector3 local(x * toLocal.e00 + y * toLocal.e10 + z * toLocal.e20 + toLocal.e30,
+                             x * toLocal.e01 + y * toLocal.e11 + z * toLocal.e21 + toLocal.e31,
+                             x * toLocal.e02 + y * toLocal.e12 + z * toLocal.e22 + toLocal.e32);
+
+        const CVector3 error = local - nodes[i].Position;
+        maxError = std::max<double>({ maxError, std::abs(error.x), std::abs(error.y), std::abs(error.z) });
+    }
+
+    const float largestCoordinate = std::max({ std::abs(boundsMin.x), std::abs(boundsMin.y), std::abs(boundsMin.z),
+                                               std::abs(boundsMax.x), std::abs(boundsMax.y), std::abs(boundsMax.z) });
+    BenchmarkCheck check;
+    check.name = "CompactPositionError/" + meshName;
+    check.mesh = meshName;
+    check.error = maxError;
+    check.limit = 0.5 * CompactPositionScale(boundsMin, boundsMax) / COMPACT_POSITION_STEPS +
+                  largestCoordinate * BENCHMARK_ROUNDING_ULPS * std::numeric_limits<float>::epsilon();
+    mChecks.push_back(check);
+}
+
+
+int BenchmarkSuite::GetFailedCheckCount() const
+{
+    return static_cast<int>(std::count_if(mChecks.begin(), mChecks.end(), [](const BenchmarkCheck& check) { return !check.IsPassed(); }));
+}
+
+
+void BenchmarkSuite::RunSpatialHashCases(int count)
+{
+    //Fixed seed so every run times the same points
+    std::mt19937 random(12345);
+    std::uniform_real_distribution<float> coordinate(0.0f, BENCHMARK_POINT_SPREAD);
+
+    std::vector<CVector3> points(count);
+    for (CVector3& point : points)
+    {
+        point = CVector3(coordinate(random), coordinate(random), coordinate(random));
+    }
+    std::vector<CVector3> queries(BENCHMARK_QUERY_COUNT);
+    for (CVector3& query : queries)
+    {
+        query = CVector3(coordinate(random), coordinate(random), coordinate(random));
+    }
+
+    const float cellSize = BENCHMARK_POINT_SPREAD * std::cbrt(BENCHMARK_POINTS_PER_CELL / count);
+    const std::string setName = "Points" + std::to_string(count);
+
+    SpatialHash hash;
+    Measure("SpatialHashBuild", setName, count, 0, [&]() { hash.Build(points.data(), count, cellSize); });
+
+    std::vector<int> found;
+    int query = 0;
+    Measure("SpatialHashRadius", setName, count, 0, [&]()
+    {
+        hash.FindInRadius(queries[query], cellSize, found);
+        query = (query + 1) % BENCHMARK_QUERY_COUNT;
+    });
+
+    query = 0;
+    Measure("SpatialHashNearest", setName, count, 0, [&]()
+    {
+        hash.FindNearest(queries[query], BENCHMARK_NEAREST_COUNT, found);
+        query = (query + 1) % BENCHMARK_QUERY_COUNT;
+    });
+}
+
+
+void BenchmarkSuite::Run()
+{
+    mResults.clear();
+    mChecks.clear();
+
+    for (const std::string& meshName : BENCHMARK_MESHES)
+    {
+        RunMeshCases(meshName, [&]() { return new Mesh(meshName, false, true); });
+    }
+
+    for (int divisions : BENCHMARK_CUBE_DIVISIONS)
+    {
+        std::vector<BasicNode> vertices;
+        std::vector<unsigned int> indices;
+        MakeSubdividedCube(divisions, 10.0f, vertices, indices);
+
+        RunMeshCases("SubdividedCube" + std::to_string(divisions), [&]() { return new Mesh(vertices, indices, true); });
+    }
+
+    for (int count : BENCHMARK_POINT_COUNTS)
+    {
+        RunSpatialHashCases(count);
+    }
+}
+
+
+bool BenchmarkSuite::WriteJson(const std::string& fileName) const
+{
+    std::ofstream file(fileName);
+    if (!file)  return false;
+
+    char date[32] = "";
+    std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+
+    //Same shape as Google Benchmark's output so the usual compare tools can read it
+    file << "{\n";
+    file << "  \"context\": {\n";
+    file << "    \"date\": \"" << date << "\",\n";
+    file << "    \"num_cpus\": " << std::thread::hardware_concurrency() << ",\n";
+#ifdef _DEBUG
+    file << "    \"library_build_type\": \"debug\"\n";
+#else
+    file << "    \"library_build_type\": \"release\"\n";
+#endif
+    file << "  },\n";
+    file << "  \"benchmarks\": [\n";
+    for (size_t i = 0; i < mResults.size(); ++i)
+    {
+        const BenchmarkResult& result = mResults[i];
+        file << "    {\n";
+        file << "      \"name\": ";  WriteJsonString(file, result.name);  file << ",\n";
+        file << "      \"mesh\": ";  WriteJsonString(file, result.mesh);  file << ",\n";
+        file << "      \"particles\": " << result.particles << ",\n";
+        file << "      \"springs\": " << result.springs << ",\n";
+        file << "      \"iterations\": " << result.iterations << ",\n";
+        file << "      \"real_time\": " << result.realTime << ",\n";
+        file << "      \"time_unit\": \"ns\"\n";
+        file << "    }" << (i + 1 < mResults.size() ? "," : "") << "\n";
+    }
+    file << "  ],\n";
+
+    //Not part of Google Benchmark's shape, compare tools skip it
+    file << "  \"checks\": [\n";
+    for (size_t i = 0; i < mChecks.size(); ++i)
+    {
+        const BenchmarkCheck& check = mChecks[i];
+        file << "    {\n";
+        file << "      \"name\": ";  WriteJsonString(file, check.name);  file << ",\n";
+        file << "      \"mesh\": ";  WriteJsonString(file, check.mesh);  file << ",\n";
+        file << "      \"error\": " << check.error << ",\n";
+        file << "      \"limit\": " << check.limit << ",\n";
+        file << "      \"passed\": " << (check.IsPassed() ? "true" : "false") << "\n";
+        file << "    }" << (i + 1 < mChecks.size() ? "," : "") << "\n";
+    }
+    file << "  ]\n";
+    file << "}\n";
+
+    return static_cast<bool>(file);
+}
+
+
+void MakeSubdividedCube(int divisions, float size, std::vector<BasicNode>& vertices, std::vector<unsigned int>& indices)
+{
+    vertices.clear();
+    indices.clear();
+    if (divisions < 1)  divisions = 1;
+
+    //Each side is given by its normal and two axes across it
+    const CVector3 sides[6][3] =
+    {
+        { CVector3( 1, 0, 0), CVector3(0, 0, 1), CVector3(0, 1, 0) },
+        { CVector3(-1, 0, 0), CVector3(0, 1, 0), CVector3(0, 0, 1) },
+        { CVector3( 0, 1, 0), CVector3(1, 0, 0), CVector3(0, 0, 1) },
+        { CVector3( 0,-1, 0), CVector3(0, 0, 1), CVector3(1, 0, 0) },
+        { CVector3( 0, 0, 1), CVector3(0, 1, 0), CVector3(1, 0, 0) },
+        { CVector3( 0, 0,-1), CVector3(1, 0, 0), CVector3(0, 1, 0) },
+    };
+
+    const float half = size * 0.5f;
+    const int rowSize = divisions + 1;
+    for (int side = 0; side < 6; ++side)
+    {
+        const CVector3& normal = sides[side][0];
+        const CVector3& u = sides[side][1];
+        const CVector3& v = sides[side][2];
+
+        unsigned int first = static_cast<unsigned int>(vertices.size());
+        for (int y = 0; y <= divisions; ++y)
+        {
+            for (int x = 0; x <= divisions; ++x)
+            {
+                float s = static_cast<float>(x) / divisions;
+                float t = static_cast<float>(y) / divisions;
+
+                BasicNode vertex;
+                vertex.Position = normal * half + u * ((s - 0.5f) * size) + v * ((t - 0.5f) * size);
+                vertex.Normal = normal;
+                vertex.UV = CVector2(s, t);
+                vertices.push_back(vertex);
+            }
+        }
+
+        //a-b-c then c-b-d, so the second triangle adds d opposite a across the shared b-c edge
+        for (int y = 0; y < divisions; ++y)
+        {
+            for (int x = 0; x < divisions; ++x)
+            {
+                unsigned int a = first + y * rowSize + x;
+                unsigned int b = a + 1;
+                unsigned int c = a + rowSize;
+                unsigned int d = c + 1;
+
+                indices.push_back(a);  indices.push_back(c);  indices.push_back(b);
+                indices.push_back(c);  indices.push_back(d);  indices.push_back(b);
+            }
+        }
+    }
+}
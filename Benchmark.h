@@ -0,0 +1,101 @@
+//--------------------------------------------------------------------------------------
+// Benchmarks for the soft body pipeline
+//--------------------------------------------------------------------------------------
+// Times the expensive parts of a soft body - loading the mesh, building the springs, a
+// simulation step (per body, through SoftBodyWorld with either solver and on the volume
+// model), a collision check between two bodies, a step followed by its collisions and the
+// same with the collisions searched alongside it, packing the vertices for upload,
+// compacting them and recalculating their normals.
+// Each one is run on the shipped models and on generated cubes of increasing size so the
+// cost can be compared as the node count grows. Building and querying a SpatialHash is timed
+// on its own on random points, up to far more particles than a mesh could load.
+//
+// Works like Google Benchmark: a case is repeated, doubling the iteration count, until it has
+// run for at least the minimum time and the average time of one iteration is reported.
+// Every case starts from the same rest state with a fixed time step so runs can be compared.
+// The results are written as JSON so they can be kept and checked for regressions.
+// A few results are checked alongside the timings (BenchmarkCheck), such as the compact
+// vertex round trip.
+// The meshes create their buffers through gGraphics, so run it from the app or after
+// InitNullGraphics.
+
+#include "Mesh.h"
+
+#include <vector>
+#include <string>
+
+#ifndef _BENCHMARK_H_INCLUDED_
+#define _BENCHMARK_H_INCLUDED_
+
+const std::string BENCHMARK_FILE_NAME = "benchmark_results.json";
+
+struct BenchmarkResult
+{
+    std::string name;       // e.g. "ApplyForce/Sphere.x"
+    std::string mesh;
+    int particles;          // Nodes in the mesh, including children and core nodes
+    int springs;
+    long long iterations;
+    double realTime;        // Nanoseconds per iteration
+};
+
+// Something the suite checks is still right alongside timing it
+struct BenchmarkCheck
+{
+    std::string name;       // e.g. "CompactPositionError/Sphere.x"
+    std::string mesh;
+    double error;           // Worst found
+    double limit;           // Largest error allowed
+
+    bool IsPassed() const { return error <= limit; }
+};
+
+
+class BenchmarkSuite
+{
+public:
+    // minTime is the least number of seconds each case is timed for.
+    BenchmarkSuite(double minTime = 0.25) : mMinTime(minTime) {}
+
+    // Runs every case on every mesh. Replaces any earlier results.
+    void Run();
+
+    // Returns false if the file can't be written.
+    bool WriteJson(const std::string& fileName) const;
+
+    const std::vector<BenchmarkResult>& GetResults() const { return mResults; }
+    const std::vector<BenchmarkCheck>& GetChecks() const { return mChecks; }
+    int GetFailedCheckCount() const;
+
+private:
+    // Runs every case on one mesh. create must return a new mesh each time it is called.
+    template <typename CreateMesh>
+    void RunMeshCases(const std::string& meshName, CreateMesh create);
+
+    // Times func, which performs one iteration, and adds the result.
+    template <typename Func>
+    void Measure(const std::string& name, const std::string& meshName, Mesh* mesh, Func func);
+    template <typename Func>
+    void Measure(const std::string& name, const std::string& meshName, int particles, int springs, Func func);
+
+    // Times SpatialHash builds and queries on count random points
+    void RunSpatialHashCases(int count);
+
+    // Packs the mesh's drawn vertices in the compact format and checks they come back,
+    // through the matrix the shaders use, to within half a step of the box they were
+    // packed across
+    void CheckCompactRoundTrip(const std::string& meshName, Mesh* mesh);
+
+    double mMinTime;
+    std::vector<BenchmarkResult> mResults;
+    std::vector<BenchmarkCheck> mChecks;
+};
+
+
+// Builds a cube centred on the origin with each side split into divisions * divisions quads.
+// Each quad is written as a pair of triangles sharing an edge, the order setupSpring expects.
+// Sides have their own vertices, like the shipped models, so edges are welded when the nodes are added.
+void MakeSubdividedCube(int divisions, float size, std::vector<BasicNode>& vertices, std::vector<unsigned int>& indices);
+
+
+#endif //_BENCHMARK_H_INCLUDED_
@@ -0,0 +1,151 @@
+//--------------------------------------------------------------------------------------
+// Collisions found on a copy of the positions, alongside the step that moves them
+//--------------------------------------------------------------------------------------
+
+#include "CollisionPipeline.h"
+#include "Mesh.h"
+#include "TaskPool.h"
+#include "Profiler.h"
+
+#include <unordered_map>
+
+
+void CollisionPipeline::SetBodies(Model* const* models, int count)
+{
+    bool isSame = (count == GetBodyCount());
+    for (int i = 0; i < count && isSame; ++i)
+    {
+        isSame = (mBodies[i].model == models[i]);
+    }
+    if (isSame)  return;
+
+    mBodies.clear();
+    mBodies.resize(count);
+    for (int i = 0; i < count; ++i)
+    {
+        mBodies[i].model = models[i];
+    }
+}
+
+
+void CollisionPipeline::MapFaces(Body& body)
+{
+    Node& nodes = body.model->GetMesh()->VertexData;
+    if (body.nodeCount == nodes.getSize() && body.faceCount == nodes.getFaceSize())  return;
+
+    body.nodeCount = nodes.getSize();
+    body.faceCount = nodes.getFaceSize();
+
+    std::unordered_map<const NodeData*, int> nodeIndices;
+    for (int n = 0; n < body.nodeCount; ++n)
+    {
+        nodeIndices[nodes.GetChildNode(n)] = n;
+    }
+
+    body.faces.resize(body.faceCount * 3);
+    for (int f = 0; f < body.faceCount; ++f)
+    {
+        const planeData* face = nodes.getFace(f);
+        body.faces[f * 3 + 0] = nodeIndices[face->a];
+        body.faces[f * 3 + 1] = nodeIndices[face->b];
+        body.faces[f * 3 + 2] = nodeIndices[face->c];
+    }
+
+    body.positions.resize(body.nodeCount);
+    body.rebound.resize(body.nodeCount);
+    body.contacts.resize(body.nodeCount);
+}
+
+
+void CollisionPipeline::Capture()
+{
+    PROFILE_SCOPE("Collision capture");
+    GetTaskPool().ParallelFor(GetBodyCount(), 1, [this](int begin, int end)
+    {
+        for (int b = begin; b < end; ++b)
+        {
+            Body& body = mBodies[b];
+            MapFaces(body);
+
+            Node& nodes = body.model->GetMesh()->VertexData;
+            for (int n = 0; n < body.nodeCount; ++n)
+            {
+                body.positions[n] = nodes.GetChildNode(n)->BasicData.Position;
+            }
+            body.origin = body.model->Position();
+
+            body.rebound.assign(body.nodeCount, CVector3(0, 0, 0));
+            body.contacts.assign(body.nodeCount, 0);
+            body.contactCount = 0;
+        }
+    });
+}
+
+
+// The loops of Model::CollideFaces over the copies, each hit handled as CollidingFaceCheck does
+void CollisionPipeline::Detect(int model, int collider)
+{
+    PROFILE_SCOPE("Collision");
+    const Body& self = mBodies[model];
+    Body& other = mBodies[collider];
+
+    auto TestEdge = [&](int start, int end, const CVector3& a, const CVector3& b, const CVector3& c)
+    {
+        CVector3 collisionPoint;
+        if (!Model::isTriangleColl(other.origin + other.positions[start], other.origin + other.positions[end], self.origin,
+                                   a, b, c, collisionPoint))
+        {
+            return 0;
+        }
+
+        ++other.contacts[end];
+        other.rebound[end] += Model::CollisionRebound(self.origin, a, b, c, collisionPoint, other.origin);
+        other.rebound[end] *= .75f;
+        return 1;
+    };
+
+    int contactsFound = 0;
+    for (int f = 0; f < self.faceCount; ++f)
+    {
+        const CVector3& a = self.positions[self.faces[f * 3 + 0]];
+        const CVector3& b = self.positions[self.faces[f * 3 + 1]];
+        const CVector3& c = self.positions[self.faces[f * 3 + 2]];
+
+        for (int g = 0; g < other.faceCount; ++g)
+        {
+            const int* corners = &other.faces[g * 3];
+            contactsFound += TestEdge(corners[1], corners[0], a, b, c);
+            contactsFound += TestEdge(corners[2], corners[1], a, b, c);
+            contactsFound += TestEdge(corners[0], corners[2], a, b, c);
+        }
+    }
+    other.contactCount += contactsFound;
+
+    PROFILE_COUNTER("Face pairs tested", static_cast<long long>(self.faceCount) * other.faceCount);
+    PROFILE_COUNTER("Contacts found", contactsFound);
+}
+
+
+// The contacts were added up from nothing, so whatever the node already held is scaled down as
+// though it had been there first
+void CollisionPipeline::Commit(int collider)
+{
+    Body& body = mBodies[collider];
+    if (body.contactCount == 0)  return;
+
+    Node& nodes = body.model->GetMesh()->VertexData;
+    for (int n = 0; n < body.nodeCount; ++n)
+    {
+        if (body.contacts[n] == 0)  continue;
+
+        float scale = 1.0f;
+        for (int i = 0; i < body.contacts[n]; ++i)
+        {
+            scale *= .75f;
+        }
+
+        NodeData* node = nodes.GetChildNode(n);
+        node->ReboundForce = node->ReboundForce * scale + body.rebound[n];
+        node->delayChange += body.contacts[n];
+    }
+}
@@ -0,0 +1,67 @@
+//--------------------------------------------------------------------------------------
+// Collisions found on a copy of the positions, alongside the step that moves them
+//--------------------------------------------------------------------------------------
+// Collisions have always been a step behind. Those found after step N are written into the nodes'
+// ReboundForce and delayChange and moved by step N+1's force pass. Searching the live nodes means the
+// search has to wait for step N to finish, and step N+1 has to wait for the search.
+//
+// Pipelined, the search reads a copy instead. Capture copies every body's node positions, and its
+// model's position, before a step starts. Detect then searches that copy while the step moves the
+// real nodes, and adds what it finds to contact lists of its own rather than to the nodes. Once both
+// are done, Commit adds the contacts to the nodes for the step after to apply. So the collisions
+// step N+1 applies are found on the positions from before step N rather than after it, a step older,
+// and the search no longer adds to the time of a step.
+//
+// Each collider's contacts are found by one Detect at a time, in the same order as Model::CollideFaces,
+// and committed in node order, so the result is the same however the work is spread over threads.
+
+#include "Model.h"
+
+#include <vector>
+
+#ifndef _COLLISION_PIPELINE_H_INCLUDED_
+#define _COLLISION_PIPELINE_H_INCLUDED_
+
+
+class CollisionPipeline
+{
+public:
+    // Bodies are numbered as they are in models. Does nothing if they're the same models as last time.
+    void SetBodies(Model* const* models, int count);
+
+    // Copies every body's positions and clears their contacts. Nothing may move the nodes while it runs.
+    void Capture();
+
+    // Tests collider's edges against model's faces, both as they were in the last Capture, adding
+    // the hits to collider's contacts. Different colliders can be detected at once.
+    void Detect(int model, int collider);
+
+    // Adds collider's contacts to its nodes' ReboundForce and delayChange, as Model::CollideFaces would have
+    void Commit(int collider);
+
+    int GetBodyCount() const { return static_cast<int>(mBodies.size()); }
+    int GetContactCount(int collider) const { return mBodies[collider].contactCount; }
+
+private:
+    struct Body
+    {
+        Model* model = nullptr;
+        int nodeCount = -1;             //Node and face counts the face indices were built for
+        int faceCount = -1;
+        std::vector<int> faces;         //Node index of each face's a, b and c
+        std::vector<CVector3> positions; //Each node's own position, indexed as Node::GetChildNode
+        CVector3 origin;                //The model's position
+
+        std::vector<CVector3> rebound;  //Contacts per node, added up as CollidingFaceCheck does from nothing
+        std::vector<int> contacts;
+        int contactCount = 0;
+    };
+
+    // Finds the node index of each face corner again if the mesh's nodes or faces have changed
+    void MapFaces(Body& body);
+
+    std::vector<Body> mBodies;
+};
+
+
+#endif //_COLLISION_PIPELINE_H_INCLUDED_
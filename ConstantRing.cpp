@@ -0,0 +1,105 @@
+//--------------------------------------------------------------------------------------
+// Per-frame ring of constant buffer slots, uploaded once and bound by offset
+//--------------------------------------------------------------------------------------
+
+#include "ConstantRing.h"
+#include "Profiler.h"
+#include "GraphicsDevice.h"
+
+#include <cstring>
+
+
+const UINT CONSTANT_RING_SLOT_CONSTANTS = CONSTANT_RING_SLOT_BYTES / 16; //Offsets are counted in 16 byte constants
+
+
+bool ConstantRing::Init()
+{
+    if (!gGraphics->CanBindConstantOffsets())  return true;
+
+    if (!ReserveBuffer(1024))
+    {
+        gLastError = "Error creating constant ring buffer";
+        return false;
+    }
+    return true;
+}
+
+
+void ConstantRing::Release()
+{
+    if (mBuffer)  mBuffer->Release();
+    mBuffer = nullptr;
+    mBufferCapacity = 0;
+}
+
+
+void ConstantRing::Begin()
+{
+    ++mFrame;
+    mSlotCount = 0;
+    mUploadedCount = 0;
+}
+
+
+int ConstantRing::Reserve(int count)
+{
+    const int first = mSlotCount;
+    mSlotCount += count;
+    if (mData.size() < static_cast<size_t>(mSlotCount) * CONSTANT_RING_SLOT_BYTES)
+    {
+        mData.resize(static_cast<size_t>(mSlotCount) * CONSTANT_RING_SLOT_BYTES);
+    }
+    return first;
+}
+
+
+bool ConstantRing::ReserveBuffer(int slotCount)
+{
+    if (slotCount <= mBufferCapacity)  return true;
+
+    int capacity = (mBufferCapacity > 0) ? mBufferCapacity : 1024;
+    while (capacity < slotCount)  capacity *= 2;
+
+    if (mBuffer)  mBuffer->Release();
+    mBuffer = nullptr;
+    mBufferCapacity = 0;
+
+    D3D11_BUFFER_DESC bufferDesc;
+    bufferDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+    bufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+    bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    bufferDesc.ByteWidth = capacity * CONSTANT_RING_SLOT_BYTES;
+    bufferDesc.MiscFlags = 0;
+    bufferDesc.StructureByteStride = 0;
+    if (FAILED(gGraphics->CreateBuffer(&bufferDesc, nullptr, &mBuffer)))  return false;
+
+    mBufferCapacity = capacity;
+    return true;
+}
+
+
+bool ConstantRing::Upload()
+{
+    if (!gGraphics->CanBindConstantOffsets() || mSlotCount == 0 || !ReserveBuffer(mSlotCount))  return false;
+
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    if (FAILED(gGraphics->Map(mBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))  return false;
+    memcpy(mapped.pData, mData.data(), static_cast<size_t>(mSlotCount) * CONSTANT_RING_SLOT_BYTES);
+    gGraphics->Unmap(mBuffer, 0);
+
+    mUploadedCount = mSlotCount;
+    PROFILE_COUNTER("Constant slots uploaded", mSlotCount);
+    return true;
+}
+
+
+bool ConstantRing::Bind(int bufferRegister, int slot)
+{
+    if (slot < 0 || slot >= mUploadedCount)  return false;
+
+    const UINT firstConstant = slot * CONSTANT_RING_SLOT_CONSTANTS;
+    const UINT constantCount = CONSTANT_RING_SLOT_CONSTANTS;
+    gGraphics->VSSetConstantBuffers1(bufferRegister, 1, &mBuffer, &firstConstant, &constantCount);
+    gGraphics->PSSetConstantBuffers1(bufferRegister, 1, &mBuffer, &firstConstant, &constantCount);
+    return true;
+}
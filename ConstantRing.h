@@ -0,0 +1,76 @@
+//--------------------------------------------------------------------------------------
+// Per-frame ring of constant buffer slots, uploaded once and bound by offset
+//--------------------------------------------------------------------------------------
+// Model::Render used to update gPerModelConstantBuffer for every draw, so a soft body drawn
+// into every shadow map and the camera view was mapped and copied to the GPU once per pass.
+// Instead the scene reserves a slot here for each model at the start of the frame, fills
+// them in one parallel pass, and Upload copies them all to the GPU with a single map. Each draw
+// then only binds its slot's offset in the buffer (VSSetConstantBuffers1, Direct3D 11.1).
+//
+// Slots are CONSTANT_RING_SLOT_BYTES apart, as offsets must be multiples of 16 constants of 16
+// bytes. Reserving and writing slots is CPU only, so the packing can be checked without a device.
+// Without 11.1 constant buffer offsets (gGraphics->CanBindConstantOffsets) Bind returns false and the
+// caller falls back to updating a buffer per draw as before.
+
+#include "Common.h"
+
+#include <vector>
+#include <cstring>
+
+#ifndef _CONSTANT_RING_H_INCLUDED_
+#define _CONSTANT_RING_H_INCLUDED_
+
+constexpr int CONSTANT_RING_SLOT_BYTES = 256;
+constexpr int CONSTANT_RING_GRAIN = 64; //Slots per block when filling in parallel
+
+
+class ConstantRing
+{
+public:
+    // Returns false on failure, with gLastError set. Finding no 11.1 support isn't a failure.
+    bool Init();
+    void Release();
+
+    // Starts a new frame, forgetting every slot. Slots from earlier frames can be told apart with GetFrame.
+    void Begin();
+
+    // Reserves count slots and returns the first. They're in a row, so the next is first + 1 and so on.
+    int Reserve(int count);
+
+    // Copies constants (at most CONSTANT_RING_SLOT_BYTES) into a slot. Different slots can be written at once.
+    template <typename T>
+    void Write(int slot, const T& constants)
+    {
+        static_assert(sizeof(T) <= CONSTANT_RING_SLOT_BYTES, "Constants don't fit in a ring slot");
+        memcpy(&mData[static_cast<size_t>(slot) * CONSTANT_RING_SLOT_BYTES], &constants, sizeof(T));
+    }
+
+    // Copies every slot reserved this frame to the GPU with one map. Returns false if it couldn't.
+    bool Upload();
+
+    // Makes a slot uploaded this frame the constant buffer in the given register of the vertex and pixel shaders.
+    // Returns false, without changing anything, if offsets aren't supported or the slot hasn't been uploaded.
+    bool Bind(int bufferRegister, int slot);
+
+    unsigned int GetFrame() const { return mFrame; }
+    int GetSlotCount() const { return mSlotCount; }
+    const unsigned char* GetSlot(int slot) const { return &mData[static_cast<size_t>(slot) * CONSTANT_RING_SLOT_BYTES]; }
+
+private:
+    bool ReserveBuffer(int slotCount);
+
+    std::vector<unsigned char> mData;
+    int mSlotCount = 0;
+    int mUploadedCount = 0;
+    unsigned int mFrame = 0;
+
+    ID3D11Buffer* mBuffer = nullptr;
+    int mBufferCapacity = 0; //In slots
+};
+
+
+// Slots for gPerModelConstants, filled by the scene each frame and bound by Model::Render
+extern ConstantRing gPerModelConstantRing;
+
+
+#endif //_CONSTANT_RING_H_INCLUDED_
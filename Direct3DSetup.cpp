@@ -5,6 +5,7 @@
 #include "Direct3DSetup.h"
 #include "Shader.h"
 #include "Common.h"
+#include "GraphicsDevice.h"
 #include <d3d11.h>
 #include <vector>
 
@@ -116,7 +117,15 @@ bool InitDirect3D()
         gLastError = "Error creating depth buffer view";
         return false;
     }
-    
+
+    gGraphics = new D3DGraphicsDevice;
+    return true;
+}
+
+
+bool InitNullGraphics()
+{
+    gGraphics = new NullGraphicsDevice;
     return true;
 }
 
@@ -127,6 +136,9 @@ void ShutdownDirect3D()
     // Release each Direct3D object to return resources to the system. Missing these out will cause memory
     // leaks. Check documentation to see which objects need to be released when adding new features in your
     // own projects.
+    delete gGraphics;
+    gGraphics = nullptr;
+
     if (gD3DContext)
     {
         gD3DContext->ClearState(); // This line is also needed to reset the GPU before shutting down DirectX
@@ -8,6 +8,9 @@
 // Returns false on failure
 bool InitDirect3D();
 
+// Sets up gGraphics with no window or GPU behind it, for timing the CPU side of a frame. See GraphicsDevice.h
+bool InitNullGraphics();
+
 // Release the memory held by all objects created
 void ShutdownDirect3D();
 
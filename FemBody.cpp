@@ -0,0 +1,591 @@
+//--------------------------------------------------------------------------------------
+// Volumetric soft body simulated with co-rotational linear finite elements
+//--------------------------------------------------------------------------------------
+
+#include "FemBody.h"
+#include "TaskPool.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <cfloat>
+
+
+const float FEM_STABILITY_FACTOR = 0.4f; //Fraction of the largest stable sub-step actually used
+const float FEM_ROTATION_TOLERANCE = 1e-5f; //Radians, a smaller correction to a tetrahedron's rotation ends its refinement
+
+// The five tetrahedra of a lattice cube, by corner (x = bit 0, y = bit 1, z = bit 2). Neighbouring cubes alternate
+// between the two splits so their shared faces are cut along the same diagonal.
+static const int CUBE_TETRAHEDRA[2][5][4] =
+{
+    { { 1, 2, 4, 7 }, { 0, 1, 2, 4 }, { 3, 1, 2, 7 }, { 5, 1, 4, 7 }, { 6, 2, 4, 7 } },
+    { { 0, 3, 5, 6 }, { 1, 0, 3, 5 }, { 2, 0, 3, 6 }, { 4, 0, 5, 6 }, { 7, 3, 5, 6 } },
+};
+
+
+// Does a ray from origin along direction pass through the triangle a, b, c (Möller-Trumbore)
+static bool RayHitsTriangle(const CVector3& origin, const CVector3& direction, const CVector3& a, const CVector3& b, const CVector3& c)
+{
+    CVector3 edge1 = b - a;
+    CVector3 edge2 = c - a;
+    CVector3 p = Cross(direction, edge2);
+    float determinant = Dot(edge1, p);
+    if (fabs(determinant) < 1e-12f)  return false;
+
+    float inverse = 1.0f / determinant;
+    CVector3 t = origin - a;
+    float u = Dot(t, p) * inverse;
+    if (u < 0 || u > 1)  return false;
+
+    CVector3 q = Cross(t, edge1);
+    float v = Dot(direction, q) * inverse;
+    if (v < 0 || u + v > 1)  return false;
+
+    return Dot(edge2, q) * inverse > 0;
+}
+
+
+// Barycentric weights of point in the tetrahedron a, b, c, d
+static void Barycentric(const CVector3& point, const CVector3& a, const CVector3& b, const CVector3& c, const CVector3& d, float weights[4])
+{
+    CVector3 e1 = b - a, e2 = c - a, e3 = d - a, p = point - a;
+    float volume = Dot(e1, Cross(e2, e3));
+    weights[1] = Dot(p, Cross(e2, e3)) / volume;
+    weights[2] = Dot(e1, Cross(p, e3)) / volume;
+    weights[3] = Dot(e1, Cross(e2, p)) / volume;
+    weights[0] = 1.0f - weights[1] - weights[2] - weights[3];
+}
+
+
+bool FemBody::Build(Node& nodes, const std::vector<int>& faceIndices)
+{
+    const int surfaceCount = nodes.getRenderVertexCount();
+    if (surfaceCount == 0 || faceIndices.size() < 3)  return false;
+
+    //Lattice over the drawn vertices, slightly padded so none sit exactly on its edge
+    CVector3 minBound = nodes.getPosition(0), maxBound = minBound;
+    for (int i = 1; i < surfaceCount; ++i)
+    {
+        CVector3 position = nodes.getPosition(i);
+        minBound = CVector3(std::min(minBound.x, position.x), std::min(minBound.y, position.y), std::min(minBound.z, position.z));
+        maxBound = CVector3(std::max(maxBound.x, position.x), std::max(maxBound.y, position.y), std::max(maxBound.z, position.z));
+    }
+    CVector3 extent = maxBound - minBound;
+    float longest = std::max(extent.x, std::max(extent.y, extent.z));
+    if (longest <= 0)  return false;
+
+    const float cellSize = longest / FEM_CELLS;
+    const float padding = cellSize * 0.01f;
+    minBound -= CVector3(padding, padding, padding);
+    extent += CVector3(padding, padding, padding) * 2;
+
+    const float origin[3] = { minBound.x, minBound.y, minBound.z };
+    const float extents[3] = { extent.x, extent.y, extent.z };
+    int cells[3];
+    for (int a = 0; a < 3; ++a)
+    {
+        cells[a] = std::max(1, static_cast<int>(ceil(extents[a] / cellSize)));
+    }
+    auto CellIndex = [&](int i, int j, int k) { return (k * cells[1] + j) * cells[0] + i; };
+    auto CellAt = [&](const CVector3& position)
+    {
+        const float coordinates[3] = { position.x, position.y, position.z };
+        int cell[3];
+        for (int a = 0; a < 3; ++a)
+        {
+            cell[a] = std::min(cells[a] - 1, std::max(0, static_cast<int>((coordinates[a] - origin[a]) / cellSize)));
+        }
+        return CellIndex(cell[0], cell[1], cell[2]);
+    };
+
+    //A cube is kept if it holds a drawn vertex or its centre is inside the mesh (an odd number of surface crossings).
+    //The ray is slightly off the axis so it doesn't run along the edges of axis aligned meshes.
+    std::vector<bool> active(cells[0] * cells[1] * cells[2], false);
+    for (int i = 0; i < surfaceCount; ++i)
+    {
+        CVector3 position = nodes.getPosition(i);
+        active[CellAt(position)] = true;
+    }
+
+    const CVector3 rayDirection = Normalise(CVector3(1.0f, 0.0123f, 0.0071f));
+    for (int k = 0; k < cells[2]; ++k)
+    {
+        for (int j = 0; j < cells[1]; ++j)
+        {
+            for (int i = 0; i < cells[0]; ++i)
+            {
+                if (active[CellIndex(i, j, k)])  continue;
+
+                CVector3 centre = minBound + CVector3(i + 0.5f, j + 0.5f, k + 0.5f) * cellSize;
+                int crossings = 0;
+                for (size_t f = 0; f + 2 < faceIndices.size(); f += 3)
+                {
+                    if (RayHitsTriangle(centre, rayDirection, nodes.getPosition(faceIndices[f]),
+                                        nodes.getPosition(faceIndices[f + 1]), nodes.getPosition(faceIndices[f + 2])))
+                    {
+                        ++crossings;
+                    }
+                }
+                active[CellIndex(i, j, k)] = (crossings & 1) != 0;
+            }
+        }
+    }
+
+    //Particles are the lattice points used by a kept cube, shared between the cubes around them
+    mX.clear(); mY.clear(); mZ.clear();
+    for (int c = 0; c < 4; ++c)  mCorners[c].clear();
+    for (int e = 0; e < 9; ++e)  mRestInverse[e].clear();
+    mVolume.clear();
+
+    std::vector<int> pointParticle((cells[0] + 1) * (cells[1] + 1) * (cells[2] + 1), -1);
+    std::vector<int> cellFirstElement(active.size(), -1);
+    for (int k = 0; k < cells[2]; ++k)
+    {
+        for (int j = 0; j < cells[1]; ++j)
+        {
+            for (int i = 0; i < cells[0]; ++i)
+            {
+                if (!active[CellIndex(i, j, k)])  continue;
+
+                int cubeParticles[8];
+                for (int corner = 0; corner < 8; ++corner)
+                {
+                    int pi = i + (corner & 1), pj = j + ((corner >> 1) & 1), pk = k + ((corner >> 2) & 1);
+                    int& particle = pointParticle[(pk * (cells[1] + 1) + pj) * (cells[0] + 1) + pi];
+                    if (particle < 0)
+                    {
+                        particle = static_cast<int>(mX.size());
+                        mX.push_back(minBound.x + pi * cellSize);
+                        mY.push_back(minBound.y + pj * cellSize);
+                        mZ.push_back(minBound.z + pk * cellSize);
+                    }
+                    cubeParticles[corner] = particle;
+                }
+
+                cellFirstElement[CellIndex(i, j, k)] = static_cast<int>(mVolume.size());
+                const int (*split)[4] = CUBE_TETRAHEDRA[(i + j + k) & 1];
+                for (int t = 0; t < 5; ++t)
+                {
+                    int corners[4] = { cubeParticles[split[t][0]], cubeParticles[split[t][1]], cubeParticles[split[t][2]], cubeParticles[split[t][3]] };
+
+                    CVector3 p0(mX[corners[0]], mY[corners[0]], mZ[corners[0]]);
+                    CVector3 e1 = CVector3(mX[corners[1]], mY[corners[1]], mZ[corners[1]]) - p0;
+                    CVector3 e2 = CVector3(mX[corners[2]], mY[corners[2]], mZ[corners[2]]) - p0;
+                    CVector3 e3 = CVector3(mX[corners[3]], mY[corners[3]], mZ[corners[3]]) - p0;
+                    float determinant = Dot(e1, Cross(e2, e3));
+                    if (determinant < 0)
+                    {
+                        std::swap(corners[1], corners[2]);
+                        std::swap(e1, e2);
+                        determinant = -determinant;
+                    }
+
+                    //Inverse of the matrix with the edges as columns, its rows are the cross products of the other two edges
+                    CVector3 rows[3] = { Cross(e2, e3), Cross(e3, e1), Cross(e1, e2) };
+                    for (int r = 0; r < 3; ++r)
+                    {
+                        mRestInverse[r * 3 + 0].push_back(rows[r].x / determinant);
+                        mRestInverse[r * 3 + 1].push_back(rows[r].y / determinant);
+                        mRestInverse[r * 3 + 2].push_back(rows[r].z / determinant);
+                    }
+                    for (int c = 0; c < 4; ++c)
+                    {
+                        mCorners[c].push_back(corners[c]);
+                    }
+                    mVolume.push_back(determinant / 6.0f);
+                }
+            }
+        }
+    }
+
+    const int particleCount = GetParticleCount();
+    const int elementCount = GetTetrahedronCount();
+    if (elementCount == 0)  return false;
+
+    //Each tetrahedron's mass is shared equally between its corners
+    std::vector<float> mass(particleCount, 0.0f);
+    std::vector<int> elementCounts(particleCount + 1, 0);
+    for (int t = 0; t < elementCount; ++t)
+    {
+        for (int c = 0; c < 4; ++c)
+        {
+            mass[mCorners[c][t]] += FEM_DENSITY * mVolume[t] * 0.25f;
+            ++elementCounts[mCorners[c][t] + 1];
+        }
+    }
+    mInverseMass.resize(particleCount);
+    for (int p = 0; p < particleCount; ++p)
+    {
+        mInverseMass[p] = 1.0f / mass[p];
+    }
+
+    mElementOffsets.resize(particleCount + 1);
+    mElementOffsets[0] = 0;
+    for (int p = 0; p < particleCount; ++p)
+    {
+        mElementOffsets[p + 1] = mElementOffsets[p] + elementCounts[p + 1];
+    }
+    mElementSlots.resize(mElementOffsets.back());
+    std::vector<int> fill(mElementOffsets.begin(), mElementOffsets.end() - 1);
+    for (int t = 0; t < elementCount; ++t)
+    {
+        for (int c = 0; c < 4; ++c)
+        {
+            mElementSlots[fill[mCorners[c][t]]++] = t * 4 + c;
+        }
+    }
+
+    mElementForceX.assign(elementCount * 4, 0.0f);
+    mElementForceY.assign(elementCount * 4, 0.0f);
+    mElementForceZ.assign(elementCount * 4, 0.0f);
+
+    mMu = FEM_YOUNGS_MODULUS / (2.0f * (1.0f + FEM_POISSON_RATIO));
+    mLambda = FEM_YOUNGS_MODULUS * FEM_POISSON_RATIO / ((1.0f + FEM_POISSON_RATIO) * (1.0f - 2.0f * FEM_POISSON_RATIO));
+
+    //An explicit step is only stable while a pressure wave can't cross a cube in one sub-step
+    mStableTimeStep = FEM_STABILITY_FACTOR * cellSize * sqrt(FEM_DENSITY / (mLambda + 2.0f * mMu));
+
+    //Embed every node in a tetrahedron of its cube, or the nearest one if it's outside the lattice (the core nodes can be)
+    mNodeElement.resize(nodes.getSize());
+    mNodeWeights.resize(nodes.getSize() * 4);
+    auto Embed = [&](const CVector3& position, int element, float weights[4])
+    {
+        CVector3 corners[4];
+        for (int c = 0; c < 4; ++c)
+        {
+            int p = mCorners[c][element];
+            corners[c] = CVector3(mX[p], mY[p], mZ[p]);
+        }
+        Barycentric(position, corners[0], corners[1], corners[2], corners[3], weights);
+        return std::min(std::min(weights[0], weights[1]), std::min(weights[2], weights[3]));
+    };
+    for (int n = 0; n < nodes.getSize(); ++n)
+    {
+        CVector3 position = nodes.getPosition(n);
+
+        int firstElement = cellFirstElement[CellAt(position)];
+        int searchBegin = (firstElement >= 0) ? firstElement : 0;
+        int searchEnd = (firstElement >= 0) ? firstElement + 5 : elementCount;
+
+        float bestInside = -FLT_MAX;
+        for (int t = searchBegin; t < searchEnd; ++t)
+        {
+            float weights[4];
+            float inside = Embed(position, t, weights);
+            if (inside > bestInside)
+            {
+                bestInside = inside;
+                mNodeElement[n] = t;
+                memcpy(&mNodeWeights[n * 4], weights, sizeof(weights));
+            }
+        }
+    }
+
+    mRestX = mX; mRestY = mY; mRestZ = mZ;
+    Reset();
+    return true;
+}
+
+
+void FemBody::Reset()
+{
+    const int particleCount = GetParticleCount();
+    mX = mRestX; mY = mRestY; mZ = mRestZ;
+    mVelocityX.assign(particleCount, 0.0f);
+    mVelocityY.assign(particleCount, 0.0f);
+    mVelocityZ.assign(particleCount, 0.0f);
+
+    mRotation[0].assign(GetTetrahedronCount(), 1.0f);
+    for (int q = 1; q < 4; ++q)
+    {
+        mRotation[q].assign(GetTetrahedronCount(), 0.0f);
+    }
+}
+
+
+void FemBody::Step(float updateTime, CVector3 externalAcceleration, float groundLevel, Node& nodes)
+{
+    PROFILE_SCOPE("Volume step");
+
+    ApplyCollisions(nodes);
+
+    int subSteps = std::max(FEM_SUB_STEPS, static_cast<int>(ceil(updateTime / mStableTimeStep)));
+    float subStepTime = updateTime / subSteps;
+    TaskPool& pool = GetTaskPool();
+    for (int s = 0; s < subSteps; ++s)
+    {
+        pool.ParallelFor(GetTetrahedronCount(), FEM_GRAIN, [this](int begin, int end) { CalculateElementForces(begin, end); });
+        pool.ParallelFor(GetParticleCount(), FEM_GRAIN, [&](int begin, int end) { Integrate(subStepTime, externalAcceleration, groundLevel, begin, end); });
+    }
+
+    UpdateNodes(nodes);
+
+    PROFILE_COUNTER("Tetrahedra evaluated", GetTetrahedronCount() * subSteps);
+}
+
+
+void FemBody::UpdateNodes(Node& nodes)
+{
+    mNodePositions.resize(nodes.getSize());
+    GetTaskPool().ParallelFor(nodes.getSize(), FEM_GRAIN, [&](int begin, int end)
+    {
+        for (int n = begin; n < end; ++n)
+        {
+            const int t = mNodeElement[n];
+            const float* weights = &mNodeWeights[n * 4];
+            CVector3 position(0, 0, 0);
+            for (int c = 0; c < 4; ++c)
+            {
+                int p = mCorners[c][t];
+                position += CVector3(mX[p], mY[p], mZ[p]) * weights[c];
+            }
+            mNodePositions[n] = position;
+        }
+    });
+    nodes.setPositions(mNodePositions.data(), NULL);
+}
+
+
+// A collision sets where a node should be (see Model::isCollision). The move is shared between the corners of the
+// node's tetrahedron by its weights, the smallest change of corners that moves the node exactly there.
+void FemBody::ApplyCollisions(Node& nodes)
+{
+    for (int n = 0; n < nodes.getSize(); ++n)
+    {
+        if (!nodes.isRoot(n))  continue;
+
+        NodeData* node = nodes.GetChildNode(n);
+        if (node->delayChange < 0.9f)  continue;
+
+        CVector3 move = node->ReboundForce / node->delayChange - node->BasicData.Position;
+        const float* weights = &mNodeWeights[n * 4];
+        float weightSquares = 0;
+        for (int c = 0; c < 4; ++c)
+        {
+            weightSquares += weights[c] * weights[c];
+        }
+        for (int c = 0; c < 4; ++c)
+        {
+            int p = mCorners[c][mNodeElement[n]];
+            float share = weights[c] / weightSquares;
+            mX[p] += move.x * share;
+            mY[p] += move.y * share;
+            mZ[p] += move.z * share;
+        }
+    }
+}
+
+
+// Rotation from the last step refined towards the rotation of the deformation matrix F, after Müller et al.
+// "A Robust Method to Extract the Rotational Part of Deformations". Then the co-rotated linear stress
+// P = R (2 mu e + lambda tr(e) I), e = sym(R^T F) - I, gives the forces -volume * P * DmInv^T on corners 1 to 3.
+void FemBody::CalculateElementForces(int begin, int end)
+{
+    for (int t = begin; t < end; ++t)
+    {
+        const int p0 = mCorners[0][t], p1 = mCorners[1][t], p2 = mCorners[2][t], p3 = mCorners[3][t];
+
+        //Current edges as columns
+        const float d[3][3] =
+        {
+            { mX[p1] - mX[p0], mX[p2] - mX[p0], mX[p3] - mX[p0] },
+            { mY[p1] - mY[p0], mY[p2] - mY[p0], mY[p3] - mY[p0] },
+            { mZ[p1] - mZ[p0], mZ[p2] - mZ[p0], mZ[p3] - mZ[p0] },
+        };
+
+        float inverse[3][3];
+        for (int e = 0; e < 9; ++e)
+        {
+            inverse[e / 3][e % 3] = mRestInverse[e][t];
+        }
+
+        float f[3][3];
+        for (int r = 0; r < 3; ++r)
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                f[r][c] = d[r][0] * inverse[0][c] + d[r][1] * inverse[1][c] + d[r][2] * inverse[2][c];
+            }
+        }
+
+        float qw = mRotation[0][t], qx = mRotation[1][t], qy = mRotation[2][t], qz = mRotation[3][t];
+        float rotation[3][3];
+        for (int iteration = 0; iteration <= FEM_ROTATION_ITERATIONS; ++iteration)
+        {
+            rotation[0][0] = 1 - 2 * (qy * qy + qz * qz); rotation[0][1] = 2 * (qx * qy - qw * qz);     rotation[0][2] = 2 * (qx * qz + qw * qy);
+            rotation[1][0] = 2 * (qx * qy + qw * qz);     rotation[1][1] = 1 - 2 * (qx * qx + qz * qz); rotation[1][2] = 2 * (qy * qz - qw * qx);
+            rotation[2][0] = 2 * (qx * qz - qw * qy);     rotation[2][1] = 2 * (qy * qz + qw * qx);     rotation[2][2] = 1 - 2 * (qx * qx + qy * qy);
+            if (iteration == FEM_ROTATION_ITERATIONS)  break;
+
+            //omega = sum of the rotation's columns crossed with F's, over the sum of their dot products
+            float ox = 0, oy = 0, oz = 0, dots = 0;
+            for (int c = 0; c < 3; ++c)
+            {
+                ox += rotation[1][c] * f[2][c] - rotation[2][c] * f[1][c];
+                oy += rotation[2][c] * f[0][c] - rotation[0][c] * f[2][c];
+                oz += rotation[0][c] * f[1][c] - rotation[1][c] * f[0][c];
+                dots += rotation[0][c] * f[0][c] + rotation[1][c] * f[1][c] + rotation[2][c] * f[2][c];
+            }
+            float scale = 1.0f / (fabs(dots) + 1e-9f);
+            ox *= scale; oy *= scale; oz *= scale;
+
+            //Usually the rotation has barely changed since the last step, so this stops after one pass
+            float angle = sqrtf(ox * ox + oy * oy + oz * oz);
+            if (angle < FEM_ROTATION_TOLERANCE)  break;
+
+            float s = sinf(angle * 0.5f) / angle;
+            float aw = cosf(angle * 0.5f), ax = ox * s, ay = oy * s, az = oz * s;
+            float nw = aw * qw - ax * qx - ay * qy - az * qz;
+            float nx = aw * qx + ax * qw + ay * qz - az * qy;
+            float ny = aw * qy - ax * qz + ay * qw + az * qx;
+            float nz = aw * qz + ax * qy - ay * qx + az * qw;
+            float length = 1.0f / sqrtf(nw * nw + nx * nx + ny * ny + nz * nz);
+            qw = nw * length; qx = nx * length; qy = ny * length; qz = nz * length;
+        }
+        mRotation[0][t] = qw; mRotation[1][t] = qx; mRotation[2][t] = qy; mRotation[3][t] = qz;
+
+        //Strain in the rotated frame
+        float strain[3][3];
+        for (int r = 0; r < 3; ++r)
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                strain[r][c] = rotation[0][r] * f[0][c] + rotation[1][r] * f[1][c] + rotation[2][r] * f[2][c];
+            }
+        }
+        float stress[3][3];
+        const float trace = strain[0][0] + strain[1][1] + strain[2][2] - 3.0f;
+        for (int r = 0; r < 3; ++r)
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                float symmetric = 0.5f * (strain[r][c] + strain[c][r]) - ((r == c) ? 1.0f : 0.0f);
+                stress[r][c] = 2.0f * mMu * symmetric + ((r == c) ? mLambda * trace : 0.0f);
+            }
+        }
+
+        float piola[3][3];
+        for (int r = 0; r < 3; ++r)
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                piola[r][c] = rotation[r][0] * stress[0][c] + rotation[r][1] * stress[1][c] + rotation[r][2] * stress[2][c];
+            }
+        }
+
+        float force[3][3]; //Columns are the forces on corners 1 to 3
+        for (int r = 0; r < 3; ++r)
+        {
+            for (int c = 0; c < 3; ++c)
+            {
+                force[r][c] = -mVolume[t] * (piola[r][0] * inverse[c][0] + piola[r][1] * inverse[c][1] + piola[r][2] * inverse[c][2]);
+            }
+        }
+
+        const int slot = t * 4;
+        mElementForceX[slot] = -(force[0][0] + force[0][1] + force[0][2]);
+        mElementForceY[slot] = -(force[1][0] + force[1][1] + force[1][2]);
+        mElementForceZ[slot] = -(force[2][0] + force[2][1] + force[2][2]);
+        for (int c = 0; c < 3; ++c)
+        {
+            mElementForceX[slot + c + 1] = force[0][c];
+            mElementForceY[slot + c + 1] = force[1][c];
+            mElementForceZ[slot + c + 1] = force[2][c];
+        }
+    }
+}
+
+
+// Gathers each particle's share of its tetrahedra's forces, then a semi-implicit Euler step
+void FemBody::Integrate(float updateTime, CVector3 externalAcceleration, float groundLevel, int begin, int end)
+{
+    const float damp = exp(-FEM_DAMPING * updateTime);
+    for (int p = begin; p < end; ++p)
+    {
+        float forceX = 0, forceY = 0, forceZ = 0;
+        for (int e = mElementOffsets[p]; e < mElementOffsets[p + 1]; ++e)
+        {
+            const int slot = mElementSlots[e];
+            forceX += mElementForceX[slot];
+            forceY += mElementForceY[slot];
+            forceZ += mElementForceZ[slot];
+        }
+
+        float velocityX = (mVelocityX[p] + (forceX * mInverseMass[p] + externalAcceleration.x) * updateTime) * damp;
+        float velocityY = (mVelocityY[p] + (forceY * mInverseMass[p] + externalAcceleration.y) * updateTime) * damp;
+        float velocityZ = (mVelocityZ[p] + (forceZ * mInverseMass[p] + externalAcceleration.z) * updateTime) * damp;
+
+        mX[p] += velocityX * updateTime;
+        mY[p] += velocityY * updateTime;
+        mZ[p] += velocityZ * updateTime;
+
+        //The ground stops the fall and drags on anything sliding across it
+        if (mY[p] < groundLevel)
+        {
+            mY[p] = groundLevel;
+            velocityY = std::max(velocityY, 0.0f);
+            velocityX *= damp;
+            velocityZ *= damp;
+        }
+
+        mVelocityX[p] = velocityX;
+        mVelocityY[p] = velocityY;
+        mVelocityZ[p] = velocityZ;
+    }
+}
+
+
+void FemBody::saveState(std::vector<unsigned char>& output)
+{
+    const int particleCount = GetParticleCount();
+    const int elementCount = GetTetrahedronCount();
+    size_t writePos = output.size();
+    output.resize(writePos + sizeof(int) * 2 + (particleCount * 6 + elementCount * 4) * sizeof(float));
+    unsigned char* write = output.data() + writePos;
+
+    memcpy(write, &particleCount, sizeof(int));
+    write += sizeof(int);
+    for (const std::vector<float>* values : { &mX, &mY, &mZ, &mVelocityX, &mVelocityY, &mVelocityZ })
+    {
+        memcpy(write, values->data(), particleCount * sizeof(float));
+        write += particleCount * sizeof(float);
+    }
+
+    //The rotations are where the next step starts refining from, so they're needed for it to come out the same
+    memcpy(write, &elementCount, sizeof(int));
+    write += sizeof(int);
+    for (int q = 0; q < 4; ++q)
+    {
+        memcpy(write, mRotation[q].data(), elementCount * sizeof(float));
+        write += elementCount * sizeof(float);
+    }
+}
+
+bool FemBody::loadState(const unsigned char*& input, const unsigned char* inputEnd)
+{
+    const int particleCount = GetParticleCount();
+    const int elementCount = GetTetrahedronCount();
+
+    int count;
+    if (inputEnd - input < sizeof(int))  return false;
+    memcpy(&count, input, sizeof(int));
+    if (count != particleCount || inputEnd - input < sizeof(int) + particleCount * 6 * sizeof(float))  return false;
+    input += sizeof(int);
+    for (std::vector<float>* values : { &mX, &mY, &mZ, &mVelocityX, &mVelocityY, &mVelocityZ })
+    {
+        memcpy(values->data(), input, particleCount * sizeof(float));
+        input += particleCount * sizeof(float);
+    }
+
+    if (inputEnd - input < sizeof(int))  return false;
+    memcpy(&count, input, sizeof(int));
+    if (count != elementCount || inputEnd - input < sizeof(int) + elementCount * 4 * sizeof(float))  return false;
+    input += sizeof(int);
+    for (int q = 0; q < 4; ++q)
+    {
+        memcpy(mRotation[q].data(), input, elementCount * sizeof(float));
+        input += elementCount * sizeof(float);
+    }
+    return true;
+}
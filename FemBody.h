@@ -0,0 +1,98 @@
+//--------------------------------------------------------------------------------------
+// Volumetric soft body simulated with co-rotational linear finite elements
+//--------------------------------------------------------------------------------------
+// An alternative to the springs and core nodes of Node/SpringPoint, chosen per Mesh with
+// Mesh::setSoftBodyModel. The springs only hold the surface and a few core nodes together, so
+// a body needs a lot of them and can still fold through itself. Here the inside of the body is
+// filled with tetrahedra, each of which resists being stretched, squashed or sheared but not
+// being rotated, so the body keeps its volume and can't turn inside out.
+//
+// The tetrahedra come from a lattice rather than the surface itself, so any closed mesh works
+// however many or few triangles it has: the bounding box is cut into FEM_CELLS cubes along its
+// longest side, every cube inside the mesh or holding one of its vertices is kept and each is
+// split into five tetrahedra. The mesh's nodes are embedded in the lattice, each following its
+// tetrahedron by fixed barycentric weights.
+//
+// Particles and tetrahedra are stored as separate arrays per value (structure of arrays). A
+// step works out each tetrahedron's forces on its four corners in one parallel pass, gathers
+// them per particle through a compressed list in a second and then integrates, with several
+// sub-steps per frame as the integration is explicit. The results are written to the nodes
+// with Node::setPositions, so rendering, collision checks and snapshots work as before.
+
+#include "NodePoint.h"
+
+#include <vector>
+
+#ifndef _FEM_BODY_H_INCLUDED_
+#define _FEM_BODY_H_INCLUDED_
+
+constexpr int   FEM_CELLS = 8;              //Lattice cubes along the longest side of the body
+constexpr float FEM_YOUNGS_MODULUS = 2000.0f; //Stiffness
+constexpr float FEM_POISSON_RATIO = 0.3f;   //How much it bulges sideways when squashed, must be under 0.5
+constexpr float FEM_DENSITY = 1.0f;
+constexpr float FEM_DAMPING = 2.0f;         //Fraction of velocity lost per second
+constexpr int   FEM_SUB_STEPS = 4;          //At least, more are taken if the frame is longer than the lattice can stably step
+constexpr int   FEM_ROTATION_ITERATIONS = 2; //Refines each tetrahedron's rotation from the last sub-step's
+constexpr int   FEM_GRAIN = 256;            //Tetrahedra or particles per block handed to a thread
+
+
+class FemBody
+{
+public:
+    // Fills the mesh's triangle list with tetrahedra and embeds its nodes. The nodes must be in their rest shape.
+    // Returns false if there's nothing to fill.
+    bool Build(Node& nodes, const std::vector<int>& faceIndices);
+
+    // Back to the rest shape, not moving
+    void Reset();
+
+    // Moves the body on by updateTime. externalAcceleration applies to every particle (gravity, movement) and
+    // groundLevel is the ground height in the body's local space. Collisions waiting on the nodes are applied
+    // first, then the nodes are moved to match.
+    void Step(float updateTime, CVector3 externalAcceleration, float groundLevel, Node& nodes);
+
+    // Positions of the nodes embedded in the lattice, indexed as the nodes
+    void UpdateNodes(Node& nodes);
+
+    int GetParticleCount() { return static_cast<int>(mX.size()); }
+    int GetTetrahedronCount() { return static_cast<int>(mVolume.size()); }
+
+    // Appends / reads back the particle positions and velocities, see Mesh::saveState
+    void saveState(std::vector<unsigned char>& output);
+    bool loadState(const unsigned char*& input, const unsigned char* inputEnd);
+
+private:
+    void ApplyCollisions(Node& nodes);
+    void CalculateElementForces(int begin, int end);
+    void Integrate(float updateTime, CVector3 externalAcceleration, float groundLevel, int begin, int end);
+
+    // Per particle
+    std::vector<float> mX, mY, mZ;
+    std::vector<float> mVelocityX, mVelocityY, mVelocityZ;
+    std::vector<float> mInverseMass;
+    std::vector<float> mRestX, mRestY, mRestZ;
+    std::vector<int> mElementOffsets; //Particle p's forces are in mElementForce*[mElementSlots[mElementOffsets[p]]] to [mElementOffsets[p + 1]]
+    std::vector<int> mElementSlots;   //Tetrahedron * 4 + corner
+
+    // Per tetrahedron
+    std::vector<int> mCorners[4];
+    std::vector<float> mRestInverse[9]; //Inverse of the rest edge matrix, row major
+    std::vector<float> mVolume;
+    std::vector<float> mRotation[4];    //Quaternion w, x, y, z, kept from step to step
+
+    // Per tetrahedron corner (tetrahedron * 4 + corner)
+    std::vector<float> mElementForceX, mElementForceY, mElementForceZ;
+
+    // Per node
+    std::vector<int> mNodeElement;
+    std::vector<float> mNodeWeights; //4 per node
+
+    std::vector<CVector3> mNodePositions; //Scratch space for UpdateNodes
+
+    float mMu = 0;     //Lamé parameters from the Young's modulus and Poisson ratio
+    float mLambda = 0;
+    float mStableTimeStep = 1.0f; //Longest sub-step the lattice can take, see Build
+};
+
+
+#endif //_FEM_BODY_H_INCLUDED_
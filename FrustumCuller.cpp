@@ -0,0 +1,120 @@
+//--------------------------------------------------------------------------------------
+// Culls boxes against the view of each render pass
+//--------------------------------------------------------------------------------------
+
+#include "FrustumCuller.h"
+
+#include <algorithm>
+#include <emmintrin.h>
+
+
+void FrustumCuller::SetBodies(const CVector3* centres, const CVector3* extents, int count)
+{
+    mBodyCount = count;
+    const int paddedCount = (count + 3) & ~3;
+    mCentreX.assign(paddedCount, 0.0f);
+    mCentreY.assign(paddedCount, 0.0f);
+    mCentreZ.assign(paddedCount, 0.0f);
+    mExtentX.assign(paddedCount, 0.0f);
+    mExtentY.assign(paddedCount, 0.0f);
+    mExtentZ.assign(paddedCount, 0.0f);
+    for (int i = 0; i < count; ++i)
+    {
+        mCentreX[i] = centres[i].x;
+        mCentreY[i] = centres[i].y;
+        mCentreZ[i] = centres[i].z;
+        mExtentX[i] = extents[i].x;
+        mExtentY[i] = extents[i].y;
+        mExtentZ[i] = extents[i].z;
+    }
+}
+
+
+// The matrix works on row vectors, so clip space x is a point dotted with the first column and so on. Each side
+// of the view is where one clip coordinate meets w (or 0 for the near side).
+int FrustumCuller::AddPass(const CMatrix4x4& viewProjection)
+{
+    const CMatrix4x4& m = viewProjection;
+    const float columnX[4] = { m.e00, m.e10, m.e20, m.e30 };
+    const float columnY[4] = { m.e01, m.e11, m.e21, m.e31 };
+    const float columnZ[4] = { m.e02, m.e12, m.e22, m.e32 };
+    const float columnW[4] = { m.e03, m.e13, m.e23, m.e33 };
+
+    Pass pass;
+    for (int k = 0; k < 4; ++k)
+    {
+        pass.planes[0][k] = columnW[k] + columnX[k]; //Left
+        pass.planes[1][k] = columnW[k] - columnX[k]; //Right
+        pass.planes[2][k] = columnW[k] + columnY[k]; //Bottom
+        pass.planes[3][k] = columnW[k] - columnY[k]; //Top
+        pass.planes[4][k] = columnZ[k];              //Near
+        pass.planes[5][k] = columnW[k] - columnZ[k]; //Far
+    }
+    mPasses.push_back(pass);
+    return static_cast<int>(mPasses.size()) - 1;
+}
+
+
+// A box is behind a side if even its corner furthest in front is: the centre's distance plus the extents
+// weighted by the size of the side's normal along each axis. The sides needn't be normalised as only the
+// sign of that is used.
+void FrustumCuller::Cull()
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+
+    for (Pass& pass : mPasses)
+    {
+        pass.visible.clear();
+        pass.isVisible.assign(mBodyCount, 0);
+
+        for (int b = 0; b < mBodyCount; b += 4)
+        {
+            const __m128 centreX = _mm_loadu_ps(&mCentreX[b]);
+            const __m128 centreY = _mm_loadu_ps(&mCentreY[b]);
+            const __m128 centreZ = _mm_loadu_ps(&mCentreZ[b]);
+            const __m128 extentX = _mm_loadu_ps(&mExtentX[b]);
+            const __m128 extentY = _mm_loadu_ps(&mExtentY[b]);
+            const __m128 extentZ = _mm_loadu_ps(&mExtentZ[b]);
+
+            __m128 isOutside = zero;
+            for (int p = 0; p < 6; ++p)
+            {
+                const float* plane = pass.planes[p];
+                const __m128 planeX = _mm_set1_ps(plane[0]);
+                const __m128 planeY = _mm_set1_ps(plane[1]);
+                const __m128 planeZ = _mm_set1_ps(plane[2]);
+
+                __m128 distance = _mm_add_ps(_mm_mul_ps(planeX, centreX), _mm_set1_ps(plane[3]));
+                distance = _mm_add_ps(distance, _mm_mul_ps(planeY, centreY));
+                distance = _mm_add_ps(distance, _mm_mul_ps(planeZ, centreZ));
+
+                __m128 reach = _mm_mul_ps(_mm_andnot_ps(signMask, planeX), extentX);
+                reach = _mm_add_ps(reach, _mm_mul_ps(_mm_andnot_ps(signMask, planeY), extentY));
+                reach = _mm_add_ps(reach, _mm_mul_ps(_mm_andnot_ps(signMask, planeZ), extentZ));
+
+                isOutside = _mm_or_ps(isOutside, _mm_cmplt_ps(_mm_add_ps(distance, reach), zero));
+            }
+
+            const int outsideBits = _mm_movemask_ps(isOutside);
+            for (int k = 0; k < 4 && b + k < mBodyCount; ++k)
+            {
+                if ((outsideBits & (1 << k)) == 0)
+                {
+                    pass.isVisible[b + k] = 1;
+                    pass.visible.push_back(b + k);
+                }
+            }
+        }
+    }
+}
+
+
+void FrustumCuller::Hide(int pass, int body)
+{
+    Pass& hidden = mPasses[pass];
+    if (!hidden.isVisible[body])  return;
+
+    hidden.isVisible[body] = 0;
+    hidden.visible.erase(std::find(hidden.visible.begin(), hidden.visible.end(), body));
+}
@@ -0,0 +1,64 @@
+//--------------------------------------------------------------------------------------
+// Culls boxes against the view of each render pass
+//--------------------------------------------------------------------------------------
+// Every soft body used to be drawn into every shadow map and the camera view, seen or not.
+// The scene gives this a world space box for each body (Model::GetBounds, which follows the
+// simulated nodes rather than just the model's position) and a view-projection matrix for each
+// pass, the lights' and the camera's, and gets back the bodies each pass can see.
+//
+// The six sides of each view are taken straight from its matrix and the boxes are tested four at
+// a time with SSE: a box is outside if it's wholly behind any one side. That's conservative, so a
+// box near a corner of the view can be kept when it's just out of sight, but nothing seen is
+// ever dropped. Only CPU maths is used, so it runs (and can be tested) without a device.
+
+#include "CVector3.h"
+#include "CMatrix4x4.h"
+
+#include <vector>
+
+#ifndef _FRUSTUM_CULLER_H_INCLUDED_
+#define _FRUSTUM_CULLER_H_INCLUDED_
+
+
+class FrustumCuller
+{
+public:
+    // The boxes to cull, by centre and half size along each world axis. Kept until set again.
+    void SetBodies(const CVector3* centres, const CVector3* extents, int count);
+
+    // Adds a view to cull against and returns its pass number. viewProjection takes world space to
+    // clip space, with depth from 0 to 1 as Direct3D's is.
+    int AddPass(const CMatrix4x4& viewProjection);
+    void ClearPasses() { mPasses.clear(); }
+
+    // Tests every box against every pass
+    void Cull();
+
+    // Drops a body from a pass after Cull, such as when it's found to be hidden behind something
+    void Hide(int pass, int body);
+
+    // Bodies the pass may see, in body order
+    const std::vector<int>& GetVisible(int pass) const { return mPasses[pass].visible; }
+    bool IsVisible(int pass, int body) const { return mPasses[pass].isVisible[body] != 0; }
+
+    int GetPassCount() const { return static_cast<int>(mPasses.size()); }
+    int GetBodyCount() const { return mBodyCount; }
+
+private:
+    struct Pass
+    {
+        float planes[6][4]; //x, y, z and w of each side, the inside is where x*px + y*py + z*pz + w >= 0
+        std::vector<int> visible;
+        std::vector<unsigned char> isVisible;
+    };
+
+    std::vector<Pass> mPasses;
+
+    // Per body, padded with empty boxes to a multiple of four
+    std::vector<float> mCentreX, mCentreY, mCentreZ;
+    std::vector<float> mExtentX, mExtentY, mExtentZ;
+    int mBodyCount = 0;
+};
+
+
+#endif //_FRUSTUM_CULLER_H_INCLUDED_
@@ -0,0 +1,435 @@
+//--------------------------------------------------------------------------------------
+// The GPU calls the app makes, behind an interface so a frame can run without a GPU
+//--------------------------------------------------------------------------------------
+
+#include "GraphicsDevice.h"
+#include "Common.h"
+#include "Profiler.h"
+
+#include <cstring>
+
+
+GraphicsDevice* gGraphics = nullptr;
+
+
+//--------------------------------------------------------------------------------------
+// Direct3D
+//--------------------------------------------------------------------------------------
+
+D3DGraphicsDevice::D3DGraphicsDevice()
+{
+    D3D11_FEATURE_DATA_D3D11_OPTIONS options = {};
+    if (FAILED(gD3DDevice->CheckFeatureSupport(D3D11_FEATURE_D3D11_OPTIONS, &options, sizeof(options))) ||
+        !options.ConstantBufferOffsetting)
+    {
+        return;
+    }
+    if (FAILED(gD3DContext->QueryInterface(__uuidof(ID3D11DeviceContext1), reinterpret_cast<void**>(&mContext1))))
+    {
+        mContext1 = nullptr;
+    }
+}
+
+D3DGraphicsDevice::~D3DGraphicsDevice()
+{
+    if (mContext1)  mContext1->Release();
+}
+
+
+HRESULT D3DGraphicsDevice::CreateBuffer(const D3D11_BUFFER_DESC* desc, const D3D11_SUBRESOURCE_DATA* initialData, ID3D11Buffer** buffer)
+{
+    return gD3DDevice->CreateBuffer(desc, initialData, buffer);
+}
+
+HRESULT D3DGraphicsDevice::CreateTexture2D(const D3D11_TEXTURE2D_DESC* desc, const D3D11_SUBRESOURCE_DATA* initialData, ID3D11Texture2D** texture)
+{
+    return gD3DDevice->CreateTexture2D(desc, initialData, texture);
+}
+
+HRESULT D3DGraphicsDevice::CreateDepthStencilView(ID3D11Resource* resource, const D3D11_DEPTH_STENCIL_VIEW_DESC* desc, ID3D11DepthStencilView** view)
+{
+    return gD3DDevice->CreateDepthStencilView(resource, desc, view);
+}
+
+HRESULT D3DGraphicsDevice::CreateShaderResourceView(ID3D11Resource* resource, const D3D11_SHADER_RESOURCE_VIEW_DESC* desc, ID3D11ShaderResourceView** view)
+{
+    return gD3DDevice->CreateShaderResourceView(resource, desc, view);
+}
+
+HRESULT D3DGraphicsDevice::CreateInputLayout(const D3D11_INPUT_ELEMENT_DESC* elements, UINT elementCount, const void* signature, SIZE_T signatureSize,
+                                             ID3D11InputLayout** layout)
+{
+    return gD3DDevice->CreateInputLayout(elements, elementCount, signature, signatureSize, layout);
+}
+
+HRESULT D3DGraphicsDevice::CreateVertexShader(const void* byteCode, SIZE_T byteCodeSize, ID3D11ClassLinkage* linkage, ID3D11VertexShader** shader)
+{
+    return gD3DDevice->CreateVertexShader(byteCode, byteCodeSize, linkage, shader);
+}
+
+HRESULT D3DGraphicsDevice::CreatePixelShader(const void* byteCode, SIZE_T byteCodeSize, ID3D11ClassLinkage* linkage, ID3D11PixelShader** shader)
+{
+    return gD3DDevice->CreatePixelShader(byteCode, byteCodeSize, linkage, shader);
+}
+
+HRESULT D3DGraphicsDevice::CreateBlendState(const D3D11_BLEND_DESC* desc, ID3D11BlendState** state)
+{
+    return gD3DDevice->CreateBlendState(desc, state);
+}
+
+HRESULT D3DGraphicsDevice::CreateDepthStencilState(const D3D11_DEPTH_STENCIL_DESC* desc, ID3D11DepthStencilState** state)
+{
+    return gD3DDevice->CreateDepthStencilState(desc, state);
+}
+
+HRESULT D3DGraphicsDevice::CreateRasterizerState(const D3D11_RASTERIZER_DESC* desc, ID3D11RasterizerState** state)
+{
+    return gD3DDevice->CreateRasterizerState(desc, state);
+}
+
+HRESULT D3DGraphicsDevice::CreateSamplerState(const D3D11_SAMPLER_DESC* desc, ID3D11SamplerState** state)
+{
+    return gD3DDevice->CreateSamplerState(desc, state);
+}
+
+
+HRESULT D3DGraphicsDevice::Map(ID3D11Resource* resource, UINT subresource, D3D11_MAP mapType, UINT flags, D3D11_MAPPED_SUBRESOURCE* mapped)
+{
+    return gD3DContext->Map(resource, subresource, mapType, flags, mapped);
+}
+
+void D3DGraphicsDevice::Unmap(ID3D11Resource* resource, UINT subresource)
+{
+    gD3DContext->Unmap(resource, subresource);
+}
+
+
+void D3DGraphicsDevice::IASetVertexBuffers(UINT startSlot, UINT bufferCount, ID3D11Buffer* const* buffers, const UINT* strides, const UINT* offsets)
+{
+    gD3DContext->IASetVertexBuffers(startSlot, bufferCount, buffers, strides, offsets);
+}
+
+void D3DGraphicsDevice::IASetIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format, UINT offset)
+{
+    gD3DContext->IASetIndexBuffer(buffer, format, offset);
+}
+
+void D3DGraphicsDevice::IASetInputLayout(ID3D11InputLayout* layout)
+{
+    gD3DContext->IASetInputLayout(layout);
+}
+
+void D3DGraphicsDevice::IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology)
+{
+    gD3DContext->IASetPrimitiveTopology(topology);
+}
+
+void D3DGraphicsDevice::VSSetShader(ID3D11VertexShader* shader, ID3D11ClassInstance* const* instances, UINT instanceCount)
+{
+    gD3DContext->VSSetShader(shader, instances, instanceCount);
+}
+
+void D3DGraphicsDevice::PSSetShader(ID3D11PixelShader* shader, ID3D11ClassInstance* const* instances, UINT instanceCount)
+{
+    gD3DContext->PSSetShader(shader, instances, instanceCount);
+}
+
+void D3DGraphicsDevice::VSSetConstantBuffers(UINT startSlot, UINT bufferCount, ID3D11Buffer* const* buffers)
+{
+    gD3DContext->VSSetConstantBuffers(startSlot, bufferCount, buffers);
+}
+
+void D3DGraphicsDevice::PSSetConstantBuffers(UINT startSlot, UINT bufferCount, ID3D11Buffer* const* buffers)
+{
+    gD3DContext->PSSetConstantBuffers(startSlot, bufferCount, buffers);
+}
+
+void D3DGraphicsDevice::PSSetShaderResources(UINT startSlot, UINT viewCount, ID3D11ShaderResourceView* const* views)
+{
+    gD3DContext->PSSetShaderResources(startSlot, viewCount, views);
+}
+
+void D3DGraphicsDevice::PSSetSamplers(UINT startSlot, UINT samplerCount, ID3D11SamplerState* const* samplers)
+{
+    gD3DContext->PSSetSamplers(startSlot, samplerCount, samplers);
+}
+
+void D3DGraphicsDevice::OMSetBlendState(ID3D11BlendState* state, const FLOAT blendFactor[4], UINT sampleMask)
+{
+    gD3DContext->OMSetBlendState(state, blendFactor, sampleMask);
+}
+
+void D3DGraphicsDevice::OMSetDepthStencilState(ID3D11DepthStencilState* state, UINT stencilRef)
+{
+    gD3DContext->OMSetDepthStencilState(state, stencilRef);
+}
+
+void D3DGraphicsDevice::RSSetState(ID3D11RasterizerState* state)
+{
+    gD3DContext->RSSetState(state);
+}
+
+void D3DGraphicsDevice::RSSetViewports(UINT viewportCount, const D3D11_VIEWPORT* viewports)
+{
+    gD3DContext->RSSetViewports(viewportCount, viewports);
+}
+
+void D3DGraphicsDevice::OMSetRenderTargets(UINT viewCount, ID3D11RenderTargetView* const* views, ID3D11DepthStencilView* depthStencil)
+{
+    gD3DContext->OMSetRenderTargets(viewCount, views, depthStencil);
+}
+
+
+void D3DGraphicsDevice::VSSetConstantBuffers1(UINT startSlot, UINT bufferCount, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts)
+{
+    mContext1->VSSetConstantBuffers1(startSlot, bufferCount, buffers, firstConstants, constantCounts);
+}
+
+void D3DGraphicsDevice::PSSetConstantBuffers1(UINT startSlot, UINT bufferCount, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts)
+{
+    mContext1->PSSetConstantBuffers1(startSlot, bufferCount, buffers, firstConstants, constantCounts);
+}
+
+
+void D3DGraphicsDevice::ClearRenderTargetView(ID3D11RenderTargetView* view, const FLOAT colour[4])
+{
+    gD3DContext->ClearRenderTargetView(view, colour);
+}
+
+void D3DGraphicsDevice::ClearDepthStencilView(ID3D11DepthStencilView* view, UINT clearFlags, FLOAT depth, UINT8 stencil)
+{
+    gD3DContext->ClearDepthStencilView(view, clearFlags, depth, stencil);
+}
+
+void D3DGraphicsDevice::DrawIndexed(UINT indexCount, UINT startIndex, INT baseVertex)
+{
+    gD3DContext->DrawIndexed(indexCount, startIndex, baseVertex);
+}
+
+void D3DGraphicsDevice::DrawIndexedInstanced(UINT indexCountPerInstance, UINT instanceCount, UINT startIndex, INT baseVertex, UINT startInstance)
+{
+    gD3DContext->DrawIndexedInstanced(indexCountPerInstance, instanceCount, startIndex, baseVertex, startInstance);
+}
+
+void D3DGraphicsDevice::Present()
+{
+    gSwapChain->Present(0, 0);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Null objects
+//--------------------------------------------------------------------------------------
+// Stand-ins for Direct3D objects, so code holding them can AddRef, Release and GetDesc as usual.
+// Each deletes itself when its last reference is released.
+
+class NullChild
+{
+public:
+    virtual ~NullChild() {}
+};
+
+template <typename Interface>
+class NullObject : public Interface, public NullChild
+{
+public:
+    HRESULT STDMETHODCALLTYPE QueryInterface(REFIID, void** object) { *object = nullptr;  return E_NOINTERFACE; }
+    ULONG STDMETHODCALLTYPE AddRef() { return ++mReferences; }
+    ULONG STDMETHODCALLTYPE Release()
+    {
+        const ULONG references = --mReferences;
+        if (references == 0)  delete this;
+        return references;
+    }
+
+    void STDMETHODCALLTYPE GetDevice(ID3D11Device** device) { *device = nullptr; }
+    HRESULT STDMETHODCALLTYPE GetPrivateData(REFGUID, UINT* size, void*) { if (size)  *size = 0;  return E_FAIL; }
+    HRESULT STDMETHODCALLTYPE SetPrivateData(REFGUID, UINT, const void*) { return S_OK; }
+    HRESULT STDMETHODCALLTYPE SetPrivateDataInterface(REFGUID, const IUnknown*) { return S_OK; }
+
+private:
+    ULONG mReferences = 1;
+};
+
+template <typename Interface, typename Desc>
+class NullDescribed : public NullObject<Interface>
+{
+public:
+    NullDescribed(const Desc* desc) : mDesc() { if (desc)  mDesc = *desc; }
+    void STDMETHODCALLTYPE GetDesc(Desc* desc) { *desc = mDesc; }
+
+private:
+    Desc mDesc;
+};
+
+template <typename Interface, typename Desc, D3D11_RESOURCE_DIMENSION Dimension>
+class NullResource : public NullDescribed<Interface, Desc>
+{
+public:
+    NullResource(const Desc* desc) : NullDescribed<Interface, Desc>(desc) {}
+    void STDMETHODCALLTYPE GetType(D3D11_RESOURCE_DIMENSION* dimension) { *dimension = Dimension; }
+    void STDMETHODCALLTYPE SetEvictionPriority(UINT) {}
+    UINT STDMETHODCALLTYPE GetEvictionPriority() { return 0; }
+};
+
+// Holds the memory Map gives out
+class NullBuffer : public NullResource<ID3D11Buffer, D3D11_BUFFER_DESC, D3D11_RESOURCE_DIMENSION_BUFFER>
+{
+public:
+    NullBuffer(const D3D11_BUFFER_DESC* desc) : NullResource(desc), memory(desc->ByteWidth) {}
+    std::vector<unsigned char> memory;
+};
+
+template <typename Interface, typename Desc>
+class NullView : public NullDescribed<Interface, Desc>
+{
+public:
+    NullView(ID3D11Resource* resource, const Desc* desc) : NullDescribed<Interface, Desc>(desc), mResource(resource)
+    {
+        if (mResource)  mResource->AddRef();
+    }
+    ~NullView() { if (mResource)  mResource->Release(); }
+
+    void STDMETHODCALLTYPE GetResource(ID3D11Resource** resource)
+    {
+        *resource = mResource;
+        if (mResource)  mResource->AddRef();
+    }
+
+private:
+    ID3D11Resource* mResource;
+};
+
+
+//--------------------------------------------------------------------------------------
+// Null device
+//--------------------------------------------------------------------------------------
+
+HRESULT NullGraphicsDevice::CreateBuffer(const D3D11_BUFFER_DESC* desc, const D3D11_SUBRESOURCE_DATA* initialData, ID3D11Buffer** buffer)
+{
+    Count(CreateCall);
+    NullBuffer* nullBuffer = new NullBuffer(desc);
+    if (initialData)
+    {
+        memcpy(nullBuffer->memory.data(), initialData->pSysMem, desc->ByteWidth);
+        mTotal.bytesCreated += desc->ByteWidth;
+        mFrame.bytesCreated += desc->ByteWidth;
+    }
+    *buffer = nullBuffer;
+    return S_OK;
+}
+
+HRESULT NullGraphicsDevice::CreateTexture2D(const D3D11_TEXTURE2D_DESC* desc, const D3D11_SUBRESOURCE_DATA*, ID3D11Texture2D** texture)
+{
+    Count(CreateCall);
+    *texture = new NullResource<ID3D11Texture2D, D3D11_TEXTURE2D_DESC, D3D11_RESOURCE_DIMENSION_TEXTURE2D>(desc);
+    return S_OK;
+}
+
+HRESULT NullGraphicsDevice::CreateDepthStencilView(ID3D11Resource* resource, const D3D11_DEPTH_STENCIL_VIEW_DESC* desc, ID3D11DepthStencilView** view)
+{
+    Count(CreateCall);
+    *view = new NullView<ID3D11DepthStencilView, D3D11_DEPTH_STENCIL_VIEW_DESC>(resource, desc);
+    return S_OK;
+}
+
+HRESULT NullGraphicsDevice::CreateShaderResourceView(ID3D11Resource* resource, const D3D11_SHADER_RESOURCE_VIEW_DESC* desc, ID3D11ShaderResourceView** view)
+{
+    Count(CreateCall);
+    *view = new NullView<ID3D11ShaderResourceView, D3D11_SHADER_RESOURCE_VIEW_DESC>(resource, desc);
+    return S_OK;
+}
+
+HRESULT NullGraphicsDevice::CreateInputLayout(const D3D11_INPUT_ELEMENT_DESC*, UINT, const void*, SIZE_T, ID3D11InputLayout** layout)
+{
+    Count(CreateCall);
+    *layout = new NullObject<ID3D11InputLayout>;
+    return S_OK;
+}
+
+HRESULT NullGraphicsDevice::CreateVertexShader(const void*, SIZE_T, ID3D11ClassLinkage*, ID3D11VertexShader** shader)
+{
+    Count(CreateCall);
+    *shader = new NullObject<ID3D11VertexShader>;
+    return S_OK;
+}
+
+HRESULT NullGraphicsDevice::CreatePixelShader(const void*, SIZE_T, ID3D11ClassLinkage*, ID3D11PixelShader** shader)
+{
+    Count(CreateCall);
+    *shader = new NullObject<ID3D11PixelShader>;
+    return S_OK;
+}
+
+HRESULT NullGraphicsDevice::CreateBlendState(const D3D11_BLEND_DESC* desc, ID3D11BlendState** state)
+{
+    Count(CreateCall);
+    *state = new NullDescribed<ID3D11BlendState, D3D11_BLEND_DESC>(desc);
+    return S_OK;
+}
+
+HRESULT NullGraphicsDevice::CreateDepthStencilState(const D3D11_DEPTH_STENCIL_DESC* desc, ID3D11DepthStencilState** state)
+{
+    Count(CreateCall);
+    *state = new NullDescribed<ID3D11DepthStencilState, D3D11_DEPTH_STENCIL_DESC>(desc);
+    return S_OK;
+}
+
+HRESULT NullGraphicsDevice::CreateRasterizerState(const D3D11_RASTERIZER_DESC* desc, ID3D11RasterizerState** state)
+{
+    Count(CreateCall);
+    *state = new NullDescribed<ID3D11RasterizerState, D3D11_RASTERIZER_DESC>(desc);
+    return S_OK;
+}
+
+HRESULT NullGraphicsDevice::CreateSamplerState(const D3D11_SAMPLER_DESC* desc, ID3D11SamplerState** state)
+{
+    Count(CreateCall);
+    *state = new NullDescribed<ID3D11SamplerState, D3D11_SAMPLER_DESC>(desc);
+    return S_OK;
+}
+
+
+// Only buffers are mapped in this app
+HRESULT NullGraphicsDevice::Map(ID3D11Resource* resource, UINT, D3D11_MAP, UINT, D3D11_MAPPED_SUBRESOURCE* mapped)
+{
+    Count(MapCall);
+    D3D11_RESOURCE_DIMENSION dimension;
+    resource->GetType(&dimension);
+    if (dimension != D3D11_RESOURCE_DIMENSION_BUFFER)  return E_FAIL;
+
+    NullBuffer* buffer = static_cast<NullBuffer*>(static_cast<ID3D11Buffer*>(resource));
+    mapped->pData = buffer->memory.data();
+    mapped->RowPitch = static_cast<UINT>(buffer->memory.size());
+    mapped->DepthPitch = mapped->RowPitch;
+    mTotal.bytesMapped += buffer->memory.size();
+    mFrame.bytesMapped += buffer->memory.size();
+    return S_OK;
+}
+
+
+void NullGraphicsDevice::DrawIndexed(UINT indexCount, UINT, INT)
+{
+    Count(DrawCall);
+    mTotal.indicesDrawn += indexCount;
+    mFrame.indicesDrawn += indexCount;
+}
+
+void NullGraphicsDevice::DrawIndexedInstanced(UINT indexCountPerInstance, UINT instanceCount, UINT, INT, UINT)
+{
+    Count(DrawCall);
+    mTotal.indicesDrawn += static_cast<long long>(indexCountPerInstance) * instanceCount;
+    mFrame.indicesDrawn += static_cast<long long>(indexCountPerInstance) * instanceCount;
+}
+
+// Ends the frame, the counts go to the profiler in place of what a GPU would have done
+void NullGraphicsDevice::Present()
+{
+    Count(PresentCall);
+    PROFILE_COUNTER("Draw calls", mFrame.calls[DrawCall]);
+    PROFILE_COUNTER("State calls", mFrame.calls[StateCall]);
+    PROFILE_COUNTER("Buffer maps", mFrame.calls[MapCall]);
+    PROFILE_COUNTER("Bytes mapped", mFrame.bytesMapped);
+    PROFILE_COUNTER("Indices drawn", mFrame.indicesDrawn);
+    mFrame = GraphicsCounts();
+}
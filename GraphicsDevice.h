@@ -0,0 +1,239 @@
+//--------------------------------------------------------------------------------------
+// The GPU calls the app makes, behind an interface so a frame can run without a GPU
+//--------------------------------------------------------------------------------------
+// Everything that creates GPU objects or sends work to the GPU goes through gGraphics rather
+// than gD3DDevice/gD3DContext. The methods are named and take the same parameters as the
+// ID3D11Device and ID3D11DeviceContext methods they stand for.
+//
+// D3DGraphicsDevice passes each call on to the real device and context made by InitDirect3D.
+// NullGraphicsDevice (InitNullGraphics) needs no window, driver or GPU: it hands out stand-in
+// objects, gives Map a block of memory the size of the buffer, and only counts the calls, draws
+// and bytes sent. That lets SceneManager::RunScene run as usual with just the CPU work left to
+// time - simulation, collision, vertex packing, culling and constant updates. The counts for each
+// frame are added to the profiler at Present. The calls and their arguments aren't kept, so the
+// null device adds next to nothing to the frame it's timing.
+//
+// Texture files and the GUI need the real device, so they're skipped when IsHeadless.
+
+#include <d3d11.h>
+#include <d3d11_1.h>
+#include <string>
+#include <vector>
+#include <cstring>
+
+#ifndef _GRAPHICS_DEVICE_H_INCLUDED_
+#define _GRAPHICS_DEVICE_H_INCLUDED_
+
+
+class GraphicsDevice
+{
+public:
+    virtual ~GraphicsDevice() {}
+
+    // True if there's no GPU behind the calls
+    virtual bool IsHeadless() const = 0;
+
+    // Creation
+    virtual HRESULT CreateBuffer(const D3D11_BUFFER_DESC* desc, const D3D11_SUBRESOURCE_DATA* initialData, ID3D11Buffer** buffer) = 0;
+    virtual HRESULT CreateTexture2D(const D3D11_TEXTURE2D_DESC* desc, const D3D11_SUBRESOURCE_DATA* initialData, ID3D11Texture2D** texture) = 0;
+    virtual HRESULT CreateDepthStencilView(ID3D11Resource* resource, const D3D11_DEPTH_STENCIL_VIEW_DESC* desc, ID3D11DepthStencilView** view) = 0;
+    virtual HRESULT CreateShaderResourceView(ID3D11Resource* resource, const D3D11_SHADER_RESOURCE_VIEW_DESC* desc, ID3D11ShaderResourceView** view) = 0;
+    virtual HRESULT CreateInputLayout(const D3D11_INPUT_ELEMENT_DESC* elements, UINT elementCount, const void* signature, SIZE_T signatureSize,
+                                      ID3D11InputLayout** layout) = 0;
+    virtual HRESULT CreateVertexShader(const void* byteCode, SIZE_T byteCodeSize, ID3D11ClassLinkage* linkage, ID3D11VertexShader** shader) = 0;
+    virtual HRESULT CreatePixelShader(const void* byteCode, SIZE_T byteCodeSize, ID3D11ClassLinkage* linkage, ID3D11PixelShader** shader) = 0;
+    virtual HRESULT CreateBlendState(const D3D11_BLEND_DESC* desc, ID3D11BlendState** state) = 0;
+    virtual HRESULT CreateDepthStencilState(const D3D11_DEPTH_STENCIL_DESC* desc, ID3D11DepthStencilState** state) = 0;
+    virtual HRESULT CreateRasterizerState(const D3D11_RASTERIZER_DESC* desc, ID3D11RasterizerState** state) = 0;
+    virtual HRESULT CreateSamplerState(const D3D11_SAMPLER_DESC* desc, ID3D11SamplerState** state) = 0;
+
+    // Uploads
+    virtual HRESULT Map(ID3D11Resource* resource, UINT subresource, D3D11_MAP mapType, UINT flags, D3D11_MAPPED_SUBRESOURCE* mapped) = 0;
+    virtual void Unmap(ID3D11Resource* resource, UINT subresource) = 0;
+
+    // Pipeline state
+    virtual void IASetVertexBuffers(UINT startSlot, UINT bufferCount, ID3D11Buffer* const* buffers, const UINT* strides, const UINT* offsets) = 0;
+    virtual void IASetIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format, UINT offset) = 0;
+    virtual void IASetInputLayout(ID3D11InputLayout* layout) = 0;
+    virtual void IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology) = 0;
+    virtual void VSSetShader(ID3D11VertexShader* shader, ID3D11ClassInstance* const* instances, UINT instanceCount) = 0;
+    virtual void PSSetShader(ID3D11PixelShader* shader, ID3D11ClassInstance* const* instances, UINT instanceCount) = 0;
+    virtual void VSSetConstantBuffers(UINT startSlot, UINT bufferCount, ID3D11Buffer* const* buffers) = 0;
+    virtual void PSSetConstantBuffers(UINT startSlot, UINT bufferCount, ID3D11Buffer* const* buffers) = 0;
+    virtual void PSSetShaderResources(UINT startSlot, UINT viewCount, ID3D11ShaderResourceView* const* views) = 0;
+    virtual void PSSetSamplers(UINT startSlot, UINT samplerCount, ID3D11SamplerState* const* samplers) = 0;
+    virtual void OMSetBlendState(ID3D11BlendState* state, const FLOAT blendFactor[4], UINT sampleMask) = 0;
+    virtual void OMSetDepthStencilState(ID3D11DepthStencilState* state, UINT stencilRef) = 0;
+    virtual void RSSetState(ID3D11RasterizerState* state) = 0;
+    virtual void RSSetViewports(UINT viewportCount, const D3D11_VIEWPORT* viewports) = 0;
+    virtual void OMSetRenderTargets(UINT viewCount, ID3D11RenderTargetView* const* views, ID3D11DepthStencilView* depthStencil) = 0;
+
+    // Constant buffers bound from an offset (Direct3D 11.1). Only call these if CanBindConstantOffsets.
+    virtual bool CanBindConstantOffsets() const = 0;
+    virtual void VSSetConstantBuffers1(UINT startSlot, UINT bufferCount, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts) = 0;
+    virtual void PSSetConstantBuffers1(UINT startSlot, UINT bufferCount, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts) = 0;
+
+    // Work
+    virtual void ClearRenderTargetView(ID3D11RenderTargetView* view, const FLOAT colour[4]) = 0;
+    virtual void ClearDepthStencilView(ID3D11DepthStencilView* view, UINT clearFlags, FLOAT depth, UINT8 stencil) = 0;
+    virtual void DrawIndexed(UINT indexCount, UINT startIndex, INT baseVertex) = 0;
+    virtual void DrawIndexedInstanced(UINT indexCountPerInstance, UINT instanceCount, UINT startIndex, INT baseVertex, UINT startInstance) = 0;
+    virtual void Present() = 0;
+};
+
+
+// Sends every call to gD3DDevice, gD3DContext and gSwapChain
+class D3DGraphicsDevice : public GraphicsDevice
+{
+public:
+    // Checks for Direct3D 11.1 constant buffer offsets, the device and context must exist already
+    D3DGraphicsDevice();
+    ~D3DGraphicsDevice();
+
+    bool IsHeadless() const override { return false; }
+
+    HRESULT CreateBuffer(const D3D11_BUFFER_DESC* desc, const D3D11_SUBRESOURCE_DATA* initialData, ID3D11Buffer** buffer) override;
+    HRESULT CreateTexture2D(const D3D11_TEXTURE2D_DESC* desc, const D3D11_SUBRESOURCE_DATA* initialData, ID3D11Texture2D** texture) override;
+    HRESULT CreateDepthStencilView(ID3D11Resource* resource, const D3D11_DEPTH_STENCIL_VIEW_DESC* desc, ID3D11DepthStencilView** view) override;
+    HRESULT CreateShaderResourceView(ID3D11Resource* resource, const D3D11_SHADER_RESOURCE_VIEW_DESC* desc, ID3D11ShaderResourceView** view) override;
+    HRESULT CreateInputLayout(const D3D11_INPUT_ELEMENT_DESC* elements, UINT elementCount, const void* signature, SIZE_T signatureSize,
+                              ID3D11InputLayout** layout) override;
+    HRESULT CreateVertexShader(const void* byteCode, SIZE_T byteCodeSize, ID3D11ClassLinkage* linkage, ID3D11VertexShader** shader) override;
+    HRESULT CreatePixelShader(const void* byteCode, SIZE_T byteCodeSize, ID3D11ClassLinkage* linkage, ID3D11PixelShader** shader) override;
+    HRESULT CreateBlendState(const D3D11_BLEND_DESC* desc, ID3D11BlendState** state) override;
+    HRESULT CreateDepthStencilState(const D3D11_DEPTH_STENCIL_DESC* desc, ID3D11DepthStencilState** state) override;
+    HRESULT CreateRasterizerState(const D3D11_RASTERIZER_DESC* desc, ID3D11RasterizerState** state) override;
+    HRESULT CreateSamplerState(const D3D11_SAMPLER_DESC* desc, ID3D11SamplerState** state) override;
+
+    HRESULT Map(ID3D11Resource* resource, UINT subresource, D3D11_MAP mapType, UINT flags, D3D11_MAPPED_SUBRESOURCE* mapped) override;
+    void Unmap(ID3D11Resource* resource, UINT subresource) override;
+
+    void IASetVertexBuffers(UINT startSlot, UINT bufferCount, ID3D11Buffer* const* buffers, const UINT* strides, const UINT* offsets) override;
+    void IASetIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format, UINT offset) override;
+    void IASetInputLayout(ID3D11InputLayout* layout) override;
+    void IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology) override;
+    void VSSetShader(ID3D11VertexShader* shader, ID3D11ClassInstance* const* instances, UINT instanceCount) override;
+    void PSSetShader(ID3D11PixelShader* shader, ID3D11ClassInstance* const* instances, UINT instanceCount) override;
+    void VSSetConstantBuffers(UINT startSlot, UINT bufferCount, ID3D11Buffer* const* buffers) override;
+    void PSSetConstantBuffers(UINT startSlot, UINT bufferCount, ID3D11Buffer* const* buffers) override;
+    void PSSetShaderResources(UINT startSlot, UINT viewCount, ID3D11ShaderResourceView* const* views) override;
+    void PSSetSamplers(UINT startSlot, UINT samplerCount, ID3D11SamplerState* const* samplers) override;
+    void OMSetBlendState(ID3D11BlendState* state, const FLOAT blendFactor[4], UINT sampleMask) override;
+    void OMSetDepthStencilState(ID3D11DepthStencilState* state, UINT stencilRef) override;
+    void RSSetState(ID3D11RasterizerState* state) override;
+    void RSSetViewports(UINT viewportCount, const D3D11_VIEWPORT* viewports) override;
+    void OMSetRenderTargets(UINT viewCount, ID3D11RenderTargetView* const* views, ID3D11DepthStencilView* depthStencil) override;
+
+    bool CanBindConstantOffsets() const override { return mContext1 != nullptr; }
+    void VSSetConstantBuffers1(UINT startSlot, UINT bufferCount, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts) override;
+    void PSSetConstantBuffers1(UINT startSlot, UINT bufferCount, ID3D11Buffer* const* buffers, const UINT* firstConstants, const UINT* constantCounts) override;
+
+    void ClearRenderTargetView(ID3D11RenderTargetView* view, const FLOAT colour[4]) override;
+    void ClearDepthStencilView(ID3D11DepthStencilView* view, UINT clearFlags, FLOAT depth, UINT8 stencil) override;
+    void DrawIndexed(UINT indexCount, UINT startIndex, INT baseVertex) override;
+    void DrawIndexedInstanced(UINT indexCountPerInstance, UINT instanceCount, UINT startIndex, INT baseVertex, UINT startInstance) override;
+    void Present() override;
+
+private:
+    ID3D11DeviceContext1* mContext1 = nullptr; //Null without 11.1 constant buffer offsets
+};
+
+
+// Kinds of call NullGraphicsDevice counts
+enum GraphicsCall
+{
+    CreateCall,      //Any object made
+    MapCall,
+    StateCall,       //Shaders, states, buffers, views and samplers bound
+    ClearCall,
+    DrawCall,
+    PresentCall,
+    GraphicsCallCount,
+};
+
+
+struct GraphicsCounts
+{
+    long long calls[GraphicsCallCount] = {};
+    long long bytesCreated = 0;  //Initial data given to new buffers
+    long long bytesMapped = 0;   //Size of every buffer mapped, as a GPU would have to take the whole of it
+    long long indicesDrawn = 0;  //Across every instance
+};
+
+
+// Counts the calls and does nothing else
+class NullGraphicsDevice : public GraphicsDevice
+{
+public:
+    bool IsHeadless() const override { return true; }
+
+    HRESULT CreateBuffer(const D3D11_BUFFER_DESC* desc, const D3D11_SUBRESOURCE_DATA* initialData, ID3D11Buffer** buffer) override;
+    HRESULT CreateTexture2D(const D3D11_TEXTURE2D_DESC* desc, const D3D11_SUBRESOURCE_DATA* initialData, ID3D11Texture2D** texture) override;
+    HRESULT CreateDepthStencilView(ID3D11Resource* resource, const D3D11_DEPTH_STENCIL_VIEW_DESC* desc, ID3D11DepthStencilView** view) override;
+    HRESULT CreateShaderResourceView(ID3D11Resource* resource, const D3D11_SHADER_RESOURCE_VIEW_DESC* desc, ID3D11ShaderResourceView** view) override;
+    HRESULT CreateInputLayout(const D3D11_INPUT_ELEMENT_DESC* elements, UINT elementCount, const void* signature, SIZE_T signatureSize,
+                              ID3D11InputLayout** layout) override;
+    HRESULT CreateVertexShader(const void* byteCode, SIZE_T byteCodeSize, ID3D11ClassLinkage* linkage, ID3D11VertexShader** shader) override;
+    HRESULT CreatePixelShader(const void* byteCode, SIZE_T byteCodeSize, ID3D11ClassLinkage* linkage, ID3D11PixelShader** shader) override;
+    HRESULT CreateBlendState(const D3D11_BLEND_DESC* desc, ID3D11BlendState** state) override;
+    HRESULT CreateDepthStencilState(const D3D11_DEPTH_STENCIL_DESC* desc, ID3D11DepthStencilState** state) override;
+    HRESULT CreateRasterizerState(const D3D11_RASTERIZER_DESC* desc, ID3D11RasterizerState** state) override;
+    HRESULT CreateSamplerState(const D3D11_SAMPLER_DESC* desc, ID3D11SamplerState** state) override;
+
+    HRESULT Map(ID3D11Resource* resource, UINT subresource, D3D11_MAP mapType, UINT flags, D3D11_MAPPED_SUBRESOURCE* mapped) override;
+    void Unmap(ID3D11Resource*, UINT) override {}
+
+    void IASetVertexBuffers(UINT, UINT, ID3D11Buffer* const*, const UINT*, const UINT*) override     { Count(StateCall); }
+    void IASetIndexBuffer(ID3D11Buffer*, DXGI_FORMAT, UINT) override                                 { Count(StateCall); }
+    void IASetInputLayout(ID3D11InputLayout*) override                                               { Count(StateCall); }
+    void IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY) override                                   { Count(StateCall); }
+    void VSSetShader(ID3D11VertexShader*, ID3D11ClassInstance* const*, UINT) override                { Count(StateCall); }
+    void PSSetShader(ID3D11PixelShader*, ID3D11ClassInstance* const*, UINT) override                 { Count(StateCall); }
+    void VSSetConstantBuffers(UINT, UINT, ID3D11Buffer* const*) override                             { Count(StateCall); }
+    void PSSetConstantBuffers(UINT, UINT, ID3D11Buffer* const*) override                             { Count(StateCall); }
+    void PSSetShaderResources(UINT, UINT, ID3D11ShaderResourceView* const*) override                 { Count(StateCall); }
+    void PSSetSamplers(UINT, UINT, ID3D11SamplerState* const*) override                              { Count(StateCall); }
+    void OMSetBlendState(ID3D11BlendState*, const FLOAT[4], UINT) override                           { Count(StateCall); }
+    void OMSetDepthStencilState(ID3D11DepthStencilState*, UINT) override                             { Count(StateCall); }
+    void RSSetState(ID3D11RasterizerState*) override                                                 { Count(StateCall); }
+    void RSSetViewports(UINT, const D3D11_VIEWPORT*) override                                        { Count(StateCall); }
+    void OMSetRenderTargets(UINT, ID3D11RenderTargetView* const*, ID3D11DepthStencilView*) override  { Count(StateCall); }
+
+    // Offsets are "supported" so the same path is timed as on a Direct3D 11.1 GPU
+    bool CanBindConstantOffsets() const override { return true; }
+    void VSSetConstantBuffers1(UINT, UINT, ID3D11Buffer* const*, const UINT*, const UINT*) override  { Count(StateCall); }
+    void PSSetConstantBuffers1(UINT, UINT, ID3D11Buffer* const*, const UINT*, const UINT*) override  { Count(StateCall); }
+
+    void ClearRenderTargetView(ID3D11RenderTargetView*, const FLOAT[4]) override    { Count(ClearCall); }
+    void ClearDepthStencilView(ID3D11DepthStencilView*, UINT, FLOAT, UINT8) override { Count(ClearCall); }
+    void DrawIndexed(UINT indexCount, UINT startIndex, INT baseVertex) override;
+    void DrawIndexedInstanced(UINT indexCountPerInstance, UINT instanceCount, UINT startIndex, INT baseVertex, UINT startInstance) override;
+    void Present() override;
+
+    // Since the device was made, and since the last Present
+    const GraphicsCounts& GetTotalCounts() const { return mTotal; }
+    const GraphicsCounts& GetFrameCounts() const { return mFrame; }
+
+private:
+    void Count(GraphicsCall call) { ++mTotal.calls[call];  ++mFrame.calls[call]; }
+
+    GraphicsCounts mTotal;
+    GraphicsCounts mFrame;
+};
+
+
+extern GraphicsDevice* gGraphics;
+
+
+// Copies a constant buffer structure to the GPU, as UpdateConstantBuffer does but through gGraphics
+template <typename T>
+void UploadConstants(ID3D11Buffer* buffer, const T& constants)
+{
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    if (FAILED(gGraphics->Map(buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))  return;
+    memcpy(mapped.pData, &constants, sizeof(T));
+    gGraphics->Unmap(buffer, 0);
+}
+
+
+#endif //_GRAPHICS_DEVICE_H_INCLUDED_
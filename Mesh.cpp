@@ -9,6 +9,8 @@
 
 #include "Mesh.h"
 #include "Shader.h" // Needed for helper function CreateSignatureForVertexLayout
+#include "Profiler.h"
+#include "GraphicsDevice.h"
 #include "CVector2.h" 
 #include "CVector3.h" 
 
@@ -18,6 +20,154 @@
 #include <assimp/scene.h>
 
 #include <memory>
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+#include <emmintrin.h>
+
+
+const float WELD_DISTANCE = 0.01f; //Same as Node::addNode, vertices closer than this on every axis become one particle
+
+
+// Reorders a soft body's vertices so that particles joined by springs sit near each other in memory, which
+// the step's force and integration loops read together. The order is reverse Cuthill-McKee over the welded
+// particles: a breadth first walk out from an end of the mesh, so each particle's neighbours are close to
+// it in the list. Copies of a welded vertex are kept together. Only the vertices move, the triangles stay in
+// their order (setupSpring pairs them into quads) and faceIndices and indices are remapped to match.
+static void ReorderForLocality(std::vector<BasicNode>& vertices, std::vector<int>& faceIndices, DWORD* indices, int indexCount)
+{
+    const int vertexCount = static_cast<int>(vertices.size());
+
+    //Weld groups - sweep along x, joining vertices that are also close in y and z
+    std::vector<int> group(vertexCount);
+    std::iota(group.begin(), group.end(), 0);
+    auto FindGroup = [&](int v)
+    {
+        while (group[v] != v)
+        {
+            group[v] = group[group[v]];
+            v = group[v];
+        }
+        return v;
+    };
+
+    std::vector<int> byX(vertexCount);
+    std::iota(byX.begin(), byX.end(), 0);
+    std::sort(byX.begin(), byX.end(), [&](int a, int b) { return vertices[a].Position.x < vertices[b].Position.x; });
+    for (int i = 0; i < vertexCount; ++i)
+    {
+        const CVector3& a = vertices[byX[i]].Position;
+        for (int j = i + 1; j < vertexCount && vertices[byX[j]].Position.x - a.x <= WELD_DISTANCE; ++j)
+        {
+            const CVector3& b = vertices[byX[j]].Position;
+            if (abs(a.y - b.y) <= WELD_DISTANCE && abs(a.z - b.z) <= WELD_DISTANCE)
+            {
+                group[FindGroup(byX[j])] = FindGroup(byX[i]);
+            }
+        }
+    }
+
+    //Particles (one per group) and the triangle edges between them
+    std::vector<int> particle(vertexCount, -1);
+    int particleCount = 0;
+    for (int v = 0; v < vertexCount; ++v)
+    {
+        int root = FindGroup(v);
+        if (particle[root] < 0)  particle[root] = particleCount++;
+        particle[v] = particle[root];
+    }
+
+    std::vector<std::vector<int>> neighbours(particleCount);
+    for (size_t f = 0; f + 2 < faceIndices.size(); f += 3)
+    {
+        for (int e = 0; e < 3; ++e)
+        {
+            int a = particle[faceIndices[f + e]], b = particle[faceIndices[f + (e + 1) % 3]];
+            if (a != b)
+            {
+                neighbours[a].push_back(b);
+                neighbours[b].push_back(a);
+            }
+        }
+    }
+    for (std::vector<int>& list : neighbours)
+    {
+        std::sort(list.begin(), list.end());
+        list.erase(std::unique(list.begin(), list.end()), list.end());
+    }
+
+    //Cuthill-McKee, lowest degree neighbours first. Each piece of the mesh starts from the far end of a walk from
+    //its lowest degree particle, which is close to an end of it.
+    std::vector<int> order;
+    order.reserve(particleCount);
+    std::vector<bool> isVisited(particleCount, false);
+    auto Walk = [&](int start, std::vector<int>& output)
+    {
+        size_t first = output.size();
+        output.push_back(start);
+        isVisited[start] = true;
+        for (size_t next = first; next < output.size(); ++next)
+        {
+            std::vector<int> adjacent;
+            for (int n : neighbours[output[next]])
+            {
+                if (!isVisited[n])  adjacent.push_back(n);
+            }
+            std::stable_sort(adjacent.begin(), adjacent.end(), [&](int a, int b) { return neighbours[a].size() < neighbours[b].size(); });
+            for (int n : adjacent)
+            {
+                isVisited[n] = true;
+                output.push_back(n);
+            }
+        }
+    };
+
+    std::vector<int> byDegree(particleCount);
+    std::iota(byDegree.begin(), byDegree.end(), 0);
+    std::stable_sort(byDegree.begin(), byDegree.end(), [&](int a, int b) { return neighbours[a].size() < neighbours[b].size(); });
+    for (int start : byDegree)
+    {
+        if (isVisited[start])  continue;
+
+        std::vector<int> piece;
+        Walk(start, piece);
+        for (int p : piece)  isVisited[p] = false;
+
+        Walk(piece.back(), order);
+    }
+    std::reverse(order.begin(), order.end());
+
+    std::vector<int> particleRank(particleCount);
+    for (int r = 0; r < particleCount; ++r)
+    {
+        particleRank[order[r]] = r;
+    }
+
+    //Vertices follow their particle, copies in their original order
+    std::vector<int> newOrder(vertexCount);
+    std::iota(newOrder.begin(), newOrder.end(), 0);
+    std::stable_sort(newOrder.begin(), newOrder.end(), [&](int a, int b) { return particleRank[particle[a]] < particleRank[particle[b]]; });
+
+    std::vector<int> newIndex(vertexCount);
+    std::vector<BasicNode> reordered(vertexCount);
+    for (int i = 0; i < vertexCount; ++i)
+    {
+        newIndex[newOrder[i]] = i;
+        reordered[i] = vertices[newOrder[i]];
+    }
+    vertices = std::move(reordered);
+
+    for (int& index : faceIndices)
+    {
+        index = newIndex[index];
+    }
+    for (int i = 0; i < indexCount; ++i)
+    {
+        indices[i] = newIndex[indices[i]];
+    }
+}
 
 
 void getCentreOfMass(CVector3 potentialInput, CVector3* currentInput, bool isGreater)
@@ -160,12 +310,15 @@ Mesh::Mesh(const std::string& fileName, bool requireTangents /*= false*/, bool i
     mVertexSize = offset;
 
     // Create a "vertex layout" to describe to DirectX what is data in each vertex of this mesh
-    auto shaderSignature = CreateSignatureForVertexLayout(vertexElements.data(), static_cast<int>(vertexElements.size()));
-    HRESULT hr = gD3DDevice->CreateInputLayout(vertexElements.data(), static_cast<UINT>(vertexElements.size()),
-                                               shaderSignature->GetBufferPointer(), shaderSignature->GetBufferSize(),
-                                               &mVertexLayout);
-    if (shaderSignature)  shaderSignature->Release();
-    if (FAILED(hr))  throw std::runtime_error("Failure creating input layout for " + fileName);
+    // Soft bodies are drawn with the compact layout made in CreateCompactBuffers, these elements are only checked against BasicNode
+    if (isCollision)
+    {
+        mVertexElements = vertexElements;
+    }
+    else
+    {
+        CreateInputLayout(vertexElements, fileName);
+    }
 
 
 
@@ -176,10 +329,10 @@ Mesh::Mesh(const std::string& fileName, bool requireTangents /*= false*/, bool i
     mNumVertices = assimpMesh->mNumVertices;
 
 
-    mNumIndices  = assimpMesh->mNumFaces * 4;
+    mNumIndices  = assimpMesh->mNumFaces * 3;
 
     auto vertices = std::make_unique<unsigned char[]>(mNumVertices * mVertexSize);
-    auto indices  = std::make_unique<unsigned char[]>(mNumIndices * 4); // Using 32 bit indexes (4 bytes) for each indeex
+    auto indices  = std::make_unique<unsigned char[]>(mNumIndices * 4); // Loaded as 32 bit indexes (4 bytes) for each indeex, CreateIndexBuffer shrinks them if it can
     std::vector<BasicNode> nodeInput;
     //-----------------------------------
 
@@ -293,171 +446,357 @@ Mesh::Mesh(const std::string& fileName, bool requireTangents /*= false*/, bool i
     }
     if (isCollision)
     {
+        //Will need the vertices order for creating faces and binding springs.
+        std::vector<int> input;
+        int inputLoopLimit = assimpMesh->mNumFaces ;
 
-        CVector3 CentreOfMass[3] = { CVector3(.0,.0,.0),CVector3(.0,.0,.0) };
-
-        CVector3 *temp;
-        aiVector3D* assimpUV = assimpMesh->mTextureCoords[0];
-        for (int i = 0; i < mNumVertices; ++i, ++assimpUV)
+        for (size_t i = 0; i < inputLoopLimit; ++i)
         {
-
-            getCentreOfMass(CVector3(assimpMesh->mVertices[i].x, assimpMesh->mVertices[i].y, assimpMesh->mVertices[i].z), &CentreOfMass[0], 0);
-            getCentreOfMass(CVector3(assimpMesh->mVertices[i].x, assimpMesh->mVertices[i].y, assimpMesh->mVertices[i].z), &CentreOfMass[1], 1);
+            //Ideally a face has only 3 vertices. This will cause an error to occur, otherwise as most of the code uses that assumption.
+            if (assimpMesh->mFaces->mNumIndices == 3)
+            {
+                input.push_back(assimpMesh->mFaces[i].mIndices[0]);
+                input.push_back(assimpMesh->mFaces[i].mIndices[1]);
+                input.push_back(assimpMesh->mFaces[i].mIndices[2]);
+            }
         }
 
+      //  for(int i = 0; i < faces[0].)
+       // input.push_back(assimpMesh->mFaces[].mIndices[0]);
 
-        CentreOfMass[2] = (CentreOfMass[0] + CentreOfMass[1]) / 2;
+        ReorderForLocality(nodeInput, input, reinterpret_cast<DWORD*>(indices.get()), mNumIndices);
+        CreateSoftBody(nodeInput, input, fileName);
+    }
+    //-----------------------------------
 
-        for (int i = 0; i < nodeInput.size(); ++i)
+    //If the model is something you can collide with then you (for this) will need to update it real-time
+    if (isCollision)
+    {
+        CreateCompactBuffers(reinterpret_cast<DWORD*>(indices.get()), fileName);
+    }
+    else
+    {
+        //Kept so the mesh can be drawn into the occlusion buffer
+        for (const BasicNode& node : nodeInput)
         {
-            NodeData input;
-            input.BasicData = nodeInput[i];
-            VertexData.addNode(std::move(input), 1.0f, false);
+            mStaticPositions.push_back(node.Position);
         }
+        const DWORD* faceIndex = reinterpret_cast<const DWORD*>(indices.get());
+        mStaticIndices.assign(faceIndex, faceIndex + mNumIndices);
+
+        CreateBuffers(vertices.get(), reinterpret_cast<DWORD*>(indices.get()), fileName);// Fill the new vertex buffer with data loaded by assimp
+    }
+}
+
+
+// Build a mesh from vertices made in code rather than loaded from a file, e.g. generated test shapes.
+// Uses the same Position/Normal/UV layout as BasicNode. Indices are a triangle list, and for soft bodies each pair of
+// triangles must form a quad in the same order assimp gives them (see setupSpring).
+Mesh::Mesh(const std::vector<BasicNode>& vertices, const std::vector<unsigned int>& triangleIndices, bool isCollision /*= false*/, bool isRendered /*= true*/)
+{
+    std::vector<D3D11_INPUT_ELEMENT_DESC> vertexElements;
+    vertexElements.push_back({ "Position", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0,  D3D11_INPUT_PER_VERTEX_DATA, 0 });
+    vertexElements.push_back({ "Normal",   0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 12, D3D11_INPUT_PER_VERTEX_DATA, 0 });
+    vertexElements.push_back({ "UV",       0, DXGI_FORMAT_R32G32_FLOAT,    0, 24, D3D11_INPUT_PER_VERTEX_DATA, 0 });
+    mVertexSize = sizeof(BasicNode);
+
+    if (isRendered && !isCollision)
+    {
+        CreateInputLayout(vertexElements, "generated mesh");
+    }
+    else
+    {
+        mVertexElements = vertexElements;
+    }
+
+    if (vertices.empty() || triangleIndices.empty())  throw std::runtime_error("No usable geometry in generated mesh");
+
+    mNumVertices = static_cast<unsigned int>(vertices.size());
+    mNumIndices  = static_cast<unsigned int>(triangleIndices.size());
 
+    std::vector<BasicNode> nodeInput = vertices;
+    std::vector<DWORD> indices(triangleIndices.begin(), triangleIndices.end());
 
-        if (isCoreNode)
+    if (isCollision)
+    {
+        std::vector<int> input(triangleIndices.begin(), triangleIndices.end());
+        ReorderForLocality(nodeInput, input, indices.data(), static_cast<int>(indices.size()));
+        CreateSoftBody(nodeInput, input, "generated mesh");
+    }
+    else
+    {
+        for (const BasicNode& node : nodeInput)
         {
+            mStaticPositions.push_back(node.Position);
+        }
+        mStaticIndices = triangleIndices;
+    }
 
-            float mult = 1.0f;
-            for (int i = 0; i < 2; ++i)
-            {
-                NodeData temp;
+    if (isRendered && isCollision)
+    {
+        CreateCompactBuffers(indices.data(), "generated mesh");
+    }
+    else if (isRendered)
+    {
+        CreateBuffers(nodeInput.data(), indices.data(), "generated mesh");
+    }
+}
 
-                //
 
-                CVector3 NewPosition = CentreOfMass[2];
+// Creates the vertex layout for the given elements. Throws on failure like the constructors.
+void Mesh::CreateInputLayout(const std::vector<D3D11_INPUT_ELEMENT_DESC>& vertexElements, const std::string& name)
+{
+    mVertexElements = vertexElements;
 
-                if (NewPosition.x <= 0.01f && NewPosition.x >= -0.01f)
-                {
-                    NewPosition.x += (CentreOfMass[1].x) * centralNodePosition;
-                    NewPosition.x *= mult;
-                }
-                else {
-                    NewPosition.x += (mult * ((CentreOfMass[2].x - CentreOfMass[0].x) * centralNodePosition));
-                }
-                temp.BasicData.Position = NewPosition;
-                temp.BasicData.Normal = CVector3(.0f, .0f, .0f);
-                temp.BasicData.UV = CVector2(0, 0);
+    auto shaderSignature = CreateSignatureForVertexLayout(vertexElements.data(), static_cast<int>(vertexElements.size()));
+    HRESULT hr = gGraphics->CreateInputLayout(vertexElements.data(), static_cast<UINT>(vertexElements.size()),
+                                               shaderSignature->GetBufferPointer(), shaderSignature->GetBufferSize(),
+                                               &mVertexLayout);
+    if (shaderSignature)  shaderSignature->Release();
+    if (FAILED(hr))  throw std::runtime_error("Failure creating input layout for " + name);
+}
 
-                VertexData.addNode(std::move(temp), 1.0f, true);
 
-                //
+// Turns the loaded vertices into nodes, adds the core nodes in the centre and connects everything with springs.
+// faceIndices is the triangle list in the order it was loaded, it is kept so the springs can be rebuilt.
+void Mesh::CreateSoftBody(std::vector<BasicNode>& nodeInput, const std::vector<int>& faceIndices, const std::string& name)
+{
+    if (!MatchesNodeLayout())  throw std::runtime_error("Vertex layout of soft body doesn't match BasicNode in " + name);
 
-                NewPosition = CentreOfMass[2];
+    CVector3 CentreOfMass[3] = { CVector3(.0,.0,.0),CVector3(.0,.0,.0) };
 
-                if (NewPosition.y <= 0.01f && NewPosition.y >= -0.01f)
-                {
-                    NewPosition.y += (CentreOfMass[1].y) * centralNodePosition;
-                    NewPosition.y *= mult;
-                }
-                else {
-                    NewPosition.y += ((mult * ((CentreOfMass[2].y - CentreOfMass[0].y) * centralNodePosition)));
-                }
+    for (int i = 0; i < mNumVertices; ++i)
+    {
+        getCentreOfMass(nodeInput[i].Position, &CentreOfMass[0], 0);
+        getCentreOfMass(nodeInput[i].Position, &CentreOfMass[1], 1);
+    }
 
 
-                temp.BasicData.Position = NewPosition;
-                temp.BasicData.Normal = CVector3(.0f, .0f, .0f);
-                temp.BasicData.UV = CVector2(0, 0);
+    CentreOfMass[2] = (CentreOfMass[0] + CentreOfMass[1]) / 2;
 
-                VertexData.addNode(std::move(temp), 1.0f, true);
+    for (int i = 0; i < nodeInput.size(); ++i)
+    {
+        NodeData input;
+        input.BasicData = nodeInput[i];
+        VertexData.addNode(std::move(input), 1.0f, false);
+    }
 
-                //
 
-                NewPosition = CentreOfMass[2];
+    if (isCoreNode)
+    {
 
+        float mult = 1.0f;
+        for (int i = 0; i < 2; ++i)
+        {
+            NodeData temp;
 
-                if (NewPosition.z <= 0.01f && NewPosition.z >= -0.01f)
-                {
-                    NewPosition.z += (CentreOfMass[1].z) * centralNodePosition;
-                    NewPosition.z *= mult;
-                }
-                else {
-                    NewPosition.z += ((mult * ((CentreOfMass[2].z - CentreOfMass[0].z) * centralNodePosition)));
-                }
-                temp.BasicData.Position = NewPosition;
-                temp.BasicData.Normal = CVector3(.0f, .0f, .0f);
-                temp.BasicData.UV = CVector2(0, 0);
+            //
 
+            CVector3 NewPosition = CentreOfMass[2];
 
-                VertexData.addNode(std::move(temp), 1.0f, true);
+            if (NewPosition.x <= 0.01f && NewPosition.x >= -0.01f)
+            {
+                NewPosition.x += (CentreOfMass[1].x) * centralNodePosition;
+                NewPosition.x *= mult;
+            }
+            else {
+                NewPosition.x += (mult * ((CentreOfMass[2].x - CentreOfMass[0].x) * centralNodePosition));
+            }
+            temp.BasicData.Position = NewPosition;
+            temp.BasicData.Normal = CVector3(.0f, .0f, .0f);
+            temp.BasicData.UV = CVector2(0, 0);
 
-                //
+            VertexData.addNode(std::move(temp), 1.0f, true);
 
+            //
 
+            NewPosition = CentreOfMass[2];
 
-                mult *= -1.0f;
+            if (NewPosition.y <= 0.01f && NewPosition.y >= -0.01f)
+            {
+                NewPosition.y += (CentreOfMass[1].y) * centralNodePosition;
+                NewPosition.y *= mult;
+            }
+            else {
+                NewPosition.y += ((mult * ((CentreOfMass[2].y - CentreOfMass[0].y) * centralNodePosition)));
             }
-        }
-    
-        //Will need the vertices order for creating faces and binding springs.
-        std::vector<int> input;
-        int inputLoopLimit = assimpMesh->mNumFaces ;
 
-        for (size_t i = 0; i < inputLoopLimit; ++i)
-        {
-            //Ideally a face has only 3 vertices. This will cause an error to occur, otherwise as most of the code uses that assumption.
-            if (assimpMesh->mFaces->mNumIndices == 3)
+
+            temp.BasicData.Position = NewPosition;
+            temp.BasicData.Normal = CVector3(.0f, .0f, .0f);
+            temp.BasicData.UV = CVector2(0, 0);
+
+            VertexData.addNode(std::move(temp), 1.0f, true);
+
+            //
+
+            NewPosition = CentreOfMass[2];
+
+
+            if (NewPosition.z <= 0.01f && NewPosition.z >= -0.01f)
             {
-                input.push_back(assimpMesh->mFaces[i].mIndices[0]);
-                input.push_back(assimpMesh->mFaces[i].mIndices[1]);
-                input.push_back(assimpMesh->mFaces[i].mIndices[2]);
+                NewPosition.z += (CentreOfMass[1].z) * centralNodePosition;
+                NewPosition.z *= mult;
+            }
+            else {
+                NewPosition.z += ((mult * ((CentreOfMass[2].z - CentreOfMass[0].z) * centralNodePosition)));
             }
+            temp.BasicData.Position = NewPosition;
+            temp.BasicData.Normal = CVector3(.0f, .0f, .0f);
+            temp.BasicData.UV = CVector2(0, 0);
+
+
+            VertexData.addNode(std::move(temp), 1.0f, true);
+
+            //
+
+
+
+            mult *= -1.0f;
         }
+    }
 
-      //  for(int i = 0; i < faces[0].)
-       // input.push_back(assimpMesh->mFaces[].mIndices[0]);
+    VertexData.setupRootSize();
 
-        VertexData.setupRootSize();
-        setupSpring(&input);
+    mFaceIndices = faceIndices;
+    setupSpring(&mFaceIndices);
 
-        
+    //Only the loaded vertices are drawn, the core nodes after them aren't in the vertex buffer
+    VertexData.setRenderVertexCount(mNumVertices);
+    mNormals.Init(VertexData, mFaceIndices);
+}
+
+
+bool Mesh::MatchesNodeLayout()
+{
+    struct NodeElement { const char* name; DXGI_FORMAT format; UINT offset; };
+    const NodeElement nodeLayout[] =
+    {
+        { "Position", DXGI_FORMAT_R32G32B32_FLOAT, offsetof(BasicNode, Position) },
+        { "Normal",   DXGI_FORMAT_R32G32B32_FLOAT, offsetof(BasicNode, Normal) },
+        { "UV",       DXGI_FORMAT_R32G32_FLOAT,    offsetof(BasicNode, UV) },
+    };
+    const size_t elementCount = sizeof(nodeLayout) / sizeof(nodeLayout[0]);
+
+    if (mVertexSize != sizeof(BasicNode) || mVertexElements.size() != elementCount)  return false;
+
+    for (size_t i = 0; i < elementCount; ++i)
+    {
+        const D3D11_INPUT_ELEMENT_DESC& element = mVertexElements[i];
+        if (strcmp(element.SemanticName, nodeLayout[i].name) != 0 || element.SemanticIndex != 0 || element.InputSlot != 0 ||
+            element.Format != nodeLayout[i].format || element.AlignedByteOffset != nodeLayout[i].offset)
+        {
+            return false;
+        }
     }
-    //-----------------------------------
+    return true;
+}
 
+
+// Creates the GPU-side index buffer. Indices are 16 bit if every vertex can be reached with them, halving the buffer.
+void Mesh::CreateIndexBuffer(const DWORD* indices, const std::string& name)
+{
     D3D11_BUFFER_DESC bufferDesc;
     D3D11_SUBRESOURCE_DATA initData;
 
+    std::vector<unsigned short> shortIndices;
+    if (mNumVertices <= MAX_16_BIT_INDEX_VERTICES)
+    {
+        shortIndices.assign(indices, indices + mNumIndices);
+        mIndexFormat = DXGI_FORMAT_R16_UINT;
+    }
 
     // Create GPU-side index buffer and copy the vertices imported by assimp into it
     bufferDesc.BindFlags = D3D11_BIND_INDEX_BUFFER; // Indicate it is an index buffer
     bufferDesc.Usage = D3D11_USAGE_DEFAULT;         // Default usage for this buffer - we'll see other usages later
-    bufferDesc.ByteWidth = mNumIndices * sizeof(DWORD); // Size of the buffer in bytes
     bufferDesc.CPUAccessFlags = 0;
     bufferDesc.MiscFlags = 0;
-    initData.pSysMem = indices.get(); // Fill the new index buffer with data loaded by assimp
-    
-    hr = gD3DDevice->CreateBuffer(&bufferDesc, &initData, &mIndexBuffer);
-    if (FAILED(hr))  throw std::runtime_error("Failure creating index buffer for " + fileName);
-
-
-    bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER; // Indicate it is a vertex buffer
-    bufferDesc.ByteWidth = mNumVertices * mVertexSize; // Size of the buffer in bytes
-        //If the model is something you can collide with then you (for this) will need to update it real-time
-    if (isCollision)
+    if (mIndexFormat == DXGI_FORMAT_R16_UINT)
     {
-        bufferDesc.Usage = D3D11_USAGE_DYNAMIC;
-        bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
-        initData.pSysMem = &nodeInput.at(0);
+        bufferDesc.ByteWidth = mNumIndices * sizeof(unsigned short); // Size of the buffer in bytes
+        initData.pSysMem = shortIndices.data();
     }
     else
     {
-        bufferDesc.Usage = D3D11_USAGE_DEFAULT;
-        bufferDesc.CPUAccessFlags = 0;
-        initData.pSysMem = vertices.get();// Fill the new vertex buffer with data loaded by assimp
+        bufferDesc.ByteWidth = mNumIndices * sizeof(DWORD);
+        initData.pSysMem = indices; // Fill the new index buffer with data loaded by assimp
     }
+
+    HRESULT hr = gGraphics->CreateBuffer(&bufferDesc, &initData, &mIndexBuffer);
+    if (FAILED(hr))  throw std::runtime_error("Failure creating index buffer for " + name);
+}
+
+
+// Creates the GPU-side buffers of a mesh that never moves
+void Mesh::CreateBuffers(const void* vertices, const DWORD* indices, const std::string& name)
+{
+    CreateIndexBuffer(indices, name);
+
+    D3D11_BUFFER_DESC bufferDesc;
+    D3D11_SUBRESOURCE_DATA initData;
+    bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER; // Indicate it is a vertex buffer
+    bufferDesc.ByteWidth = mNumVertices * mVertexSize; // Size of the buffer in bytes
+    bufferDesc.Usage = D3D11_USAGE_DEFAULT;
+    bufferDesc.CPUAccessFlags = 0;
     bufferDesc.MiscFlags = 0;
-    
+    initData.pSysMem = vertices;
 
-    hr = gD3DDevice->CreateBuffer(&bufferDesc, &initData, &mVertexBuffer);
-    if (FAILED(hr))  throw std::runtime_error("Failure creating vertex buffer for " + fileName);
+    HRESULT hr = gGraphics->CreateBuffer(&bufferDesc, &initData, &mVertexBuffer);
+    if (FAILED(hr))  throw std::runtime_error("Failure creating vertex buffer for " + name);
+}
+
+
+// Creates the GPU-side buffers of a soft body, once CreateSoftBody has packed its drawn nodes. The compact vertices
+// go in a dynamic buffer as they're rewritten each frame, the UVs in one that can't change.
+void Mesh::CreateCompactBuffers(const DWORD* indices, const std::string& name)
+{
+    CreateIndexBuffer(indices, name);
+    CreateInputLayout(CompactVertexElements(), name);
+    mVertexSize = sizeof(CompactVertex);
+    mIsCompact = true;
+
+    const BasicNode* nodes = VertexData.getRenderVertices();
+    VertexData.getRenderBounds(mRenderBoundsMin, mRenderBoundsMax);
+    std::vector<CompactVertex> vertices(mNumVertices);
+    PackCompactVertices(nodes, mNumVertices, mRenderBoundsMin, mRenderBoundsMax, vertices.data());
+
+    D3D11_BUFFER_DESC bufferDesc;
+    D3D11_SUBRESOURCE_DATA initData;
+    bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+    bufferDesc.ByteWidth = mNumVertices * mVertexSize;
+    bufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+    bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    bufferDesc.MiscFlags = 0;
+    initData.pSysMem = vertices.data();
+
+    HRESULT hr = gGraphics->CreateBuffer(&bufferDesc, &initData, &mVertexBuffer);
+    if (FAILED(hr))  throw std::runtime_error("Failure creating vertex buffer for " + name);
+
+    std::vector<CVector2> uvs(mNumVertices);
+    for (unsigned int i = 0; i < mNumVertices; ++i)
+    {
+        uvs[i] = nodes[i].UV;
+    }
+    bufferDesc.ByteWidth = mNumVertices * sizeof(CVector2);
+    bufferDesc.Usage = D3D11_USAGE_IMMUTABLE;
+    bufferDesc.CPUAccessFlags = 0;
+    initData.pSysMem = uvs.data();
+
+    hr = gGraphics->CreateBuffer(&bufferDesc, &initData, &mUVBuffer);
+    if (FAILED(hr))  throw std::runtime_error("Failure creating UV buffer for " + name);
 }
 
 
 Mesh::~Mesh()
 {
+    for (int i = 0; i < SpringData.size(); ++i)
+    {
+        delete SpringData[i];
+    }
+
     if (mIndexBuffer)   mIndexBuffer ->Release();
     if (mVertexBuffer)  mVertexBuffer->Release();
+    if (mUVBuffer)      mUVBuffer    ->Release();
     if (mVertexLayout)  mVertexLayout->Release();
 }
 
@@ -597,63 +936,289 @@ void Mesh::setupSpring(std::vector<int>* input)
         }
     }
 
+    //Springs in the order of their first particle, so walking them reads the nodes in order too
+    std::unordered_map<const NodeData*, int> nodeIndex;
+    for (int i = 0; i < VertexSize; ++i)
+    {
+        if (VertexData.isRoot(i))
+        {
+            nodeIndex[VertexData.GetChildNode(i)] = i;
+        }
+    }
+    auto FirstParticle = [&](const SpringPoint* spring)
+    {
+        return std::min(nodeIndex[spring->Parents[0]], nodeIndex[spring->Parents[1]]);
+    };
+    std::stable_sort(SpringData.begin(), SpringData.end(), [&](const SpringPoint* a, const SpringPoint* b) { return FirstParticle(a) < FirstParticle(b); });
 }
 
 
 
-// The render function assumes shaders, matrices, textures, samplers etc. have been set up already.
-// It simply draws this mesh with whatever settings the GPU is currently using.
-void Mesh::Render()
+void Mesh::rebuildSprings()
+{
+    for (int i = 0; i < SpringData.size(); ++i)
+    {
+        delete SpringData[i];
+    }
+    SpringData.clear();
+    VertexData.clearLinks();
+
+    if (!mFaceIndices.empty())
+    {
+        setupSpring(&mFaceIndices);
+    }
+}
+
+
+bool Mesh::setSoftBodyModel(SoftBodyModel model)
 {
-    // Set vertex buffer as next data source for GPU
-    UINT stride = mVertexSize;
-    UINT offset = 0;
-
-    //No positions should be at 0,0,0 so this should be fine. Can be refined later.
-    if (VertexData.getSize() > 0 && 
-        VertexData.getPosition(0).x >=-0.01f && 
-        VertexData.getPosition(0).x <= 0.01f && 
-        VertexData.getPosition(0).y >=-0.01f && 
-        VertexData.getPosition(0).y <= 0.01f && 
-        VertexData.getPosition(0).z >=-0.01f && 
-        VertexData.getPosition(0).z <= 0.01f)
-    {}
-    else if(VertexData.getSize() > 0)
-    {        
-        int loopLimit = VertexData.getSize();
-        D3D11_MAPPED_SUBRESOURCE cb;
-       
-        //Gain access to the GPU, slowing it, and then copy over a copy of the data used to the buffer.
-        gD3DContext->Map(mVertexBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &cb);
-        BasicNode* bufferData = (BasicNode*)cb.pData;
-
-        for (int i = 0; i < loopLimit; ++i)
+    //The lattice is built around the rest shape
+    VertexData.resetPoints();
+    if (model == VolumeModel && !mVolume)
+    {
+        std::unique_ptr<FemBody> volume = std::make_unique<FemBody>();
+        if (!volume->Build(VertexData, mFaceIndices))
         {
-            *bufferData++ = VertexData.GetChildNode(i)->BasicData;//*VertexData[i].BasicData;
+            return false;
         }
+        mVolume = std::move(volume);
+    }
 
+    mModel = model;
+    if (mVolume)
+    {
+        mVolume->Reset();
+    }
+    return true;
+}
 
-       // memcpy(cb.pData, vertices.get(), mNumVertices * mVertexSize); //CVector3 = 3 floats.  // 1 float = 4 bits of memory. (Should equal 12 memory) (50 * 12 = 600)
-        gD3DContext->Unmap(mVertexBuffer, 0);
-        
 
+void Mesh::resetSoftBody()
+{
+    VertexData.resetPoints();
+    if (getVolume() != nullptr)
+    {
+        getVolume()->Reset();
     }
+}
 
-    gD3DContext->IASetVertexBuffers(0, 1, &mVertexBuffer, &stride, &offset);
+
+void Mesh::saveState(std::vector<unsigned char>& output)
+{
+    VertexData.saveState(output);
+
+    //Spring coefficients can be changed through the GUI so they are part of the state. Lengths never change after setupSpring.
+    int springCount = SpringData.size();
+    size_t writePos = output.size();
+    output.resize(writePos + sizeof(int) + springCount * sizeof(float));
+    unsigned char* write = output.data() + writePos;
+
+    memcpy(write, &springCount, sizeof(int));
+    write += sizeof(int);
+    for (int i = 0; i < springCount; ++i)
+    {
+        memcpy(write, &SpringData[i]->SpringCoefficient, sizeof(float));
+        write += sizeof(float);
+    }
+
+    //A body on the springs writes empty particle and tetrahedron counts in place of the volume
+    if (getVolume() != nullptr)
+    {
+        getVolume()->saveState(output);
+    }
+    else
+    {
+        const int emptyVolume[2] = { 0, 0 };
+        writePos = output.size();
+        output.resize(writePos + sizeof(emptyVolume));
+        memcpy(output.data() + writePos, emptyVolume, sizeof(emptyVolume));
+    }
+}
+
+bool Mesh::loadState(const unsigned char*& input, const unsigned char* inputEnd)
+{
+    if (!VertexData.loadState(input, inputEnd))
+    {
+        return false;
+    }
+
+    int springCount;
+    if (inputEnd - input < sizeof(int))
+    {
+        return false;
+    }
+    memcpy(&springCount, input, sizeof(int));
+    if (springCount != SpringData.size() || inputEnd - input < sizeof(int) + springCount * sizeof(float))
+    {
+        return false;
+    }
+    input += sizeof(int);
+
+    for (int i = 0; i < springCount; ++i)
+    {
+        memcpy(&SpringData[i]->SpringCoefficient, input, sizeof(float));
+        input += sizeof(float);
+    }
+
+    if (getVolume() != nullptr)
+    {
+        return getVolume()->loadState(input, inputEnd);
+    }
+
+    int emptyVolume[2];
+    if (inputEnd - input < sizeof(emptyVolume))
+    {
+        return false;
+    }
+    memcpy(emptyVolume, input, sizeof(emptyVolume));
+    if (emptyVolume[0] != 0 || emptyVolume[1] != 0)
+    {
+        return false;
+    }
+    input += sizeof(emptyVolume);
+    return true;
+}
+
+
+// Copies into a mapped GPU buffer. Mapped memory is write-combined so this uses non-temporal stores, which skip the
+// cache rather than filling it with data the CPU won't read again. Falls back to memcpy if either side isn't 16 byte aligned.
+static void StreamCopy(void* destination, const void* source, size_t size)
+{
+    if ((reinterpret_cast<uintptr_t>(destination) & 15) != 0 || (reinterpret_cast<uintptr_t>(source) & 15) != 0)
+    {
+        memcpy(destination, source, size);
+        return;
+    }
+
+    __m128i* write = static_cast<__m128i*>(destination);
+    const __m128i* read = static_cast<const __m128i*>(source);
+    size_t blocks = size / 16;
+    for (size_t i = 0; i < blocks; ++i)
+    {
+        _mm_stream_si128(write + i, _mm_load_si128(read + i));
+    }
+    _mm_sfence();
+
+    memcpy(write + blocks, read + blocks, size % 16);
+}
+
+
+void Mesh::PublishRenderVertices()
+{
+    if (VertexData.getRenderVertexCount() == 0)  return;
+
+    //Switching back to the loaded normals just takes them from the nodes again
+    if (mNormalsRecalculated != gRecalculateNormals)
+    {
+        if (gRecalculateNormals)
+        {
+            mNormals.Invalidate();
+            VertexData.markRenderDirty();
+        }
+        else
+        {
+            VertexData.setRenderVertexCount(mNumVertices);
+        }
+        mNormalsRecalculated = gRecalculateNormals;
+    }
+
+    //Bodies in a SoftBodyWorld are normally packed already by its PackRenderVertices, this catches any others
+    if (VertexData.packRenderVertices())
+    {
+        PROFILE_COUNTER("Vertex packs", 1);
+    }
+
+    if (!VertexData.takeRenderDirty())  return;
+
+    if (gRecalculateNormals)
+    {
+        mNormals.Update(VertexData, gNormalMoveThreshold);
+    }
+
+    //Compacted here, on the simulation side, so the render only has to copy it
+    RenderSnapshot& snapshot = mRenderSnapshots.GetWriteBuffer();
+    VertexData.getRenderBounds(snapshot.boundsMin, snapshot.boundsMax);
+    snapshot.vertices.resize(VertexData.getRenderVertexCount());
+    PackCompactVertices(VertexData.getRenderVertices(), VertexData.getRenderVertexCount(), snapshot.boundsMin, snapshot.boundsMax, snapshot.vertices.data());
+    mRenderSnapshots.Publish();
+}
+
+
+void Mesh::UpdateVertexBuffer()
+{
+    //Soft bodies publish their drawn nodes already compacted, so it's one straight copy and only when they've moved
+    if (!mRenderSnapshots.Acquire())  return;
+
+    const RenderSnapshot& snapshot = mRenderSnapshots.GetReadBuffer();
+    if (snapshot.vertices.empty())  return;
+    mRenderBoundsMin = snapshot.boundsMin;
+    mRenderBoundsMax = snapshot.boundsMax;
+
+    //Left to the first Render that draws it, so a culled body isn't uploaded. The snapshot is held until the next Acquire.
+    mIsUploadPending = true;
+}
+
+
+void Mesh::UploadVertices()
+{
+    mIsUploadPending = false;
+    const RenderSnapshot& snapshot = mRenderSnapshots.GetReadBuffer();
+
+    PROFILE_SCOPE("Vertex upload");
+    PROFILE_COUNTER("Vertex uploads", 1);
+    D3D11_MAPPED_SUBRESOURCE cb;
+
+    //Gain access to the GPU, slowing it, and then copy over a copy of the data used to the buffer.
+    gGraphics->Map(mVertexBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &cb);
+    StreamCopy(cb.pData, snapshot.vertices.data(), snapshot.vertices.size() * sizeof(CompactVertex));
+    gGraphics->Unmap(mVertexBuffer, 0);
+}
+
+
+// The render function assumes shaders, matrices, textures, samplers etc. have been set up already.
+// It simply draws this mesh with whatever settings the GPU is currently using.
+void Mesh::Render()
+{
+    if (mIsUploadPending)  UploadVertices();
+
+    // Set vertex buffer as next data source for GPU, and the UVs of a soft body after it
+    ID3D11Buffer* buffers[2] = { mVertexBuffer, mUVBuffer };
+    UINT strides[2] = { mVertexSize, sizeof(CVector2) };
+    UINT offsets[2] = { 0, 0 };
+
+    gGraphics->IASetVertexBuffers(0, GetStreamCount(), buffers, strides, offsets);
    
     
     //mVertexLayout->SetPrivateData();
     // Indicate the layout of vertex buffer
-    gD3DContext->IASetInputLayout(mVertexLayout);
+    gGraphics->IASetInputLayout(mVertexLayout);
 
-    // Set index buffer as next data source for GPU, indicate it uses 32-bit integers
-    gD3DContext->IASetIndexBuffer(mIndexBuffer, DXGI_FORMAT_R32_UINT, 0);
+    // Set index buffer as next data source for GPU, indicate whether it uses 16 or 32-bit integers
+    gGraphics->IASetIndexBuffer(mIndexBuffer, mIndexFormat, 0);
 
     // Using triangle lists only in this class
-    gD3DContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    gGraphics->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
     // Render mesh
-    gD3DContext->DrawIndexed(mNumIndices, 0, 0);
+    gGraphics->DrawIndexed(mNumIndices, 0, 0);
 }
 
 
+void Mesh::RenderInstanced(ID3D11InputLayout* instanceLayout, ID3D11Buffer* instanceBuffer, UINT instanceStride, UINT instanceCount)
+{
+    if (mIsUploadPending)  UploadVertices();
+
+    const UINT instanceSlot = GetStreamCount();
+    ID3D11Buffer* buffers[3] = { mVertexBuffer, mUVBuffer, nullptr };
+    UINT strides[3] = { mVertexSize, sizeof(CVector2), 0 };
+    UINT offsets[3] = { 0, 0, 0 };
+    buffers[instanceSlot] = instanceBuffer;
+    strides[instanceSlot] = instanceStride;
+    gGraphics->IASetVertexBuffers(0, instanceSlot + 1, buffers, strides, offsets);
+
+    gGraphics->IASetInputLayout(instanceLayout);
+    gGraphics->IASetIndexBuffer(mIndexBuffer, mIndexFormat, 0);
+    gGraphics->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+
+    gGraphics->DrawIndexedInstanced(mNumIndices, instanceCount, 0, 0, 0);
+}
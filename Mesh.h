@@ -10,9 +10,14 @@
 //#include "common.h"
 #include "SpringPoint.h"
 #include "NodePoint.h"
+#include "NormalUpdater.h"
+#include "TripleBuffer.h"
+#include "FemBody.h"
+#include "VertexCompression.h"
 
 #include <vector>
 #include <string>
+#include <memory>
 
 #ifndef _MESH_H_INCLUDED_
 #define _MESH_H_INCLUDED_
@@ -43,6 +48,14 @@ constexpr float CentralNodeStrength = 22.5f * SPRING_MULT;
 constexpr float centralNodePosition = 3.75f; //Never make 100%
 
 
+//How a soft body's nodes are moved. Springs is the original, Volume fills the body with tetrahedra (see FemBody).
+enum SoftBodyModel
+{
+    SpringModel,
+    VolumeModel,
+};
+
+
 class Mesh
 {
 private:
@@ -50,6 +63,7 @@ private:
     //???aiMesh STORED_assimpMesh;
     unsigned int       mVertexSize;             // Size in bytes of a single vertex (depends on what it contains, uvs, tangents etc.)
     ID3D11InputLayout* mVertexLayout = nullptr; // DirectX specification of data held in a single vertex
+    std::vector<D3D11_INPUT_ELEMENT_DESC> mVertexElements; // The elements mVertexLayout was made from
 
     // GPU-side vertex and index buffers
     unsigned int       mNumVertices;
@@ -58,7 +72,42 @@ private:
 
     unsigned int       mNumIndices;
     ID3D11Buffer* mIndexBuffer = nullptr;
+    DXGI_FORMAT   mIndexFormat = DXGI_FORMAT_R32_UINT; // 16 bit when there are few enough vertices
+
+    // Soft bodies are drawn in the compact format (see VertexCompression), with their UVs in a second buffer as they never change
+    bool          mIsCompact = false;
+    ID3D11Buffer* mUVBuffer = nullptr;
+
+    std::vector<int> mFaceIndices; //Triangle list the springs were built from, kept so they can be rebuilt.
+
+    NormalUpdater mNormals;
+    bool mNormalsRecalculated = true; //gRecalculateNormals as of the last publish, to notice it being toggled
 
+    //Drawn vertices handed from the simulation to the render, already packed in the compact format. See PublishRenderVertices
+    struct RenderSnapshot
+    {
+        std::vector<CompactVertex> vertices;
+        CVector3 boundsMin;
+        CVector3 boundsMax;
+    };
+    TripleBuffer<RenderSnapshot> mRenderSnapshots;
+    CVector3 mRenderBoundsMin = { 0, 0, 0 }; //Of the snapshot being drawn
+    CVector3 mRenderBoundsMax = { 0, 0, 0 };
+    bool mIsUploadPending = false; //The snapshot being drawn hasn't been copied to mVertexBuffer yet
+
+    //Positions and triangle list as loaded, for meshes that aren't soft bodies
+    std::vector<CVector3> mStaticPositions;
+    std::vector<unsigned int> mStaticIndices;
+
+    SoftBodyModel mModel = SpringModel;
+    std::unique_ptr<FemBody> mVolume; //Made the first time the volume model is used
+
+    void CreateInputLayout(const std::vector<D3D11_INPUT_ELEMENT_DESC>& vertexElements, const std::string& name);
+    void CreateSoftBody(std::vector<BasicNode>& nodeInput, const std::vector<int>& faceIndices, const std::string& name);
+    void CreateIndexBuffer(const DWORD* indices, const std::string& name);
+    void CreateBuffers(const void* vertices, const DWORD* indices, const std::string& name);
+    void CreateCompactBuffers(const DWORD* indices, const std::string& name);
+    void UploadVertices();
    
     //std::vector<NodeData> VertexData;
 
@@ -75,15 +124,105 @@ public:
     // Will throw a std::runtime_error exception on failure (since constructors can't return errors).
     Mesh(const std::string& fileName, bool requireTangents = false, bool isCollision = false);
 
+    // Build a mesh from vertices generated in code. Indices are a triangle list.
+    // A mesh that's only simulated and never drawn (such as a level of detail proxy) can skip creating any GPU resources.
+    Mesh(const std::vector<BasicNode>& vertices, const std::vector<unsigned int>& triangleIndices, bool isCollision = false, bool isRendered = true);
+
     ~Mesh();
 
     void setupSpring(std::vector<int> *input);
 
+    //Throws away every spring and face and builds them again from the original triangle list.
+    void rebuildSprings();
+
+    int getVertexCount()
+    {
+        return mNumVertices;
+    }
+
+    const std::vector<int>& getFaceIndices()
+    {
+        return mFaceIndices;
+    }
+
+    NormalUpdater& GetNormals()
+    {
+        return mNormals;
+    }
+
+    //Switches how the soft body is simulated. The body is reset to its rest shape, which the volume model is built
+    //from the first time. Returns false, staying on the springs, if the mesh has no volume to fill.
+    bool setSoftBodyModel(SoftBodyModel model);
+
+    SoftBodyModel getSoftBodyModel()
+    {
+        return mModel;
+    }
+
+    //The volume model, only while it's the one in use
+    FemBody* getVolume()
+    {
+        return (mModel == VolumeModel) ? mVolume.get() : nullptr;
+    }
+
+    //Sets the nodes, and the volume if it's in use, back to the rest shape
+    void resetSoftBody();
+
+
+    // Simulation side. If the soft body has moved, packs its drawn vertices (unless SoftBodyWorld::PackRenderVertices
+    // already has), recalculates its normals and publishes a snapshot of them for UpdateVertexBuffer. Safe to call on another thread to the render, as long as it's only ever one.
+    void PublishRenderVertices();
+
+    // Render side. Takes the latest snapshot from PublishRenderVertices, if there's a new one, to be uploaded by the
+    // first Render that draws it. Call once a frame before any Render so every pass of the frame draws the same shape.
+    void UpdateVertexBuffer();
+
+    // Geometry of a mesh that isn't a soft body, as loaded, for drawing into an OcclusionBuffer. Empty for soft bodies.
+    const std::vector<CVector3>& GetStaticPositions() { return mStaticPositions; }
+    const std::vector<unsigned int>& GetStaticIndices() { return mStaticIndices; }
+
+    // Render side. Box around the vertices being drawn, in the mesh's local space.
+    void GetRenderBounds(CVector3& boundsMin, CVector3& boundsMax)
+    {
+        boundsMin = mRenderBoundsMin;
+        boundsMax = mRenderBoundsMax;
+    }
+
+    // True if the mesh is drawn from compact vertices, whose positions need GetCompactPositionMatrix before the world matrix
+    bool IsCompact()
+    {
+        return mIsCompact;
+    }
+
+    // Render side. Takes the positions of the vertices being drawn from the compact format back to local space.
+    CMatrix4x4 GetCompactPositionMatrix()
+    {
+        return CompactPositionMatrix(mRenderBoundsMin, mRenderBoundsMax);
+    }
 
     // The render function assumes shaders, matrices, textures, samplers etc. have been set up already.
     // It simply draws this mesh with whatever settings the GPU is currently using.
     void Render();
 
+    // Draws instanceCount copies of the mesh in one call. instanceBuffer is bound to the vertex slot after the mesh's own
+    // (see GetStreamCount) and the layout must start with this mesh's vertex elements (see GetVertexElements) followed by the per-instance ones.
+    void RenderInstanced(ID3D11InputLayout* instanceLayout, ID3D11Buffer* instanceBuffer, UINT instanceStride, UINT instanceCount);
+
+    const std::vector<D3D11_INPUT_ELEMENT_DESC>& GetVertexElements()
+    {
+        return mVertexElements;
+    }
+
+    // Number of vertex buffers the mesh is drawn from, starting at slot 0
+    UINT GetStreamCount()
+    {
+        return mUVBuffer ? 2 : 1;
+    }
+
+    // True if the vertex elements as loaded are laid out exactly as BasicNode (Position, Normal, UV), which soft bodies
+    // rely on as their drawn nodes are packed as BasicNodes before being compacted for upload.
+    bool MatchesNodeLayout();
+
     int getSpringSize()
     {
         return SpringData.size();
@@ -100,6 +239,12 @@ public:
         SpringData[index]->SpringCoefficient = input;      
     }
 
+    //Appends the node state, every spring coefficient and the volume model's state to output. See SimulationState for the full layout.
+    void saveState(std::vector<unsigned char>& output);
+
+    //Reads back a block written by saveState. Returns false if it was saved from a different mesh.
+    bool loadState(const unsigned char*& input, const unsigned char* inputEnd);
+
     bool isParent(int input)
     {
         return (VertexData.getParent(input) == NULL);
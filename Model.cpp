@@ -1,7 +1,8 @@
 //--------------------------------------------------------------------------------------
 // Class encapsulating a model
 //--------------------------------------------------------------------------------------
-// Holds a pointer to a mesh as well as position, rotation and scaling, which are converted to a world matrix when required
+// Holds a pointer to a mesh as well as a handle to its position, rotation and scaling in the TransformStore, which
+// converts them to a world matrix when required
 // This is more of a convenience class, the Mesh class does most of the difficult work.
 
 #include "Model.h"
@@ -9,12 +10,18 @@
 #include "Common.h"
 #include "GraphicsHelpers.h"
 #include "Mesh.h"
+#include "Replay.h"
+#include "Profiler.h"
+#include "ConstantRing.h"
+#include "GraphicsDevice.h"
 
-void Model::SetPosition(CVector3 position) { mPosition = position; mMesh->VertexData.setOriginPoint(mPosition); }
+#include <cmath>
+
+void Model::SetPosition(CVector3 position) { GetTransformStore().SetPosition(mTransform, position); mMesh->VertexData.setOriginPoint(position); }
 
 void Model::initiateNodeCount()
 {
-	mMesh->VertexData.setOriginPoint(mPosition);
+	mMesh->VertexData.setOriginPoint(Position());
 	CollidedVertexSize = mMesh->VertexData.getSize();//Couldn't figure out how to turn Models into a external contructor so this is the way.
 	//mMesh references need to be outside the class.h
 }
@@ -22,72 +29,112 @@ void Model::initiateNodeCount()
 
 void Model::Render()
 {
-	
-    UpdateWorldMatrix();
+    if (mConstantFrame == gPerModelConstantRing.GetFrame() && gPerModelConstantRing.Bind(1, mConstantSlot))
+    {
+        mMesh->Render();
+        return;
+    }
 
-    gPerModelConstants.worldMatrix = mWorldMatrix; // Update C++ side constant buffer
-    UpdateConstantBuffer(gPerModelConstantBuffer, gPerModelConstants); // Send to GPU
+    gPerModelConstants.worldMatrix = RenderMatrix(); // Update C++ side constant buffer
+    UploadConstants(gPerModelConstantBuffer, gPerModelConstants); // Send to GPU
 
     // Indicate that the constant buffer we just updated is for use in the vertex shader (VS) and pixel shader (PS)
-    gD3DContext->VSSetConstantBuffers(1, 1, &gPerModelConstantBuffer); // First parameter must match constant buffer number in the shader
-    gD3DContext->PSSetConstantBuffers(1, 1, &gPerModelConstantBuffer);
+    gGraphics->VSSetConstantBuffers(1, 1, &gPerModelConstantBuffer); // First parameter must match constant buffer number in the shader
+    gGraphics->PSSetConstantBuffers(1, 1, &gPerModelConstantBuffer);
 
 	mMesh->Render();
 }
 
 
+void Model::PrepareConstants(int slot)
+{
+    PerModelConstants constants = gPerModelConstants;
+    constants.worldMatrix = RenderMatrix();
+    gPerModelConstantRing.Write(slot, constants);
+
+    mConstantSlot = slot;
+    mConstantFrame = gPerModelConstantRing.GetFrame();
+}
+
+
 
 // Control the model's position and rotation using keys provided. Amount of motion performed depends on frame time
 void Model::Control(float frameTime, KeyCode turnUp, KeyCode turnDown, KeyCode turnLeft, KeyCode turnRight,
                                      KeyCode turnCW, KeyCode turnCCW, KeyCode moveForward, KeyCode moveBackward)
 {
-    UpdateWorldMatrix();
+    const CMatrix4x4 worldMatrix = GetTransformStore().GetWorldMatrix(mTransform); //As it was before this frame's turn
+    CVector3 rotation = Rotation();
+    CVector3 position = Position();
 
-	if (KeyHeld( turnDown ))
+	if (SimulationKeyHeld( turnDown ))
 	{
-		mRotation.x += ROTATION_SPEED * frameTime;
+		rotation.x += ROTATION_SPEED * frameTime;
 	}
-	if (KeyHeld( turnUp ))
+	if (SimulationKeyHeld( turnUp ))
 	{
-		mRotation.x -= ROTATION_SPEED * frameTime;
+		rotation.x -= ROTATION_SPEED * frameTime;
 	}
-	if (KeyHeld( turnRight ))
+	if (SimulationKeyHeld( turnRight ))
 	{
-		mRotation.y += ROTATION_SPEED * frameTime;
+		rotation.y += ROTATION_SPEED * frameTime;
 	}
-	if (KeyHeld( turnLeft ))
+	if (SimulationKeyHeld( turnLeft ))
 	{
-		mRotation.y -= ROTATION_SPEED * frameTime;
+		rotation.y -= ROTATION_SPEED * frameTime;
 	}
-	if (KeyHeld( turnCW ))
+	if (SimulationKeyHeld( turnCW ))
 	{
-		mRotation.z += ROTATION_SPEED * frameTime;
+		rotation.z += ROTATION_SPEED * frameTime;
 	}
-	if (KeyHeld( turnCCW ))
+	if (SimulationKeyHeld( turnCCW ))
 	{
-		mRotation.z -= ROTATION_SPEED * frameTime;
+		rotation.z -= ROTATION_SPEED * frameTime;
 	}
 
 	// Local Z movement - move in the direction of the Z axis, get axis from world matrix
-    CVector3 localZDir = Normalise({ mWorldMatrix.e20, mWorldMatrix.e21, mWorldMatrix.e22 }); // normalise axis in case world matrix has scaling
-	if (KeyHeld( moveForward ))
+    CVector3 localZDir = Normalise({ worldMatrix.e20, worldMatrix.e21, worldMatrix.e22 }); // normalise axis in case world matrix has scaling
+	if (SimulationKeyHeld( moveForward ))
 	{
-		mPosition.x += localZDir.x * MOVEMENT_SPEED * frameTime;
-		mPosition.y += localZDir.y * MOVEMENT_SPEED * frameTime;
-		mPosition.z += localZDir.z * MOVEMENT_SPEED * frameTime;
+		position.x += localZDir.x * MOVEMENT_SPEED * frameTime;
+		position.y += localZDir.y * MOVEMENT_SPEED * frameTime;
+		position.z += localZDir.z * MOVEMENT_SPEED * frameTime;
 	}
-	if (KeyHeld( moveBackward ))
+	if (SimulationKeyHeld( moveBackward ))
 	{
-		mPosition.x -= localZDir.x * MOVEMENT_SPEED * frameTime;
-		mPosition.y -= localZDir.y * MOVEMENT_SPEED * frameTime;
-		mPosition.z -= localZDir.z * MOVEMENT_SPEED * frameTime;
+		position.x -= localZDir.x * MOVEMENT_SPEED * frameTime;
+		position.y -= localZDir.y * MOVEMENT_SPEED * frameTime;
+		position.z -= localZDir.z * MOVEMENT_SPEED * frameTime;
 	}
+
+    GetTransformStore().SetRotation(mTransform, rotation);
+    GetTransformStore().SetPosition(mTransform, position);
+}
+
+
+CMatrix4x4 Model::RenderMatrix()
+{
+    const CMatrix4x4& worldMatrix = GetTransformStore().GetWorldMatrix(mTransform);
+    if (!mMesh->IsCompact())  return worldMatrix;
+    return mMesh->GetCompactPositionMatrix() * worldMatrix;
 }
 
 
-void Model::UpdateWorldMatrix()
+// The mesh's local box moved into the world. Its centre is transformed as a point and its half size grows to
+// cover the box however the world matrix turns it.
+void Model::GetBounds(CVector3& centre, CVector3& extents)
 {
-    mWorldMatrix = MatrixScaling(mScale) * MatrixRotationZ(mRotation.z) * MatrixRotationX(mRotation.x) * MatrixRotationY(mRotation.y) * MatrixTranslation(mPosition);
+    CVector3 boundsMin, boundsMax;
+    mMesh->GetRenderBounds(boundsMin, boundsMax);
+    const CVector3 localCentre = (boundsMin + boundsMax) * 0.5f;
+    const CVector3 localExtents = (boundsMax - boundsMin) * 0.5f;
+    const CMatrix4x4& m = GetTransformStore().GetWorldMatrix(mTransform);
+
+    centre = CVector3(localCentre.x * m.e00 + localCentre.y * m.e10 + localCentre.z * m.e20 + m.e30,
+                      localCentre.x * m.e01 + localCentre.y * m.e11 + localCentre.z * m.e21 + m.e31,
+                      localCentre.x * m.e02 + localCentre.y * m.e12 + localCentre.z * m.e22 + m.e32);
+    extents = CVector3(localExtents.x * std::abs(m.e00) + localExtents.y * std::abs(m.e10) + localExtents.z * std::abs(m.e20),
+                       localExtents.x * std::abs(m.e01) + localExtents.y * std::abs(m.e11) + localExtents.z * std::abs(m.e21),
+                       localExtents.x * std::abs(m.e02) + localExtents.y * std::abs(m.e12) + localExtents.z * std::abs(m.e22));
 }
 
 
@@ -95,39 +142,55 @@ const float ModelWidth = 400.0f;
 
 void Model::isCollision(Model* collider)
 {
-	CVector3 Coll_Scale = collider->mScale;
 	//If within X box size then check if the vertices are colliding
-	if (isWithinRange(collider))
+	if (IsInCollisionRange(collider))
 	{
-		CVector3 ColliderPosition = collider->Position(); //Increases memory usage but decreases time taken to fetch data.
-		planeData* CurrentMod;
+		CollideFaces(collider);
+	}
+}
+
+bool Model::IsInCollisionRange(Model* collider)
+{
+	return isWithinRange(collider);
+}
 
+// Only writes to the collider's nodes, so different colliders can be tested at once
+void Model::CollideFaces(Model* collider)
+{
+	PROFILE_SCOPE("Collision");
+	CVector3 ColliderPosition = collider->Position(); //Increases memory usage but decreases time taken to fetch data.
+	const CVector3 Origin = Position();
+	planeData* CurrentMod;
 
-		planeData* Collider;
 
-		int ColliderVertexSize = collider->mMesh->VertexData.getFaceSize();
-		CollidedVertexSize = mMesh->VertexData.getFaceSize();
+	planeData* Collider;
 
-		for (unsigned int i = 0; i < CollidedVertexSize
-			; ++i)//This is for each corner of the triangle. Instead of incrementing by 2 or 3 it increments by 1 in order to use the previous 2 positions to build another 2D triangle. 
-		{
-			//Needs faces to create a working collision triangle
-			CurrentMod = mMesh->VertexData.getFace(i);
+	int ColliderVertexSize = collider->mMesh->VertexData.getFaceSize();
+	const unsigned int CollidedFaceSize = mMesh->VertexData.getFaceSize();
+	int contactsFound = 0;
 
-			for (unsigned int j = 0; j < ColliderVertexSize; ++j)
-			{
-				//Only needs the point so it's more efficient to iterate through the root nodes as faces will have overlap.
-				Collider = collider->mMesh->VertexData.getFace(j);
+	for (unsigned int i = 0; i < CollidedFaceSize
+		; ++i)//This is for each corner of the triangle. Instead of incrementing by 2 or 3 it increments by 1 in order to use the previous 2 positions to build another 2D triangle. 
+	{
+		//Needs faces to create a working collision triangle
+		CurrentMod = mMesh->VertexData.getFace(i);
 
-				//If DelayChange is true then the problem has been addressed. 
-				CollidingFaceCheck(Collider->b, Collider->a,&ColliderPosition, CurrentMod);
-				CollidingFaceCheck(Collider->c, Collider->b,&ColliderPosition, CurrentMod);
-				CollidingFaceCheck(Collider->a, Collider->c,&ColliderPosition, CurrentMod);			
-			}
-			
+		for (unsigned int j = 0; j < ColliderVertexSize; ++j)
+		{
+			//Only needs the point so it's more efficient to iterate through the root nodes as faces will have overlap.
+			Collider = collider->mMesh->VertexData.getFace(j);
 
+			//If DelayChange is true then the problem has been addressed. 
+			contactsFound += CollidingFaceCheck(Collider->b, Collider->a,&ColliderPosition, CurrentMod, Origin);
+			contactsFound += CollidingFaceCheck(Collider->c, Collider->b,&ColliderPosition, CurrentMod, Origin);
+			contactsFound += CollidingFaceCheck(Collider->a, Collider->c,&ColliderPosition, CurrentMod, Origin);			
 		}
-	 }
+		
+
+	}
+
+	PROFILE_COUNTER("Face pairs tested", static_cast<long long>(CollidedFaceSize) * ColliderVertexSize);
+	PROFILE_COUNTER("Contacts found", contactsFound);
 }
 
  CVector3 Model::GetCollisionVectors(int i)
@@ -156,7 +219,7 @@ void Model::isCollision(Model* collider)
 
 
 
-	 if (10.0f * CollPos->Scale().x < distance)
+	 if (distance <= Collision_Range * CollPos->Scale().x)
 	 {
 		 return true;
 	 }
@@ -228,12 +291,12 @@ void Model::isCollision(Model* collider)
  }
 
 
- inline bool Model::isTriangleColl(CVector3 Collide0, CVector3 Collide1, planeData* Face, CVector3 &CollPoint)
+ bool Model::isTriangleColl(CVector3 Collide0, CVector3 Collide1, CVector3 Origin, CVector3 a, CVector3 b, CVector3 c, CVector3 &CollPoint)
  {
-	 //Collide01 have their positions preloaded for global calculations. Anything from face will be local to Position();
+	 //Collide01 have their positions preloaded for global calculations. Anything from face will be local to Origin;
 	 //As we're only getting the point between a and b or a and c, we only need to get the position once per calculation.
-		 CVector3 PntAB = Position() +(Face->b->BasicData.Position - Face->a->BasicData.Position);
-		 CVector3 PntAC = Position() +(Face->c->BasicData.Position - Face->a->BasicData.Position);
+		 CVector3 PntAB = Origin +(b - a);
+		 CVector3 PntAC = Origin +(c - a);
 		 CVector3 CollideAB = Collide0 - Collide1;
 
 		 CVector3 n = Cross(PntAB, PntAC);
@@ -241,7 +304,7 @@ void Model::isCollision(Model* collider)
 		 float d = Dot(CollideAB,n);
 		 if (d <= .0f) { return 0; } //If less than 0 then it is parralel or moving away. Force it to leave early for optimization
 
-		 CVector3 PntAP = Collide0 - (Position() + Face->a->BasicData.Position);
+		 CVector3 PntAP = Collide0 - (Origin + a);
 		 float t = Dot(PntAP, n);
 		 if (t < .0f) { return 0; }
 		 if (t > d) { return 0; } //Check if it's within range. This is the part of the code which makes it a segment instead of a ray.
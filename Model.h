@@ -1,13 +1,15 @@
 //--------------------------------------------------------------------------------------
 // Class encapsulating a model
 //--------------------------------------------------------------------------------------
-// Holds a pointer to a mesh as well as position, rotation and scaling, which are converted to a world matrix when required
+// Holds a pointer to a mesh as well as a handle to its position, rotation and scaling in the TransformStore, which
+// converts them to a world matrix when required
 // This is more of a convenience class, the Mesh class does most of the difficult work.
 
 #include "Common.h"
 #include "CVector3.h"
 #include "CMatrix4x4.h"
 #include "Input.h"
+#include "TransformStore.h"
 
 #ifndef _MODEL_H_INCLUDED_
 #define _MODEL_H_INCLUDED_
@@ -17,35 +19,36 @@
 
 class Mesh;
 constexpr float Cube_Coll = 6.0f;
+constexpr float Collision_Range = 10.0f; //Bodies further apart than this, times the collider's scale, can't be touching
 
 
 class Model
 {
 private:
-	void UpdateWorldMatrix();
+	// World matrix as the shaders need it, after undoing the quantisation of a compact mesh's positions
+	CMatrix4x4 RenderMatrix();
 
 	Mesh* mMesh;
 
-	// Position, rotation and scaling for the model
-	CVector3 mPosition;
-	CVector3 mRotation;
-	CVector3 mScale;
+	int mConstantSlot = -1;
+	unsigned int mConstantFrame = 0; //Frame of gPerModelConstantRing the slot is for
 
-	// World matrix for the model - built from the above
-	CMatrix4x4 mWorldMatrix;
+	// Handle of the model's position, rotation, scaling and world matrix in GetTransformStore()
+	int mTransform;
 
 	void initiateNodeCount();
 
-	inline void CollidingFaceCheck(NodeData* p1, NodeData* p2, CVector3* p_WorldPos, planeData* Current)
+	//Returns true if the edge hit the face. Origin is this model's position, passed in as it's the same for every face.
+	inline bool CollidingFaceCheck(NodeData* p1, NodeData* p2, CVector3* p_WorldPos, planeData* Current, const CVector3& Origin)
 	{
 		CVector3 CollisionPoint;
 
-		//Input the starting and ending segments, with their world positions, aswell as the local positions of 'this' model as the 
-		//Position can be accessed internally.
+		//Input the starting and ending segments, with their world positions, aswell as the local positions of 'this' model.
 
 		//Collision point is a returned variable used to calculate the point of collision.
 		bool IsIntercept =
-			isTriangleColl(*p_WorldPos + p1->BasicData.Position, *p_WorldPos + p2->BasicData.Position, Current, CollisionPoint);
+			isTriangleColl(*p_WorldPos + p1->BasicData.Position, *p_WorldPos + p2->BasicData.Position, Origin,
+				Current->a->BasicData.Position, Current->b->BasicData.Position, Current->c->BasicData.Position, CollisionPoint);
 		if (IsIntercept)
 		{
 			
@@ -53,42 +56,80 @@ private:
 
 				++p2->delayChange;
 			//	p2->Old_Position = p2->BasicData.Position;
-				p2->ReboundForce +=
-					(CVector3((Current->a->BasicData.Position + Position()) * CollisionPoint.z) + // Point A * U
-					CVector3((Current->b->BasicData.Position + Position()) * CollisionPoint.y) + // Point B * V
-					CVector3((Current->c->BasicData.Position + Position()) * CollisionPoint.x)) -  // Point C * W
-					*p_WorldPos;
+				p2->ReboundForce += CollisionRebound(Origin, Current->a->BasicData.Position, Current->b->BasicData.Position,
+					Current->c->BasicData.Position, CollisionPoint, *p_WorldPos);
 				p2->ReboundForce *= .75f;
 				//This needs to be the collision point instead of the actual collisions (But slightly away)
 
 		}
-		
+		return IsIntercept;
 	}
 
 	inline bool isWithinRange(Model* CollPos);
 
 	inline bool isWithinRange(float CollPos, float OrigPos, float PolyPos);
 	int CollidedVertexSize;
-
+public:
 	//A heavily used function that needs to be oxptimized for as much efficiency as possible.
 	//Include as many possible returns or GOTO's in order to increase efficiency.
-	inline bool isTriangleColl(CVector3 Ray, CVector3 Collide, planeData* Face, CVector3 &CollPoint);
-public:
+	//Tests the segment from Collide0 to Collide1 against the face a, b, c of a model at Origin, with a, b, c local to it.
+	//Takes positions rather than the face so the pipelined collisions can test copies of them (see CollisionPipeline).
+	static bool isTriangleColl(CVector3 Collide0, CVector3 Collide1, CVector3 Origin, CVector3 a, CVector3 b, CVector3 c, CVector3 &CollPoint);
+
+	//Where isTriangleColl's hit pushes the colliding node to, relative to the colliding model's position.
+	static CVector3 CollisionRebound(const CVector3& Origin, const CVector3& a, const CVector3& b, const CVector3& c,
+		const CVector3& CollPoint, const CVector3& ColliderPosition)
+	{
+		return (CVector3((a + Origin) * CollPoint.z) + // Point A * U
+			CVector3((b + Origin) * CollPoint.y) + // Point B * V
+			CVector3((c + Origin) * CollPoint.x)) -  // Point C * W
+			ColliderPosition;
+	}
+
 	//-------------------------------------
 	// Construction / Usage
 	//-------------------------------------
 
 	Model(Mesh* mesh, CVector3 position = { 0,0,0 }, CVector3 rotation = { 0,0,0 }, float scale = 1)
-		: mMesh(mesh), mPosition(position), mRotation(rotation), mScale({ scale, scale, scale })
+		: mMesh(mesh), mTransform(GetTransformStore().Add(position, rotation, { scale, scale, scale }))
 	{
 		initiateNodeCount();
 	}
 
+	// A copy gets a transform of its own
+	Model(const Model& other)
+		: mMesh(other.mMesh), mTransform(GetTransformStore().Add(other.Position(), other.Rotation(), other.Scale())),
+		  CollidedVertexSize(other.CollidedVertexSize)
+	{
+	}
+
+	Model& operator=(const Model& other)
+	{
+		mMesh = other.mMesh;
+		mConstantSlot = -1;
+		mConstantFrame = 0;
+		GetTransformStore().SetPosition(mTransform, other.Position());
+		GetTransformStore().SetRotation(mTransform, other.Rotation());
+		GetTransformStore().SetScale(mTransform, other.Scale());
+		CollidedVertexSize = other.CollidedVertexSize;
+		return *this;
+	}
+
+	~Model()
+	{
+		GetTransformStore().Remove(mTransform);
+	}
+
 	// The render function sets the world matrix in the per-frame constant buffer and makes that buffer available
 	// to vertex & pixel shader. Then it calls Mesh:Render, which renders the geometry with current GPU settings.
 	// So all other per-frame constants must have been set already along with shaders, textures, samplers, states etc.
+	// If PrepareConstants gave the model a slot in gPerModelConstantRing this frame, that slot is bound instead.
 	void Render();
 
+	// Writes the model's constants, gPerModelConstants with this model's world matrix, into a slot reserved in
+	// gPerModelConstantRing this frame. Models can be prepared at once.
+	void PrepareConstants(int slot);
+
 
 	// Control the model's position and rotation using keys provided. Amount of motion performed depends on frame time
 	void Control(float frameTime, KeyCode turnUp, KeyCode turnDown, KeyCode turnLeft, KeyCode turnRight,
@@ -97,9 +138,9 @@ public:
 
 	void FaceTarget(CVector3 target)
 	{
-		UpdateWorldMatrix();
-		mWorldMatrix.FaceTarget(target);
-		mRotation = mWorldMatrix.GetEulerAngles();
+		CMatrix4x4 worldMatrix = WorldMatrix();
+		worldMatrix.FaceTarget(target);
+		SetRotation(worldMatrix.GetEulerAngles());
 	}
 
 
@@ -108,25 +149,35 @@ public:
 	//-------------------------------------
 
 	// Getters / setters
-	CVector3 Position() { return mPosition; }
-	CVector3 Rotation() { return mRotation; }
-	CVector3 Scale() { return mScale; }
+	CVector3 Position() const { return GetTransformStore().GetPosition(mTransform); }
+	CVector3 Rotation() const { return GetTransformStore().GetRotation(mTransform); }
+	CVector3 Scale() const { return GetTransformStore().GetScale(mTransform); }
+	Mesh* GetMesh() { return mMesh; }
 
 	void SetPosition(CVector3 position);
-	void SetRotation(CVector3 rotation) { mRotation = rotation; }
+	void SetRotation(CVector3 rotation) { GetTransformStore().SetRotation(mTransform, rotation); }
 
 	// Two ways to set scale: x,y,z separately, or all to the same value
-	void SetScale(CVector3 scale) { mScale = scale; }
-	void SetScale(float scale) { mScale = { scale, scale, scale }; }
+	void SetScale(CVector3 scale) { GetTransformStore().SetScale(mTransform, scale); }
+	void SetScale(float scale) { GetTransformStore().SetScale(mTransform, { scale, scale, scale }); }
 
-	// Read only access to model world matrix, updated on request
-	CMatrix4x4 WorldMatrix() { UpdateWorldMatrix();  return mWorldMatrix; }
+	// Read only access to model world matrix, rebuilt on request if the model has changed since
+	CMatrix4x4 WorldMatrix() { return GetTransformStore().GetWorldMatrix(mTransform); }
+
+	// World space box around the mesh's drawn vertices, as centre and half size along each axis. Follows the
+	// simulated nodes, not just the model's position.
+	void GetBounds(CVector3& centre, CVector3& extents);
 
 	//MOve this over to the Mesh - The parents don't update otherwise and return null
 	CVector3 getSpring(int index, bool isDist);
 	CVector3 getSpringFacing(int index, int parentID);
 
 	void isCollision(Model* collider);
+
+	// The two halves of isCollision: the cheap test of whether collider is near enough to need its faces
+	// tested, and then the test itself, which pushes collider's nodes back out of this model
+	bool IsInCollisionRange(Model* collider);
+	void CollideFaces(Model* collider);
 	
 	int GetVectorMax();
 	int GetNullParentVectorMax();
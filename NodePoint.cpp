@@ -1,4 +1,7 @@
 #include "NodePoint.h"
+#include "Profiler.h"
+#include <cstring>
+#include <algorithm>
 
 
 const float groundHeight = -.0f;
@@ -11,8 +14,10 @@ void Node::addNode(NodeData input, float NodeMass, bool positionLock)
 	input.Old_Position = input.BasicData.Position;
 	input.isBound = positionLock;
 	input.root = NULL;
+	input.ReboundForce = CVector3(.0f, .0f, .0f);
+	input.delayChange = 0;
 	VertexData.push_back(new NodeData(input));
-	BaseData.push_back(new NodeData(input));
+	BaseState.push_back(getState(&input));
 	//Bind face edges together. Everything should access the parent. 
 	//Go through all but .back() in VertexData
 	for (int i = 0; i < VertexData.size() - 1; ++i)
@@ -29,7 +34,10 @@ void Node::addNode(NodeData input, float NodeMass, bool positionLock)
 
 void Node::applyForce(float updateTime, CVector3 externalForces)
 {
-
+	PROFILE_SCOPE("Soft body step");
+	ProfileAccumulator springTimer("Spring forces");
+	ProfileAccumulator integrationTimer("Integration");
+	int springsEvaluated = 0;
 
 	for (int i = 0; i < VertexData.size(); ++i)
 	{
@@ -41,10 +49,14 @@ void Node::applyForce(float updateTime, CVector3 externalForces)
 			//This will act as the holder of the forces involved in the current node.
 			CVector3 internalForces = { 0, 0, 0 };
 
+			springTimer.Begin();
 			for (int j = 0; j < VertexData[i]->SpringList.size(); ++j) 
 			{
 				internalForces += VertexData[i]->SpringList[j]->calculateForce(std::move(getRoot(i)));
 			}
+			springsEvaluated += VertexData[i]->SpringList.size();
+			springTimer.End();
+			integrationTimer.Begin();
 
 			internalForces += externalForces; //Adding constant, static, forces - such as wind/gravity
 
@@ -117,7 +129,7 @@ void Node::applyForce(float updateTime, CVector3 externalForces)
 			{
 				VertexData[i]->BasicData.Position = FuturePos;
 			}
-
+			integrationTimer.End();
 
 		}
 		else
@@ -128,6 +140,150 @@ void Node::applyForce(float updateTime, CVector3 externalForces)
 		}
 	}
 
+	markPositionsChanged();
+
+	PROFILE_COUNTER("Springs evaluated", springsEvaluated);
+}
+
+
+void Node::saveState(std::vector<unsigned char>& output)
+{
+	//Grow the buffer once and copy straight into it. Called every frame when rolling back so avoid per-node allocations.
+	size_t writePos = output.size();
+	output.resize(writePos + getStateSize());
+	unsigned char* write = output.data() + writePos;
+
+	int rootCount = getRootSize();
+	memcpy(write, &rootCount, sizeof(int));
+	write += sizeof(int);
+
+	for (int i = 0; i < VertexData.size(); ++i)
+	{
+		if (VertexData[i]->root == NULL)
+		{
+			NodeState state = getState(VertexData[i]);
+			memcpy(write, &state, sizeof(NodeState));
+			write += sizeof(NodeState);
+		}
+	}
+}
+
+bool Node::loadState(const unsigned char*& input, const unsigned char* inputEnd)
+{
+	int rootCount;
+	if (inputEnd - input < sizeof(int))
+	{
+		return false;
+	}
+	memcpy(&rootCount, input, sizeof(int));
+
+	//The saved state must come from the same mesh, otherwise the nodes will not line up.
+	if (rootCount != getRootSize() || inputEnd - input < getStateSize())
+	{
+		return false;
+	}
+	input += sizeof(int);
+
+	for (int i = 0; i < VertexData.size(); ++i)
+	{
+		if (VertexData[i]->root == NULL)
+		{
+			NodeState state;
+			memcpy(&state, input, sizeof(NodeState));
+			input += sizeof(NodeState);
+			setState(VertexData[i], state);
+		}
+	}
+
+	//Children only hold copies of their root so refresh them once every root is back in place.
+	for (int i = 0; i < VertexData.size(); ++i)
+	{
+		if (VertexData[i]->root != NULL)
+		{
+			UpdateRootChild(i);
+		}
+	}
+	markPositionsChanged();
+	return true;
+}
+
+void Node::clearLinks()
+{
+	for (int i = 0; i < VertexData.size(); ++i)
+	{
+		VertexData[i]->SpringList.clear();
+		VertexData[i]->ConnectedNodes.clear();
+	}
+	FaceList.clear();
+}
+
+void Node::setPositions(const CVector3* positions, const CVector3* oldPositions)
+{
+	for (int i = 0; i < VertexData.size(); ++i)
+	{
+		NodeData* node = VertexData[i];
+		if (node->root == NULL)
+		{
+			node->Old_Position = (oldPositions != NULL) ? oldPositions[i] : node->BasicData.Position;
+			node->BasicData.Position = positions[i];
+			node->Velocity = node->BasicData.Position - node->Old_Position;
+			node->ReboundForce = CVector3(.0f, .0f, .0f);
+			node->delayChange = 0;
+		}
+	}
+	for (int i = 0; i < VertexData.size(); ++i)
+	{
+		if (VertexData[i]->root != NULL)
+		{
+			UpdateRootChild(i);
+		}
+	}
+	markPositionsChanged();
+}
+
+void Node::setRenderVertexCount(int count)
+{
+	if (count > VertexData.size())
+	{
+		count = VertexData.size();
+	}
+	RenderVertices.resize(count);
+	for (int i = 0; i < count; ++i)
+	{
+		RenderVertices[i] = VertexData[i]->BasicData;
+	}
+	updateRenderBounds();
+	RenderDirty = true;
+}
 
+void Node::updateRenderBounds()
+{
+	if (RenderVertices.empty())
+	{
+		RenderBoundsMin = RenderBoundsMax = CVector3(.0f, .0f, .0f);
+		return;
+	}
+
+	CVector3 low = RenderVertices[0].Position;
+	CVector3 high = low;
+	for (const BasicNode& vertex : RenderVertices)
+	{
+		low.x = std::min(low.x, vertex.Position.x);
+		low.y = std::min(low.y, vertex.Position.y);
+		low.z = std::min(low.z, vertex.Position.z);
+		high.x = std::max(high.x, vertex.Position.x);
+		high.y = std::max(high.y, vertex.Position.y);
+		high.z = std::max(high.z, vertex.Position.z);
+	}
+	RenderBoundsMin = low;
+	RenderBoundsMax = high;
+}
 
-}
\ No newline at end of file
+void Node::copyRenderVertices(int begin, int end)
+{
+	BasicNode* output = RenderVertices.data();
+	for (int i = begin; i < end; ++i)
+	{
+		output[i].Position = VertexData[i]->BasicData.Position;
+	}
+}
@@ -4,6 +4,17 @@
 #include "SpringPoint.h"
 
 
+//The values of a node that change while the simulation runs. Everything else (springs, faces, parents) is fixed once the mesh is loaded,
+//So this is all that needs to be stored to rewind or checkpoint a node. Kept as plain data so it can be copied straight into a buffer.
+struct NodeState
+{
+	CVector3 Position;
+	CVector3 Old_Position;
+	CVector3 Velocity;
+	CVector3 ReboundForce;
+	float delayChange;
+};
+
 
 class Node
 {
@@ -17,6 +28,11 @@ public:
 		modelPosition = input;
 	}
 
+	CVector3 getOriginPoint()
+	{
+		return modelPosition;
+	}
+
 	bool isRoot(int index)
 	{
 		return (VertexData[index]->root == NULL);
@@ -41,6 +57,7 @@ public:
 			getRoot(index)->BasicData.Position = input;
 		}
 		UpdateRootChild(index);
+		markPositionsChanged();
 	}
 
 	//This function is used as a delayed position setter. Allowing other values to use the outdated data.
@@ -139,17 +156,123 @@ public:
 		return FaceList.size();
 	}
 
+	//Removes every spring, connection and face so they can be built again. Does not delete the springs.
+	void clearLinks();
+
+	//Moves every root node to positions[i], with its last position set to oldPositions[i] or, if that's NULL, to where it was.
+	//Both arrays are indexed as the nodes are, the entries for children are ignored. Any collision waiting to be applied is dropped.
+	//Used when another simulation drives this one, such as a level of detail proxy.
+	void setPositions(const CVector3* positions, const CVector3* oldPositions);
+
+	//The first count nodes are drawn. Their render data is kept packed together as BasicNodes, ready for
+	//Mesh::PublishRenderVertices to compact in one pass.
+	void setRenderVertexCount(int count);
+
+	int getRenderVertexCount()
+	{
+		return RenderVertices.size();
+	}
+
+	const BasicNode* getRenderVertices()
+	{
+		return RenderVertices.data();
+	}
+
+	//Copies the positions of the drawn nodes from begin to end into the packed array. Doesn't mark it changed,
+	//so separate ranges can be copied from different threads. Call finishRenderPack once they're all done.
+	//Normals and UVs are only taken from the nodes once, in setRenderVertexCount, as the nodes never change them.
+	void copyRenderVertices(int begin, int end);
+
+	//Copies every drawn node and marks the packed array changed.
+	void updateRenderVertices()
+	{
+		copyRenderVertices(0, RenderVertices.size());
+		finishRenderPack();
+	}
+
+	//Everything that moves the nodes calls this rather than packing straight away, so a node moved several
+	//times in a frame (steps, collisions, level of detail) is only packed once, by packRenderVertices.
+	void markPositionsChanged()
+	{
+		PositionsChanged = true;
+	}
+
+	bool havePositionsChanged()
+	{
+		return PositionsChanged;
+	}
+
+	//Packs the drawn nodes if they've moved since the last pack. Returns true if it did.
+	bool packRenderVertices()
+	{
+		if (!PositionsChanged)  return false;
+		updateRenderVertices();
+		return true;
+	}
+
+	//Marks the packed array up to date with the nodes and changed since the last upload
+	void finishRenderPack()
+	{
+		updateRenderBounds();
+		PositionsChanged = false;
+		RenderDirty = true;
+		++RenderPackCount;
+	}
+
+	//Box around the packed drawn nodes as of the last pack, in the body's local space. Used for culling.
+	void getRenderBounds(CVector3& boundsMin, CVector3& boundsMax)
+	{
+		boundsMin = RenderBoundsMin;
+		boundsMax = RenderBoundsMax;
+	}
+
+	//Number of times the nodes have been packed, for checking it's no more than once a frame
+	long long getRenderPackCount()
+	{
+		return RenderPackCount;
+	}
+
+	//Normals are recalculated straight into the packed array (see NormalUpdater)
+	void setRenderNormal(int index, const CVector3& normal)
+	{
+		RenderVertices[index].Normal = normal;
+	}
+
+	void markRenderDirty()
+	{
+		RenderDirty = true;
+	}
+
+	//Returns true, once, if the packed array has changed since it was last uploaded.
+	bool takeRenderDirty()
+	{
+		bool wasDirty = RenderDirty;
+		RenderDirty = false;
+		return wasDirty;
+	}
+
 	//Sets the node positions back to their origins. Effectively reseting a simulation.
 	void resetPoints()
 	{
 		for (int i = 0; i < VertexData.size(); ++i)
 		{
-			VertexData[i]->BasicData.Position = BaseData[i]->BasicData.Position;
-			VertexData[i]->Old_Position = BaseData[i]->Old_Position;
-			VertexData[i]->Velocity = BaseData[i]->Velocity;
+			setState(VertexData[i], BaseState[i]);
 		}
+		markPositionsChanged();
+	}
+
+	//Number of bytes saveState will write. Only root nodes are stored as the children are copies of them.
+	int getStateSize()
+	{
+		return sizeof(int) + getRootSize() * sizeof(NodeState);
 	}
 
+	//Appends the dynamic state of every root node to the end of output.
+	void saveState(std::vector<unsigned char>& output);
+
+	//Reads back a block written by saveState, moving input past it. Returns false if the block does not match this node list.
+	bool loadState(const unsigned char*& input, const unsigned char* inputEnd);
+
 
 	//Delete allocated memory.
 	~Node()
@@ -157,15 +280,23 @@ public:
 		for (int i = 0; i < VertexData.size(); ++i)
 		{
 			delete VertexData[i];
-			delete BaseData[i];
 		}
 	}
 private:
-	std::vector<NodeData*> BaseData; //Origin list for the nodes to revert to when simulation is reset
+	std::vector<NodeState> BaseState; //Origin list for the nodes to revert to when simulation is reset
 	std::vector<NodeData*> VertexData; //List of nodes and their current position
 	std::vector<planeData> FaceList; //List of faces in the above trees, linked directly to the vertexData nodes.
 	int RootVertexSize;
 
+	std::vector<BasicNode> RenderVertices; //Packed copy of the drawn nodes' render data, see setRenderVertexCount
+	bool RenderDirty = false; //RenderVertices changed since the last upload
+	bool PositionsChanged = false; //Nodes moved since RenderVertices was last packed
+	long long RenderPackCount = 0;
+	CVector3 RenderBoundsMin = CVector3(.0f, .0f, .0f);
+	CVector3 RenderBoundsMax = CVector3(.0f, .0f, .0f);
+
+	void updateRenderBounds();
+
 	CVector3 modelPosition; //Gives the node access to the models position so it can calculate world positions.
 
 	//Disconnect/Connect faces
@@ -192,6 +323,20 @@ private:
 
 
 
+	static NodeState getState(const NodeData* node)
+	{
+		return { node->BasicData.Position, node->Old_Position, node->Velocity, node->ReboundForce, static_cast<float>(node->delayChange) };
+	}
+
+	static void setState(NodeData* node, const NodeState& state)
+	{
+		node->BasicData.Position = state.Position;
+		node->Old_Position = state.Old_Position;
+		node->Velocity = state.Velocity;
+		node->ReboundForce = state.ReboundForce;
+		node->delayChange = static_cast<decltype(node->delayChange)>(state.delayChange);
+	}
+
 	//The root position will have all the calculations done to it. 
 	//As the children are bound to the root position they will need to be updated.
 	void UpdateRootChild(int index)
@@ -0,0 +1,242 @@
+//--------------------------------------------------------------------------------------
+// Recalculates the vertex normals of a soft body as it deforms
+//--------------------------------------------------------------------------------------
+
+#include "NormalUpdater.h"
+#include "TaskPool.h"
+#include "Profiler.h"
+
+#include <unordered_map>
+#include <emmintrin.h>
+#include <cmath>
+
+
+bool  gRecalculateNormals = true;
+float gNormalMoveThreshold = 0.005f;
+
+
+void NormalUpdater::Init(Node& nodes, const std::vector<int>& faceIndices)
+{
+    int vertexCount = nodes.getRenderVertexCount();
+    const BasicNode* vertices = nodes.getRenderVertices();
+
+    mFaces.clear();
+    for (size_t i = 0; i + 2 < faceIndices.size(); i += 3)
+    {
+        if (faceIndices[i] < vertexCount && faceIndices[i + 1] < vertexCount && faceIndices[i + 2] < vertexCount)
+        {
+            mFaces.insert(mFaces.end(), faceIndices.begin() + i, faceIndices.begin() + i + 3);
+        }
+    }
+    int faceCount = GetFaceCount();
+
+    //Face normals from the rest shape. Check which way round the faces are against the loaded normals
+    std::vector<CVector3> restNormals(faceCount);
+    float windingTotal = 0;
+    for (int f = 0; f < faceCount; ++f)
+    {
+        const int* face = &mFaces[f * 3];
+        CVector3 a = vertices[face[0]].Position;
+        restNormals[f] = Cross(vertices[face[1]].Position - a, vertices[face[2]].Position - a);
+        windingTotal += Dot(restNormals[f], vertices[face[0]].Normal + vertices[face[1]].Normal + vertices[face[2]].Normal);
+    }
+    mWindingSign = (windingTotal < 0) ? -1.0f : 1.0f;
+
+    //The faces each vertex is part of
+    std::vector<int> directOffsets(vertexCount + 1, 0);
+    for (int index : mFaces)
+    {
+        ++directOffsets[index + 1];
+    }
+    for (int v = 0; v < vertexCount; ++v)
+    {
+        directOffsets[v + 1] += directOffsets[v];
+    }
+    std::vector<int> directFaces(mFaces.size());
+    std::vector<int> fill(directOffsets.begin(), directOffsets.end() - 1);
+    for (int i = 0; i < mFaces.size(); ++i)
+    {
+        directFaces[fill[mFaces[i]]++] = i / 3;
+    }
+
+    //Vertices sharing a root are welded together
+    std::unordered_map<NodeData*, std::vector<int>> welds;
+    for (int v = 0; v < vertexCount; ++v)
+    {
+        welds[nodes.getNode(v)].push_back(v);
+    }
+
+    //Each vertex takes the faces of its whole weld group that are close enough to its own loaded normal
+    const float smoothingCos = std::cos(NORMAL_SMOOTHING_ANGLE * 3.14159265f / 180.0f);
+    std::vector<int> lastAdded(faceCount, -1);
+    mVertexFaceOffsets.assign(1, 0);
+    mVertexFaces.clear();
+    for (int v = 0; v < vertexCount; ++v)
+    {
+        CVector3 vertexNormal = vertices[v].Normal;
+        float vertexNormalLength = Length(vertexNormal);
+
+        for (int welded : welds[nodes.getNode(v)])
+        {
+            for (int i = directOffsets[welded]; i < directOffsets[welded + 1]; ++i)
+            {
+                int f = directFaces[i];
+                if (lastAdded[f] == v)  continue;
+
+                float faceNormalLength = Length(restNormals[f]);
+                if (vertexNormalLength > 0 && faceNormalLength > 0 &&
+                    mWindingSign * Dot(restNormals[f], vertexNormal) < smoothingCos * faceNormalLength * vertexNormalLength)
+                {
+                    continue;
+                }
+
+                lastAdded[f] = v;
+                mVertexFaces.push_back(f);
+            }
+        }
+        mVertexFaceOffsets.push_back(static_cast<int>(mVertexFaces.size()));
+    }
+
+    mFaceNormalX.assign(faceCount, 0);
+    mFaceNormalY.assign(faceCount, 0);
+    mFaceNormalZ.assign(faceCount, 0);
+    mFaceChanged.assign(faceCount, 0);
+
+    mLastPositions.resize(vertexCount);
+    mVertexMoved.assign(vertexCount, 0);
+    for (int v = 0; v < vertexCount; ++v)
+    {
+        mLastPositions[v] = vertices[v].Position;
+    }
+
+    mUpdateAll = true;
+}
+
+
+void NormalUpdater::Update(Node& nodes, float moveThreshold)
+{
+    int vertexCount = static_cast<int>(mLastPositions.size());
+    if (vertexCount == 0 || nodes.getRenderVertexCount() != vertexCount)  return;
+
+    PROFILE_SCOPE("Normals");
+
+    const BasicNode* vertices = nodes.getRenderVertices();
+    TaskPool& pool = GetTaskPool();
+
+    float thresholdSquared = moveThreshold * moveThreshold;
+    pool.ParallelFor(vertexCount, NORMAL_VERTEX_GRAIN, [&](int begin, int end) { FindMovedVertices(vertices, thresholdSquared, begin, end); });
+    pool.ParallelFor(GetFaceCount(), NORMAL_FACE_GRAIN, [&](int begin, int end) { CalculateFaceNormals(vertices, begin, end); });
+    pool.ParallelFor(vertexCount, NORMAL_VERTEX_GRAIN, [&](int begin, int end) { SumVertexNormals(nodes, begin, end); });
+
+    mUpdateAll = false;
+}
+
+
+void NormalUpdater::UpdateAll(Node& nodes)
+{
+    Invalidate();
+    Update(nodes, 0);
+}
+
+
+void NormalUpdater::FindMovedVertices(const BasicNode* vertices, float thresholdSquared, int begin, int end)
+{
+    for (int v = begin; v < end; ++v)
+    {
+        CVector3 offset = vertices[v].Position - mLastPositions[v];
+        bool moved = mUpdateAll || Dot(offset, offset) > thresholdSquared;
+        if (moved)
+        {
+            mLastPositions[v] = vertices[v].Position;
+        }
+        mVertexMoved[v] = moved;
+    }
+}
+
+
+// Faces are done four at a time with SSE, one face per lane. Lanes whose face didn't move keep their old normal.
+// NORMAL_FACE_GRAIN is a multiple of four so only the last block of the list has any faces left over.
+void NormalUpdater::CalculateFaceNormals(const BasicNode* vertices, int begin, int end)
+{
+    int f = begin;
+    for (; f + 4 <= end; f += 4)
+    {
+        const int* face = &mFaces[f * 3];
+        int changed[4];
+        for (int i = 0; i < 4; ++i)
+        {
+            changed[i] = (mVertexMoved[face[i * 3]] | mVertexMoved[face[i * 3 + 1]] | mVertexMoved[face[i * 3 + 2]]) ? -1 : 0;
+            mFaceChanged[f + i] = (changed[i] != 0);
+        }
+        if ((changed[0] | changed[1] | changed[2] | changed[3]) == 0)  continue;
+
+        const CVector3& a0 = vertices[face[0]].Position; const CVector3& a1 = vertices[face[3]].Position;
+        const CVector3& a2 = vertices[face[6]].Position; const CVector3& a3 = vertices[face[9]].Position;
+        const CVector3& b0 = vertices[face[1]].Position; const CVector3& b1 = vertices[face[4]].Position;
+        const CVector3& b2 = vertices[face[7]].Position; const CVector3& b3 = vertices[face[10]].Position;
+        const CVector3& c0 = vertices[face[2]].Position; const CVector3& c1 = vertices[face[5]].Position;
+        const CVector3& c2 = vertices[face[8]].Position; const CVector3& c3 = vertices[face[11]].Position;
+
+        __m128 ax = _mm_setr_ps(a0.x, a1.x, a2.x, a3.x);
+        __m128 ay = _mm_setr_ps(a0.y, a1.y, a2.y, a3.y);
+        __m128 az = _mm_setr_ps(a0.z, a1.z, a2.z, a3.z);
+
+        __m128 abx = _mm_sub_ps(_mm_setr_ps(b0.x, b1.x, b2.x, b3.x), ax);
+        __m128 aby = _mm_sub_ps(_mm_setr_ps(b0.y, b1.y, b2.y, b3.y), ay);
+        __m128 abz = _mm_sub_ps(_mm_setr_ps(b0.z, b1.z, b2.z, b3.z), az);
+        __m128 acx = _mm_sub_ps(_mm_setr_ps(c0.x, c1.x, c2.x, c3.x), ax);
+        __m128 acy = _mm_sub_ps(_mm_setr_ps(c0.y, c1.y, c2.y, c3.y), ay);
+        __m128 acz = _mm_sub_ps(_mm_setr_ps(c0.z, c1.z, c2.z, c3.z), az);
+
+        __m128 sign = _mm_set1_ps(mWindingSign);
+        __m128 nx = _mm_mul_ps(sign, _mm_sub_ps(_mm_mul_ps(aby, acz), _mm_mul_ps(abz, acy)));
+        __m128 ny = _mm_mul_ps(sign, _mm_sub_ps(_mm_mul_ps(abz, acx), _mm_mul_ps(abx, acz)));
+        __m128 nz = _mm_mul_ps(sign, _mm_sub_ps(_mm_mul_ps(abx, acy), _mm_mul_ps(aby, acx)));
+
+        //Keep the old normal in the lanes that didn't change
+        __m128 mask = _mm_castsi128_ps(_mm_setr_epi32(changed[0], changed[1], changed[2], changed[3]));
+        _mm_storeu_ps(&mFaceNormalX[f], _mm_or_ps(_mm_and_ps(mask, nx), _mm_andnot_ps(mask, _mm_loadu_ps(&mFaceNormalX[f]))));
+        _mm_storeu_ps(&mFaceNormalY[f], _mm_or_ps(_mm_and_ps(mask, ny), _mm_andnot_ps(mask, _mm_loadu_ps(&mFaceNormalY[f]))));
+        _mm_storeu_ps(&mFaceNormalZ[f], _mm_or_ps(_mm_and_ps(mask, nz), _mm_andnot_ps(mask, _mm_loadu_ps(&mFaceNormalZ[f]))));
+    }
+
+    for (; f < end; ++f)
+    {
+        const int* face = &mFaces[f * 3];
+        mFaceChanged[f] = mVertexMoved[face[0]] | mVertexMoved[face[1]] | mVertexMoved[face[2]];
+        if (!mFaceChanged[f])  continue;
+
+        CVector3 a = vertices[face[0]].Position;
+        CVector3 normal = Cross(vertices[face[1]].Position - a, vertices[face[2]].Position - a) * mWindingSign;
+        mFaceNormalX[f] = normal.x;
+        mFaceNormalY[f] = normal.y;
+        mFaceNormalZ[f] = normal.z;
+    }
+}
+
+
+void NormalUpdater::SumVertexNormals(Node& nodes, int begin, int end)
+{
+    for (int v = begin; v < end; ++v)
+    {
+        bool changed = false;
+        for (int i = mVertexFaceOffsets[v]; i < mVertexFaceOffsets[v + 1] && !changed; ++i)
+        {
+            changed = mFaceChanged[mVertexFaces[i]] != 0;
+        }
+        if (!changed)  continue;
+
+        CVector3 normal = { 0, 0, 0 };
+        for (int i = mVertexFaceOffsets[v]; i < mVertexFaceOffsets[v + 1]; ++i)
+        {
+            int f = mVertexFaces[i];
+            normal += CVector3(mFaceNormalX[f], mFaceNormalY[f], mFaceNormalZ[f]);
+        }
+
+        //A vertex whose faces have all collapsed keeps its last normal
+        if (Dot(normal, normal) > 0)
+        {
+            nodes.setRenderNormal(v, Normalise(normal));
+        }
+    }
+}
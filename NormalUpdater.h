@@ -0,0 +1,77 @@
+//--------------------------------------------------------------------------------------
+// Recalculates the vertex normals of a soft body as it deforms
+//--------------------------------------------------------------------------------------
+// The nodes keep the normals they were loaded with, so without this a squashed body is lit as
+// if it were still in its rest shape. Normals are worked out from the triangle list: each face
+// normal is the cross product of two of its edges (so larger faces count for more) and each
+// vertex normal is the sum of the faces around it.
+//
+// Vertices welded together (split at a seam, sharing one root node) share the faces of the whole
+// group, so seams are smooth. Faces that were at more than NORMAL_SMOOTHING_ANGLE to a vertex's
+// loaded normal are left out of its sum, which keeps hard edges such as a cube's corners hard.
+//
+// Only what has moved is recalculated. A vertex counts as moved once it is further than the
+// move threshold from where it was the last time its normals were worked out, then only the
+// faces touching moved vertices and the vertices touching those faces are updated. A threshold
+// of 0 updates everything that moved at all. The results are written into the packed render
+// vertices ready for upload (see Node::setRenderNormal).
+
+#include "NodePoint.h"
+
+#include <vector>
+
+#ifndef _NORMAL_UPDATER_H_INCLUDED_
+#define _NORMAL_UPDATER_H_INCLUDED_
+
+constexpr float NORMAL_SMOOTHING_ANGLE = 60.0f; //Degrees
+constexpr int NORMAL_VERTEX_GRAIN = 1024; //Vertices per block handed to a thread
+constexpr int NORMAL_FACE_GRAIN = 1024;
+
+//Set from the GUI, used by Mesh::PublishRenderVertices
+extern bool  gRecalculateNormals;
+extern float gNormalMoveThreshold;
+
+
+class NormalUpdater
+{
+public:
+    // Builds the face lists of each drawn vertex from the triangle list. Call once the nodes and
+    // their render vertices are set up, the nodes should be in their loaded positions.
+    void Init(Node& nodes, const std::vector<int>& faceIndices);
+
+    // Recalculates the normals of everything that moved further than moveThreshold
+    void Update(Node& nodes, float moveThreshold);
+
+    // Recalculates every normal whether it moved or not
+    void UpdateAll(Node& nodes);
+
+    // Makes the next Update recalculate everything, for when the render normals were replaced from elsewhere
+    void Invalidate() { mUpdateAll = true; }
+
+    int GetFaceCount() { return static_cast<int>(mFaces.size() / 3); }
+
+private:
+    void FindMovedVertices(const BasicNode* vertices, float thresholdSquared, int begin, int end);
+    void CalculateFaceNormals(const BasicNode* vertices, int begin, int end);
+    void SumVertexNormals(Node& nodes, int begin, int end);
+
+    std::vector<int> mFaces; //Three vertex indices per triangle
+    float mWindingSign = 1.0f; //Flips the cross product if the mesh winds its faces the other way to its normals
+
+    // Per face, each axis stored separately so blocks of four are worked on at once
+    std::vector<float> mFaceNormalX;
+    std::vector<float> mFaceNormalY;
+    std::vector<float> mFaceNormalZ;
+    std::vector<unsigned char> mFaceChanged;
+
+    // Per drawn vertex
+    std::vector<CVector3> mLastPositions; //Where it was when its normal was last worked out
+    std::vector<unsigned char> mVertexMoved;
+    std::vector<int> mVertexFaceOffsets;  //Vertex i sums mVertexFaces[mVertexFaceOffsets[i]] to mVertexFaces[mVertexFaceOffsets[i + 1]]
+    std::vector<int> mVertexFaces;
+
+    bool mUpdateAll = true;
+};
+
+
+#endif //_NORMAL_UPDATER_H_INCLUDED_
@@ -0,0 +1,260 @@
+//--------------------------------------------------------------------------------------
+// Software depth buffer for occlusion culling
+//--------------------------------------------------------------------------------------
+
+#include "OcclusionBuffer.h"
+#include "TaskPool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <emmintrin.h>
+
+
+const float OCCLUSION_MIN_W = 1e-6f; //Clip space w this small or less is at (or behind) the eye
+
+
+void OcclusionBuffer::Begin(const CMatrix4x4& viewProjection)
+{
+    mViewProjection = viewProjection;
+    mTriangles.clear();
+    std::fill(mDepths.begin(), mDepths.end(), 1.0f);
+}
+
+
+// Row vectors, so the point is multiplied on the left
+OcclusionBuffer::ClipPoint OcclusionBuffer::ToClip(CVector3 point, const CMatrix4x4& m) const
+{
+    ClipPoint clip;
+    clip.x = point.x * m.e00 + point.y * m.e10 + point.z * m.e20 + m.e30;
+    clip.y = point.x * m.e01 + point.y * m.e11 + point.z * m.e21 + m.e31;
+    clip.z = point.x * m.e02 + point.y * m.e12 + point.z * m.e22 + m.e32;
+    clip.w = point.x * m.e03 + point.y * m.e13 + point.z * m.e23 + m.e33;
+    return clip;
+}
+
+
+void OcclusionBuffer::AddOccluder(const CVector3* positions, const unsigned int* indices, int indexCount, const CMatrix4x4& world)
+{
+    const CMatrix4x4 transform = world * mViewProjection;
+
+    //Edges used by only one triangle make the outline
+    auto EdgeKey = [](unsigned int from, unsigned int to)
+    {
+        return (static_cast<unsigned long long>(std::min(from, to)) << 32) | std::max(from, to);
+    };
+    std::unordered_map<unsigned long long, int> edgeUses;
+    for (int i = 0; i + 2 < indexCount; i += 3)
+    {
+        for (int k = 0; k < 3; ++k)
+        {
+            ++edgeUses[EdgeKey(indices[i + k], indices[i + (k + 1) % 3])];
+        }
+    }
+
+    for (int i = 0; i + 2 < indexCount; i += 3)
+    {
+        ClipPoint corners[3] =
+        {
+            ToClip(positions[indices[i]], transform),
+            ToClip(positions[indices[i + 1]], transform),
+            ToClip(positions[indices[i + 2]], transform),
+        };
+
+        //Cut off the part in front of the near plane (z below 0), which leaves a triangle or a quad.
+        //The cut is part of the outline, the rest of each edge keeps the original edge's.
+        ClipPoint clipped[4];
+        bool isOutline[4];
+        int clippedCount = 0;
+        for (int k = 0; k < 3; ++k)
+        {
+            const ClipPoint& from = corners[k];
+            const ClipPoint& to = corners[(k + 1) % 3];
+            const bool isEdgeOutline = edgeUses[EdgeKey(indices[i + k], indices[i + (k + 1) % 3])] == 1;
+            if (from.z >= 0)
+            {
+                isOutline[clippedCount] = isEdgeOutline;
+                clipped[clippedCount++] = from;
+            }
+            if ((from.z >= 0) != (to.z >= 0))
+            {
+                const float t = from.z / (from.z - to.z);
+                isOutline[clippedCount] = (from.z >= 0) ? true : isEdgeOutline;
+                clipped[clippedCount++] = { from.x + (to.x - from.x) * t, from.y + (to.y - from.y) * t, 0.0f, from.w + (to.w - from.w) * t };
+            }
+        }
+
+        //A quad is split along its diagonal, which is inside the occluder
+        if (clippedCount >= 3)
+        {
+            const bool firstOutline[3] = { isOutline[0], isOutline[1], (clippedCount == 3) ? isOutline[2] : false };
+            AddTriangle(clipped, firstOutline);
+        }
+        if (clippedCount == 4)
+        {
+            const ClipPoint second[3] = { clipped[0], clipped[2], clipped[3] };
+            const bool secondOutline[3] = { false, isOutline[2], isOutline[3] };
+            AddTriangle(second, secondOutline);
+        }
+    }
+}
+
+
+void OcclusionBuffer::AddTriangle(const ClipPoint* corners, const bool* isOutline)
+{
+    bool isEdgeOutline[3] = { isOutline[0], isOutline[1], isOutline[2] };
+    float x[3], y[3], z[3];
+    for (int k = 0; k < 3; ++k)
+    {
+        if (corners[k].w <= OCCLUSION_MIN_W)  return;
+        const float inverseW = 1.0f / corners[k].w;
+        x[k] = (corners[k].x * inverseW + 1.0f) * 0.5f * OCCLUSION_WIDTH;
+        y[k] = (1.0f - corners[k].y * inverseW) * 0.5f * OCCLUSION_HEIGHT;
+        z[k] = corners[k].z * inverseW;
+    }
+
+    //Turn it so the edge equations are positive inside
+    float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (area == 0)  return;
+    if (area < 0)
+    {
+        std::swap(x[1], x[2]);
+        std::swap(y[1], y[2]);
+        std::swap(z[1], z[2]);
+        std::swap(isEdgeOutline[0], isEdgeOutline[2]); //The edges now run 0 to 2, 2 to 1 and 1 to 0
+        area = -area;
+    }
+
+    Triangle triangle;
+    for (int k = 0; k < 3; ++k)
+    {
+        const int next = (k + 1) % 3;
+        triangle.a[k] = y[k] - y[next];
+        triangle.b[k] = x[next] - x[k];
+        triangle.c[k] = -(triangle.a[k] * x[k] + triangle.b[k] * y[k]);
+
+        //Pulled in by as far as the edge's value changes from a pixel's centre to its furthest corner
+        if (isEdgeOutline[k])  triangle.c[k] -= 0.5f * (std::abs(triangle.a[k]) + std::abs(triangle.b[k]));
+    }
+
+    //Depth after the divide changes linearly across the screen. Each pixel takes the furthest depth the triangle
+    //has within it, found from the centre's plus half a pixel of slope each way, and never past the furthest corner.
+    const float depthX = ((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) / area;
+    const float depthY = ((z[2] - z[0]) * (x[1] - x[0]) - (z[1] - z[0]) * (x[2] - x[0])) / area;
+    triangle.depthX = depthX;
+    triangle.depthY = depthY;
+    triangle.depthC = z[0] - depthX * x[0] - depthY * y[0] + 0.5f * (std::abs(depthX) + std::abs(depthY));
+    triangle.depth = std::max(z[0], std::max(z[1], z[2]));
+
+    triangle.minX = std::max(0, static_cast<int>(std::floor(std::min(x[0], std::min(x[1], x[2])))));
+    triangle.maxX = std::min(OCCLUSION_WIDTH - 1, static_cast<int>(std::floor(std::max(x[0], std::max(x[1], x[2])))));
+    triangle.minY = std::max(0, static_cast<int>(std::floor(std::min(y[0], std::min(y[1], y[2])))));
+    triangle.maxY = std::min(OCCLUSION_HEIGHT - 1, static_cast<int>(std::floor(std::max(y[0], std::max(y[1], y[2])))));
+    if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)  return;
+
+    mTriangles.push_back(triangle);
+}
+
+
+void OcclusionBuffer::Rasterise()
+{
+    //Each block only writes its own rows
+    GetTaskPool().ParallelFor(OCCLUSION_HEIGHT, OCCLUSION_BAND_ROWS, [this](int begin, int end) { RasteriseRows(begin, end); });
+}
+
+
+void OcclusionBuffer::RasteriseRows(int rowBegin, int rowEnd)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 pixelOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f); //Centres of four pixels in a row
+
+    for (const Triangle& triangle : mTriangles)
+    {
+        const int yBegin = std::max(triangle.minY, rowBegin);
+        const int yEnd = std::min(triangle.maxY + 1, rowEnd);
+        if (yBegin >= yEnd)  continue;
+
+        const __m128 furthest = _mm_set1_ps(triangle.depth);
+        const __m128 depthX = _mm_set1_ps(triangle.depthX);
+        const __m128 a0 = _mm_set1_ps(triangle.a[0]);
+        const __m128 a1 = _mm_set1_ps(triangle.a[1]);
+        const __m128 a2 = _mm_set1_ps(triangle.a[2]);
+
+        for (int y = yBegin; y < yEnd; ++y)
+        {
+            const float centreY = y + 0.5f;
+            const __m128 row0 = _mm_set1_ps(triangle.b[0] * centreY + triangle.c[0]);
+            const __m128 row1 = _mm_set1_ps(triangle.b[1] * centreY + triangle.c[1]);
+            const __m128 row2 = _mm_set1_ps(triangle.b[2] * centreY + triangle.c[2]);
+            const __m128 rowDepth = _mm_set1_ps(triangle.depthY * centreY + triangle.depthC);
+            float* depths = &mDepths[y * OCCLUSION_WIDTH];
+
+            //Starting on a multiple of 4 keeps each group of four within the row
+            for (int x = triangle.minX & ~3; x <= triangle.maxX; x += 4)
+            {
+                const __m128 centreX = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), pixelOffsets);
+                __m128 isInside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a0, centreX), row0), zero);
+                isInside = _mm_and_ps(isInside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a1, centreX), row1), zero));
+                isInside = _mm_and_ps(isInside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a2, centreX), row2), zero));
+
+                const __m128 depth = _mm_min_ps(_mm_add_ps(_mm_mul_ps(depthX, centreX), rowDepth), furthest);
+                const __m128 old = _mm_loadu_ps(depths + x);
+                const __m128 nearer = _mm_min_ps(old, depth);
+                _mm_storeu_ps(depths + x, _mm_or_ps(_mm_and_ps(isInside, nearer), _mm_andnot_ps(isInside, old)));
+            }
+        }
+    }
+}
+
+
+bool OcclusionBuffer::IsVisible(CVector3 centre, CVector3 extents) const
+{
+    if (mTriangles.empty())  return true;
+
+    float minX = static_cast<float>(OCCLUSION_WIDTH);
+    float maxX = 0;
+    float minY = static_cast<float>(OCCLUSION_HEIGHT);
+    float maxY = 0;
+    float nearest = 1.0f;
+    for (int corner = 0; corner < 8; ++corner)
+    {
+        CVector3 point(centre.x + ((corner & 1) ? extents.x : -extents.x),
+                       centre.y + ((corner & 2) ? extents.y : -extents.y),
+                       centre.z + ((corner & 4) ? extents.z : -extents.z));
+        ClipPoint clip = ToClip(point, mViewProjection);
+        if (clip.z < 0 || clip.w <= OCCLUSION_MIN_W)  return true;
+
+        const float inverseW = 1.0f / clip.w;
+        const float x = (clip.x * inverseW + 1.0f) * 0.5f * OCCLUSION_WIDTH;
+        const float y = (1.0f - clip.y * inverseW) * 0.5f * OCCLUSION_HEIGHT;
+        minX = std::min(minX, x);
+        maxX = std::max(maxX, x);
+        minY = std::min(minY, y);
+        maxY = std::max(maxY, y);
+        nearest = std::min(nearest, clip.z * inverseW);
+    }
+    if (maxX < 0 || maxY < 0 || minX >= OCCLUSION_WIDTH || minY >= OCCLUSION_HEIGHT)  return true;
+
+    //Every pixel the box touches
+    const int xBegin = std::max(0, static_cast<int>(std::floor(minX)));
+    const int xEnd = std::min(OCCLUSION_WIDTH - 1, static_cast<int>(std::floor(maxX)));
+    const int yBegin = std::max(0, static_cast<int>(std::floor(minY)));
+    const int yEnd = std::min(OCCLUSION_HEIGHT - 1, static_cast<int>(std::floor(maxY)));
+
+    const __m128 boxDepth = _mm_set1_ps(nearest);
+    const __m128 firstColumn = _mm_set1_ps(static_cast<float>(xBegin));
+    const __m128 lastColumn = _mm_set1_ps(static_cast<float>(xEnd));
+    const __m128 columnOffsets = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+    for (int y = yBegin; y <= yEnd; ++y)
+    {
+        const float* depths = &mDepths[y * OCCLUSION_WIDTH];
+        for (int x = xBegin & ~3; x <= xEnd; x += 4)
+        {
+            const __m128 column = _mm_add_ps(_mm_set1_ps(static_cast<float>(x)), columnOffsets);
+            const __m128 isInRange = _mm_and_ps(_mm_cmpge_ps(column, firstColumn), _mm_cmple_ps(column, lastColumn));
+            const __m128 isInFront = _mm_cmple_ps(boxDepth, _mm_loadu_ps(depths + x));
+            if (_mm_movemask_ps(_mm_and_ps(isInRange, isInFront)) != 0)  return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,80 @@
+//--------------------------------------------------------------------------------------
+// Software depth buffer for occlusion culling
+//--------------------------------------------------------------------------------------
+// Frustum culling (FrustumCuller) keeps every body in front of the camera, including those
+// hidden behind the floor or walls, which are then uploaded and drawn for nothing. This draws
+// the meshes chosen as occluders into a small depth buffer on the CPU each frame, as the camera
+// sees them, and tests each body's box against it before the body is rendered.
+//
+// The occluders' triangles are clipped to the near plane and projected as they're added. Each
+// pixel takes the furthest depth its triangle reaches within it, so the buffer is never nearer
+// than the real occluders. The buffer is split into bands of rows that are drawn on the TaskPool at once,
+// each band testing four pixels at a time against the triangles' edges with SSE. A box is hidden
+// if its nearest corner is behind the buffer at every pixel it covers.
+//
+// Coverage is by pixel centre, as a GPU's is, except at an occluder's outline. Edges that no
+// other triangle of the occluder shares are pulled in by half a pixel, so an edge pixel is only
+// written when the occluder covers all of it, and a body showing even a sliver past the outline
+// is kept. Everything is CPU maths, so it runs without a device.
+
+#include "CVector3.h"
+#include "CMatrix4x4.h"
+
+#include <vector>
+
+#ifndef _OCCLUSION_BUFFER_H_INCLUDED_
+#define _OCCLUSION_BUFFER_H_INCLUDED_
+
+constexpr int OCCLUSION_WIDTH = 256;  //Must be a multiple of 4
+constexpr int OCCLUSION_HEIGHT = 128;
+constexpr int OCCLUSION_BAND_ROWS = 8; //Rows per block handed to a thread
+
+
+class OcclusionBuffer
+{
+public:
+    // Starts a new frame seen through viewProjection (world to clip space, depth 0 to 1), clearing the
+    // occluders and depths.
+    void Begin(const CMatrix4x4& viewProjection);
+
+    // Adds a mesh's triangles, placed in the world by world, to be drawn by the next Rasterise
+    void AddOccluder(const CVector3* positions, const unsigned int* indices, int indexCount, const CMatrix4x4& world);
+
+    // Draws every occluder added since Begin into the depths
+    void Rasterise();
+
+    // Returns false only if the world space box (centre and half size) is wholly behind the occluders.
+    // Boxes crossing the near plane or off the buffer are left to the frustum culling and count as visible.
+    bool IsVisible(CVector3 centre, CVector3 extents) const;
+
+    float GetDepth(int x, int y) const { return mDepths[y * OCCLUSION_WIDTH + x]; }
+    int GetTriangleCount() const { return static_cast<int>(mTriangles.size()); }
+
+private:
+    // A triangle in buffer pixels. Inside is where every edge's a * x + b * y + c is at least 0 at the pixel's centre.
+    struct Triangle
+    {
+        float a[3], b[3], c[3];
+        float depthX, depthY, depthC; //Depth at pixel x, y is at most depthX * x + depthY * y + depthC
+        float depth;                  //Of the furthest corner
+        int minX, maxX, minY, maxY;
+    };
+
+    // A point in clip space
+    struct ClipPoint
+    {
+        float x, y, z, w;
+    };
+
+    ClipPoint ToClip(CVector3 point, const CMatrix4x4& transform) const;
+    // isOutline[k] is true if the edge from corners[k] to the next corner is on the occluder's outline
+    void AddTriangle(const ClipPoint* corners, const bool* isOutline);
+    void RasteriseRows(int rowBegin, int rowEnd);
+
+    CMatrix4x4 mViewProjection;
+    std::vector<Triangle> mTriangles;
+    std::vector<float> mDepths = std::vector<float>(OCCLUSION_WIDTH * OCCLUSION_HEIGHT, 1.0f);
+};
+
+
+#endif //_OCCLUSION_BUFFER_H_INCLUDED_
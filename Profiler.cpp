@@ -0,0 +1,265 @@
+//--------------------------------------------------------------------------------------
+// Lightweight profiler for the hot paths
+//--------------------------------------------------------------------------------------
+
+#include "Profiler.h"
+#include "imgui.h"
+
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <thread>
+
+
+namespace
+{
+    // One per thread. Only its own thread writes, readers copy out and then check nothing they copied was overwritten.
+    struct ThreadBuffer
+    {
+        std::atomic<unsigned long long> writeCount{ 0 };
+        Profiler::Event events[PROFILER_RING_SIZE];
+        int threadId = 0;
+        std::string threadName;
+    };
+
+    struct PhaseStat
+    {
+        double frameTime = 0;   // Milliseconds in the last frame
+        double averageTime = 0; // Running average of frameTime
+        int    calls = 0;
+    };
+
+    struct CounterStat
+    {
+        long long frameValue = 0;
+        double    averageValue = 0;
+    };
+
+    const auto gProfilerEpoch = std::chrono::steady_clock::now();
+
+    std::mutex gBufferMutex; //Only taken when a thread first records and when reading
+    std::vector<std::unique_ptr<ThreadBuffer>> gBuffers;
+
+    thread_local ThreadBuffer* tThreadBuffer = nullptr;
+
+    // Panel state, only used from the thread drawing the GUI
+    std::vector<unsigned long long> gPanelReadCounts;
+    std::map<std::string, PhaseStat> gPhaseStats;
+    std::map<std::string, CounterStat> gCounterStats;
+    bool gPanelPaused = false;
+
+    const double PANEL_AVERAGE_WEIGHT = 0.05; //How quickly the running averages follow the frame values
+
+
+    ThreadBuffer* GetThreadBuffer()
+    {
+        if (tThreadBuffer == nullptr)
+        {
+            std::lock_guard<std::mutex> lock(gBufferMutex);
+            gBuffers.push_back(std::make_unique<ThreadBuffer>());
+            tThreadBuffer = gBuffers.back().get();
+            tThreadBuffer->threadId = static_cast<int>(gBuffers.size());
+            tThreadBuffer->threadName = "Thread " + std::to_string(tThreadBuffer->threadId);
+        }
+        return tThreadBuffer;
+    }
+
+    void Record(const Profiler::Event& event)
+    {
+        ThreadBuffer* buffer = GetThreadBuffer();
+        unsigned long long index = buffer->writeCount.load(std::memory_order_relaxed);
+        buffer->events[index & (PROFILER_RING_SIZE - 1)] = event;
+        buffer->writeCount.store(index + 1, std::memory_order_release);
+    }
+
+    // Copies the events written since readFrom into output and returns the new write count.
+    // Anything the writer may have overwritten during the copy is dropped.
+    unsigned long long ReadEvents(const ThreadBuffer& buffer, unsigned long long readFrom, std::vector<Profiler::Event>& output)
+    {
+        unsigned long long writeCount = buffer.writeCount.load(std::memory_order_acquire);
+        if (writeCount > PROFILER_RING_SIZE && readFrom < writeCount - PROFILER_RING_SIZE)
+        {
+            readFrom = writeCount - PROFILER_RING_SIZE;
+        }
+
+        size_t outputStart = output.size();
+        for (unsigned long long i = readFrom; i < writeCount; ++i)
+        {
+            output.push_back(buffer.events[i & (PROFILER_RING_SIZE - 1)]);
+        }
+
+        unsigned long long writeCountAfter = buffer.writeCount.load(std::memory_order_acquire);
+        if (writeCountAfter > PROFILER_RING_SIZE && readFrom < writeCountAfter - PROFILER_RING_SIZE)
+        {
+            unsigned long long overwritten = writeCountAfter - PROFILER_RING_SIZE - readFrom;
+            if (overwritten > writeCount - readFrom)  overwritten = writeCount - readFrom;
+            output.erase(output.begin() + outputStart, output.begin() + outputStart + static_cast<size_t>(overwritten));
+        }
+        return writeCount;
+    }
+
+    void WriteJsonString(std::ofstream& file, const char* text)
+    {
+        file << '"';
+        for (; *text; ++text)
+        {
+            if (*text == '"' || *text == '\\')  file << '\\';
+            file << *text;
+        }
+        file << '"';
+    }
+}
+
+
+long long Profiler::Now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - gProfilerEpoch).count();
+}
+
+void Profiler::RecordScope(const char* name, long long start, long long duration)
+{
+    Record({ name, start, duration, EventType::Scope });
+}
+
+void Profiler::RecordCounter(const char* name, long long value)
+{
+    Record({ name, Now(), value, EventType::Counter });
+}
+
+void Profiler::BeginFrame()
+{
+    Record({ "Frame", Now(), 0, EventType::Frame });
+}
+
+void Profiler::SetThreadName(const char* name)
+{
+    ThreadBuffer* buffer = GetThreadBuffer();
+    std::lock_guard<std::mutex> lock(gBufferMutex);
+    buffer->threadName = name;
+}
+
+
+bool Profiler::WriteChromeTrace(const std::string& fileName)
+{
+    std::ofstream file(fileName);
+    if (!file)  return false;
+
+    std::lock_guard<std::mutex> lock(gBufferMutex);
+
+    //Chrome's trace event format, times are in microseconds
+    file << "{\"traceEvents\":[\n";
+    bool first = true;
+    std::vector<Event> events;
+    for (const auto& buffer : gBuffers)
+    {
+        if (!first)  file << ",\n";
+        first = false;
+        file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->threadId << ",\"args\":{\"name\":";
+        WriteJsonString(file, buffer->threadName.c_str());
+        file << "}}";
+
+        events.clear();
+        ReadEvents(*buffer, 0, events);
+        for (const Event& event : events)
+        {
+            file << ",\n{\"name\":";
+            WriteJsonString(file, event.name);
+            file << ",\"pid\":1,\"tid\":" << buffer->threadId << ",\"ts\":" << event.start / 1000.0;
+            switch (event.type)
+            {
+            case EventType::Scope:
+                file << ",\"ph\":\"X\",\"dur\":" << event.value / 1000.0 << "}";
+                break;
+            case EventType::Counter:
+                file << ",\"ph\":\"C\",\"args\":{\"value\":" << event.value << "}}";
+                break;
+            case EventType::Frame:
+                file << ",\"ph\":\"i\",\"s\":\"g\"}";
+                break;
+            }
+        }
+    }
+    file << "\n]}\n";
+
+    return static_cast<bool>(file);
+}
+
+
+void Profiler::ShowPanel()
+{
+    //Gather everything recorded since the last call, from every thread, as this frame's values
+    if (!gPanelPaused)
+    {
+        std::vector<Event> events;
+        {
+            std::lock_guard<std::mutex> lock(gBufferMutex);
+            gPanelReadCounts.resize(gBuffers.size(), 0);
+            for (size_t i = 0; i < gBuffers.size(); ++i)
+            {
+                gPanelReadCounts[i] = ReadEvents(*gBuffers[i], gPanelReadCounts[i], events);
+            }
+        }
+
+        for (auto& phase : gPhaseStats)
+        {
+            phase.second.frameTime = 0;
+            phase.second.calls = 0;
+        }
+        for (auto& counter : gCounterStats)
+        {
+            counter.second.frameValue = 0;
+        }
+
+        for (const Event& event : events)
+        {
+            if (event.type == EventType::Scope)
+            {
+                PhaseStat& phase = gPhaseStats[event.name];
+                phase.frameTime += event.value / 1000000.0;
+                ++phase.calls;
+            }
+            else if (event.type == EventType::Counter)
+            {
+                gCounterStats[event.name].frameValue += event.value;
+            }
+        }
+
+        for (auto& phase : gPhaseStats)
+        {
+            phase.second.averageTime += (phase.second.frameTime - phase.second.averageTime) * PANEL_AVERAGE_WEIGHT;
+        }
+        for (auto& counter : gCounterStats)
+        {
+            counter.second.averageValue += (counter.second.frameValue - counter.second.averageValue) * PANEL_AVERAGE_WEIGHT;
+        }
+    }
+
+    ImGui::Begin("Profiler", 0, ImGuiWindowFlags_AlwaysAutoResize);
+#if !PROFILING_ENABLED
+    ImGui::Text("Profiling is compiled out (PROFILING_ENABLED is 0)");
+#endif
+    ImGui::Checkbox("Pause", &gPanelPaused);
+    ImGui::SameLine();
+    if (ImGui::Button("Export Chrome trace"))
+    {
+        WriteChromeTrace(PROFILER_TRACE_FILE_NAME);
+    }
+
+    ImGui::Separator();
+    ImGui::Text("Phase                  frame ms   avg ms  calls");
+    for (const auto& phase : gPhaseStats)
+    {
+        ImGui::Text("%-22s %8.3f %8.3f %6d", phase.first.c_str(), phase.second.frameTime, phase.second.averageTime, phase.second.calls);
+    }
+
+    ImGui::Separator();
+    ImGui::Text("Counter                   frame      avg");
+    for (const auto& counter : gCounterStats)
+    {
+        ImGui::Text("%-22s %8lld %8.0f", counter.first.c_str(), counter.second.frameValue, counter.second.averageValue);
+    }
+    ImGui::End();
+}
@@ -0,0 +1,129 @@
+//--------------------------------------------------------------------------------------
+// Lightweight profiler for the hot paths
+//--------------------------------------------------------------------------------------
+// Times phases of a frame (spring forces, integration, collision, vertex upload, shadows, GUI)
+// and records counters such as springs evaluated or contacts found.
+//
+//   PROFILE_SCOPE("Collision");                 - times from here to the end of the block
+//   PROFILE_COUNTER("Contacts found", contacts); - adds a value to a counter for this frame
+//   PROFILE_FRAME();                             - marks the start of a frame, once per frame
+//
+// Each thread writes into its own fixed size ring buffer so recording never locks or allocates,
+// old events are overwritten once the ring is full. The events can be written out as a Chrome
+// trace (open with chrome://tracing or ui.perfetto.dev) and are summarised in an ImGui panel.
+//
+// Define PROFILING_ENABLED as 0 to compile every macro out.
+
+#include <atomic>
+#include <string>
+
+#ifndef _PROFILER_H_INCLUDED_
+#define _PROFILER_H_INCLUDED_
+
+#ifndef PROFILING_ENABLED
+#define PROFILING_ENABLED 1
+#endif
+
+const std::string PROFILER_TRACE_FILE_NAME = "SoftBodyTrace.json";
+
+constexpr int PROFILER_RING_SIZE = 1 << 15; //Events kept per thread, must be a power of two
+
+
+namespace Profiler
+{
+    enum class EventType : unsigned char
+    {
+        Scope,
+        Counter,
+        Frame,
+    };
+
+    // name must be a string literal (or otherwise live forever) as only the pointer is stored
+    struct Event
+    {
+        const char* name;
+        long long   start;  // Nanoseconds since the profiler started
+        long long   value;  // Duration in nanoseconds for scopes, the amount for counters
+        EventType   type;
+    };
+
+    // Nanoseconds since the profiler started
+    long long Now();
+
+    void RecordScope(const char* name, long long start, long long duration);
+    void RecordCounter(const char* name, long long value);
+    void BeginFrame();
+
+    // Name shown for the calling thread in the trace
+    void SetThreadName(const char* name);
+
+    // Writes every event still held in the ring buffers. Returns false on failure.
+    bool WriteChromeTrace(const std::string& fileName);
+
+    // Per-phase times and counters for the last frame, with a running average. Call once per frame inside an ImGui frame.
+    void ShowPanel();
+}
+
+
+#if PROFILING_ENABLED
+
+// Records the time from construction to destruction
+class ProfileScope
+{
+public:
+    ProfileScope(const char* name) : mName(name), mStart(Profiler::Now()) {}
+    ~ProfileScope() { Profiler::RecordScope(mName, mStart, Profiler::Now() - mStart); }
+
+private:
+    const char* mName;
+    long long   mStart;
+};
+
+// Adds up many short sections inside a loop and records them as one event when destroyed.
+// The event starts at the first section and lasts for the total, so it shows how much of the
+// enclosing scope was spent in the sections rather than when each one ran.
+class ProfileAccumulator
+{
+public:
+    ProfileAccumulator(const char* name) : mName(name) {}
+    ~ProfileAccumulator() { if (mFirstStart >= 0)  Profiler::RecordScope(mName, mFirstStart, mTotal); }
+
+    void Begin()
+    {
+        mStart = Profiler::Now();
+        if (mFirstStart < 0)  mFirstStart = mStart;
+    }
+    void End() { mTotal += Profiler::Now() - mStart; }
+
+private:
+    const char* mName;
+    long long   mFirstStart = -1;
+    long long   mStart = 0;
+    long long   mTotal = 0;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#define PROFILE_SCOPE(name)          ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_COUNTER(name, value) Profiler::RecordCounter(name, static_cast<long long>(value))
+#define PROFILE_FRAME()              Profiler::BeginFrame()
+
+#else
+
+class ProfileAccumulator
+{
+public:
+    ProfileAccumulator(const char*) {}
+    void Begin() {}
+    void End() {}
+};
+
+#define PROFILE_SCOPE(name)          ((void)0)
+#define PROFILE_COUNTER(name, value) ((void)0)
+#define PROFILE_FRAME()              ((void)0)
+
+#endif //PROFILING_ENABLED
+
+
+#endif //_PROFILER_H_INCLUDED_
@@ -0,0 +1,160 @@
+//--------------------------------------------------------------------------------------
+// Sorted queue of draws that only changes the GPU state it has to
+//--------------------------------------------------------------------------------------
+
+#include "RenderQueue.h"
+#include "GraphicsDevice.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+const unsigned long long RENDER_KEY_SHADER_LIMIT = (1ull << 8) - 1;
+const unsigned long long RENDER_KEY_TEXTURE_LIMIT = (1ull << 12) - 1;
+const unsigned long long RENDER_KEY_STATE_LIMIT = (1ull << 8) - 1;
+
+
+//--------------------------------------------------------------------------------------
+// Backends
+//--------------------------------------------------------------------------------------
+
+void D3DRenderBackend::SetVertexShader(ID3D11VertexShader* shader)
+{
+    gGraphics->VSSetShader(shader, nullptr, 0);
+}
+
+void D3DRenderBackend::SetPixelShader(ID3D11PixelShader* shader)
+{
+    gGraphics->PSSetShader(shader, nullptr, 0);
+}
+
+void D3DRenderBackend::SetTexture(ID3D11ShaderResourceView* texture)
+{
+    gGraphics->PSSetShaderResources(0, 1, &texture);
+}
+
+void D3DRenderBackend::SetSampler(ID3D11SamplerState* sampler)
+{
+    gGraphics->PSSetSamplers(0, 1, &sampler);
+}
+
+void D3DRenderBackend::SetBlendState(ID3D11BlendState* state)
+{
+    gGraphics->OMSetBlendState(state, nullptr, 0xffffff);
+}
+
+void D3DRenderBackend::SetDepthState(ID3D11DepthStencilState* state)
+{
+    gGraphics->OMSetDepthStencilState(state, 0);
+}
+
+void D3DRenderBackend::SetRasterizerState(ID3D11RasterizerState* state)
+{
+    gGraphics->RSSetState(state);
+}
+
+void D3DRenderBackend::Draw(const std::function<void()>& draw)
+{
+    draw();
+}
+
+
+void RecordingRenderBackend::Draw(const std::function<void()>& draw)
+{
+    Record(DrawCommand, nullptr);
+    ++mDrawCount;
+    if (mIsDrawing)  draw();
+}
+
+
+//--------------------------------------------------------------------------------------
+// Queue
+//--------------------------------------------------------------------------------------
+
+template <typename T>
+unsigned long long RenderQueue::FindId(std::vector<T>& seen, const T& value, unsigned long long limit)
+{
+    for (size_t i = 0; i < seen.size(); ++i)
+    {
+        if (std::memcmp(&seen[i], &value, sizeof(T)) == 0)  return std::min<unsigned long long>(i, limit);
+    }
+    seen.push_back(value);
+    return std::min<unsigned long long>(seen.size() - 1, limit);
+}
+
+
+unsigned long long RenderQueue::MakeKey(RenderPass pass, const DrawState& state, float depth)
+{
+    const unsigned long long shader = FindId(mShaderIds, std::make_pair(state.vertexShader, state.pixelShader), RENDER_KEY_SHADER_LIMIT);
+    const unsigned long long texture = FindId(mTextureIds, state.texture, RENDER_KEY_TEXTURE_LIMIT);
+
+    //Only the states' pointers, the shaders and texture are already in the key
+    DrawState states;
+    states.sampler = state.sampler;
+    states.blendState = state.blendState;
+    states.depthState = state.depthState;
+    states.rasterizerState = state.rasterizerState;
+    const unsigned long long stateId = FindId(mStateIds, states, RENDER_KEY_STATE_LIMIT);
+
+    //The bits of a float that isn't negative sort the same way as the float does
+    unsigned int depthBits;
+    depth = std::max(depth, 0.0f);
+    std::memcpy(&depthBits, &depth, sizeof(depthBits));
+    if (pass == BlendedPass)  depthBits = ~depthBits;
+
+    return (static_cast<unsigned long long>(pass) << 60) | (shader << 52) | (texture << 40) | (stateId << 32) | depthBits;
+}
+
+
+void RenderQueue::Submit(RenderPass pass, const DrawState& state, float depth, std::function<void()> draw)
+{
+    mItems.push_back({ MakeKey(pass, state, depth), static_cast<int>(mItems.size()), state, std::move(draw) });
+}
+
+
+void RenderQueue::Flush(RenderBackend& backend)
+{
+    mOrder.resize(mItems.size());
+    for (size_t i = 0; i < mItems.size(); ++i)  mOrder[i] = static_cast<int>(i);
+    std::sort(mOrder.begin(), mOrder.end(), [this](int a, int b)
+    {
+        if (mItems[a].key != mItems[b].key)  return mItems[a].key < mItems[b].key;
+        return mItems[a].order < mItems[b].order;
+    });
+
+    mStateChanges = 0;
+    mSkippedStates = 0;
+    mDraws = 0;
+
+    //Sets one piece of state unless the backend already has it
+    auto change = [this](auto& current, auto wanted, auto set)
+    {
+        if (mIsStateKnown && current == wanted)
+        {
+            ++mSkippedStates;
+            return;
+        }
+        set(wanted);
+        current = wanted;
+        ++mStateChanges;
+    };
+
+    for (int index : mOrder)
+    {
+        const DrawItem& item = mItems[index];
+        const DrawState& state = item.state;
+        change(mCurrent.vertexShader,    state.vertexShader,    [&](ID3D11VertexShader* s)       { backend.SetVertexShader(s); });
+        change(mCurrent.pixelShader,     state.pixelShader,     [&](ID3D11PixelShader* s)        { backend.SetPixelShader(s); });
+        change(mCurrent.texture,         state.texture,         [&](ID3D11ShaderResourceView* s) { backend.SetTexture(s); });
+        change(mCurrent.sampler,         state.sampler,         [&](ID3D11SamplerState* s)       { backend.SetSampler(s); });
+        change(mCurrent.blendState,      state.blendState,      [&](ID3D11BlendState* s)         { backend.SetBlendState(s); });
+        change(mCurrent.depthState,      state.depthState,      [&](ID3D11DepthStencilState* s)  { backend.SetDepthState(s); });
+        change(mCurrent.rasterizerState, state.rasterizerState, [&](ID3D11RasterizerState* s)    { backend.SetRasterizerState(s); });
+        mIsStateKnown = true;
+
+        backend.Draw(item.draw);
+        ++mDraws;
+    }
+
+    mItems.clear();
+}
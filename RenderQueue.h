@@ -0,0 +1,181 @@
+//--------------------------------------------------------------------------------------
+// Sorted queue of draws that only changes the GPU state it has to
+//--------------------------------------------------------------------------------------
+// A render pass submits each draw with the state it needs (shaders, texture, sampler, blend,
+// depth and rasterizer states) instead of setting that state on the context itself. Flush
+// sorts the draws by a 64-bit key and issues them, setting only the state that differs from
+// what's already set, so draws sharing shaders or textures are grouped and nothing is set twice.
+//
+// Key, most significant first:
+//   pass (4 bits)    - RenderPass, so blended draws follow opaque ones
+//   shader (8 bits)  - vertex and pixel shader pair, numbered as first seen
+//   texture (12 bits)
+//   state (8 bits)   - sampler, blend, depth and rasterizer states together
+//   depth (32 bits)  - opaque draws near to far so the depth test rejects more, blended far to near
+// Numbers past their bits share the top value, which only makes the grouping less tight.
+//
+// The queue talks to the GPU through a RenderBackend. D3DRenderBackend sets the state through
+// gGraphics, RecordingRenderBackend only writes down what it was asked to do, so the order of
+// commands and the number of state changes can be checked without a device.
+
+#include "Common.h"
+
+#include <vector>
+#include <functional>
+
+#ifndef _RENDER_QUEUE_H_INCLUDED_
+#define _RENDER_QUEUE_H_INCLUDED_
+
+
+enum RenderPass
+{
+    OpaquePass,
+    BlendedPass,
+};
+
+
+// GPU state a draw needs. The texture and sampler go in slot 0 of the pixel shader.
+struct DrawState
+{
+    ID3D11VertexShader*       vertexShader = nullptr;
+    ID3D11PixelShader*        pixelShader = nullptr;
+    ID3D11ShaderResourceView* texture = nullptr;
+    ID3D11SamplerState*       sampler = nullptr;
+    ID3D11BlendState*         blendState = nullptr;
+    ID3D11DepthStencilState*  depthState = nullptr;
+    ID3D11RasterizerState*    rasterizerState = nullptr;
+};
+
+
+class RenderBackend
+{
+public:
+    virtual ~RenderBackend() {}
+
+    virtual void SetVertexShader(ID3D11VertexShader* shader) = 0;
+    virtual void SetPixelShader(ID3D11PixelShader* shader) = 0;
+    virtual void SetTexture(ID3D11ShaderResourceView* texture) = 0;
+    virtual void SetSampler(ID3D11SamplerState* sampler) = 0;
+    virtual void SetBlendState(ID3D11BlendState* state) = 0;
+    virtual void SetDepthState(ID3D11DepthStencilState* state) = 0;
+    virtual void SetRasterizerState(ID3D11RasterizerState* state) = 0;
+
+    // Issues the draw itself, e.g. Model::Render
+    virtual void Draw(const std::function<void()>& draw) = 0;
+};
+
+
+// Sets the state through gGraphics
+class D3DRenderBackend : public RenderBackend
+{
+public:
+    void SetVertexShader(ID3D11VertexShader* shader) override;
+    void SetPixelShader(ID3D11PixelShader* shader) override;
+    void SetTexture(ID3D11ShaderResourceView* texture) override;
+    void SetSampler(ID3D11SamplerState* sampler) override;
+    void SetBlendState(ID3D11BlendState* state) override;
+    void SetDepthState(ID3D11DepthStencilState* state) override;
+    void SetRasterizerState(ID3D11RasterizerState* state) override;
+    void Draw(const std::function<void()>& draw) override;
+};
+
+
+// Writes down every command instead of sending it anywhere
+class RecordingRenderBackend : public RenderBackend
+{
+public:
+    enum CommandType
+    {
+        VertexShaderCommand,
+        PixelShaderCommand,
+        TextureCommand,
+        SamplerCommand,
+        BlendStateCommand,
+        DepthStateCommand,
+        RasterizerStateCommand,
+        DrawCommand,
+    };
+
+    struct Command
+    {
+        CommandType type;
+        const void* object; //The state set, null for draws
+    };
+
+    // isDrawing also calls each draw's function, otherwise draws are only recorded
+    RecordingRenderBackend(bool isDrawing = false) : mIsDrawing(isDrawing) {}
+
+    void SetVertexShader(ID3D11VertexShader* shader) override        { Record(VertexShaderCommand, shader); }
+    void SetPixelShader(ID3D11PixelShader* shader) override          { Record(PixelShaderCommand, shader); }
+    void SetTexture(ID3D11ShaderResourceView* texture) override      { Record(TextureCommand, texture); }
+    void SetSampler(ID3D11SamplerState* sampler) override            { Record(SamplerCommand, sampler); }
+    void SetBlendState(ID3D11BlendState* state) override             { Record(BlendStateCommand, state); }
+    void SetDepthState(ID3D11DepthStencilState* state) override      { Record(DepthStateCommand, state); }
+    void SetRasterizerState(ID3D11RasterizerState* state) override   { Record(RasterizerStateCommand, state); }
+    void Draw(const std::function<void()>& draw) override;
+
+    const std::vector<Command>& GetCommands() const { return mCommands; }
+    int GetStateChangeCount() const { return static_cast<int>(mCommands.size()) - mDrawCount; }
+    int GetDrawCount() const { return mDrawCount; }
+    void Clear() { mCommands.clear();  mDrawCount = 0; }
+
+private:
+    void Record(CommandType type, const void* object) { mCommands.push_back({ type, object }); }
+
+    std::vector<Command> mCommands;
+    int  mDrawCount = 0;
+    bool mIsDrawing;
+};
+
+
+class RenderQueue
+{
+public:
+    // Adds a draw. depth is its distance from the viewer, used to order draws that share all their state.
+    void Submit(RenderPass pass, const DrawState& state, float depth, std::function<void()> draw);
+
+    // Sorts and issues every draw submitted since the last flush, then empties the queue. State already set by
+    // an earlier flush isn't set again.
+    void Flush(RenderBackend& backend);
+
+    // Forgets what state is set, for when something outside the queue may have changed it (e.g. the GUI)
+    void Invalidate() { mIsStateKnown = false; }
+
+    // Counts from the last Flush
+    int GetStateChangeCount() const { return mStateChanges; }
+    int GetSkippedStateCount() const { return mSkippedStates; } //Set calls avoided as the state was already set
+    int GetDrawCount() const { return mDraws; }
+
+private:
+    struct DrawItem
+    {
+        unsigned long long key;
+        int order; //Submission order, so equal keys draw as submitted
+        DrawState state;
+        std::function<void()> draw;
+    };
+
+    unsigned long long MakeKey(RenderPass pass, const DrawState& state, float depth);
+
+    // Small number for a pointer, in the order first seen, capped at limit
+    template <typename T>
+    static unsigned long long FindId(std::vector<T>& seen, const T& value, unsigned long long limit);
+
+    std::vector<DrawItem> mItems;
+    std::vector<int> mOrder; //mItems sorted, reused between flushes
+
+    // Pointers numbered for the key. Kept between frames so the order is stable.
+    std::vector<std::pair<ID3D11VertexShader*, ID3D11PixelShader*>> mShaderIds;
+    std::vector<ID3D11ShaderResourceView*> mTextureIds;
+    std::vector<DrawState> mStateIds;
+
+    DrawState mCurrent; //What the backend was last told
+    bool mIsStateKnown = false;
+
+    int mStateChanges = 0;
+    int mSkippedStates = 0;
+    int mDraws = 0;
+};
+
+
+#endif //_RENDER_QUEUE_H_INCLUDED_
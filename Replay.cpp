@@ -0,0 +1,187 @@
+//--------------------------------------------------------------------------------------
+// Deterministic replay
+//--------------------------------------------------------------------------------------
+
+#include "Replay.h"
+
+#include <fstream>
+
+ReplaySystem gReplay;
+
+
+//--------------------------------------------------------------------------------------
+// Recording
+//--------------------------------------------------------------------------------------
+
+void ReplaySystem::StartRecording(const SimulationState& initialState, const std::vector<ReplayBodyStart>& bodies, CVector3 momentum)
+{
+    mIsPlaying = false;
+    mIsRecording = true;
+
+    mInitialState = initialState;
+    mInitialBodies = bodies;
+    mInitialMomentum = momentum;
+    mFrames.clear();
+}
+
+
+void ReplaySystem::BeginRecordedFrame(ReplayFrame frame)
+{
+    mPendingFrame = frame;
+    mPendingFrame.keyMask = 0;
+    mPendingFrame.padding = 0;
+    mPendingFrame.stateHash = 0;
+}
+
+
+void ReplaySystem::EndRecordedFrame(unsigned long long stateHash)
+{
+    mPendingFrame.stateHash = stateHash;
+    mFrames.push_back(mPendingFrame);
+}
+
+
+bool ReplaySystem::StopRecording(const std::string& fileName)
+{
+    if (!mIsRecording)
+    {
+        return false;
+    }
+    mIsRecording = false;
+
+    std::ofstream file(fileName, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    ReplayHeader header;
+    header.magic = REPLAY_FILE_MAGIC;
+    header.version = REPLAY_VERSION;
+    header.bodyCount = static_cast<unsigned int>(mInitialBodies.size());
+    header.frameCount = static_cast<unsigned int>(mFrames.size());
+    header.stateSize = static_cast<unsigned int>(mInitialState.GetSize());
+    header.momentum = mInitialMomentum;
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(mInitialBodies.data()), mInitialBodies.size() * sizeof(ReplayBodyStart));
+    file.write(reinterpret_cast<const char*>(mInitialState.GetData().data()), mInitialState.GetSize());
+    file.write(reinterpret_cast<const char*>(mFrames.data()), mFrames.size() * sizeof(ReplayFrame));
+    return !file.fail();
+}
+
+
+//--------------------------------------------------------------------------------------
+// Playback
+//--------------------------------------------------------------------------------------
+
+bool ReplaySystem::StartPlayback(const std::string& fileName)
+{
+    mIsRecording = false;
+    mIsPlaying = false;
+
+    std::ifstream file(fileName, std::ios::in | std::ios::binary);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    ReplayHeader header;
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (file.fail() || header.magic != REPLAY_FILE_MAGIC || header.version != REPLAY_VERSION)
+    {
+        return false;
+    }
+
+    mInitialBodies.resize(header.bodyCount);
+    file.read(reinterpret_cast<char*>(mInitialBodies.data()), mInitialBodies.size() * sizeof(ReplayBodyStart));
+
+    std::vector<unsigned char> state(header.stateSize);
+    file.read(reinterpret_cast<char*>(state.data()), state.size());
+    mInitialState.SetData(state.data(), state.size());
+
+    mFrames.resize(header.frameCount);
+    file.read(reinterpret_cast<char*>(mFrames.data()), mFrames.size() * sizeof(ReplayFrame));
+    if (file.fail())
+    {
+        return false;
+    }
+
+    mInitialMomentum = header.momentum;
+    mCurrentFrame = -1;
+    mMismatchCount = 0;
+    mFirstMismatchFrame = -1;
+    mIsPlaying = true;
+    return true;
+}
+
+
+bool ReplaySystem::NextPlaybackFrame(ReplayFrame& frame)
+{
+    if (!mIsPlaying || mCurrentFrame + 1 >= static_cast<int>(mFrames.size()))
+    {
+        mIsPlaying = false;
+        return false;
+    }
+
+    ++mCurrentFrame;
+    frame = mFrames[mCurrentFrame];
+    return true;
+}
+
+
+void ReplaySystem::CheckPlaybackFrame(unsigned long long stateHash)
+{
+    if (!mIsPlaying || mCurrentFrame < 0)
+    {
+        return;
+    }
+
+    if (mFrames[mCurrentFrame].stateHash != stateHash)
+    {
+        if (mFirstMismatchFrame == -1)
+        {
+            mFirstMismatchFrame = mCurrentFrame;
+        }
+        ++mMismatchCount;
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+// Input
+//--------------------------------------------------------------------------------------
+
+int ReplaySystem::GetKeyBit(KeyCode key)
+{
+    for (int i = 0; i < REPLAY_KEY_COUNT; ++i)
+    {
+        if (REPLAY_KEYS[i] == key)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+bool ReplaySystem::KeyHeld(KeyCode key)
+{
+    int bit = GetKeyBit(key);
+    if (bit == -1)
+    {
+        return ::KeyHeld(key); //Not a simulation key, nothing to record
+    }
+
+    if (mIsPlaying && mCurrentFrame >= 0)
+    {
+        return (mFrames[mCurrentFrame].keyMask & (1u << bit)) != 0;
+    }
+
+    bool isHeld = ::KeyHeld(key);
+    if (mIsRecording && isHeld)
+    {
+        mPendingFrame.keyMask |= (1u << bit);
+    }
+    return isHeld;
+}
@@ -0,0 +1,147 @@
+//--------------------------------------------------------------------------------------
+// Deterministic replay
+//--------------------------------------------------------------------------------------
+// Records everything that feeds the simulation each frame (frame time, the keys that move the
+// soft bodies and the scene toggles) along with a hash of the simulation state after the step.
+// Playing the file back feeds the same values in and compares the hashes, so any change that
+// alters the results (threading, SIMD, new solvers) shows up as the first frame that differs.
+//
+// The keys the simulation reads go through SimulationKeyHeld instead of KeyHeld so playback
+// can take over the keyboard. The camera still uses the real keyboard as it doesn't affect the results.
+//
+// File layout:
+//   ReplayHeader, body count * ReplayBodyStart, initial SimulationState bytes, frame count * ReplayFrame
+
+#include "SimulationState.h"
+#include "Input.h"
+
+#include <vector>
+#include <string>
+
+#ifndef _REPLAY_H_INCLUDED_
+#define _REPLAY_H_INCLUDED_
+
+constexpr unsigned int REPLAY_FILE_MAGIC = 0x52504253; //"SBPR"
+constexpr unsigned int REPLAY_VERSION = 1;
+
+// Keys that change the simulation. Each one is a bit in ReplayFrame::keyMask.
+const KeyCode REPLAY_KEYS[] = { Key_I, Key_K, Key_J, Key_L, Key_U, Key_O, Key_Period, Key_Comma };
+constexpr int REPLAY_KEY_COUNT = sizeof(REPLAY_KEYS) / sizeof(REPLAY_KEYS[0]);
+
+// Scene toggles held in ReplayFrame::flags
+enum ReplayFlags
+{
+    ReplaySimulationPaused = 1 << 0,
+    ReplayGravity          = 1 << 1,
+    ReplayCollision        = 1 << 2,
+    ReplaySwitchControl    = 1 << 3,
+    ReplayResetBodies      = 1 << 4, //Reset was pressed during the previous frame
+    ReplayHierarchicalSolver = 1 << 5,
+    ReplayPipelinedCollision = 1 << 6,
+};
+
+struct ReplayFrame
+{
+    float frameTime;
+    unsigned int keyMask;
+    unsigned int flags;
+    int gravityStrength;
+    int currentScene;
+    unsigned int padding; //Always 0, so stateHash's alignment leaves no uninitialised bytes in the file
+    unsigned long long stateHash; //SimulationState::Hash after this frame's step
+};
+
+// Model placement and momentum at the start of the recording. These aren't part of SimulationState but the step depends on them.
+struct ReplayBodyStart
+{
+    CVector3 position;
+    CVector3 rotation;
+};
+
+struct ReplayHeader
+{
+    unsigned int magic;
+    unsigned int version;
+    unsigned int bodyCount;
+    unsigned int frameCount;
+    unsigned int stateSize;
+    CVector3 momentum;
+};
+
+
+class ReplaySystem
+{
+public:
+    //-------------------------------------
+    // Recording
+    //-------------------------------------
+
+    void StartRecording(const SimulationState& initialState, const std::vector<ReplayBodyStart>& bodies, CVector3 momentum);
+
+    // Call at the start of the frame with the toggles that frame will use.
+    void BeginRecordedFrame(ReplayFrame frame);
+
+    // Call once the step is done. Adds the frame with the keys read during it and the resulting state hash.
+    void EndRecordedFrame(unsigned long long stateHash);
+
+    // Writes the recording to disk. Returns false on failure.
+    bool StopRecording(const std::string& fileName);
+
+    //-------------------------------------
+    // Playback
+    //-------------------------------------
+
+    // Loads a recording. Returns false if the file is missing or damaged.
+    bool StartPlayback(const std::string& fileName);
+
+    // Moves to the next recorded frame. Returns false, ending playback, once every frame has been played.
+    bool NextPlaybackFrame(ReplayFrame& frame);
+
+    // Compares the state after the current frame's step with the recorded one.
+    void CheckPlaybackFrame(unsigned long long stateHash);
+
+    void StopPlayback() { mIsPlaying = false; }
+
+    //-------------------------------------
+    // Data access
+    //-------------------------------------
+
+    // Replay aware version of KeyHeld, see SimulationKeyHeld.
+    bool KeyHeld(KeyCode key);
+
+    bool IsRecording() const { return mIsRecording; }
+    bool IsPlaying() const { return mIsPlaying; }
+
+    const SimulationState& GetInitialState() const { return mInitialState; }
+    const std::vector<ReplayBodyStart>& GetInitialBodies() const { return mInitialBodies; }
+    CVector3 GetInitialMomentum() const { return mInitialMomentum; }
+
+    int GetFrameCount() const { return static_cast<int>(mFrames.size()); }
+    int GetCurrentFrame() const { return mCurrentFrame; }
+    int GetMismatchCount() const { return mMismatchCount; }
+    int GetFirstMismatchFrame() const { return mFirstMismatchFrame; } //-1 when every frame so far has matched
+
+private:
+    static int GetKeyBit(KeyCode key);
+
+    bool mIsRecording = false;
+    bool mIsPlaying = false;
+
+    SimulationState mInitialState;
+    std::vector<ReplayBodyStart> mInitialBodies;
+    CVector3 mInitialMomentum = { .0f, .0f, .0f };
+    std::vector<ReplayFrame> mFrames;
+
+    ReplayFrame mPendingFrame; //Frame being recorded, keys are added to it as they are read
+    int mCurrentFrame = -1;
+    int mMismatchCount = 0;
+    int mFirstMismatchFrame = -1;
+};
+
+extern ReplaySystem gReplay;
+
+// Use in place of KeyHeld for any key that changes the simulation. Returns the recorded key during playback and records it while recording.
+inline bool SimulationKeyHeld(KeyCode key) { return gReplay.KeyHeld(key); }
+
+
+#endif //_REPLAY_H_INCLUDED_
@@ -31,8 +31,9 @@ static int frameCount = 0;
 
 constexpr int DELAY_SPRINGS = true;
 
-constexpr float NodeScale = 0.0085f;
-constexpr float SpringScale = 0.1; //Cubes have a size of (10,10,10)
+const std::string TRAJECTORY_FILE_NAME = "SoftBodyTrajectory.sbtr";
+const std::string REPLAY_FILE_NAME = "SoftBodyReplay.sbrp";
+
 //--------------------------------------------------------------------------------------
 //**** Shadow Texture  ****//
 //--------------------------------------------------------------------------------------
@@ -55,6 +56,7 @@ ID3D11Buffer* gPerFrameConstantBuffer; // The GPU buffer that will recieve the c
 
 PerModelConstants gPerModelConstants;      // As above, but constant that change per-model (e.g. world matrix)
 ID3D11Buffer* gPerModelConstantBuffer; 
+ConstantRing gPerModelConstantRing;        // Every model's constants for the frame in one buffer, see Model::Render
 
 
 bool SceneManager::InitGeometry()
@@ -111,36 +113,44 @@ bool SceneManager::InitGeometry()
         gLastError = "Error creating constant buffers";
         return false;
     }
-
-    //Cube map texture
-    if ((HRESULT)DirectX::CreateDDSTextureFromFileEx
-    (
-        gD3DDevice, //Engine/Device
-        L"StreetCubeMap.dds", //Filename
-        2048 * 2048, //Size of texture
-        D3D11_USAGE_DEFAULT, //Usage
-        D3D11_BIND_SHADER_RESOURCE, //Bindflags
-        NULL, //CPUaccess
-        D3D11_RESOURCE_MISC_TEXTURECUBE, //MiscFlags, tells it that it's used for cubemapping
-        false,
-        (ID3D11Resource**)&gStaticReflectionCubeMap,
-        &gStaticReflectionCubeMapSRV
-    ) != S_OK)
-    {
-        gLastError = "Error loading cubemap textures";
+    if (!gPerModelConstantRing.Init())
+    {
         return false;
     }
-    // Load / prepare textures on the GPU ////
-    // Load textures and create DirectX objects for them
 
-
-    for (int i = 0; i < CUBETEXTURECOUNT; ++i)
+    //Texture files need the real device. Without one (see GraphicsDevice.h) the textures are left empty.
+    if (!gGraphics->IsHeadless())
     {
-        if (!LoadTexture(ARR_CUBETEXTURES[i], &gCubeDiffuseSpecularMap[i], &gCubeDiffuseSpecularMapSRV[i]))
+        //Cube map texture
+        if ((HRESULT)DirectX::CreateDDSTextureFromFileEx
+        (
+            gD3DDevice, //Engine/Device
+            L"StreetCubeMap.dds", //Filename
+            2048 * 2048, //Size of texture
+            D3D11_USAGE_DEFAULT, //Usage
+            D3D11_BIND_SHADER_RESOURCE, //Bindflags
+            NULL, //CPUaccess
+            D3D11_RESOURCE_MISC_TEXTURECUBE, //MiscFlags, tells it that it's used for cubemapping
+            false,
+            (ID3D11Resource**)&gStaticReflectionCubeMap,
+            &gStaticReflectionCubeMapSRV
+        ) != S_OK)
         {
-            gLastError = "Error loading cube textures: " + ARR_CUBETEXTURES[i];
+            gLastError = "Error loading cubemap textures";
             return false;
         }
+        // Load / prepare textures on the GPU ////
+        // Load textures and create DirectX objects for them
+
+
+        for (int i = 0; i < CUBETEXTURECOUNT; ++i)
+        {
+            if (!LoadTexture(ARR_CUBETEXTURES[i], &gCubeDiffuseSpecularMap[i], &gCubeDiffuseSpecularMapSRV[i]))
+            {
+                gLastError = "Error loading cube textures: " + ARR_CUBETEXTURES[i];
+                return false;
+            }
+        }
     }
 
     //**** Create Shadow Map texture ****//
@@ -161,7 +171,7 @@ bool SceneManager::InitGeometry()
 
     for (int i = 0; i < SPOT_LIGHT_SHADOW_MAP_COUNT; ++i)
     {
-        if (FAILED(gD3DDevice->CreateTexture2D(&textureDesc, NULL, &gSpotShadowMap[i].Texture)))
+        if (FAILED(gGraphics->CreateTexture2D(&textureDesc, NULL, &gSpotShadowMap[i].Texture)))
         {
             gLastError = "Error creating shadow map texture " + i;
             return false;
@@ -179,7 +189,7 @@ bool SceneManager::InitGeometry()
 
     for (int i = 0; i < SPOT_LIGHT_SHADOW_MAP_COUNT; ++i)
     {
-        if ((FAILED(gD3DDevice->CreateDepthStencilView(gSpotShadowMap[i].Texture, &dsvDesc, &gSpotShadowMap[i].DepthStencil))))
+        if ((FAILED(gGraphics->CreateDepthStencilView(gSpotShadowMap[i].Texture, &dsvDesc, &gSpotShadowMap[i].DepthStencil))))
         {
             gLastError = "Error creating shadow map depth stencil view: 1";
             return false;
@@ -197,7 +207,7 @@ bool SceneManager::InitGeometry()
 
     for (int i = 0; i < SPOT_LIGHT_SHADOW_MAP_COUNT; ++i)
     {
-        if (FAILED(gD3DDevice->CreateShaderResourceView(gSpotShadowMap[i].Texture, &srvDesc, &gSpotShadowMap[i].ShaderResourceView)))
+        if (FAILED(gGraphics->CreateShaderResourceView(gSpotShadowMap[i].Texture, &srvDesc, &gSpotShadowMap[i].ShaderResourceView)))
         {
             gLastError = "Error creating shadow map shader resource view";
             return false;
@@ -234,16 +244,10 @@ bool SceneManager::InitScene()
         gSoftBody[j] = new Model(gSoftBodyMesh[j]);
     }
 
-    unsigned int VertexloopLimit = gSoftBody[0]->GetVectorMax();
-    for (int i = 0; i < /*50; ++i)*/VertexloopLimit; ++i)
-    {
-        VectorRep.push_back(new Model(gSpringMesh));
-    }
-
-    unsigned int SpringloopLimit = gSoftBodyMesh[0]->getSpringSize();
-    for (int i = 0; i < /*50; ++i)*/SpringloopLimit; ++i)
+    //Nodes and springs are drawn as instances of the spring mesh
+    if (!gSpringVisualiser.Init(gSpringMesh))
     {
-        SpringRep.push_back(new Model(gSpringMesh));
+        return false;
     }
 
 
@@ -257,18 +261,29 @@ bool SceneManager::InitScene()
         }
     }
 
-    //Node positions given visual representation.
-    for (int i = 0; i < VectorRep.size(); ++i)
+    for (int i = 0; i < ARR_SCENE_COUNT * ARR_SOFT_BODY_COUNT; ++i)
+    {
+        gSoftBodyLod[i].Build(gSoftBodyMesh[i]);
+    }
+
+    for (int j = 0; j < ARR_SCENE_COUNT; ++j)
     {
-        VectorRep[i]->SetPosition(CVector3(0.0f, 0.0f, 0.0f));
-        VectorRep[i]->SetScale(NodeScale);
+        for (int i = 0; i < ARR_SOFT_BODY_COUNT; ++i)
+        {
+            gSoftBodyWorld[j].AddBody(gSoftBodyMesh[(j * ARR_SOFT_BODY_COUNT) + i]);
+        }
+        gSoftBodyWorld[j].Build();
     }
-    //Set the springs to a basic position, ready to recieve data.
-    for (int i = 0; i < SpringRep.size(); ++i)
+
+    showSpringNum = gSoftBodyMesh[0]->getSpringSize();
+
+    //First snapshot of every body, so there's something to draw before the first step
+    for (int i = 0; i < ARR_SCENE_COUNT * ARR_SOFT_BODY_COUNT; ++i)
     {
-        SpringRep[i]->SetPosition(CVector3(0.0f, 0.0f, 0.0f));
+        gSoftBodyMesh[i]->PublishRenderVertices();
     }
-    showSpringNum = SpringRep.size();
+    BuildFrameGraphs();
+    gSimulationThread.Start([this]() { StepSimulation(); });
 
     // Light set-up - using an array this time
     UnqPtr_Lights[0]->ModelSetup(0, gLightMesh, lightStartPositions[0], CVector3(.0f, .0f, .0f));
@@ -289,6 +304,8 @@ bool SceneManager::InitScene()
 // Release the geometry and scene resources created above
 void SceneManager::ReleaseResources()
 {
+    gSimulationThread.Stop();
+    gTrajectoryRecorder.Stop();
     ReleaseStates();
 
     for (int i = 0; i < SPOT_LIGHT_SHADOW_MAP_COUNT; ++i)
@@ -308,6 +325,7 @@ void SceneManager::ReleaseResources()
     }
 
 
+    gPerModelConstantRing.Release();
     if (gPerModelConstantBuffer)  gPerModelConstantBuffer->Release();
     if (gPerFrameConstantBuffer)  gPerFrameConstantBuffer->Release();
 
@@ -324,6 +342,8 @@ void SceneManager::ReleaseResources()
     delete gLightMesh;     gLightMesh = nullptr;
     delete gFloorMesh;    gFloorMesh = nullptr;
     delete gSpringMesh;     gSpringMesh = nullptr;
+
+    gSpringVisualiser.Release();
 }
 
 
@@ -332,6 +352,13 @@ void SceneManager::ReleaseResources()
 // Scene Rendering
 //--------------------------------------------------------------------------------------
 
+// How far in front of the viewer a point is, used to sort queued draws. The view matrix works on row vectors.
+static float ViewDepth(const CMatrix4x4& view, CVector3 point)
+{
+    return point.x * view.e02 + point.y * view.e12 + point.z * view.e22 + view.e32;
+}
+
+
 // Render the scene from the given light's point of view. Only renders depth buffer
 void SceneManager::RenderDepthBufferForLightIndex(int lightIndex)
 {
@@ -341,160 +368,198 @@ void SceneManager::RenderDepthBufferForLightIndex(int lightIndex)
     gPerFrameConstants.viewMatrix = UnqPtr_Lights[lightIndex]->CalculateViewMatrix();
     gPerFrameConstants.projectionMatrix = UnqPtr_Lights[lightIndex]->CalculateProjectionMatrix();
     gPerFrameConstants.viewProjectionMatrix = gPerFrameConstants.viewMatrix * gPerFrameConstants.projectionMatrix;
-    UpdateConstantBuffer(gPerFrameConstantBuffer, gPerFrameConstants);
+    UploadConstants(gPerFrameConstantBuffer, gPerFrameConstants);
 
     // Indicate that the constant buffer we just updated is for use in the vertex shader (VS) and pixel shader (PS)
-    gD3DContext->PSSetConstantBuffers(0, 2, &gPerFrameConstantBuffer);
-    gD3DContext->VSSetConstantBuffers(0, 2, &gPerFrameConstantBuffer); // First parameter must match constant buffer number in the shader 
+    gGraphics->PSSetConstantBuffers(0, 2, &gPerFrameConstantBuffer);
+    gGraphics->VSSetConstantBuffers(0, 2, &gPerFrameConstantBuffer); // First parameter must match constant buffer number in the shader 
 
 
     //// Only render models that cast shadows ////
 
-    // Use special depth-only rendering shaders
-    gD3DContext->VSSetShader(gBasicTransformVertexShader, nullptr, 0);
-    gD3DContext->PSSetShader(gDepthOnlyPixelShader, nullptr, 0);
-
-    // States - no blending, normal depth buffer and culling
-    gD3DContext->OMSetBlendState(gNoBlendingState, nullptr, 0xffffff);
-    gD3DContext->OMSetDepthStencilState(gUseDepthBufferState, 0);
-    gD3DContext->RSSetState(gCullBackState); //I did both.
+    // Special depth-only rendering shaders, no blending, normal depth buffer and culling. No textures are used in this step.
+    DrawState depthOnly;
+    depthOnly.vertexShader = gBasicTransformVertexShader;
+    depthOnly.pixelShader = gDepthOnlyPixelShader;
+    depthOnly.blendState = gNoBlendingState;
+    depthOnly.depthState = gUseDepthBufferState;
+    depthOnly.rasterizerState = gCullBackState;
 
-    // Render models - no state changes required between each object in this situation (no textures used in this step)
     for (int i = 0; i < ARR_SOFT_BODY_COUNT; ++i)
     {
-        gSoftBody[(currScene * ARR_SOFT_BODY_COUNT) + i]->Render();
+        if (useCulling && !gSoftBodyCuller.IsVisible(lightIndex, i))  continue;
+        Model* body = gSoftBody[(currScene * ARR_SOFT_BODY_COUNT) + i];
+        gRenderQueue.Submit(OpaquePass, depthOnly, ViewDepth(gPerFrameConstants.viewMatrix, body->Position()), [body]() { body->Render(); });
     }
+    FlushRenderQueue();
 }
 
 
-// Render everything in the scene from the given camera
-// This code is common between rendering the main scene and rendering the scene in the portal
-void SceneManager::RenderSceneFromCamera(Camera* camera)
+void SceneManager::FlushRenderQueue()
 {
-    // Set camera matrices in the constant buffer and send over to GPU
-    gPerFrameConstants.viewMatrix = camera->ViewMatrix();
-    gPerFrameConstants.projectionMatrix = camera->ProjectionMatrix();
-    gPerFrameConstants.viewProjectionMatrix = camera->ViewProjectionMatrix();
-    UpdateConstantBuffer(gPerFrameConstantBuffer, gPerFrameConstants);
-
-    // Indicate that the constant buffer we just updated is for use in the vertex shader (VS) and pixel shader (PS)
-    gD3DContext->VSSetConstantBuffers(0, 1, &gPerFrameConstantBuffer); // First parameter must match constant buffer number in the shader 
-    gD3DContext->PSSetConstantBuffers(0, 1, &gPerFrameConstantBuffer);
+    gRenderQueue.Flush(gRenderBackend);
+    PROFILE_COUNTER("State changes", gRenderQueue.GetStateChangeCount());
+    PROFILE_COUNTER("State changes skipped", gRenderQueue.GetSkippedStateCount());
+}
 
-    //// Render lit models ////
 
+// Boxes around where each soft body's nodes are now, tested against every light's view and the camera's.
+// Run by gRenderGraph once every body's box is in gSoftBodyCentres and gSoftBodyExtents.
+void SceneManager::CullSoftBodies()
+{
+    gSoftBodyCuller.SetBodies(gSoftBodyCentres, gSoftBodyExtents, ARR_SOFT_BODY_COUNT);
 
-    // Select which shaders to use next
-    gD3DContext->VSSetShader(gPixelLightingVertexShader[0], nullptr, 0);
-    gD3DContext->PSSetShader(gPixelLightingPixelShader[0], nullptr, 0);
+    gSoftBodyCuller.ClearPasses();
+    for (int i = 0; i < SPOT_LIGHT_SHADOW_MAP_COUNT; ++i)
+    {
+        gSoftBodyCuller.AddPass(UnqPtr_Lights[i]->CalculateViewMatrix() * UnqPtr_Lights[i]->CalculateProjectionMatrix());
+    }
+    gSoftBodyCuller.AddPass(gCamera->ViewProjectionMatrix());
+    gSoftBodyCuller.Cull();
 
-    // States - no blending, normal depth buffer and culling
-    gD3DContext->OMSetBlendState(gNoBlendingState, nullptr, 0xffffff);
-    gD3DContext->OMSetDepthStencilState(gUseDepthBufferState, 0);
-    gD3DContext->RSSetState(gCullBackState);
+    //Of the bodies in view, drop any wholly behind the occluders
+    if (useOcclusionCulling)
+    {
+        Model* occluders[] = { gGround };
+        gOcclusionBuffer.Begin(gCamera->ViewProjectionMatrix());
+        for (Model* occluder : occluders)
+        {
+            Mesh* mesh = occluder->GetMesh();
+            gOcclusionBuffer.AddOccluder(mesh->GetStaticPositions().data(), mesh->GetStaticIndices().data(),
+                                         static_cast<int>(mesh->GetStaticIndices().size()), occluder->WorldMatrix());
+        }
+        gOcclusionBuffer.Rasterise();
 
-    // Select the approriate textures and sampler to use in the pixel shader
+        int occluded = 0;
+        for (int i = 0; i < ARR_SOFT_BODY_COUNT; ++i)
+        {
+            if (gSoftBodyCuller.IsVisible(CAMERA_CULL_PASS, i) && !gOcclusionBuffer.IsVisible(gSoftBodyCentres[i], gSoftBodyExtents[i]))
+            {
+                gSoftBodyCuller.Hide(CAMERA_CULL_PASS, i);
+                ++occluded;
+            }
+        }
+        PROFILE_COUNTER("Soft bodies occluded", occluded);
+    }
 
-            // Select which shaders to use next
-    gD3DContext->VSSetShader(gPixelLightingVertexShader[2], nullptr, 0);
-    gD3DContext->PSSetShader(gPixelLightingPixelShader[2], nullptr, 0);
-    //TEXTURE FOR GROUND HEWRE >..................................................
-    gD3DContext->PSSetSamplers(0, 1, &gAnisotropic4xSampler);
+    int drawn = 0;
+    for (int pass = 0; pass < gSoftBodyCuller.GetPassCount(); ++pass)
+    {
+        drawn += static_cast<int>(gSoftBodyCuller.GetVisible(pass).size());
+    }
+    PROFILE_COUNTER("Soft body draws culled", gSoftBodyCuller.GetPassCount() * ARR_SOFT_BODY_COUNT - drawn);
+}
 
-    gGround->Render();
 
-    // Render model - it will update the model's world matrix and send it to the GPU in a constant buffer, then it will call
-    // the Mesh render function, which will set up vertex & index buffer before finally calling Draw on the GPU
-    // This will also update the node positions if this is a softbody.
+// The ground and soft bodies are drawn in several passes with the same constants, so each gets one slot for the
+// whole frame. The lights set their own colour per draw and keep updating gPerModelConstantBuffer.
+// The slots are reserved and uploaded by RenderScene, this only fills them so it can run as a task.
+void SceneManager::PrepareModelConstants()
+{
+    Model* models[ARR_SOFT_BODY_COUNT + 1];
+    models[0] = gGround;
+    for (int i = 0; i < ARR_SOFT_BODY_COUNT; ++i)
+    {
+        models[i + 1] = gSoftBody[(currScene * ARR_SOFT_BODY_COUNT) + i];
+    }
+    const int modelCount = ARR_SOFT_BODY_COUNT + 1;
 
+    GetTaskPool().ParallelFor(modelCount, CONSTANT_RING_GRAIN, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            models[i]->PrepareConstants(firstModelConstantSlot + i);
+        }
+    });
+}
 
 
+// Render everything in the scene from the given camera
+// This code is common between rendering the main scene and rendering the scene in the portal
+void SceneManager::RenderSceneFromCamera(Camera* camera)
+{
+    PROFILE_SCOPE("Main pass");
+    // Set camera matrices in the constant buffer and send over to GPU
+    gPerFrameConstants.viewMatrix = camera->ViewMatrix();
+    gPerFrameConstants.projectionMatrix = camera->ProjectionMatrix();
+    gPerFrameConstants.viewProjectionMatrix = camera->ViewProjectionMatrix();
+    UploadConstants(gPerFrameConstantBuffer, gPerFrameConstants);
 
-    gD3DContext->PSSetShaderResources(0, 1, &gCubeDiffuseSpecularMapSRV[1]);
+    // Indicate that the constant buffer we just updated is for use in the vertex shader (VS) and pixel shader (PS)
+    gGraphics->VSSetConstantBuffers(0, 1, &gPerFrameConstantBuffer); // First parameter must match constant buffer number in the shader 
+    gGraphics->PSSetConstantBuffers(0, 1, &gPerFrameConstantBuffer);
 
+    //// Render lit models ////
 
-    gD3DContext->PSSetSamplers(0, 1, &gPointSampler);
-    gD3DContext->VSSetShader(gPixelLightingVertexShader[0], nullptr, 0);
-    gD3DContext->PSSetShader(gPixelLightingPixelShader[0], nullptr, 0);
+    // Each draw is queued with the state it needs and the queue sets only what changes between them.
+    // Rendering a model updates its world matrix and sends it to the GPU in a constant buffer, then the mesh
+    // sets up its vertex & index buffers before finally calling Draw on the GPU.
+    const CMatrix4x4& view = gPerFrameConstants.viewMatrix;
 
+    // No blending, normal depth buffer and culling
+    DrawState lit;
+    lit.blendState = gNoBlendingState;
+    lit.depthState = gUseDepthBufferState;
+    lit.rasterizerState = gCullBackState;
 
-    gD3DContext->PSSetShaderResources(0, 1, &gCubeDiffuseSpecularMapSRV[2]);
+    DrawState ground = lit;
+    ground.vertexShader = gPixelLightingVertexShader[2];
+    ground.pixelShader = gPixelLightingPixelShader[2];
+    ground.texture = gCubeDiffuseSpecularMapSRV[0];
+    ground.sampler = gAnisotropic4xSampler;
+    gRenderQueue.Submit(OpaquePass, ground, ViewDepth(view, gGround->Position()), [this]() { gGround->Render(); });
 
     //Render every soft body within the current scene. These soft bodies will appear as rubber
+    DrawState rubber = lit;
+    rubber.vertexShader = gPixelLightingVertexShader[0];
+    rubber.pixelShader = gPixelLightingPixelShader[0];
+    rubber.texture = gCubeDiffuseSpecularMapSRV[2];
+    rubber.sampler = gPointSampler;
     for (int i = 0; i < ARR_SOFT_BODY_COUNT; ++i)
     {
+        if (useCulling && !gSoftBodyCuller.IsVisible(CAMERA_CULL_PASS, i))  continue;
         if (showSprings < SHOW_SPRINGS_LIMIT || i != 0)
         {
-            gSoftBody[(currScene * ARR_SOFT_BODY_COUNT) + i]->Render();
+            Model* body = gSoftBody[(currScene * ARR_SOFT_BODY_COUNT) + i];
+            gRenderQueue.Submit(OpaquePass, rubber, ViewDepth(view, body->Position()), [body]() { body->Render(); });
         }
     }
 
-
+    //Springs are optionally rendered. Every node and spring of the first soft body goes in one draw call.
     //There does not need to be a texture for the springs as they just output (1,1,1) in the pixel shader to make them more visible.
-    gD3DContext->VSSetShader(gPixelLightingVertexShader[1], nullptr, 0);
-    gD3DContext->PSSetShader(gPixelLightingPixelShader[1], nullptr, 0);
-
-    //Springs are optionally rendered.
-    if (showSprings >= SpringShowingNumbers(2))
+    if (showSprings >= SpringShowingNumbers(2) && (!useCulling || gSoftBodyCuller.IsVisible(CAMERA_CULL_PASS, 0)))
     {
-        for (int i = 0; i < VectorRep.size(); ++i)
-        {
-            VectorRep[i]->Render();
-        }
-
-        if (showSprings >= SpringShowingNumbers(3))
-        {
-            for (int i = 0; i < /*50; ++i)*/SpringRep.size(); ++i)
-            {
-                if (i < showSpringNum)
-                {
-                    SpringRep[i]->Render();
-                }
-            }
-        }
+        DrawState springs = rubber;
+        springs.vertexShader = gSpringInstanceVertexShader;
+        springs.pixelShader = gSpringInstancePixelShader;
+        gRenderQueue.Submit(OpaquePass, springs, ViewDepth(view, gSoftBody[(currScene * ARR_SOFT_BODY_COUNT) + 0]->Position()),
+                            [this]() { gSpringVisualiser.Render(); });
     }
 
 
-    gD3DContext->PSSetShaderResources(0, 1, &gCubeDiffuseSpecularMapSRV[0]); // First parameter must match texture slot number in the shade
-    gD3DContext->OMSetBlendState(gSubtractiveBlendState, nullptr, 0xffffff);
-
-
     //// Render lights ////
-    gD3DContext->VSSetShader(gPixelLightingVertexShader[2], nullptr, 0);
-    gD3DContext->PSSetShader(gPixelLightingPixelShader[2], nullptr, 0);
-
-    // Select which shaders to use next
-    gD3DContext->VSSetShader(gBasicTransformVertexShader, nullptr, 0);
-    gD3DContext->PSSetShader(gDepthOnlyPixelShader, nullptr, 0);
 
-    // States - additive blending, read-only depth buffer and no culling (standard set-up for blending
-    gD3DContext->OMSetBlendState(gAdditiveBlendingState, nullptr, 0xffffff);
-    gD3DContext->OMSetDepthStencilState(gDepthReadOnlyState, 0);
-    gD3DContext->RSSetState(gCullNoneState);
-
-    // Render all the lights in the array
+    // Additive blending, read-only depth buffer and no culling (standard set-up for blending)
+    DrawState light;
+    light.vertexShader = gBasicTransformVertexShader;
+    light.pixelShader = gDepthOnlyPixelShader;
+    light.texture = gCubeDiffuseSpecularMapSRV[0];
+    light.sampler = gPointSampler;
+    light.blendState = gAdditiveBlendingState;
+    light.depthState = gDepthReadOnlyState;
+    light.rasterizerState = gCullNoneState;
+
+    // Additive blending doesn't depend on order, so the lights needn't be sorted by distance
     for (int i = 0; i < LIGHT_COUNTER; ++i)
     {
-        gPerModelConstants.objectColour = UnqPtr_Lights[i]->getColour(); // Set any per-model constants apart from the world matrix just before calling render (light colour here)
-        UnqPtr_Lights[i]->Render();
-    }
-
-
-    //Apply collisions as soon as rendering is done.
-    //Iterate through each polygons within every potential colliding model, checking if a point is within its bounds
-    if (isCollisionOn)
-    {
-        for (int i = 0; i < ARR_SOFT_BODY_COUNT; ++i)
+        gRenderQueue.Submit(BlendedPass, light, 0.0f, [this, i]()
         {
-            for (int j = 0; j < ARR_SOFT_BODY_COUNT; ++j)
-            {
-                if (i != j)
-                {
-                    gSoftBody[(currScene * ARR_SOFT_BODY_COUNT) + i]->isCollision(gSoftBody[(currScene * ARR_SOFT_BODY_COUNT) + j]);
-                }
-            }
-        }
+            gPerModelConstants.objectColour = UnqPtr_Lights[i]->getColour(); // Set any per-model constants apart from the world matrix just before calling render (light colour here)
+            UnqPtr_Lights[i]->Render();
+        });
     }
+
+    FlushRenderQueue();
 }
 
 
@@ -503,29 +568,6 @@ void SceneManager::RenderSceneFromCamera(Camera* camera)
 // Then it renders the main scene using the portal texture on a model.
 void SceneManager::RenderScene()
 {
-    ImGui_ImplDX11_NewFrame();
-    ImGui_ImplWin32_NewFrame();
-    ImGui::NewFrame();
-
-
-
-    //  gCube[0]->
-    if (!go)
-    {
-        if (isGravity)
-        {
-
-            gSoftBodyMesh[(currScene * ARR_SOFT_BODY_COUNT) + 0]->VertexData.applyForce(frameTime, CVector3(Cube0momentum.x, Cube0momentum.y + -gravityStrength, Cube0momentum.z));
-            gSoftBodyMesh[(currScene * ARR_SOFT_BODY_COUNT) + 1]->VertexData.applyForce(frameTime, CVector3(0, 0 + -gravityStrength, 0));
-        }
-        else
-        {
-            gSoftBodyMesh[(currScene * ARR_SOFT_BODY_COUNT) + 0]->VertexData.applyForce(frameTime, Cube0momentum);
-            gSoftBodyMesh[(currScene * ARR_SOFT_BODY_COUNT) + 1]->VertexData.applyForce(frameTime, CVector3(0, 0, 0));
-        }
-
-    }
-
     for (int i = 0; i < UnqPtr_Lights.size(); ++i)
     {
         UnqPtr_Lights[i]->LightEffect(frameTime);
@@ -562,17 +604,27 @@ void SceneManager::RenderScene()
     vp.MaxDepth = 1.0f;
     vp.TopLeftX = 0;
     vp.TopLeftY = 0;
-    gD3DContext->RSSetViewports(1, &vp);
+    gGraphics->RSSetViewports(1, &vp);
 
 
 
     // Select the shadow map texture as the current depth buffer. We will not be rendering any pixel colours
     // Also clear the the shadow map depth buffer to the far distance
 
+    //Transforms, culling and model constants. Mapping the ring talks to the GPU so it stays on this thread.
+    gPerModelConstantRing.Begin();
+    firstModelConstantSlot = gPerModelConstantRing.Reserve(ARR_SOFT_BODY_COUNT + 1);
+    gRenderGraph.Run();
+    gPerModelConstantRing.Upload();
+
+    // The GUI sets its own state after the last frame's draws
+    gRenderQueue.Invalidate();
+
     for (int i = 0; i < SPOT_LIGHT_SHADOW_MAP_COUNT; ++i)
     {
-        gD3DContext->OMSetRenderTargets(0, nullptr, gSpotShadowMap[i].DepthStencil);
-        gD3DContext->ClearDepthStencilView(gSpotShadowMap[i].DepthStencil, D3D11_CLEAR_DEPTH, 1.0f, 0);
+        PROFILE_SCOPE("Shadow pass");
+        gGraphics->OMSetRenderTargets(0, nullptr, gSpotShadowMap[i].DepthStencil);
+        gGraphics->ClearDepthStencilView(gSpotShadowMap[i].DepthStencil, D3D11_CLEAR_DEPTH, 1.0f, 0);
         RenderDepthBufferForLightIndex(i);
     }
 
@@ -583,12 +635,12 @@ void SceneManager::RenderScene()
     // Set the back buffer as the target for rendering and select the main depth buffer.
     // When finished the back buffer is sent to the "front buffer" - which is the monitor.
 
-    gD3DContext->OMSetRenderTargets(1, &gBackBufferRenderTarget, gDepthStencil);
+    gGraphics->OMSetRenderTargets(1, &gBackBufferRenderTarget, gDepthStencil);
 
 
     // Clear the back buffer to a fixed colour and the depth buffer to the far distance
-    gD3DContext->ClearRenderTargetView(gBackBufferRenderTarget, &gBackgroundColor.r);
-    gD3DContext->ClearDepthStencilView(gDepthStencil, D3D11_CLEAR_DEPTH, 1.0f, 0);
+    gGraphics->ClearRenderTargetView(gBackBufferRenderTarget, &gBackgroundColor.r);
+    gGraphics->ClearDepthStencilView(gDepthStencil, D3D11_CLEAR_DEPTH, 1.0f, 0);
 
 
 
@@ -599,7 +651,7 @@ void SceneManager::RenderScene()
     vp.MaxDepth = 1.0f;
     vp.TopLeftX = 0;
     vp.TopLeftY = 0;
-    gD3DContext->RSSetViewports(1, &vp);
+    gGraphics->RSSetViewports(1, &vp);
 
 
     // Set shadow maps in shaders
@@ -609,9 +661,9 @@ void SceneManager::RenderScene()
 
     for (int i = 0; i < SPOT_LIGHT_SHADOW_MAP_COUNT; ++i)
     {
-        gD3DContext->PSSetShaderResources(i + 1, 1, &gSpotShadowMap[i].ShaderResourceView);
+        gGraphics->PSSetShaderResources(i + 1, 1, &gSpotShadowMap[i].ShaderResourceView);
 
-        gD3DContext->PSSetSamplers(i + 1, 1, &gPointSampler);
+        gGraphics->PSSetSamplers(i + 1, 1, &gPointSampler);
     }
 
     RenderSceneFromCamera(gCamera);
@@ -622,10 +674,20 @@ void SceneManager::RenderScene()
 
     for (int i = 1; i < SPOT_LIGHT_SHADOW_MAP_COUNT + 1; ++i)
     {
-        gD3DContext->PSSetShaderResources(i, 1, &nullView);
+        gGraphics->PSSetShaderResources(i, 1, &nullView);
     }
+}
 
 
+// Builds and draws the GUI over the finished scene
+void SceneManager::RenderGUI()
+{
+    if (gGraphics->IsHeadless())  return; //ImGui draws with the real device
+    PROFILE_SCOPE("ImGui");
+    ImGui_ImplDX11_NewFrame();
+    ImGui_ImplWin32_NewFrame();
+    ImGui::NewFrame();
+
     //Begin ImGui screen
 
     ImGui::Begin("Soft body Controls - IJKL may be used for movement", 0, ImGuiWindowFlags_AlwaysAutoResize);
@@ -643,19 +705,36 @@ void SceneManager::RenderScene()
     ImGui::SliderInt("Affect inner-to-outer springs", &effectSpringType[1], 0, 1);
     ImGui::SliderInt("Affect outer springs", &effectSpringType[2], 0, 1);
 
+    ImGui::Checkbox("Recalculate normals", &gRecalculateNormals);
+    ImGui::SliderFloat("Normal update distance", &gNormalMoveThreshold, 0.0f, 0.1f);
+    ImGui::Checkbox("Simulate alongside the render", &useSimulationThread);
+    ImGui::Checkbox("Show frame task graphs", &showTaskGraphs);
+    ImGui::Checkbox("Solve springs hierarchically", &useHierarchicalSolver);
+    ImGui::Checkbox("Find collisions alongside the step", &usePipelinedCollision);
+    ImGui::Checkbox("Use levels of detail", &useLevelsOfDetail);
+    ImGui::Checkbox("Cull soft bodies out of view", &useCulling);
+    ImGui::Checkbox("Cull soft bodies behind the floor", &useOcclusionCulling);
+    ImGui::SliderInt("Level of detail budget", &lodBudget, 1000, LOD_BUDGET_LIMIT);
+
+    //Body 0 can be filled with tetrahedra in place of its springs, which starts it again from its rest shape
+    bool isVolume = (gSoftBodyMesh[(currScene * ARR_SOFT_BODY_COUNT) + 0]->getSoftBodyModel() == VolumeModel);
+    if (ImGui::Checkbox("Simulate as a volume", &isVolume))
+    {
+        gSoftBodyLod[(currScene * ARR_SOFT_BODY_COUNT) + 0].SetActiveLevel(0);
+        gSoftBodyMesh[(currScene * ARR_SOFT_BODY_COUNT) + 0]->setSoftBodyModel(isVolume ? VolumeModel : SpringModel);
+        gSoftBodyWorld[currScene].SetBodyMesh(0, gSoftBodyMesh[(currScene * ARR_SOFT_BODY_COUNT) + 0]);
+        gSoftBodyWorld[currScene].Build();
+    }
+
 
     //Iterate through the springs. Only effecting them based on the sliders involved
     //As the outer nodes are bound in place it makes sense to control how the springs
     //Interact with them uniquely. 
     if (ImGui::Button("Apply spring change"))
     {
-        int loopLimitSpring = SpringRep.size();
+        int loopLimitSpring = gSoftBodyMesh[(currScene * ARR_SOFT_BODY_COUNT) + 0]->getSpringSize();
         for (int i = 0; i < /*50; ++i)*/loopLimitSpring; ++i)
         {
-            if (loopLimitSpring > gSoftBodyMesh[(currScene * ARR_SOFT_BODY_COUNT) + 0]->getSpringSize())
-            {
-                loopLimitSpring = gSoftBodyMesh[(currScene * ARR_SOFT_BODY_COUNT) + 0]->getSpringSize();
-            }
 
             int springType = gSoftBodyMesh[(currScene * ARR_SOFT_BODY_COUNT) + 0]->SpringData[i]->getBoundParentCount();
             if (springType == 0 && effectSpringType[0])
@@ -681,10 +760,28 @@ void SceneManager::RenderScene()
 
     if (ImGui::Button("Reset softbody"))
     {
-        Cube0momentum *= 0.0f; //Movement is superficial. Ponts are pushed in a direction and not part of the class itself.
-        //Note that without resistance this will result in objects appearing as if they are being "Pushed", thickening on the side the force is applied
-        gSoftBodyMesh[(currScene * ARR_SOFT_BODY_COUNT) + 0]->VertexData.resetPoints();
-        gSoftBodyMesh[(currScene * ARR_SOFT_BODY_COUNT) + 1]->VertexData.resetPoints();
+        ResetSoftBodies();
+        resetRequested = true;
+    }
+    if (ImGui::Button("Save softbody state"))
+    {
+        gSavedState.Capture(gSoftBodyMesh, ARR_SCENE_COUNT * ARR_SOFT_BODY_COUNT);
+    }
+    if (!gSavedState.IsEmpty() && ImGui::Button("Restore softbody state"))
+    {
+        gSavedState.Restore(gSoftBodyMesh, ARR_SCENE_COUNT * ARR_SOFT_BODY_COUNT);
+        SyncLevelsOfDetail();
+    }
+    if (ImGui::Button(gTrajectoryRecorder.IsRecording() ? "Stop recording" : "Record trajectory"))
+    {
+        if (gTrajectoryRecorder.IsRecording())
+        {
+            gTrajectoryRecorder.Stop();
+        }
+        else
+        {
+            gTrajectoryRecorder.Start(TRAJECTORY_FILE_NAME, gSoftBodyMesh, ARR_SCENE_COUNT * ARR_SOFT_BODY_COUNT);
+        }
     }
     if (ImGui::Button("Activate softbody"))
     {
@@ -698,18 +795,74 @@ void SceneManager::RenderScene()
     {
         isCollisionOn = !isCollisionOn; //Disabled due to errors
     }
+    //Stalls the app while it runs, the timings are written to BENCHMARK_FILE_NAME
+    if (ImGui::Button("Run benchmarks"))
+    {
+        BenchmarkSuite benchmarks;
+        benchmarks.Run();
+        benchmarks.WriteJson(BENCHMARK_FILE_NAME);
+        lastBenchmarkFailures = benchmarks.GetFailedCheckCount();
+    }
+    if (lastBenchmarkFailures > 0)
+    {
+        ImGui::Text("%d benchmark checks failed, see %s", lastBenchmarkFailures, BENCHMARK_FILE_NAME.c_str());
+    }
+
+    //Replays record the inputs of every frame so a run can be repeated exactly and checked for changes in the results.
+    if (gReplay.IsRecording())
+    {
+        ImGui::Text("Recording replay: %d frames", gReplay.GetFrameCount());
+        if (ImGui::Button("Stop replay recording"))
+        {
+            gReplay.StopRecording(REPLAY_FILE_NAME);
+        }
+    }
+    else if (gReplay.IsPlaying())
+    {
+        ImGui::Text("Playing replay: frame %d / %d, mismatches %d", gReplay.GetCurrentFrame() + 1, gReplay.GetFrameCount(), gReplay.GetMismatchCount());
+        if (ImGui::Button("Stop replay"))
+        {
+            gReplay.StopPlayback();
+        }
+    }
+    else
+    {
+        if (ImGui::Button("Record replay"))
+        {
+            StartReplayRecording();
+        }
+        if (ImGui::Button("Play replay"))
+        {
+            StartReplayPlayback(REPLAY_FILE_NAME);
+        }
+        if (ImGui::Button("Verify replay without rendering"))
+        {
+            lastReplayResult = RunReplayHeadless(REPLAY_FILE_NAME);
+        }
+        if (lastReplayResult == 2)
+        {
+            ImGui::Text("Couldn't start replay from %s", REPLAY_FILE_NAME.c_str());
+        }
+        else if (lastReplayResult != -1)
+        {
+            ImGui::Text(lastReplayResult ? "Replay matched on every frame" : "Replay differed from frame %d", gReplay.GetFirstMismatchFrame());
+        }
+    }
     ImGui::End();
 
+    Profiler::ShowPanel();
+    if (showTaskGraphs)
+    {
+        gSimulationGraph.ShowPanel("Simulation tasks");
+        gRenderGraph.ShowPanel("Render preparation tasks");
+    }
+
 
     //showSprings
     //// Scene completion ////
     ImGui::Render();
-    gD3DContext->OMSetRenderTargets(1, &gBackBufferRenderTarget, nullptr);
+    gGraphics->OMSetRenderTargets(1, &gBackBufferRenderTarget, nullptr);
     ImGui_ImplDX11_RenderDrawData(ImGui::GetDrawData());
-
-//Scene compltetion
-    // When drawing to the off-screen back buffer is complete, we "present" the image to the front buffer (the screen)
-    gSwapChain->Present(0, 0);
 }
 
 
@@ -718,93 +871,284 @@ void SceneManager::RenderScene()
 //--------------------------------------------------------------------------------------
 void SceneManager::RunScene(float frameTime_2)
 {
+    PROFILE_FRAME();
     frameTime = frameTime_2;
-   
+
+    //During playback the recorded frame replaces the real frame time and GUI settings.
+    if (gReplay.IsPlaying())
+    {
+        ReplayFrame frame;
+        if (gReplay.NextPlaybackFrame(frame))
+        {
+            ApplyReplayFrame(frame);
+        }
+    }
+    else if (gReplay.IsRecording())
+    {
+        gReplay.BeginRecordedFrame(MakeReplayFrame());
+        resetRequested = false;
+    }
+
     UpdateScene();
-    RenderScene();
+
+    //Either step in line and draw the result, or draw the last step while the thread works out the next.
+    //Either way the thread is idle again before the GUI, which can change anything in the simulation.
+    if (useSimulationThread && gSimulationThread.IsRunning())
+    {
+        PrepareRender();
+        gSimulationThread.StartStep();
+        RenderScene();
+        gSimulationThread.WaitForStep();
+    }
+    else
+    {
+        StepSimulation();
+        PrepareRender();
+        RenderScene();
+    }
+
+    RenderGUI();
+
+//Scene compltetion
+    // When drawing to the off-screen back buffer is complete, we "present" the image to the front buffer (the screen)
+    gGraphics->Present();
 }
-// Update models and camera. frameTime is the time passed since the last frame
-void SceneManager::UpdateScene()
+
+
+// Uploads the latest soft body vertices and builds the spring instances. The render only uses these
+// and the models' matrices so it can run while the simulation is stepping.
+void SceneManager::PrepareRender()
 {
+    for (int i = 0; i < ARR_SOFT_BODY_COUNT; ++i)
+    {
+        gSoftBodyMesh[(currScene * ARR_SOFT_BODY_COUNT) + i]->UpdateVertexBuffer();
+    }
 
+    if (showSprings >= SpringShowingNumbers(2))
+    {
+        Model* body = gSoftBody[(currScene * ARR_SOFT_BODY_COUNT) + 0];
+        int springCount = (showSprings >= SpringShowingNumbers(3)) ? showSpringNum : 0;
+        gSpringVisualiser.Prepare(gSoftBodyMesh[(currScene * ARR_SOFT_BODY_COUNT) + 0], body->Position(), body->Scale(), true, springCount);
+    }
+}
 
 
-    gPerModelConstants.Wiggle += 1.0f * frameTime;
-    // Create a matrix to position the camera - called the view (camera) matrix - we'll see this in more detail later
-    gPerFrameConstants.viewMatrix = InverseAffine(MatrixTranslation(CVector3(0, 0, -4.0f)));
+// Moves the soft bodies on by frameTime and then finds their collisions, which are applied on the next step.
+// The work is in gSimulationGraph, see BuildFrameGraphs.
+void SceneManager::StepSimulation()
+{
+    PROFILE_SCOPE("Simulation");
+    gSimulationGraph.Run();
+}
 
-    // Create a "projection matrix" - this determines properties of the camera - again we'll see this later
-    gPerFrameConstants.projectionMatrix = MakeProjectionMatrix();
 
+// The frame's CPU work as two graphs, each task started as soon as what it reads has been written.
+//
+// gSimulationGraph is StepSimulation, run on the simulation thread while the render works through
+// gRenderGraph when that's on, so both share the pool. The world steps every body in the scene as one
+// system (see SoftBodyWorld), so integration is a single task that spreads itself over the pool. The
+// broad phase only reads the models' positions, which a step never moves, so it runs alongside. Each
+// narrow phase task pushes one body's nodes out of every other body, the only body it writes to, in the
+// same order as testing the pairs one after another, so the result is the same whichever thread runs it.
+// Packing the vertices only reads the positions, so it overlaps the narrow phase.
+//
+// With pipelined collision the narrow phase searches gCollisionPipeline's copy of the positions from
+// before the step instead, so it runs alongside integration, and each body's contacts are committed
+// to its nodes once the step is done.
+//
+// gRenderGraph builds the dirty world matrices, then each body's bounds and the culling that uses them,
+// alongside the model constants.
+void SceneManager::BuildFrameGraphs()
+{
+    gSimulationGraph.Clear();
 
-    // Control sphere (will update its world matrix)
-    if (SwitchControl)
+    const int capture = gSimulationGraph.AddTask("Collision snapshot", [this]()
     {
+        if (!isCollisionOn || !usePipelinedCollision)  return;
 
-        gSoftBody[(currScene * ARR_SOFT_BODY_COUNT) + 1]->Control(frameTime, Key_I, Key_K, Key_J, Key_L, Key_U, Key_O, Key_Period, Key_Comma);
+        gCollisionPipeline.SetBodies(&gSoftBody[currScene * ARR_SOFT_BODY_COUNT], ARR_SOFT_BODY_COUNT);
+        gCollisionPipeline.Capture();
+    });
 
-    }
-    else {
-        if (KeyHeld(Key_I))
+    const int integrate = gSimulationGraph.AddTask("Integrate", [this]()
+    {
+        if (go)  return;
+
+        //Body 0 is the controlled one and carries the momentum, every body gets gravity.
+        CVector3 gravity = isGravity ? CVector3(0, -gravityStrength, 0) : CVector3(0, 0, 0);
+        for (int i = 0; i < ARR_SOFT_BODY_COUNT; ++i)
         {
-            Cube0momentum += CVector3(0, 0, CUBE_SPEED);
+            gSoftBodyWorld[currScene].SetExternalForce(i, (i == 0) ? Cube0momentum + gravity : gravity);
         }
+        gSoftBodyWorld[currScene].SetSolver(useHierarchicalSolver ? HierarchicalSolver : ExplicitSolver);
 
-        if (KeyHeld(Key_K))
+        //Last step's collisions were written to the full meshes, which a proxy level doesn't step
+        for (int i = 0; i < ARR_SOFT_BODY_COUNT; ++i)
         {
-            Cube0momentum += CVector3(0, 0, -CUBE_SPEED);
+            gSoftBodyLod[(currScene * ARR_SOFT_BODY_COUNT) + i].PassCollisionsToProxy();
         }
+        gSoftBodyWorld[currScene].Step(frameTime);
+    });
+
+    int fullMesh[ARR_SOFT_BODY_COUNT];
+    for (int i = 0; i < ARR_SOFT_BODY_COUNT; ++i)
+    {
+        fullMesh[i] = gSimulationGraph.AddTask("Full mesh", [this, i]()
+        {
+            if (!go)  gSoftBodyLod[(currScene * ARR_SOFT_BODY_COUNT) + i].UpdateFullMesh();
+        });
+        gSimulationGraph.AddDependency(integrate, fullMesh[i]);
+    }
+    gSimulationGraph.AddDependency(capture, integrate);
 
-        if (KeyHeld(Key_J))
+    //Only steps that actually moved the bodies are recorded.
+    const int record = gSimulationGraph.AddTask("Record trajectory", [this]()
+    {
+        if (!go && gTrajectoryRecorder.IsRecording())
         {
-            Cube0momentum += CVector3(-CUBE_SPEED, 0, .0f);
+            gTrajectoryRecorder.AddFrame(gSoftBodyMesh, ARR_SCENE_COUNT * ARR_SOFT_BODY_COUNT);
         }
+    });
 
-        if (KeyHeld(Key_L))
+    //Collisions are found after the step and applied by the next one.
+    const int broadPhase = gSimulationGraph.AddTask("Broad phase", [this]()
+    {
+        for (int i = 0; i < ARR_SOFT_BODY_COUNT; ++i)
         {
-            Cube0momentum += CVector3(CUBE_SPEED, 0, .0f);
+            for (int j = 0; j < ARR_SOFT_BODY_COUNT; ++j)
+            {
+                gInCollisionRange[i][j] = isCollisionOn && i != j &&
+                    gSoftBody[(currScene * ARR_SOFT_BODY_COUNT) + i]->IsInCollisionRange(gSoftBody[(currScene * ARR_SOFT_BODY_COUNT) + j]);
+            }
         }
+    });
+
+    //Iterate through each polygons within every potential colliding model, checking if a point is within its bounds
+    int narrowPhase[ARR_SOFT_BODY_COUNT];
+    for (int j = 0; j < ARR_SOFT_BODY_COUNT; ++j)
+    {
+        narrowPhase[j] = gSimulationGraph.AddTask("Narrow phase", [this, j]()
+        {
+            if (usePipelinedCollision)  return;
+
+            Model* collider = gSoftBody[(currScene * ARR_SOFT_BODY_COUNT) + j];
+            for (int i = 0; i < ARR_SOFT_BODY_COUNT; ++i)
+            {
+                if (gInCollisionRange[i][j])  gSoftBody[(currScene * ARR_SOFT_BODY_COUNT) + i]->CollideFaces(collider);
+            }
+        });
+        gSimulationGraph.AddDependency(broadPhase, narrowPhase[j]);
     }
 
-    //Activate/Deactive Sphere->Soft-body collision
-    CVector3 Base = gSoftBody[(currScene * ARR_SOFT_BODY_COUNT) + 0]->Position();
-    CVector3 B_Scale = gSoftBody[(currScene * ARR_SOFT_BODY_COUNT) + 0]->Scale();
-    if (showSprings >= SpringShowingNumbers(2))
+    //Pipelined, each narrow phase searches the snapshot taken before integration began
+    int pipelinedPhase[ARR_SOFT_BODY_COUNT];
+    int commit[ARR_SOFT_BODY_COUNT];
+    for (int j = 0; j < ARR_SOFT_BODY_COUNT; ++j)
     {
-        //Iterate through the nodes within a mesh to create a visual representation placement.
-        for (int i = 0; i < VectorRep.size(); ++i)
+        pipelinedPhase[j] = gSimulationGraph.AddTask("Pipelined narrow phase", [this, j]()
         {
-            CVector3 PolygonModifier = gSoftBody[(currScene * ARR_SOFT_BODY_COUNT) + 0]->GetCollisionVectors(i);
+            if (!usePipelinedCollision)  return;
 
+            for (int i = 0; i < ARR_SOFT_BODY_COUNT; ++i)
+            {
+                if (gInCollisionRange[i][j])  gCollisionPipeline.Detect(i, j);
+            }
+        });
+        gSimulationGraph.AddDependency(capture, pipelinedPhase[j]);
+        gSimulationGraph.AddDependency(broadPhase, pipelinedPhase[j]);
 
-            VectorRep[i]->SetPosition
-            (
-                Base +
-                CVector3(PolygonModifier.x * B_Scale.x, PolygonModifier.y * B_Scale.y, PolygonModifier.z * B_Scale.z)
-            );
-        }
+        commit[j] = gSimulationGraph.AddTask("Commit contacts", [this, j]()
+        {
+            if (usePipelinedCollision && isCollisionOn)  gCollisionPipeline.Commit(j);
+        });
+        gSimulationGraph.AddDependency(pipelinedPhase[j], commit[j]);
+        gSimulationGraph.AddDependency(narrowPhase[j], commit[j]);
     }
-    int loopLimitSpring = SpringRep.size();
 
-    //Calculate physical spring representation
-    for (int i = 0; i < /*50; ++i)*/loopLimitSpring; ++i)
+    const int replay = gSimulationGraph.AddTask("Replay hash", [this]()
     {
-        if (showSprings >= SpringShowingNumbers(3))
+        if (gReplay.IsRecording() || gReplay.IsPlaying())
         {
-            CVector3 PolygonFaceMod = gSoftBody[(currScene * ARR_SOFT_BODY_COUNT) + 0]->getSpringFacing(i, 0);
-            CVector3 PolygonModifier = gSoftBody[(currScene * ARR_SOFT_BODY_COUNT) + 0]->getSpring(i, 0);//->getSpring(i);
-            float ZScaler = Distance(Base + PolygonFaceMod, Base + gSoftBody[(currScene * ARR_SOFT_BODY_COUNT) + 0]->getSpringFacing(i, 1));
+            gReplayState.Capture(gSoftBodyMesh, ARR_SCENE_COUNT * ARR_SOFT_BODY_COUNT);
+            if (gReplay.IsRecording())
+            {
+                gReplay.EndRecordedFrame(gReplayState.Hash());
+            }
+            else
+            {
+                gReplay.CheckPlaybackFrame(gReplayState.Hash());
+            }
+        }
+    });
+
+    //Hand the new shapes to the render, packing each moved body once however many times it moved this frame
+    const int pack = gSimulationGraph.AddTask("Pack vertices", [this]() { gSoftBodyWorld[currScene].PackRenderVertices(); });
+    for (int m = 0; m < ARR_SCENE_COUNT * ARR_SOFT_BODY_COUNT; ++m)
+    {
+        const int publish = gSimulationGraph.AddTask("Publish vertices", [this, m]() { gSoftBodyMesh[m]->PublishRenderVertices(); });
+        gSimulationGraph.AddDependency(pack, publish);
+    }
 
-            //.0025f
-            SpringRep[i]->SetScale(CVector3(NodeScale * 0.1f, NodeScale * 0.1f, ZScaler * SpringScale));
-            SpringRep[i]->SetPosition(Base + PolygonModifier);//CVector3(PolygonModifier.x * B_Scale.x, PolygonModifier.y * B_Scale.y, PolygonModifier.z * B_Scale.z)); //Base + PolygonModifier);   
-            SpringRep[i]->FaceTarget(Base + PolygonFaceMod);
+    for (int i = 0; i < ARR_SOFT_BODY_COUNT; ++i)
+    {
+        gSimulationGraph.AddDependency(fullMesh[i], record);
+        gSimulationGraph.AddDependency(fullMesh[i], pack);
+        for (int j = 0; j < ARR_SOFT_BODY_COUNT; ++j)
+        {
+            gSimulationGraph.AddDependency(fullMesh[i], narrowPhase[j]);
+            gSimulationGraph.AddDependency(fullMesh[i], commit[j]);
         }
+        gSimulationGraph.AddDependency(commit[i], replay);
     }
 
+
+    gRenderGraph.Clear();
+
+    const int transforms = gRenderGraph.AddTask("Transform build", []() { GetTransformStore().UpdateAll(); });
+
+    int bounds[ARR_SOFT_BODY_COUNT];
+    for (int i = 0; i < ARR_SOFT_BODY_COUNT; ++i)
+    {
+        bounds[i] = gRenderGraph.AddTask("Bounds", [this, i]()
+        {
+            gSoftBody[(currScene * ARR_SOFT_BODY_COUNT) + i]->GetBounds(gSoftBodyCentres[i], gSoftBodyExtents[i]);
+        });
+        gRenderGraph.AddDependency(transforms, bounds[i]);
+    }
+
+    const int culling = gRenderGraph.AddTask("Culling", [this]() { CullSoftBodies(); });
+    for (int i = 0; i < ARR_SOFT_BODY_COUNT; ++i)
+    {
+        gRenderGraph.AddDependency(bounds[i], culling);
+    }
+
+    const int constants = gRenderGraph.AddTask("Model constants", [this]() { PrepareModelConstants(); });
+    gRenderGraph.AddDependency(transforms, constants);
+}
+
+
+// Update models and camera. frameTime is the time passed since the last frame
+void SceneManager::UpdateScene()
+{
+    PROFILE_SCOPE("Update");
+
+
+
+    gPerModelConstants.Wiggle += 1.0f * frameTime;
+    // Create a matrix to position the camera - called the view (camera) matrix - we'll see this in more detail later
+    gPerFrameConstants.viewMatrix = InverseAffine(MatrixTranslation(CVector3(0, 0, -4.0f)));
+
+    // Create a "projection matrix" - this determines properties of the camera - again we'll see this later
+    gPerFrameConstants.projectionMatrix = MakeProjectionMatrix();
+
+
+    UpdateSimulationInput();
+
     // Control camera (will update its view matrix)
     gCamera->Control(frameTime, Key_Up, Key_Down, Key_Left, Key_Right, Key_W, Key_S, Key_A, Key_D);
 
+    UpdateLevelsOfDetail();
+
 
     // Show frame time / FPS in the window title //
     const float fpsUpdateTime = 0.5f; // How long between updates (in seconds)
@@ -827,3 +1171,187 @@ void SceneManager::UpdateScene()
     frameCount = 0;
 
 }
+
+// Keyboard control of the soft bodies. Reads keys through SimulationKeyHeld so replays can supply them.
+void SceneManager::UpdateSimulationInput()
+{
+    // Control sphere (will update its world matrix)
+    if (SwitchControl)
+    {
+
+        gSoftBody[(currScene * ARR_SOFT_BODY_COUNT) + 1]->Control(frameTime, Key_I, Key_K, Key_J, Key_L, Key_U, Key_O, Key_Period, Key_Comma);
+
+    }
+    else {
+        if (SimulationKeyHeld(Key_I))
+        {
+            Cube0momentum += CVector3(0, 0, CUBE_SPEED);
+        }
+
+        if (SimulationKeyHeld(Key_K))
+        {
+            Cube0momentum += CVector3(0, 0, -CUBE_SPEED);
+        }
+
+        if (SimulationKeyHeld(Key_J))
+        {
+            Cube0momentum += CVector3(-CUBE_SPEED, 0, .0f);
+        }
+
+        if (SimulationKeyHeld(Key_L))
+        {
+            Cube0momentum += CVector3(CUBE_SPEED, 0, .0f);
+        }
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+// Replays
+//--------------------------------------------------------------------------------------
+
+ReplayFrame SceneManager::MakeReplayFrame()
+{
+    ReplayFrame frame{};
+    frame.frameTime = frameTime;
+    frame.keyMask = 0; //Filled in as the keys are read
+    frame.flags = (go             ? ReplaySimulationPaused : 0) |
+                  (isGravity      ? ReplayGravity          : 0) |
+                  (isCollisionOn  ? ReplayCollision        : 0) |
+                  (SwitchControl  ? ReplaySwitchControl    : 0) |
+                  (resetRequested ? ReplayResetBodies      : 0) |
+                  (useHierarchicalSolver ? ReplayHierarchicalSolver : 0) |
+                  (usePipelinedCollision ? ReplayPipelinedCollision : 0);
+    frame.gravityStrength = gravityStrength;
+    frame.currentScene = currScene;
+    frame.stateHash = 0;
+    return frame;
+}
+
+void SceneManager::ApplyReplayFrame(const ReplayFrame& frame)
+{
+    frameTime = frame.frameTime;
+    go            = (frame.flags & ReplaySimulationPaused) != 0;
+    isGravity     = (frame.flags & ReplayGravity) != 0;
+    isCollisionOn = (frame.flags & ReplayCollision) != 0;
+    SwitchControl = (frame.flags & ReplaySwitchControl) != 0;
+    useHierarchicalSolver = (frame.flags & ReplayHierarchicalSolver) != 0;
+    usePipelinedCollision = (frame.flags & ReplayPipelinedCollision) != 0;
+    gravityStrength = frame.gravityStrength;
+    currScene = frame.currentScene;
+
+    //When recording the reset happened after the previous step, which is the same as doing it now.
+    if (frame.flags & ReplayResetBodies)
+    {
+        ResetSoftBodies();
+    }
+}
+
+void SceneManager::ResetSoftBodies()
+{
+    Cube0momentum *= 0.0f; //Movement is superficial. Ponts are pushed in a direction and not part of the class itself.
+    //Note that without resistance this will result in objects appearing as if they are being "Pushed", thickening on the side the force is applied
+    gSoftBodyMesh[(currScene * ARR_SOFT_BODY_COUNT) + 0]->resetSoftBody();
+    gSoftBodyMesh[(currScene * ARR_SOFT_BODY_COUNT) + 1]->resetSoftBody();
+    SyncLevelsOfDetail();
+}
+
+
+// Picks each body's level of detail from its distance to the camera. Replays always run at full detail,
+// as the camera isn't part of a replay and the level changes the result.
+void SceneManager::UpdateLevelsOfDetail()
+{
+    std::vector<LodBody> bodies(ARR_SOFT_BODY_COUNT);
+    std::vector<int> levels(ARR_SOFT_BODY_COUNT, 0);
+    if (useLevelsOfDetail && !gReplay.IsRecording() && !gReplay.IsPlaying())
+    {
+        for (int i = 0; i < ARR_SOFT_BODY_COUNT; ++i)
+        {
+            bodies[i].lod = &gSoftBodyLod[(currScene * ARR_SOFT_BODY_COUNT) + i];
+            bodies[i].distance = Length(gSoftBody[(currScene * ARR_SOFT_BODY_COUNT) + i]->Position() - gCamera->Position());
+        }
+        ChooseLodLevels(bodies, lodBudget, levels);
+    }
+
+    bool changed = false;
+    for (int i = 0; i < ARR_SOFT_BODY_COUNT; ++i)
+    {
+        SoftBodyLod& lod = gSoftBodyLod[(currScene * ARR_SOFT_BODY_COUNT) + i];
+        if (lod.SetActiveLevel(levels[i]))
+        {
+            gSoftBodyWorld[currScene].SetBodyMesh(i, lod.GetLevelMesh(levels[i]));
+            changed = true;
+        }
+    }
+    if (changed)
+    {
+        gSoftBodyWorld[currScene].Build();
+    }
+}
+
+
+void SceneManager::SyncLevelsOfDetail()
+{
+    for (int i = 0; i < ARR_SCENE_COUNT * ARR_SOFT_BODY_COUNT; ++i)
+    {
+        gSoftBodyLod[i].SyncProxy();
+    }
+}
+
+void SceneManager::StartReplayRecording()
+{
+    std::vector<ReplayBodyStart> bodies(ARR_SCENE_COUNT * ARR_SOFT_BODY_COUNT);
+    for (int i = 0; i < bodies.size(); ++i)
+    {
+        bodies[i].position = gSoftBody[i]->Position();
+        bodies[i].rotation = gSoftBody[i]->Rotation();
+    }
+
+    gReplayState.Capture(gSoftBodyMesh, ARR_SCENE_COUNT * ARR_SOFT_BODY_COUNT);
+    gReplay.StartRecording(gReplayState, bodies, Cube0momentum);
+    resetRequested = false;
+}
+
+bool SceneManager::StartReplayPlayback(const std::string& fileName)
+{
+    if (!gReplay.StartPlayback(fileName))
+    {
+        return false;
+    }
+
+    //Put everything back where it was when the recording started.
+    const std::vector<ReplayBodyStart>& bodies = gReplay.GetInitialBodies();
+    if (bodies.size() != ARR_SCENE_COUNT * ARR_SOFT_BODY_COUNT ||
+        !gReplay.GetInitialState().Restore(gSoftBodyMesh, ARR_SCENE_COUNT * ARR_SOFT_BODY_COUNT))
+    {
+        gReplay.StopPlayback();
+        return false;
+    }
+
+    for (int i = 0; i < bodies.size(); ++i)
+    {
+        gSoftBody[i]->SetPosition(bodies[i].position);
+        gSoftBody[i]->SetRotation(bodies[i].rotation);
+    }
+    Cube0momentum = gReplay.GetInitialMomentum();
+    UpdateLevelsOfDetail();
+    return true;
+}
+
+int SceneManager::RunReplayHeadless(const std::string& fileName)
+{
+    if (!StartReplayPlayback(fileName))
+    {
+        return 2;
+    }
+
+    //Same order as RunScene, minus everything that only affects the picture.
+    ReplayFrame frame;
+    while (gReplay.NextPlaybackFrame(frame))
+    {
+        ApplyReplayFrame(frame);
+        UpdateSimulationInput();
+        StepSimulation();
+    }
+    return (gReplay.GetMismatchCount() == 0) ? 1 : 0;
+}
@@ -5,6 +5,23 @@
 #include "CVector3.h"
 #include <cmath>
 #include "Mesh.h"
+#include "SimulationState.h"
+#include "TrajectoryRecorder.h"
+#include "Replay.h"
+#include "Benchmark.h"
+#include "Profiler.h"
+#include "SoftBodyWorld.h"
+#include "SpringVisualiser.h"
+#include "SimulationThread.h"
+#include "SoftBodyLod.h"
+#include "FrustumCuller.h"
+#include "OcclusionBuffer.h"
+#include "RenderQueue.h"
+#include "ConstantRing.h"
+#include "TaskPool.h"
+#include "TaskGraph.h"
+#include "CollisionPipeline.h"
+#include "GraphicsDevice.h"
 #include "Model.h"
 #include "Camera.h"
 #include "State.h"
@@ -75,9 +92,12 @@ const CVector3 WallPositions[ARR_BOUNDARY_COUNT] =
 };
 
 const float CUBE_SPEED = 1.125f;
+const int LOD_DEFAULT_BUDGET = 20000; //Springs plus nodes simulated each step in a scene, see ChooseLodLevels
+const int LOD_BUDGET_LIMIT = 200000;
 const int GRAVITY_LIMIT = 500.f;
 
 const int SPOT_LIGHT_SHADOW_MAP_COUNT = LIGHT_COUNTER;
+const int CAMERA_CULL_PASS = SPOT_LIGHT_SHADOW_MAP_COUNT; //Culling pass of the camera, after the shadow maps'
 
 
 typedef class Camera;
@@ -119,6 +139,11 @@ public:
 	void RunScene(float frameTime);
 	void ReleaseResources();
 	bool SetupScene() {return (InitGeometry() && InitScene());}
+
+	// Plays a recorded replay without rendering anything, stepping the simulation as fast as possible.
+	// Returns 1 if every frame produced the same state hash as when it was recorded, 0 if one didn't,
+	// or 2 if the replay couldn't be started (no file, or it doesn't fit the scene).
+	int  RunReplayHeadless(const std::string& fileName);
 private:
 
 	int currScene = 0;
@@ -145,7 +170,23 @@ private:
 	
 	
 	void UpdateScene();
+	void UpdateSimulationInput(); //The part of UpdateScene that changes the simulation, kept apart so replays can run it without rendering.
+	void StepSimulation();
+	void BuildFrameGraphs(); //Splits StepSimulation and the CPU side of RenderScene into tasks, once at setup
+	void PrepareRender(); //Everything the render reads from the simulation, done while it isn't stepping.
+	void UpdateLevelsOfDetail();
+	void SyncLevelsOfDetail(); //After the full meshes were moved from outside the simulation
 	void RenderScene();
+	void CullSoftBodies(); //Works out which soft bodies each shadow map and the camera can see, see gSoftBodyCuller
+	void PrepareModelConstants(); //Fills this frame's slots of gPerModelConstantRing for every model drawn
+	void FlushRenderQueue(); //Issues the queued draws and counts the state changes
+	void RenderGUI();
+
+	ReplayFrame MakeReplayFrame();
+	void ApplyReplayFrame(const ReplayFrame& frame);
+	void ResetSoftBodies();
+	void StartReplayRecording();
+	bool StartReplayPlayback(const std::string& fileName);
 	void RenderSceneFromCamera(Camera* camera);
 	void RenderDepthBufferForLightIndex(int lightIndex);
 
@@ -184,11 +225,39 @@ private:
 	Mesh* gBoundaryMesh;
 
 	Model* gSoftBody[ARR_SCENE_COUNT*ARR_SOFT_BODY_COUNT];
+	SoftBodyWorld gSoftBodyWorld[ARR_SCENE_COUNT]; //Every soft body in a scene, stepped together.
+	SoftBodyLod gSoftBodyLod[ARR_SCENE_COUNT * ARR_SOFT_BODY_COUNT]; //Coarser proxies simulated in place of far away bodies
+	bool useHierarchicalSolver = false; //Implicit spring step with a multigrid solve, see SoftBodyWorld
+	bool useLevelsOfDetail = true;
+	int  lodBudget = LOD_DEFAULT_BUDGET;
 	Model* gGround;
 	Model* gWall[ARR_BOUNDARY_COUNT];
 
-	std::vector<Model*> VectorRep;
-	std::vector<Model*> SpringRep;
+	SimulationState gSavedState; //Snapshot taken from the GUI, every soft body in every scene.
+	TrajectoryRecorder gTrajectoryRecorder; //Writes every soft body's particles to disk each step while recording.
+	SimulationState gReplayState; //Reused each frame to hash the state while recording or playing a replay.
+	bool resetRequested = false; //Reset pressed this frame, stored in the next replay frame.
+	int  lastReplayResult = -1; //-1 not run, 0 mismatch, 1 matched, 2 couldn't start. Shown in the GUI.
+	int  lastBenchmarkFailures = -1; //Checks the last benchmark run failed, -1 before any run. Shown in the GUI.
+
+	SpringVisualiser gSpringVisualiser; //Draws the nodes and springs of the first soft body when shown
+	FrustumCuller gSoftBodyCuller; //One pass per shadow map, in light order, then CAMERA_CULL_PASS
+	bool useCulling = true;
+	OcclusionBuffer gOcclusionBuffer; //The floor as the camera sees it, to find bodies hidden behind it
+	bool useOcclusionCulling = true;
+	RenderQueue gRenderQueue; //Draws of each pass, sorted so shared state is only set once
+	D3DRenderBackend gRenderBackend;
+	SimulationThread gSimulationThread; //Runs StepSimulation while the last step is being drawn
+	bool useSimulationThread = true;
+	TaskGraph gSimulationGraph; //StepSimulation's work: integration, full meshes, broad and narrow phase, packing
+	TaskGraph gRenderGraph; //RenderScene's work before the draws: world matrices, bounds, culling, model constants
+	bool showTaskGraphs = false;
+	bool gInCollisionRange[ARR_SOFT_BODY_COUNT][ARR_SOFT_BODY_COUNT]; //Broad phase result, [model][collider]
+	CollisionPipeline gCollisionPipeline; //The current scene's bodies as they were before the step, searched alongside it
+	bool usePipelinedCollision = false;
+	CVector3 gSoftBodyCentres[ARR_SOFT_BODY_COUNT]; //World boxes around the current scene's bodies, for culling
+	CVector3 gSoftBodyExtents[ARR_SOFT_BODY_COUNT];
+	int firstModelConstantSlot = 0; //This frame's gPerModelConstantRing slot for the ground, then each soft body
 	Camera* gCamera;
 
 
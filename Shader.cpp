@@ -4,6 +4,7 @@
 //--------------------------------------------------------------------------------------
 
 #include "Shader.h"
+#include "GraphicsDevice.h"
 #include <fstream>
 #include <vector>
 #include <d3dcompiler.h>
@@ -33,6 +34,9 @@ ID3D11VertexShader* gBasicTransformVertexShader = nullptr; // Used before light
 ID3D11PixelShader*  gLightModelPixelShader  = nullptr;
 ID3D11PixelShader*  gDepthOnlyPixelShader  = nullptr;
 
+ID3D11VertexShader* gSpringInstanceVertexShader = nullptr; // Draws every spring/node in one call, see SpringVisualiser
+ID3D11PixelShader*  gSpringInstancePixelShader  = nullptr;
+
 
 
 //--------------------------------------------------------------------------------------
@@ -57,6 +61,8 @@ bool LoadShaders()
     gBasicTransformVertexShader = LoadVertexShader("BasicTransform_vs");
     gLightModelPixelShader      = LoadPixelShader ("LightModel_ps");
     gDepthOnlyPixelShader       = LoadPixelShader ("DepthOnly_ps");
+    gSpringInstanceVertexShader = LoadVertexShader("SpringInstance_vs");
+    gSpringInstancePixelShader  = LoadPixelShader ("SpringInstance_ps");
 
     for (int i = 0; i < ShaderCount; ++i)
     {
@@ -67,7 +73,8 @@ bool LoadShaders()
         }
     }
 
-    if (gBasicTransformVertexShader == nullptr || gLightModelPixelShader    == nullptr || gDepthOnlyPixelShader == nullptr)
+    if (gBasicTransformVertexShader == nullptr || gLightModelPixelShader    == nullptr || gDepthOnlyPixelShader == nullptr ||
+        gSpringInstanceVertexShader == nullptr || gSpringInstancePixelShader == nullptr)
     {
         gLastError = "Error loading shaders";
         return false;
@@ -79,6 +86,8 @@ bool LoadShaders()
 
 void ReleaseShaders()
 {
+    if (gSpringInstancePixelShader)   gSpringInstancePixelShader->Release();
+    if (gSpringInstanceVertexShader)  gSpringInstanceVertexShader->Release();
     if (gDepthOnlyPixelShader)        gDepthOnlyPixelShader->Release();
     if (gLightModelPixelShader)       gLightModelPixelShader->Release();
     if (gBasicTransformVertexShader)  gBasicTransformVertexShader->Release();
@@ -118,7 +127,7 @@ ID3D11VertexShader* LoadVertexShader(std::string shaderName)
 
     // Create shader object from loaded file (we will use the object later when rendering)
     ID3D11VertexShader* shader;
-    HRESULT hr = gD3DDevice->CreateVertexShader(byteCode.data(), byteCode.size(), nullptr, &shader);
+    HRESULT hr = gGraphics->CreateVertexShader(byteCode.data(), byteCode.size(), nullptr, &shader);
     if (FAILED(hr))
     {
         return nullptr;
@@ -152,7 +161,7 @@ ID3D11PixelShader* LoadPixelShader(std::string shaderName)
 
     // Create shader object from loaded file (we will use the object later when rendering)
     ID3D11PixelShader* shader;
-    HRESULT hr = gD3DDevice->CreatePixelShader(byteCode.data(), byteCode.size(), nullptr, &shader);
+    HRESULT hr = gGraphics->CreatePixelShader(byteCode.data(), byteCode.size(), nullptr, &shader);
     if (FAILED(hr))
     {
         return nullptr;
@@ -178,6 +187,8 @@ ID3DBlob* CreateSignatureForVertexLayout(const D3D11_INPUT_ELEMENT_DESC vertexLa
         else if (format == DXGI_FORMAT_R32G32B32_FLOAT)    shaderSource += "float3";
         else if (format == DXGI_FORMAT_R32G32_FLOAT)       shaderSource += "float2";
         else if (format == DXGI_FORMAT_R32_FLOAT)          shaderSource += "float";
+        else if (format == DXGI_FORMAT_R16G16B16A16_UNORM) shaderSource += "float4";
+        else if (format == DXGI_FORMAT_R8G8B8A8_SNORM)     shaderSource += "float4";
         else return nullptr; // Unsupported type in layout
 
         uint8_t index = static_cast<uint8_t>(vertexLayout[elt].SemanticIndex);
@@ -227,7 +238,7 @@ ID3D11Buffer* CreateConstantBuffer(int size)
     cbDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE; // CPU is only going to write to the constants (not read them)
     cbDesc.MiscFlags = 0;
     ID3D11Buffer* constantBuffer;
-    HRESULT hr = gD3DDevice->CreateBuffer(&cbDesc, nullptr, &constantBuffer);
+    HRESULT hr = gGraphics->CreateBuffer(&cbDesc, nullptr, &constantBuffer);
     if (FAILED(hr))
     {
         return nullptr;
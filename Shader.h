@@ -26,6 +26,9 @@ extern ID3D11VertexShader* gBasicTransformVertexShader;
 extern ID3D11PixelShader*  gLightModelPixelShader;
 extern ID3D11PixelShader*  gDepthOnlyPixelShader;
 
+extern ID3D11VertexShader* gSpringInstanceVertexShader;
+extern ID3D11PixelShader*  gSpringInstancePixelShader;
+
 
 //--------------------------------------------------------------------------------------
 // Shader creation / destruction
@@ -0,0 +1,148 @@
+//--------------------------------------------------------------------------------------
+// Snapshot of the soft body simulation
+//--------------------------------------------------------------------------------------
+
+#include "SimulationState.h"
+
+#include <fstream>
+#include <cstring>
+
+namespace
+{
+    // Steps read past a section of a body (an int count, then count elements of elementSize) if its count
+    // is expectedCount and the whole section fits before readEnd. read is never moved past readEnd.
+    bool SkipSection(const unsigned char*& read, const unsigned char* readEnd, int expectedCount, size_t elementSize)
+    {
+        const size_t left = static_cast<size_t>(readEnd - read);
+        if (left < sizeof(int))  return false;
+
+        int count;
+        memcpy(&count, read, sizeof(int));
+        if (count != expectedCount)  return false;
+
+        const size_t sectionSize = sizeof(int) + static_cast<size_t>(count) * elementSize;
+        if (left < sectionSize)  return false;
+
+        read += sectionSize;
+        return true;
+    }
+}
+
+
+void SimulationState::Capture(Mesh* const* meshes, int meshCount)
+{
+    mData.clear(); //Keeps its capacity
+
+    Header header = { SIMULATION_STATE_MAGIC, SIMULATION_STATE_VERSION, static_cast<unsigned short>(meshCount) };
+    mData.resize(sizeof(Header));
+    memcpy(mData.data(), &header, sizeof(Header));
+
+    for (int i = 0; i < meshCount; ++i)
+    {
+        meshes[i]->saveState(mData);
+    }
+}
+
+
+bool SimulationState::Restore(Mesh* const* meshes, int meshCount) const
+{
+    //Check the whole snapshot first so a bad one can't leave half the bodies restored.
+    if (!IsValidFor(meshes, meshCount))
+    {
+        return false;
+    }
+
+    const unsigned char* read = mData.data() + sizeof(Header);
+    const unsigned char* readEnd = mData.data() + mData.size();
+    for (int i = 0; i < meshCount; ++i)
+    {
+        if (!meshes[i]->loadState(read, readEnd))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+bool SimulationState::IsValidFor(Mesh* const* meshes, int meshCount) const
+{
+    if (mData.size() < sizeof(Header))
+    {
+        return false;
+    }
+
+    Header header;
+    memcpy(&header, mData.data(), sizeof(Header));
+    if (header.magic != SIMULATION_STATE_MAGIC || header.version != SIMULATION_STATE_VERSION || header.bodyCount != meshCount)
+    {
+        return false;
+    }
+
+    //Walk the per-body counts without touching the meshes.
+    const unsigned char* read = mData.data() + sizeof(Header);
+    const unsigned char* readEnd = mData.data() + mData.size();
+    for (int i = 0; i < meshCount; ++i)
+    {
+        FemBody* volume = meshes[i]->getVolume();
+        if (!SkipSection(read, readEnd, meshes[i]->VertexData.getRootSize(), sizeof(NodeState)) ||
+            !SkipSection(read, readEnd, meshes[i]->getSpringSize(), sizeof(float)) ||
+            !SkipSection(read, readEnd, volume ? volume->GetParticleCount() : 0, 6 * sizeof(float)) ||
+            !SkipSection(read, readEnd, volume ? volume->GetTetrahedronCount() : 0, 4 * sizeof(float)))
+        {
+            return false;
+        }
+    }
+    return read == readEnd;
+}
+
+
+unsigned long long SimulationState::Hash() const
+{
+    unsigned long long hash = 14695981039346656037ull;
+    for (size_t i = 0; i < mData.size(); ++i)
+    {
+        hash ^= mData[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+
+bool SimulationState::SaveToFile(const std::string& fileName) const
+{
+    std::ofstream file(fileName, std::ios::out | std::ios::binary);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    file.write(reinterpret_cast<const char*>(mData.data()), mData.size());
+    return !file.fail();
+}
+
+
+bool SimulationState::LoadFromFile(const std::string& fileName)
+{
+    std::ifstream file(fileName, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    std::streamoff fileSize = file.tellg();
+    if (fileSize < static_cast<std::streamoff>(sizeof(Header)))
+    {
+        return false;
+    }
+    file.seekg(0, std::ios::beg);
+
+    mData.resize(static_cast<size_t>(fileSize));
+    file.read(reinterpret_cast<char*>(mData.data()), fileSize);
+    if (file.fail())
+    {
+        mData.clear();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,68 @@
+//--------------------------------------------------------------------------------------
+// Snapshot of the soft body simulation
+//--------------------------------------------------------------------------------------
+// Stores the dynamic state of a set of soft body meshes in one compact block of bytes so the
+// simulation can be rewound, checkpointed or reset. Only the values that change while running
+// are stored (root node positions, old positions, velocities, rebound/delay values, spring
+// coefficients and any volume model particles), the springs, faces and tetrahedra themselves
+// are rebuilt when the mesh is loaded.
+//
+// Layout, everything is little-endian and tightly packed:
+//   Header  - magic, version, body count
+//   Per body (Mesh::saveState) -
+//     int root count,   root count * NodeState
+//     int spring count, spring count * float coefficient
+//     int volume particle count, count * float x, then y, z and the velocities the same way
+//     int tetrahedron count, count * float rotation w, then x, y and z (both counts 0 on the spring model)
+
+#include "Mesh.h"
+
+#include <vector>
+#include <string>
+
+#ifndef _SIMULATION_STATE_H_INCLUDED_
+#define _SIMULATION_STATE_H_INCLUDED_
+
+constexpr unsigned int SIMULATION_STATE_MAGIC = 0x53534253; //"SBSS"
+constexpr unsigned short SIMULATION_STATE_VERSION = 3;
+
+
+class SimulationState
+{
+public:
+    // Copies the state of each mesh into this snapshot. The buffer is reused so capturing every frame doesn't allocate once warmed up.
+    void Capture(Mesh* const* meshes, int meshCount);
+
+    // Writes the snapshot back into the meshes. The meshes must be the same ones, in the same order, that were captured.
+    // Returns false, leaving the meshes untouched, if the snapshot doesn't match them.
+    bool Restore(Mesh* const* meshes, int meshCount) const;
+
+    // Checkpoints for long runs. Returns false on failure.
+    bool SaveToFile(const std::string& fileName) const;
+    bool LoadFromFile(const std::string& fileName);
+
+    // Replaces the snapshot with bytes saved elsewhere, e.g. inside a replay file. Checked when restored.
+    void SetData(const unsigned char* data, size_t size) { mData.assign(data, data + size); }
+
+    // 64-bit FNV-1a of the snapshot bytes. Two runs that match bit for bit give the same hash, used to catch determinism regressions.
+    unsigned long long Hash() const;
+
+    bool IsEmpty() const { return mData.empty(); }
+    size_t GetSize() const { return mData.size(); }
+    const std::vector<unsigned char>& GetData() const { return mData; }
+
+private:
+    struct Header
+    {
+        unsigned int   magic;
+        unsigned short version;
+        unsigned short bodyCount;
+    };
+
+    bool IsValidFor(Mesh* const* meshes, int meshCount) const;
+
+    std::vector<unsigned char> mData;
+};
+
+
+#endif //_SIMULATION_STATE_H_INCLUDED_
@@ -0,0 +1,74 @@
+//--------------------------------------------------------------------------------------
+// Runs the simulation step on its own thread alongside the render
+//--------------------------------------------------------------------------------------
+
+#include "SimulationThread.h"
+#include "Profiler.h"
+
+
+SimulationThread::~SimulationThread()
+{
+    Stop();
+}
+
+
+void SimulationThread::Start(const std::function<void()>& step)
+{
+    if (IsRunning())  return;
+
+    mStep = step;
+    mStepPending = false;
+    mQuit = false;
+    mThread = std::thread(&SimulationThread::ThreadLoop, this);
+}
+
+
+void SimulationThread::Stop()
+{
+    if (!IsRunning())  return;
+
+    WaitForStep();
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mQuit = true;
+    }
+    mStartCondition.notify_one();
+    mThread.join();
+}
+
+
+void SimulationThread::StartStep()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStepPending = true;
+    }
+    mStartCondition.notify_one();
+}
+
+
+void SimulationThread::WaitForStep()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    mDoneCondition.wait(lock, [this]() { return !mStepPending; });
+}
+
+
+void SimulationThread::ThreadLoop()
+{
+    Profiler::SetThreadName("Simulation");
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (true)
+    {
+        mStartCondition.wait(lock, [this]() { return mStepPending || mQuit; });
+        if (mQuit)  return;
+
+        lock.unlock();
+        mStep();
+        lock.lock();
+
+        mStepPending = false;
+        mDoneCondition.notify_all();
+    }
+}
@@ -0,0 +1,56 @@
+//--------------------------------------------------------------------------------------
+// Runs the simulation step on its own thread alongside the render
+//--------------------------------------------------------------------------------------
+// Each frame the scene hands a step to the thread with StartStep, draws the last step's
+// results while it runs and then calls WaitForStep before changing anything the step uses
+// (input, GUI settings, resets). Frame N is drawn while N+1 is simulated, with one frame of
+// latency, and every step sees exactly the same inputs as it would run in line, so replays
+// still match.
+//
+// The step publishes each soft body's vertices into its Mesh (Mesh::PublishRenderVertices) and
+// the render picks up the newest ones through a TripleBuffer, so that handoff never locks.
+// Only StartStep and WaitForStep synchronise, once each per frame.
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+#ifndef _SIMULATION_THREAD_H_INCLUDED_
+#define _SIMULATION_THREAD_H_INCLUDED_
+
+
+class SimulationThread
+{
+public:
+    ~SimulationThread();
+
+    // Starts the thread, step is called on it for each StartStep
+    void Start(const std::function<void()>& step);
+
+    // Waits for any step in progress and ends the thread
+    void Stop();
+
+    bool IsRunning() { return mThread.joinable(); }
+
+    // Begins a step on the thread. The previous one must have been waited for.
+    void StartStep();
+
+    // Blocks until the step begun by StartStep has finished. Returns straight away if none is running.
+    void WaitForStep();
+
+private:
+    void ThreadLoop();
+
+    std::thread mThread;
+    std::function<void()> mStep;
+
+    std::mutex mMutex;
+    std::condition_variable mStartCondition;
+    std::condition_variable mDoneCondition;
+    bool mStepPending = false;
+    bool mQuit = false;
+};
+
+
+#endif //_SIMULATION_THREAD_H_INCLUDED_
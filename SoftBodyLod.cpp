@@ -0,0 +1,373 @@
+//--------------------------------------------------------------------------------------
+// Coarser stand-ins for a soft body, simulated in its place when it can't be afforded
+//--------------------------------------------------------------------------------------
+
+#include "SoftBodyLod.h"
+
+#include <unordered_map>
+#include <set>
+#include <array>
+#include <algorithm>
+#include <cmath>
+
+
+void SoftBodyLod::Build(Mesh* mesh)
+{
+    mMesh = mesh;
+    mLevels.clear();
+    mActiveLevel = 0;
+
+    mRestPositions.resize(mesh->VertexData.getSize());
+    for (int i = 0; i < mRestPositions.size(); ++i)
+    {
+        mRestPositions[i] = mesh->VertexData.getPosition(i);
+    }
+
+    int vertexCount = mesh->getVertexCount();
+    for (int cells = LOD_BASE_CELLS; mLevels.size() + 1 < LOD_MAX_LEVELS && cells >= 1; cells /= 2)
+    {
+        if (BuildLevel(cells, vertexCount))
+        {
+            vertexCount = mLevels.back().mesh->getVertexCount();
+        }
+    }
+
+    mPositions.resize(mesh->VertexData.getSize());
+}
+
+
+bool SoftBodyLod::BuildLevel(int cellsAcross, int previousVertexCount)
+{
+    Node& nodes = mMesh->VertexData;
+    int renderCount = mMesh->getVertexCount();
+    int coreCount = nodes.getSize() - renderCount;
+    const std::vector<int>& faces = mMesh->getFaceIndices();
+
+    //Grid over the rest shape
+    CVector3 minBound = nodes.GetChildNode(0)->BasicData.Position;
+    CVector3 maxBound = minBound;
+    for (int i = 1; i < renderCount; ++i)
+    {
+        const CVector3& position = nodes.GetChildNode(i)->BasicData.Position;
+        minBound = CVector3(std::min(minBound.x, position.x), std::min(minBound.y, position.y), std::min(minBound.z, position.z));
+        maxBound = CVector3(std::max(maxBound.x, position.x), std::max(maxBound.y, position.y), std::max(maxBound.z, position.z));
+    }
+    CVector3 size = maxBound - minBound;
+    float cellSize = std::max(size.x, std::max(size.y, size.z)) / cellsAcross;
+    if (cellSize <= 0)  return false;
+
+    //Every vertex falls into a cell, which becomes a proxy vertex if any quad survives through it
+    std::unordered_map<long long, int> cellIndex;
+    std::vector<int> vertexCell(renderCount);
+    for (int i = 0; i < renderCount; ++i)
+    {
+        CVector3 offset = nodes.GetChildNode(i)->BasicData.Position - minBound;
+        long long x = static_cast<long long>(offset.x / cellSize);
+        long long y = static_cast<long long>(offset.y / cellSize);
+        long long z = static_cast<long long>(offset.z / cellSize);
+        long long key = (x * (cellsAcross + 1) + y) * (cellsAcross + 1) + z;
+
+        auto found = cellIndex.find(key);
+        if (found == cellIndex.end())
+        {
+            found = cellIndex.emplace(key, static_cast<int>(cellIndex.size())).first;
+        }
+        vertexCell[i] = found->second;
+    }
+
+    //setupSpring reads faces in pairs making a quad, so quads are kept or dropped whole.
+    //A quad is kept if its four corners are still in four different cells, and only once.
+    std::vector<int> cellVertex(cellIndex.size(), -1);
+    std::vector<int> quadCells;
+    std::set<std::array<int, 4>> keptQuads;
+    for (size_t face = 0; face + 5 < faces.size(); face += 6)
+    {
+        int a = vertexCell[faces[face]];
+        int b = vertexCell[faces[face + 1]];
+        int c = vertexCell[faces[face + 2]];
+        if (a == b || b == c || c == a)  continue;
+
+        int d = -1;
+        for (int i = 3; i < 6 && d < 0; ++i)
+        {
+            int corner = vertexCell[faces[face + i]];
+            if (corner != a && corner != b && corner != c)  d = corner;
+        }
+        if (d < 0)  continue;
+
+        std::array<int, 4> quad = { a, b, c, d };
+        std::sort(quad.begin(), quad.end());
+        if (!keptQuads.insert(quad).second)  continue;
+
+        quadCells.insert(quadCells.end(), { a, b, c, d, b, c });
+    }
+
+    //Proxy vertices sit at the middle of the vertices in their cell
+    std::vector<BasicNode> proxyVertices;
+    std::vector<int> cellCount;
+    for (int cell : quadCells)
+    {
+        if (cellVertex[cell] < 0)
+        {
+            cellVertex[cell] = static_cast<int>(proxyVertices.size());
+            proxyVertices.push_back({ CVector3(0, 0, 0), CVector3(0, 0, 0), CVector2(0, 0) });
+            cellCount.push_back(0);
+        }
+    }
+    int proxyCount = static_cast<int>(proxyVertices.size());
+    if (proxyCount < LOD_MIN_VERTICES || proxyCount > previousVertexCount * LOD_MIN_REDUCTION)  return false;
+
+    for (int i = 0; i < renderCount; ++i)
+    {
+        int proxy = cellVertex[vertexCell[i]];
+        if (proxy < 0)  continue;
+
+        const BasicNode& vertex = nodes.GetChildNode(i)->BasicData;
+        proxyVertices[proxy].Position += vertex.Position;
+        proxyVertices[proxy].Normal += vertex.Normal;
+        if (cellCount[proxy]++ == 0)  proxyVertices[proxy].UV = vertex.UV;
+    }
+    for (int i = 0; i < proxyCount; ++i)
+    {
+        proxyVertices[i].Position = proxyVertices[i].Position / static_cast<float>(cellCount[i]);
+        if (Dot(proxyVertices[i].Normal, proxyVertices[i].Normal) > 0)  proxyVertices[i].Normal = Normalise(proxyVertices[i].Normal);
+    }
+
+    std::vector<unsigned int> proxyIndices;
+    for (int cell : quadCells)
+    {
+        proxyIndices.push_back(cellVertex[cell]);
+    }
+
+    Level level;
+    level.mesh.reset(new Mesh(proxyVertices, proxyIndices, true, false));
+    Node& proxyNodes = level.mesh->VertexData;
+    if (proxyNodes.getSize() - proxyCount != coreCount)  return false;
+    proxyNodes.setOriginPoint(nodes.getOriginPoint());
+
+    level.restPositions.resize(proxyNodes.getSize());
+    for (int p = 0; p < proxyNodes.getSize(); ++p)
+    {
+        level.restPositions[p] = proxyNodes.getPosition(p);
+    }
+
+    //Each drawn vertex follows its nearest proxy vertices, each core node the matching proxy core node
+    level.influenceNode.assign(nodes.getSize() * LOD_INFLUENCES, 0);
+    level.influenceWeight.assign(nodes.getSize() * LOD_INFLUENCES, 0);
+    level.influenceOffset.assign(nodes.getSize() * LOD_INFLUENCES, CVector3(0, 0, 0));
+    level.owner.resize(nodes.getSize());
+
+    for (int i = 0; i < nodes.getSize(); ++i)
+    {
+        CVector3 position = nodes.GetChildNode(i)->BasicData.Position;
+        int* influenceNode = &level.influenceNode[i * LOD_INFLUENCES];
+        float* influenceWeight = &level.influenceWeight[i * LOD_INFLUENCES];
+        CVector3* influenceOffset = &level.influenceOffset[i * LOD_INFLUENCES];
+
+        if (i >= renderCount)
+        {
+            influenceNode[0] = proxyCount + (i - renderCount);
+            influenceWeight[0] = 1.0f;
+            influenceOffset[0] = position - proxyNodes.getPosition(influenceNode[0]);
+            level.owner[i] = influenceNode[0];
+            continue;
+        }
+
+        //Nearest few, kept in order
+        float nearestDistance[LOD_INFLUENCES];
+        int found = 0;
+        for (int p = 0; p < proxyCount; ++p)
+        {
+            CVector3 offset = position - proxyNodes.getPosition(p);
+            float distance = Dot(offset, offset);
+            if (found == LOD_INFLUENCES && distance >= nearestDistance[LOD_INFLUENCES - 1])  continue;
+
+            int slot = (found < LOD_INFLUENCES) ? found++ : LOD_INFLUENCES - 1;
+            while (slot > 0 && nearestDistance[slot - 1] > distance)
+            {
+                nearestDistance[slot] = nearestDistance[slot - 1];
+                influenceNode[slot] = influenceNode[slot - 1];
+                --slot;
+            }
+            nearestDistance[slot] = distance;
+            influenceNode[slot] = p;
+        }
+
+        float totalWeight = 0;
+        for (int k = 0; k < found; ++k)
+        {
+            influenceWeight[k] = std::exp(-nearestDistance[k] / (cellSize * cellSize));
+            totalWeight += influenceWeight[k];
+        }
+        for (int k = 0; k < found; ++k)
+        {
+            influenceWeight[k] = (totalWeight > 0) ? influenceWeight[k] / totalWeight : (k == 0 ? 1.0f : 0.0f);
+            influenceOffset[k] = position - proxyNodes.getPosition(influenceNode[k]);
+        }
+        level.owner[i] = influenceNode[0];
+    }
+
+    mLevels.push_back(std::move(level));
+    return true;
+}
+
+
+int SoftBodyLod::GetLevelCost(int level)
+{
+    Mesh* mesh = GetLevelMesh(level);
+    return mesh->getSpringSize() + mesh->VertexData.getSize();
+}
+
+
+bool SoftBodyLod::SetActiveLevel(int level)
+{
+    level = std::max(0, std::min(level, GetLevelCount() - 1));
+    if (level == mActiveLevel)  return false;
+
+    //The full nodes always hold the current shape, so only a proxy being switched to needs setting up
+    mActiveLevel = level;
+    SyncProxy();
+    return true;
+}
+
+
+void SoftBodyLod::UpdateFullMesh()
+{
+    if (mActiveLevel == 0)  return;
+
+    const Level& level = mLevels[mActiveLevel - 1];
+    Node& nodes = mMesh->VertexData;
+    Node& proxyNodes = level.mesh->VertexData;
+
+    for (int i = 0; i < nodes.getSize(); ++i)
+    {
+        if (!nodes.isRoot(i))  continue;
+
+        CVector3 position = { 0, 0, 0 };
+        for (int k = i * LOD_INFLUENCES; k < (i + 1) * LOD_INFLUENCES; ++k)
+        {
+            if (level.influenceWeight[k] > 0)
+            {
+                position += (proxyNodes.getPosition(level.influenceNode[k]) + level.influenceOffset[k]) * level.influenceWeight[k];
+            }
+        }
+        mPositions[i] = position;
+    }
+    nodes.setPositions(mPositions.data(), NULL);
+
+    //The model may have moved, which changes where the ground is for the proxy
+    proxyNodes.setOriginPoint(nodes.getOriginPoint());
+}
+
+
+// A response is a target position summed delayChange times, so each target moves by the node's offset from its
+// owner and is added on with the same weight
+void SoftBodyLod::PassCollisionsToProxy()
+{
+    if (mActiveLevel == 0)  return;
+
+    const Level& level = mLevels[mActiveLevel - 1];
+    Node& nodes = mMesh->VertexData;
+    Node& proxyNodes = level.mesh->VertexData;
+
+    for (int i = 0; i < nodes.getSize(); ++i)
+    {
+        NodeData* node = nodes.GetChildNode(i);
+        if (!nodes.isRoot(i) || node->delayChange == 0)  continue;
+
+        int owner = level.owner[i];
+        int k = i * LOD_INFLUENCES;
+        while (level.influenceNode[k] != owner)  ++k;
+
+        NodeData* proxyNode = proxyNodes.GetChildNode(owner);
+        proxyNode->ReboundForce += node->ReboundForce - level.influenceOffset[k] * static_cast<float>(node->delayChange);
+        proxyNode->delayChange += node->delayChange;
+
+        node->ReboundForce = CVector3(.0f, .0f, .0f);
+        node->delayChange = 0;
+    }
+}
+
+
+void SoftBodyLod::SyncProxy()
+{
+    if (mActiveLevel == 0)  return;
+
+    const Level& level = mLevels[mActiveLevel - 1];
+    Node& nodes = mMesh->VertexData;
+    Node& proxyNodes = level.mesh->VertexData;
+
+    //Each proxy node goes to the average of where the full nodes it owns put it
+    int proxySize = proxyNodes.getSize();
+    std::vector<CVector3> positions(proxySize, CVector3(0, 0, 0));
+    std::vector<CVector3> oldPositions(proxySize, CVector3(0, 0, 0));
+    std::vector<int> count(proxySize, 0);
+    CVector3 totalMove = { 0, 0, 0 };
+
+    for (int i = 0; i < nodes.getSize(); ++i)
+    {
+        const NodeData* node = nodes.getNode(i);
+        int owner = level.owner[i];
+        int k = i * LOD_INFLUENCES;
+        while (level.influenceNode[k] != owner)  ++k;
+
+        positions[owner] += node->BasicData.Position - level.influenceOffset[k];
+        oldPositions[owner] += node->Old_Position - level.influenceOffset[k];
+        ++count[owner];
+        totalMove += node->BasicData.Position - mRestPositions[i];
+    }
+
+    //A proxy node that owns nothing (e.g. with every nearby vertex closer to another) moves with the body as a whole
+    CVector3 averageMove = totalMove / static_cast<float>(nodes.getSize());
+    for (int p = 0; p < proxySize; ++p)
+    {
+        if (count[p] > 0)
+        {
+            positions[p] = positions[p] / static_cast<float>(count[p]);
+            oldPositions[p] = oldPositions[p] / static_cast<float>(count[p]);
+        }
+        else
+        {
+            positions[p] = level.restPositions[p] + averageMove;
+            oldPositions[p] = positions[p];
+        }
+    }
+
+    proxyNodes.setOriginPoint(nodes.getOriginPoint());
+    proxyNodes.setPositions(positions.data(), oldPositions.data());
+}
+
+
+void ChooseLodLevels(const std::vector<LodBody>& bodies, int budget, std::vector<int>& levels)
+{
+    levels.resize(bodies.size());
+    int spent = 0;
+    for (int b = 0; b < bodies.size(); ++b)
+    {
+        levels[b] = bodies[b].lod->GetLevelCount() - 1;
+        spent += bodies[b].lod->GetLevelCost(levels[b]);
+    }
+
+    std::vector<int> order(bodies.size());
+    for (int b = 0; b < order.size(); ++b)
+    {
+        order[b] = b;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return bodies[a].distance < bodies[b].distance; });
+
+    for (int b : order)
+    {
+        SoftBodyLod* lod = bodies[b].lod;
+        int coarseCost = lod->GetLevelCost(levels[b]);
+        for (int level = 0; level < levels[b]; ++level)
+        {
+            int extra = lod->GetLevelCost(level) - coarseCost;
+            if (spent + extra <= budget)
+            {
+                levels[b] = level;
+                spent += extra;
+                break;
+            }
+        }
+    }
+}
@@ -0,0 +1,99 @@
+//--------------------------------------------------------------------------------------
+// Coarser stand-ins for a soft body, simulated in its place when it can't be afforded
+//--------------------------------------------------------------------------------------
+// Build makes a few levels of detail from the body's mesh at load time. Level 0 is the mesh
+// itself. Each level after it snaps the vertices to a grid twice as coarse as the last, keeps
+// the quads whose four corners still land in different cells and makes a new soft body from
+// them with the same Mesh::setupSpring (so the same springs and core nodes) as the full mesh.
+//
+// While a proxy level is active it's simulated instead of the full mesh, and the full mesh's
+// nodes are moved after each step to follow it. Each drawn vertex is attached to its nearest
+// proxy vertices with radial basis (Gaussian) weights and keeps its offset from each of them,
+// each core node follows the matching proxy core node. As the full nodes always hold the
+// current shape, rendering, collision checks, snapshots and replays all keep using the full
+// mesh. Collision responses found on the full nodes are handed to the proxy nodes that own them
+// before the next step, as the full nodes' own are overwritten when they're moved.
+//
+// ChooseLodLevels picks every body's level from a budget of springs and nodes, nearest first.
+
+#include "Mesh.h"
+
+#include <vector>
+#include <memory>
+
+#ifndef _SOFT_BODY_LOD_H_INCLUDED_
+#define _SOFT_BODY_LOD_H_INCLUDED_
+
+constexpr int LOD_MAX_LEVELS = 4;     //Including the full mesh
+constexpr int LOD_BASE_CELLS = 16;    //Grid cells along the longest side of the body for level 1
+constexpr int LOD_MIN_VERTICES = 16;  //No level is made with fewer drawn vertices than this
+constexpr float LOD_MIN_REDUCTION = 0.75f; //A level must have at most this fraction of the vertices of the one before
+constexpr int LOD_INFLUENCES = 4;     //Proxy vertices each full vertex follows
+
+
+class SoftBodyLod
+{
+public:
+    // Makes the proxy levels for mesh, which must be a soft body in its rest shape
+    void Build(Mesh* mesh);
+
+    // A body on the volume model has no proxies, as they're built from springs
+    int GetLevelCount() { return (mMesh && mMesh->getSoftBodyModel() == VolumeModel) ? 1 : static_cast<int>(mLevels.size()) + 1; }
+    int GetActiveLevel() { return mActiveLevel; }
+
+    // The mesh simulated at a level, 0 being the full mesh
+    Mesh* GetLevelMesh(int level) { return (level == 0) ? mMesh : mLevels[level - 1].mesh.get(); }
+
+    // Springs plus nodes, as a measure of how long a step of the level takes
+    int GetLevelCost(int level);
+
+    // Switches level, carrying the current shape and movement across. Returns true if the level changed.
+    bool SetActiveLevel(int level);
+
+    // Moves the full mesh's nodes to follow the active proxy. Call after every step.
+    void UpdateFullMesh();
+
+    // Hands the collision responses waiting on the full mesh's nodes to the active proxy's nodes. Call before every step.
+    void PassCollisionsToProxy();
+
+    // Puts the active proxy into the full mesh's shape, after it was moved from outside (reset, restored etc.)
+    void SyncProxy();
+
+private:
+    struct Level
+    {
+        std::unique_ptr<Mesh> mesh;
+
+        // Per full node, LOD_INFLUENCES each. A full node at i follows proxy nodes influenceNode[] by influenceWeight[],
+        // each with the offset from that node it had in the rest shape.
+        std::vector<int>      influenceNode;
+        std::vector<float>    influenceWeight;
+        std::vector<CVector3> influenceOffset;
+
+        std::vector<int> owner; //Per full node, the proxy node it counts towards when the proxy takes the full shape
+        std::vector<CVector3> restPositions; //Per proxy node
+    };
+
+    bool BuildLevel(int cellsAcross, int previousVertexCount);
+
+    Mesh* mMesh = nullptr;
+    std::vector<Level> mLevels;
+    int mActiveLevel = 0;
+
+    std::vector<CVector3> mRestPositions; //Per full node
+    std::vector<CVector3> mPositions;     //Scratch space for moving the full nodes
+};
+
+
+struct LodBody
+{
+    SoftBodyLod* lod;
+    float distance; //From the camera, nearer bodies get the detail first
+};
+
+// Chooses a level for each body so that their total cost stays within budget, where it can. Every body starts
+// at its coarsest level, then nearest first each takes the finest level that still fits.
+void ChooseLodLevels(const std::vector<LodBody>& bodies, int budget, std::vector<int>& levels);
+
+
+#endif //_SOFT_BODY_LOD_H_INCLUDED_
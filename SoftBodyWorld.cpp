@@ -0,0 +1,464 @@
+//--------------------------------------------------------------------------------------
+// Steps a group of soft bodies together as one set of particles and springs
+//--------------------------------------------------------------------------------------
+
+#include "SoftBodyWorld.h"
+#include "TaskPool.h"
+#include "Profiler.h"
+
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+
+
+const float WORLD_GROUND_HEIGHT = -.0f; //Same as the ground used by Node::applyForce
+
+
+int SoftBodyWorld::AddBody(Mesh* mesh)
+{
+    mBodies.push_back({ mesh, 0, 0, CVector3(0, 0, 0), 0 });
+    return static_cast<int>(mBodies.size()) - 1;
+}
+
+
+void SoftBodyWorld::Build()
+{
+    mNodes.clear();
+    mParticleBody.clear();
+    mLinkOffsets.clear();
+    mLinks.clear();
+    mSprings.clear();
+    mChildren.clear();
+
+    std::unordered_map<NodeData*, int> particleIndex;
+    std::unordered_map<SpringPoint*, int> springIndex;
+
+    //Roots become particles, children just follow them. A volume body's nodes are moved by its FemBody.
+    for (int b = 0; b < mBodies.size(); ++b)
+    {
+        Node& nodes = mBodies[b].mesh->VertexData;
+        const bool isVolume = (mBodies[b].mesh->getVolume() != nullptr);
+        mBodies[b].particleBegin = static_cast<int>(mNodes.size());
+        for (int i = 0; i < nodes.getSize(); ++i)
+        {
+            if (nodes.isRoot(i) && !isVolume)
+            {
+                particleIndex[nodes.GetChildNode(i)] = static_cast<int>(mNodes.size());
+                mNodes.push_back(nodes.GetChildNode(i));
+                mParticleBody.push_back(b);
+            }
+        }
+        mBodies[b].particleEnd = static_cast<int>(mNodes.size());
+    }
+
+    for (int b = 0; b < mBodies.size(); ++b)
+    {
+        Node& nodes = mBodies[b].mesh->VertexData;
+        const bool isVolume = (mBodies[b].mesh->getVolume() != nullptr);
+        for (int i = 0; i < nodes.getSize(); ++i)
+        {
+            if (!nodes.isRoot(i) && !isVolume)
+            {
+                mChildren.push_back({ nodes.GetChildNode(i), particleIndex[nodes.getNode(i)] });
+            }
+        }
+    }
+
+    //Springs are shared by both their roots, so number them the first time they're seen
+    mLinkOffsets.push_back(0);
+    for (int p = 0; p < mNodes.size(); ++p)
+    {
+        NodeData* node = mNodes[p];
+        for (SpringPoint* spring : node->SpringList)
+        {
+            auto found = springIndex.find(spring);
+            int index;
+            if (found == springIndex.end())
+            {
+                Spring packed;
+                packed.source = spring;
+                packed.inertialLength = spring->m_InertialLength;
+                for (int j = 0; j < 2; ++j)
+                {
+                    NodeData* root = spring->Parents[j];
+                    while (root->root != NULL)
+                    {
+                        root = root->root;
+                    }
+                    packed.particle[j] = particleIndex[root];
+                }
+
+                index = static_cast<int>(mSprings.size());
+                springIndex[spring] = index;
+                mSprings.push_back(packed);
+            }
+            else
+            {
+                index = found->second;
+            }
+
+            mLinks.push_back({ index, (node == spring->Parents[1]) ? 1.0f : -1.0f });
+        }
+        mLinkOffsets.push_back(static_cast<int>(mLinks.size()));
+    }
+
+    mPositions.resize(mNodes.size());
+    mSpringForces.resize(mSprings.size());
+
+    mMultigridBuilt = false;
+    mPredicted.resize(mNodes.size());
+    mSolved.resize(mNodes.size());
+    mRightHandSide.resize(mNodes.size());
+    mSpringTargets.resize(mSprings.size());
+}
+
+
+void SoftBodyWorld::SetBodyMesh(int body, Mesh* mesh)
+{
+    mBodies[body].mesh = mesh;
+}
+
+
+void SoftBodyWorld::SetExternalForce(int body, CVector3 force)
+{
+    mBodies[body].externalForce = force;
+}
+
+
+void SoftBodyWorld::Step(float updateTime)
+{
+    PROFILE_SCOPE("World step");
+
+    for (Body& body : mBodies)
+    {
+        body.groundLevel = WORLD_GROUND_HEIGHT - body.mesh->VertexData.getOriginPoint().y;
+    }
+
+    const float damp = pow(0.0015f, updateTime);
+    TaskPool& pool = GetTaskPool();
+
+    const bool isHierarchical = (mSolver == HierarchicalSolver && GetSpringCount() > 0);
+
+    {
+        PROFILE_SCOPE("Spring forces");
+        pool.ParallelFor(GetParticleCount(), WORLD_PARTICLE_GRAIN, [this](int begin, int end) { ReadPositions(begin, end); });
+        if (!isHierarchical)
+        {
+            pool.ParallelFor(GetSpringCount(), WORLD_SPRING_GRAIN, [this](int begin, int end) { CalculateSpringForces(begin, end); });
+        }
+    }
+    {
+        PROFILE_SCOPE("Integration");
+        if (isHierarchical)
+        {
+            SolveHierarchical(updateTime, damp);
+        }
+        else
+        {
+            pool.ParallelFor(GetParticleCount(), WORLD_PARTICLE_GRAIN, [&](int begin, int end) { Integrate(updateTime, damp, begin, end); });
+        }
+        pool.ParallelFor(static_cast<int>(mChildren.size()), WORLD_PARTICLE_GRAIN, [this](int begin, int end) { UpdateChildren(begin, end); });
+    }
+
+    //The external force is taken as an acceleration, as the volume has its own masses
+    for (Body& body : mBodies)
+    {
+        FemBody* volume = body.mesh->getVolume();
+        if (volume != nullptr)
+        {
+            volume->Step(updateTime, body.externalForce, body.groundLevel, body.mesh->VertexData);
+        }
+    }
+    for (Body& body : mBodies)
+    {
+        body.mesh->VertexData.markPositionsChanged();
+    }
+
+    PROFILE_COUNTER("Springs evaluated", mSprings.size());
+}
+
+
+void SoftBodyWorld::PackRenderVertices()
+{
+    PROFILE_SCOPE("Vertex packing");
+
+    //Only bodies that moved since their last pack, numbered one after another so the blocks can span bodies
+    mPackedBodies.clear();
+    mRenderOffsets.assign(1, 0);
+    for (Body& body : mBodies)
+    {
+        if (body.mesh->VertexData.havePositionsChanged())
+        {
+            mPackedBodies.push_back(body.mesh);
+            mRenderOffsets.push_back(mRenderOffsets.back() + body.mesh->VertexData.getRenderVertexCount());
+        }
+    }
+
+    GetTaskPool().ParallelFor(mRenderOffsets.back(), WORLD_VERTEX_GRAIN, [this](int begin, int end) { CopyRenderVertices(begin, end); });
+    //Finishing finds each body's bounds from its packed vertices, so the bodies are shared out too
+    GetTaskPool().ParallelFor(static_cast<int>(mPackedBodies.size()), 1, [this](int begin, int end)
+    {
+        for (int b = begin; b < end; ++b)
+        {
+            mPackedBodies[b]->VertexData.finishRenderPack();
+        }
+    });
+
+    PROFILE_COUNTER("Vertex packs", mPackedBodies.size());
+}
+
+
+void SoftBodyWorld::ReadPositions(int begin, int end)
+{
+    for (int p = begin; p < end; ++p)
+    {
+        mPositions[p] = mNodes[p]->BasicData.Position;
+    }
+}
+
+
+// Same force as SpringPoint::calculateForce, worked out once per spring rather than once for each end
+void SoftBodyWorld::CalculateSpringForces(int begin, int end)
+{
+    for (int s = begin; s < end; ++s)
+    {
+        const Spring& spring = mSprings[s];
+        CVector3 direction = mPositions[spring.particle[0]] - mPositions[spring.particle[1]];
+        float currLength = getDist(&mPositions[spring.particle[0]], &mPositions[spring.particle[1]]);
+
+        float forceStrength = spring.source->SpringCoefficient * (currLength - spring.inertialLength);
+        mSpringForces[s] = (direction * forceStrength) / currLength;
+    }
+}
+
+
+// The per node part of Node::applyForce
+void SoftBodyWorld::Integrate(float updateTime, float damp, int begin, int end)
+{
+    for (int p = begin; p < end; ++p)
+    {
+        NodeData* node = mNodes[p];
+        const Body& body = mBodies[mParticleBody[p]];
+
+        CVector3 internalForces = { 0, 0, 0 };
+        for (int l = mLinkOffsets[p]; l < mLinkOffsets[p + 1]; ++l)
+        {
+            internalForces += mSpringForces[mLinks[l].spring] * mLinks[l].sign;
+        }
+        internalForces += body.externalForce;
+
+        //Bound nodes are more sturdy and will need to adjust to models of different complexity.
+        if (node->isBound)
+        {
+            internalForces *= 5;
+            node->_Mass = (mLinkOffsets[p + 1] - mLinkOffsets[p]) / 5.f;
+        }
+        internalForces = internalForces / node->_Mass; //Now acceleration
+
+        CVector3& position = node->BasicData.Position;
+        if (!node->isBound && position.y <= body.groundLevel + 0.1f)
+        {
+            if (internalForces.y < 0.)
+            {
+                internalForces.y = 0.;
+            }
+            if (position.y < body.groundLevel)
+            {
+                position.y = body.groundLevel;
+            }
+        }
+
+        CVector3 FuturePos = (1.0 + damp) * position - damp * node->Old_Position + internalForces * updateTime * updateTime;
+
+        node->Old_Position = position;
+        node->Velocity = FuturePos - node->Old_Position;
+
+        //A collision has set where the node should go
+        if (node->delayChange >= 0.9f)
+        {
+            node->ReboundForce = node->ReboundForce / (float)node->delayChange;
+            node->delayChange = 0;
+            position = node->ReboundForce;
+            node->ReboundForce = CVector3(.0f, .0f, .0f);
+        }
+        else if (node->isBound)
+        {
+            position = (FuturePos + node->Old_Position) * 0.500001f;
+        }
+        else
+        {
+            position = FuturePos;
+        }
+    }
+}
+
+
+// As Node::UpdateRootChild, without copying the spring list as it never changes while running
+void SoftBodyWorld::UpdateChildren(int begin, int end)
+{
+    for (int c = begin; c < end; ++c)
+    {
+        NodeData* child = mChildren[c].node;
+        const NodeData* root = mNodes[mChildren[c].particle];
+
+        child->BasicData.Position = root->BasicData.Position;
+        child->isBound = root->isBound;
+        child->Old_Position = root->Old_Position;
+        child->Velocity = root->Velocity;
+        child->_Mass = root->_Mass;
+    }
+}
+
+
+// The hierarchical solver's masses are the explicit step's, with a bound node's 5 times force and links / 5 mass as links / 25
+void SoftBodyWorld::BuildMultigrid()
+{
+    std::vector<int> springEnds(mSprings.size() * 2);
+    mSolverStiffness.resize(mSprings.size());
+    for (int s = 0; s < mSprings.size(); ++s)
+    {
+        mSolverStiffness[s] = mSprings[s].source->SpringCoefficient;
+        springEnds[s * 2] = mSprings[s].particle[0];
+        springEnds[s * 2 + 1] = mSprings[s].particle[1];
+    }
+
+    mSolverMass.resize(mNodes.size());
+    for (int p = 0; p < mNodes.size(); ++p)
+    {
+        int links = std::max(1, mLinkOffsets[p + 1] - mLinkOffsets[p]);
+        mSolverMass[p] = mNodes[p]->isBound ? links / 25.f : mNodes[p]->_Mass;
+    }
+
+    mMultigrid.Build(mSolverMass, springEnds, mSolverStiffness);
+    mMultigridBuilt = true;
+}
+
+
+void SoftBodyWorld::SolveHierarchical(float updateTime, float damp)
+{
+    bool isChanged = !mMultigridBuilt;
+    for (int s = 0; s < mSprings.size() && !isChanged; ++s)
+    {
+        isChanged = (mSprings[s].source->SpringCoefficient != mSolverStiffness[s]);
+    }
+    if (isChanged)
+    {
+        BuildMultigrid();
+    }
+
+    TaskPool& pool = GetTaskPool();
+    pool.ParallelFor(GetParticleCount(), WORLD_PARTICLE_GRAIN, [&](int begin, int end) { PredictPositions(updateTime, damp, begin, end); });
+    for (int round = 0; round < HIERARCHY_PROJECTIONS; ++round)
+    {
+        pool.ParallelFor(GetSpringCount(), WORLD_SPRING_GRAIN, [this](int begin, int end) { ProjectSprings(begin, end); });
+        pool.ParallelFor(GetParticleCount(), WORLD_PARTICLE_GRAIN, [&](int begin, int end) { GatherRightHandSide(updateTime, begin, end); });
+        mSolverResidual = mMultigrid.Solve(updateTime, mRightHandSide, mSolved, HIERARCHY_SOLVER_ITERATIONS);
+    }
+    pool.ParallelFor(GetParticleCount(), WORLD_PARTICLE_GRAIN, [this](int begin, int end) { ApplySolvedPositions(begin, end); });
+
+    PROFILE_COUNTER("Multigrid levels", mMultigrid.GetLevelCount());
+}
+
+
+// Integrate's step with the external force only, the springs then pull from here
+void SoftBodyWorld::PredictPositions(float updateTime, float damp, int begin, int end)
+{
+    for (int p = begin; p < end; ++p)
+    {
+        NodeData* node = mNodes[p];
+        const Body& body = mBodies[mParticleBody[p]];
+
+        CVector3 acceleration = body.externalForce / mSolverMass[p];
+
+        CVector3& position = node->BasicData.Position;
+        if (!node->isBound && position.y <= body.groundLevel + 0.1f)
+        {
+            if (acceleration.y < 0.)
+            {
+                acceleration.y = 0.;
+            }
+            if (position.y < body.groundLevel)
+            {
+                position.y = body.groundLevel;
+            }
+        }
+
+        mPredicted[p] = (1.0 + damp) * position - damp * node->Old_Position + acceleration * updateTime * updateTime;
+        mSolved[p] = mPredicted[p];
+    }
+}
+
+
+void SoftBodyWorld::ProjectSprings(int begin, int end)
+{
+    for (int s = begin; s < end; ++s)
+    {
+        const Spring& spring = mSprings[s];
+        CVector3 direction = mSolved[spring.particle[0]] - mSolved[spring.particle[1]];
+        float length = Length(direction);
+        mSpringTargets[s] = (length > 1e-6f) ? direction * (mSolverStiffness[s] * spring.inertialLength / length) : CVector3(0, 0, 0);
+    }
+}
+
+
+// (M / h^2) predicted plus each spring's target, which pushes its first particle and pulls its second
+void SoftBodyWorld::GatherRightHandSide(float updateTime, int begin, int end)
+{
+    const float massScale = 1.0f / (updateTime * updateTime);
+    for (int p = begin; p < end; ++p)
+    {
+        CVector3 sum = mPredicted[p] * (mSolverMass[p] * massScale);
+        for (int l = mLinkOffsets[p]; l < mLinkOffsets[p + 1]; ++l)
+        {
+            sum -= mSpringTargets[mLinks[l].spring] * mLinks[l].sign;
+        }
+        mRightHandSide[p] = sum;
+    }
+}
+
+
+// The end of Integrate, with the solved position in place of its FuturePos
+void SoftBodyWorld::ApplySolvedPositions(int begin, int end)
+{
+    for (int p = begin; p < end; ++p)
+    {
+        NodeData* node = mNodes[p];
+        CVector3& position = node->BasicData.Position;
+        const CVector3 FuturePos = mSolved[p];
+
+        node->Old_Position = position;
+        node->Velocity = FuturePos - node->Old_Position;
+
+        if (node->delayChange >= 0.9f)
+        {
+            node->ReboundForce = node->ReboundForce / (float)node->delayChange;
+            node->delayChange = 0;
+            position = node->ReboundForce;
+            node->ReboundForce = CVector3(.0f, .0f, .0f);
+        }
+        else if (node->isBound)
+        {
+            position = (FuturePos + node->Old_Position) * 0.500001f;
+        }
+        else
+        {
+            position = FuturePos;
+        }
+    }
+}
+
+
+// A block of render vertices can span several of the bodies being packed, so copy the part that falls in each
+void SoftBodyWorld::CopyRenderVertices(int begin, int end)
+{
+    int b = static_cast<int>(std::upper_bound(mRenderOffsets.begin(), mRenderOffsets.end(), begin) - mRenderOffsets.begin()) - 1;
+    for (; begin < end; ++b)
+    {
+        int bodyEnd = std::min(end, mRenderOffsets[b + 1]);
+        if (bodyEnd > begin)
+        {
+            mPackedBodies[b]->VertexData.copyRenderVertices(begin - mRenderOffsets[b], bodyEnd - mRenderOffsets[b]);
+            begin = bodyEnd;
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,170 @@
+//--------------------------------------------------------------------------------------
+// Steps a group of soft bodies together as one set of particles and springs
+//--------------------------------------------------------------------------------------
+// Node::applyForce steps one body at a time, walking each node's spring list through pointers.
+// The world instead packs the root nodes and springs of every body it holds into shared flat
+// arrays, with a range of particles and an external force for each body, and steps them all in
+// parallel passes over the whole set. Many small bodies then spread over the cores as well as
+// one large one does.
+//
+// The nodes stay the real state: positions are read from them at the start of a step and the
+// results written back at the end, so collisions, rendering, resets and snapshots all work as
+// before. Springs are looked up per node in a compressed (CSR) list in the node's own
+// SpringList order and the spring strengths are read each step so GUI changes apply.
+//
+// Unlike applyForce, which moves each node as it goes so later nodes see earlier ones already
+// moved, every spring force here comes from the positions at the start of the step. This is
+// what lets the particles be done in any order, and the result is the same on any thread count.
+//
+// A step only marks the bodies moved. PackRenderVertices, called once a frame when the simulation is
+// done with it, refreshes the packed render vertices of every moved body in one parallel pass over
+// their drawn vertices, so Mesh::UpdateVertexBuffer only has a single copy left to upload.
+//
+// The hierarchical solver (SetSolver) steps the springs implicitly instead, in the manner of
+// projective dynamics: every spring's ideal end positions (at its rest length along its current
+// direction) are found in parallel, then one linear solve puts every particle as close to both
+// those and its momentum as it can. The solve is SpringMultigrid's, over a hierarchy of coarser
+// spring graphs built from the same springs, so an impact reaches the far side of a large mesh
+// in the step it happens rather than one spring per step, and stiff springs can't blow up.
+//
+// A body on the volume model (Mesh::setSoftBodyModel) adds no particles or springs. Its FemBody
+// is stepped on its own, with the same external force and ground, spread over the cores per
+// tetrahedron instead.
+//
+// Build must be called again if a body's nodes or springs change (e.g. Mesh::rebuildSprings) or
+// it's switched to another model.
+
+#include "Mesh.h"
+#include "SpringMultigrid.h"
+
+#include <vector>
+
+#ifndef _SOFT_BODY_WORLD_H_INCLUDED_
+#define _SOFT_BODY_WORLD_H_INCLUDED_
+
+constexpr int WORLD_PARTICLE_GRAIN = 256; //Particles per block handed to a thread
+constexpr int WORLD_SPRING_GRAIN = 1024;
+constexpr int WORLD_VERTEX_GRAIN = 1024;
+constexpr int HIERARCHY_PROJECTIONS = 2;       //Spring target / solve rounds per step for the hierarchical solver
+constexpr int HIERARCHY_SOLVER_ITERATIONS = 2; //Multigrid preconditioned iterations per solve
+
+
+enum WorldSolver
+{
+    ExplicitSolver,
+    HierarchicalSolver,
+};
+
+
+class SoftBodyWorld
+{
+public:
+    // Adds a body, returning its index in the world. Call Build once every body is added.
+    int AddBody(Mesh* mesh);
+
+    // Packs the bodies' nodes and springs into the flat arrays
+    void Build();
+
+    // Swaps the mesh simulated for a body, such as for a different level of detail. Call Build after.
+    void SetBodyMesh(int body, Mesh* mesh);
+
+    // Constant force (gravity, wind, movement) applied to every node of the body from the next step
+    void SetExternalForce(int body, CVector3 force);
+
+    // Moves every body on by updateTime
+    void Step(float updateTime);
+
+    // Per-frame staging for the render: packs the drawn vertices of every body that has moved since it was
+    // last packed. Call once after the frame's steps, collisions and level of detail updates.
+    void PackRenderVertices();
+
+    // How the springs are stepped, see the top of this file
+    void SetSolver(WorldSolver solver) { mSolver = solver; }
+    WorldSolver GetSolver() { return mSolver; }
+
+    // Remaining residual of the last hierarchical solve, relative to where it started
+    float GetSolverResidual() { return mSolverResidual; }
+
+    int GetBodyCount()     { return static_cast<int>(mBodies.size()); }
+    int GetParticleCount() { return static_cast<int>(mNodes.size()); }
+    int GetSpringCount()   { return static_cast<int>(mSprings.size()); }
+
+private:
+    struct Body
+    {
+        Mesh* mesh;
+        int   particleBegin;
+        int   particleEnd;
+        CVector3 externalForce;
+        float groundLevel; //Ground height in the body's local space, updated each step from the model's position
+    };
+
+    // One per spring in the world
+    struct Spring
+    {
+        SpringPoint* source; //Read for the strength each step
+        int   particle[2];
+        float inertialLength;
+    };
+
+    // One per spring in a particle's spring list
+    struct SpringLink
+    {
+        int   spring;
+        float sign; //calculateForce returns +force for the spring's second parent and -force otherwise
+    };
+
+    // A welded copy of a root node, updated from the root after each step
+    struct Child
+    {
+        NodeData* node;
+        int particle;
+    };
+
+    void ReadPositions(int begin, int end);
+    void CalculateSpringForces(int begin, int end);
+    void Integrate(float updateTime, float damp, int begin, int end);
+    void UpdateChildren(int begin, int end);
+    void CopyRenderVertices(int begin, int end);
+
+    void BuildMultigrid();
+    void SolveHierarchical(float updateTime, float damp);
+    void PredictPositions(float updateTime, float damp, int begin, int end);
+    void ProjectSprings(int begin, int end);
+    void GatherRightHandSide(float updateTime, int begin, int end);
+    void ApplySolvedPositions(int begin, int end);
+
+    std::vector<Body> mBodies;
+    // Bodies being packed by PackRenderVertices. Body b's render vertices are numbered mRenderOffsets[b] to
+    // mRenderOffsets[b + 1] across them.
+    std::vector<Mesh*> mPackedBodies;
+    std::vector<int>   mRenderOffsets;
+
+    // Per particle (root node), across every body
+    std::vector<NodeData*> mNodes;
+    std::vector<int>       mParticleBody;
+    std::vector<CVector3>  mPositions;     //Positions at the start of the step
+    std::vector<int>       mLinkOffsets;   //Particle i's springs are mLinks[mLinkOffsets[i]] to mLinks[mLinkOffsets[i + 1]]
+    std::vector<SpringLink> mLinks;
+
+    // Per spring
+    std::vector<Spring>   mSprings;
+    std::vector<CVector3> mSpringForces;
+
+    std::vector<Child> mChildren;
+
+    // Hierarchical solver
+    WorldSolver mSolver = ExplicitSolver;
+    SpringMultigrid mMultigrid;
+    bool mMultigridBuilt = false;
+    std::vector<float> mSolverStiffness; //Spring strengths the multigrid was built with, a change means building it again
+    std::vector<float> mSolverMass;      //Per particle
+    std::vector<CVector3> mPredicted;    //Where each particle goes on its momentum and external force alone
+    std::vector<CVector3> mSolved;
+    std::vector<CVector3> mRightHandSide;
+    std::vector<CVector3> mSpringTargets; //Per spring, stiffness * rest length along its current direction
+    float mSolverResidual = 0;
+};
+
+
+#endif //_SOFT_BODY_WORLD_H_INCLUDED_
@@ -0,0 +1,439 @@
+//--------------------------------------------------------------------------------------
+// Spatial hash of points for proximity queries
+//--------------------------------------------------------------------------------------
+
+#include "SpatialHash.h"
+#include "TaskPool.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+const unsigned long long SPATIAL_HASH_MULTIPLIER = 0x9E3779B97F4A7C15ull; //Spreads nearby codes across the table
+
+
+// Spaces the low 21 bits of value out to every third bit
+static unsigned long long SpreadBits(unsigned long long value)
+{
+    value &= 0x1FFFFF;
+    value = (value | (value << 32)) & 0x1F00000000FFFFull;
+    value = (value | (value << 16)) & 0x1F0000FF0000FFull;
+    value = (value | (value << 8))  & 0x100F00F00F00F00Full;
+    value = (value | (value << 4))  & 0x10C30C30C30C30C3ull;
+    value = (value | (value << 2))  & 0x1249249249249249ull;
+    return value;
+}
+
+static unsigned long long MortonCode(long long x, long long y, long long z)
+{
+    return SpreadBits(x) | (SpreadBits(y) << 1) | (SpreadBits(z) << 2);
+}
+
+// Cube coordinate of a value along one axis. Kept within a cube either side of what a code can hold so far away
+// values don't overflow, which still leaves them outside the grid.
+static long long CellCoordinate(float value, float origin, float cellSize)
+{
+    double cell = std::floor((static_cast<double>(value) - origin) / cellSize);
+    cell = std::max(cell, -1.0);
+    cell = std::min(cell, static_cast<double>(1 << SPATIAL_HASH_AXIS_BITS));
+    return static_cast<long long>(cell);
+}
+
+
+void SpatialHash::Build(const CVector3* positions, int count, float cellSize)
+{
+    mCodes.resize(count);
+    mIndices.resize(count);
+    mPositions.resize(count);
+    mCellCodes.clear();
+    mCellStarts.clear();
+    if (count == 0)
+    {
+        mGridSize[0] = mGridSize[1] = mGridSize[2] = 0;
+        mTable.assign(2, -1);
+        mTableShift = 63;
+        mCellStarts.push_back(0);
+        return;
+    }
+
+    TaskPool& pool = GetTaskPool();
+    const int blockCount = (count + SPATIAL_HASH_GRAIN - 1) / SPATIAL_HASH_GRAIN;
+
+    //Bounds, per block and then together
+    mBlockBounds.resize(blockCount * 2);
+    pool.ParallelFor(count, SPATIAL_HASH_GRAIN, [&](int begin, int end)
+    {
+        //ParallelFor runs everything as one block when there's nobody to share it with
+        for (int blockBegin = begin; blockBegin < end; blockBegin += SPATIAL_HASH_GRAIN)
+        {
+            const int blockEnd = std::min(end, blockBegin + SPATIAL_HASH_GRAIN);
+            CVector3 low = positions[blockBegin];
+            CVector3 high = low;
+            for (int i = blockBegin + 1; i < blockEnd; ++i)
+            {
+                low.x = std::min(low.x, positions[i].x);
+                low.y = std::min(low.y, positions[i].y);
+                low.z = std::min(low.z, positions[i].z);
+                high.x = std::max(high.x, positions[i].x);
+                high.y = std::max(high.y, positions[i].y);
+                high.z = std::max(high.z, positions[i].z);
+            }
+            mBlockBounds[(blockBegin / SPATIAL_HASH_GRAIN) * 2] = low;
+            mBlockBounds[(blockBegin / SPATIAL_HASH_GRAIN) * 2 + 1] = high;
+        }
+    });
+
+    CVector3 low = mBlockBounds[0];
+    CVector3 high = mBlockBounds[1];
+    for (int block = 1; block < blockCount; ++block)
+    {
+        const CVector3& blockLow = mBlockBounds[block * 2];
+        const CVector3& blockHigh = mBlockBounds[block * 2 + 1];
+        low.x = std::min(low.x, blockLow.x);
+        low.y = std::min(low.y, blockLow.y);
+        low.z = std::min(low.z, blockLow.z);
+        high.x = std::max(high.x, blockHigh.x);
+        high.y = std::max(high.y, blockHigh.y);
+        high.z = std::max(high.z, blockHigh.z);
+    }
+
+    //Bigger cubes if the points span more than a code can number
+    const float largest = std::max(high.x - low.x, std::max(high.y - low.y, high.z - low.z));
+    const float maxCells = static_cast<float>((1 << SPATIAL_HASH_AXIS_BITS) - 2);
+    mCellSize = std::max(cellSize, largest / maxCells);
+    if (mCellSize <= 0)  mCellSize = 1.0f;
+    mOrigin = low;
+
+    mGridSize[0] = CellCoordinate(high.x, mOrigin.x, mCellSize) + 1;
+    mGridSize[1] = CellCoordinate(high.y, mOrigin.y, mCellSize) + 1;
+    mGridSize[2] = CellCoordinate(high.z, mOrigin.z, mCellSize) + 1;
+
+    //Every point is past the origin, so truncating is flooring and the far corner bounds the coordinates
+    const float inverseCellSize = 1.0f / mCellSize;
+    pool.ParallelFor(count, SPATIAL_HASH_GRAIN, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            long long x = std::min(static_cast<long long>((positions[i].x - mOrigin.x) * inverseCellSize), mGridSize[0] - 1);
+            long long y = std::min(static_cast<long long>((positions[i].y - mOrigin.y) * inverseCellSize), mGridSize[1] - 1);
+            long long z = std::min(static_cast<long long>((positions[i].z - mOrigin.z) * inverseCellSize), mGridSize[2] - 1);
+            mCodes[i] = MortonCode(x, y, z);
+            mIndices[i] = i;
+        }
+    });
+
+    //A code only grows with each coordinate, so the far corner has the highest and only its bits need sorting
+    unsigned long long highestCode = MortonCode(mGridSize[0] - 1, mGridSize[1] - 1, mGridSize[2] - 1);
+    int bitCount = 0;
+    while (highestCode >> bitCount)  ++bitCount;
+    SortCodes(bitCount);
+
+    //Copy the positions into sorted order so a cube's points are read together
+    pool.ParallelFor(count, SPATIAL_HASH_GRAIN, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            mPositions[i] = positions[mIndices[i]];
+        }
+    });
+
+    //Cubes start wherever the code changes. Counted per block first so each block knows where its cubes go.
+    mBlockCounts.resize(blockCount + 1);
+    pool.ParallelFor(count, SPATIAL_HASH_GRAIN, [&](int begin, int end)
+    {
+        for (int blockBegin = begin; blockBegin < end; blockBegin += SPATIAL_HASH_GRAIN)
+        {
+            const int blockEnd = std::min(end, blockBegin + SPATIAL_HASH_GRAIN);
+            int starts = 0;
+            for (int i = blockBegin; i < blockEnd; ++i)
+            {
+                if (i == 0 || mCodes[i] != mCodes[i - 1])  ++starts;
+            }
+            mBlockCounts[blockBegin / SPATIAL_HASH_GRAIN] = starts;
+        }
+    });
+
+    int cellCount = 0;
+    for (int block = 0; block < blockCount; ++block)
+    {
+        const int starts = mBlockCounts[block];
+        mBlockCounts[block] = cellCount;
+        cellCount += starts;
+    }
+
+    mCellCodes.resize(cellCount);
+    mCellStarts.resize(cellCount + 1);
+    mCellStarts[cellCount] = count;
+    pool.ParallelFor(count, SPATIAL_HASH_GRAIN, [&](int begin, int end)
+    {
+        for (int blockBegin = begin; blockBegin < end; blockBegin += SPATIAL_HASH_GRAIN)
+        {
+            const int blockEnd = std::min(end, blockBegin + SPATIAL_HASH_GRAIN);
+            int cell = mBlockCounts[blockBegin / SPATIAL_HASH_GRAIN];
+            for (int i = blockBegin; i < blockEnd; ++i)
+            {
+                if (i == 0 || mCodes[i] != mCodes[i - 1])
+                {
+                    mCellCodes[cell] = mCodes[i];
+                    mCellStarts[cell] = i;
+                    ++cell;
+                }
+            }
+        }
+    });
+
+    //At most half full so the probes stay short. Filled on one thread as the slots are shared.
+    int tableBits = 1;
+    while ((1 << tableBits) < cellCount * 2)  ++tableBits;
+    mTable.assign(static_cast<size_t>(1) << tableBits, -1);
+    mTableShift = 64 - tableBits;
+    const int tableMask = static_cast<int>(mTable.size()) - 1;
+    for (int cell = 0; cell < cellCount; ++cell)
+    {
+        int slot = static_cast<int>((mCellCodes[cell] * SPATIAL_HASH_MULTIPLIER) >> mTableShift);
+        while (mTable[slot] != -1)
+        {
+            slot = (slot + 1) & tableMask;
+        }
+        mTable[slot] = cell;
+    }
+}
+
+
+void SpatialHash::Build(Node& nodes, float cellSize)
+{
+    //Child nodes share their root's position, so only the roots are added
+    mNodePositions.clear();
+    mNodeIndices.clear();
+    for (int i = 0; i < nodes.getSize(); ++i)
+    {
+        if (nodes.isRoot(i))
+        {
+            mNodePositions.push_back(nodes.getPosition(i));
+            mNodeIndices.push_back(i);
+        }
+    }
+
+    Build(mNodePositions.data(), static_cast<int>(mNodePositions.size()), cellSize);
+
+    for (int& index : mIndices)
+    {
+        index = mNodeIndices[index];
+    }
+}
+
+
+// Least significant digit first radix sort of mCodes, carrying mIndices along. Each block counts its digits,
+// the counts are turned into where each block's digits start and the blocks then place their points, so
+// every pass is stable.
+void SpatialHash::SortCodes(int bitCount)
+{
+    const int count = static_cast<int>(mCodes.size());
+    const int blockCount = (count + SPATIAL_HASH_GRAIN - 1) / SPATIAL_HASH_GRAIN;
+    const int digitCount = 1 << SPATIAL_HASH_RADIX_BITS;
+    const unsigned long long digitMask = digitCount - 1;
+
+    mSortCodes.resize(count);
+    mSortIndices.resize(count);
+    mBlockCounts.resize(blockCount * digitCount);
+
+    TaskPool& pool = GetTaskPool();
+    for (int shift = 0; shift < bitCount; shift += SPATIAL_HASH_RADIX_BITS)
+    {
+        pool.ParallelFor(count, SPATIAL_HASH_GRAIN, [&](int begin, int end)
+        {
+            for (int blockBegin = begin; blockBegin < end; blockBegin += SPATIAL_HASH_GRAIN)
+            {
+                const int blockEnd = std::min(end, blockBegin + SPATIAL_HASH_GRAIN);
+                int* counts = &mBlockCounts[(blockBegin / SPATIAL_HASH_GRAIN) * digitCount];
+                std::fill(counts, counts + digitCount, 0);
+                for (int i = blockBegin; i < blockEnd; ++i)
+                {
+                    ++counts[(mCodes[i] >> shift) & digitMask];
+                }
+            }
+        });
+
+        //Every block's 0s, then every block's 1s and so on, with the blocks in order
+        int offset = 0;
+        for (int digit = 0; digit < digitCount; ++digit)
+        {
+            for (int block = 0; block < blockCount; ++block)
+            {
+                int& slot = mBlockCounts[block * digitCount + digit];
+                const int digitTotal = slot;
+                slot = offset;
+                offset += digitTotal;
+            }
+        }
+
+        pool.ParallelFor(count, SPATIAL_HASH_GRAIN, [&](int begin, int end)
+        {
+            for (int blockBegin = begin; blockBegin < end; blockBegin += SPATIAL_HASH_GRAIN)
+            {
+                const int blockEnd = std::min(end, blockBegin + SPATIAL_HASH_GRAIN);
+                int* offsets = &mBlockCounts[(blockBegin / SPATIAL_HASH_GRAIN) * digitCount];
+                for (int i = blockBegin; i < blockEnd; ++i)
+                {
+                    const int slot = offsets[(mCodes[i] >> shift) & digitMask]++;
+                    mSortCodes[slot] = mCodes[i];
+                    mSortIndices[slot] = mIndices[i];
+                }
+            }
+        });
+
+        mCodes.swap(mSortCodes);
+        mIndices.swap(mSortIndices);
+    }
+}
+
+
+int SpatialHash::FindCell(long long x, long long y, long long z) const
+{
+    if (x < 0 || y < 0 || z < 0 || x >= mGridSize[0] || y >= mGridSize[1] || z >= mGridSize[2])  return -1;
+
+    const unsigned long long code = MortonCode(x, y, z);
+    const int tableMask = static_cast<int>(mTable.size()) - 1;
+    int slot = static_cast<int>((code * SPATIAL_HASH_MULTIPLIER) >> mTableShift);
+    while (mTable[slot] != -1)
+    {
+        if (mCellCodes[mTable[slot]] == code)  return mTable[slot];
+        slot = (slot + 1) & tableMask;
+    }
+    return -1;
+}
+
+
+int SpatialHash::FindInRadius(CVector3 centre, float radius, std::vector<int>& output) const
+{
+    output.clear();
+    if (mIndices.empty() || radius < 0)  return 0;
+
+    long long low[3] =
+    {
+        std::max(CellCoordinate(centre.x - radius, mOrigin.x, mCellSize), 0ll),
+        std::max(CellCoordinate(centre.y - radius, mOrigin.y, mCellSize), 0ll),
+        std::max(CellCoordinate(centre.z - radius, mOrigin.z, mCellSize), 0ll),
+    };
+    long long high[3] =
+    {
+        std::min(CellCoordinate(centre.x + radius, mOrigin.x, mCellSize), mGridSize[0] - 1),
+        std::min(CellCoordinate(centre.y + radius, mOrigin.y, mCellSize), mGridSize[1] - 1),
+        std::min(CellCoordinate(centre.z + radius, mOrigin.z, mCellSize), mGridSize[2] - 1),
+    };
+
+    const float radiusSquared = radius * radius;
+    for (long long z = low[2]; z <= high[2]; ++z)
+    {
+        for (long long y = low[1]; y <= high[1]; ++y)
+        {
+            for (long long x = low[0]; x <= high[0]; ++x)
+            {
+                const int cell = FindCell(x, y, z);
+                if (cell < 0)  continue;
+
+                for (int i = mCellStarts[cell]; i < mCellStarts[cell + 1]; ++i)
+                {
+                    CVector3 offset = mPositions[i] - centre;
+                    if (Dot(offset, offset) <= radiusSquared)  output.push_back(mIndices[i]);
+                }
+            }
+        }
+    }
+    return static_cast<int>(output.size());
+}
+
+
+void SpatialHash::GatherNearest(long long x, long long y, long long z, CVector3 centre, int count,
+                                std::vector<std::pair<float, int>>& nearest) const
+{
+    const int cell = FindCell(x, y, z);
+    if (cell < 0)  return;
+
+    for (int i = mCellStarts[cell]; i < mCellStarts[cell + 1]; ++i)
+    {
+        CVector3 offset = mPositions[i] - centre;
+        std::pair<float, int> candidate(Dot(offset, offset), mIndices[i]);
+        if (static_cast<int>(nearest.size()) < count)
+        {
+            nearest.push_back(candidate);
+            std::push_heap(nearest.begin(), nearest.end());
+        }
+        else if (candidate < nearest.front())
+        {
+            //Ties go to the lower index so the result doesn't depend on the order cubes are visited
+            std::pop_heap(nearest.begin(), nearest.end());
+            nearest.back() = candidate;
+            std::push_heap(nearest.begin(), nearest.end());
+        }
+    }
+}
+
+
+// Searches shells of cubes outwards from the one holding centre. Once count points are found, any point in a
+// cube outside the shells searched is at least one cube width per shell away, so the search stops as soon
+// as the furthest point kept is closer than that.
+int SpatialHash::FindNearest(CVector3 centre, int count, std::vector<int>& output) const
+{
+    output.clear();
+    if (mIndices.empty() || count <= 0)  return 0;
+
+    const long long centreCell[3] =
+    {
+        CellCoordinate(centre.x, mOrigin.x, mCellSize),
+        CellCoordinate(centre.y, mOrigin.y, mCellSize),
+        CellCoordinate(centre.z, mOrigin.z, mCellSize),
+    };
+
+    //Shells before the first to reach the grid are empty, and the search is over at the one that covers it all
+    long long firstShell = 0;
+    long long lastShell = 0;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        firstShell = std::max(firstShell, std::max(-centreCell[axis], centreCell[axis] - (mGridSize[axis] - 1)));
+        lastShell = std::max(lastShell, std::max(centreCell[axis], mGridSize[axis] - 1 - centreCell[axis]));
+    }
+
+    std::vector<std::pair<float, int>> nearest;
+    nearest.reserve(count);
+    for (long long shell = firstShell; shell <= lastShell; ++shell)
+    {
+        const long long zBegin = std::max(centreCell[2] - shell, 0ll);
+        const long long zEnd = std::min(centreCell[2] + shell, mGridSize[2] - 1);
+        const long long yBegin = std::max(centreCell[1] - shell, 0ll);
+        const long long yEnd = std::min(centreCell[1] + shell, mGridSize[1] - 1);
+        const long long xBegin = std::max(centreCell[0] - shell, 0ll);
+        const long long xEnd = std::min(centreCell[0] + shell, mGridSize[0] - 1);
+        for (long long z = zBegin; z <= zEnd; ++z)
+        {
+            const bool isZFace = (std::abs(z - centreCell[2]) == shell);
+            for (long long y = yBegin; y <= yEnd; ++y)
+            {
+                if (isZFace || std::abs(y - centreCell[1]) == shell)
+                {
+                    for (long long x = xBegin; x <= xEnd; ++x)
+                    {
+                        GatherNearest(x, y, z, centre, count, nearest);
+                    }
+                }
+                else
+                {
+                    //Inside the shell's faces only its two x ends are new
+                    GatherNearest(centreCell[0] - shell, y, z, centre, count, nearest);
+                    if (shell > 0)  GatherNearest(centreCell[0] + shell, y, z, centre, count, nearest);
+                }
+            }
+        }
+
+        const float searched = shell * mCellSize;
+        if (static_cast<int>(nearest.size()) == count && nearest.front().first <= searched * searched)  break;
+    }
+
+    std::sort_heap(nearest.begin(), nearest.end());
+    output.resize(nearest.size());
+    for (size_t i = 0; i < nearest.size(); ++i)
+    {
+        output[i] = nearest[i].second;
+    }
+    return static_cast<int>(output.size());
+}
@@ -0,0 +1,86 @@
+//--------------------------------------------------------------------------------------
+// Spatial hash of points for proximity queries
+//--------------------------------------------------------------------------------------
+// Answers "which particles are near here" without testing every particle, for the places that
+// do that by brute force now (welding nodes, collisions). Space is cut into cubes of a chosen
+// size and each point gets the Morton code of its cube, the cube's x, y and z bits interleaved,
+// so cubes that are close in space mostly get close codes. The points are sorted by code with a
+// radix sort, which leaves every cube's points in one run and neighbouring cubes' runs near each
+// other in memory, and a hash table from code to run finds a cube's points.
+//
+// Meant to be rebuilt whenever the points move, so a Build reuses the last one's memory and is
+// split over the TaskPool. The sort is stable and in fixed blocks, so the order (and every query
+// result) is the same on any thread count. Queries only read, so several threads can query at once.
+
+#include "NodePoint.h"
+
+#include <vector>
+#include <utility>
+
+#ifndef _SPATIAL_HASH_H_INCLUDED_
+#define _SPATIAL_HASH_H_INCLUDED_
+
+constexpr int SPATIAL_HASH_AXIS_BITS = 21;  //Bits of each cube coordinate in a code, three make up 63 bits
+constexpr int SPATIAL_HASH_RADIX_BITS = 8;  //Bits sorted per radix pass
+constexpr int SPATIAL_HASH_GRAIN = 4096;    //Points per block handed to a thread
+
+
+class SpatialHash
+{
+public:
+    // Sorts count points into cubes cellSize wide. Query results are indices into positions. The cube size is
+    // raised if the points would span more cubes than a code can hold.
+    void Build(const CVector3* positions, int count, float cellSize);
+
+    // Sorts the root nodes of a soft body. Query results are node indices.
+    void Build(Node& nodes, float cellSize);
+
+    // Every point within radius of centre, in cube order. Replaces the contents of output and returns the count.
+    int FindInRadius(CVector3 centre, float radius, std::vector<int>& output) const;
+
+    // The count points nearest to centre (fewer if there aren't that many), closest first. Replaces the contents
+    // of output and returns the count.
+    int FindNearest(CVector3 centre, int count, std::vector<int>& output) const;
+
+    int GetPointCount() const { return static_cast<int>(mIndices.size()); }
+    int GetCellCount() const { return static_cast<int>(mCellCodes.size()); }
+    float GetCellSize() const { return mCellSize; }
+
+private:
+    void SortCodes(int bitCount);
+
+    // Run of points in the cube at x, y, z, or -1 if it's empty
+    int FindCell(long long x, long long y, long long z) const;
+
+    // Adds the points of the cube at x, y, z to a max-heap of the nearest found so far
+    void GatherNearest(long long x, long long y, long long z, CVector3 centre, int count,
+                       std::vector<std::pair<float, int>>& nearest) const;
+
+    // Per point, sorted by code
+    std::vector<unsigned long long> mCodes;
+    std::vector<int> mIndices;
+    std::vector<CVector3> mPositions;
+
+    // Per cube with any points in, in code order. Cube c's points are [mCellStarts[c], mCellStarts[c + 1]).
+    std::vector<unsigned long long> mCellCodes;
+    std::vector<int> mCellStarts;
+
+    // Open addressing table from code to cube, a power of two in size, -1 where empty
+    std::vector<int> mTable;
+    int mTableShift = 64;
+
+    CVector3 mOrigin = CVector3(0, 0, 0); //Corner of cube 0, 0, 0
+    float mCellSize = 1.0f;
+    long long mGridSize[3] = { 0, 0, 0 }; //Cubes along each axis
+
+    // Build scratch space
+    std::vector<unsigned long long> mSortCodes;
+    std::vector<int> mSortIndices;
+    std::vector<int> mBlockCounts;
+    std::vector<CVector3> mBlockBounds;
+    std::vector<CVector3> mNodePositions;
+    std::vector<int> mNodeIndices;
+};
+
+
+#endif //_SPATIAL_HASH_H_INCLUDED_
@@ -0,0 +1,18 @@
+//--------------------------------------------------------------------------------------
+// Spring and Node Instancing Pixel Shader
+//--------------------------------------------------------------------------------------
+// Springs and nodes are plain white so they stand out against the soft bodies
+
+#include "Common.hlsli" // Shaders can also use include files - note the extension
+
+
+struct SpringPixelShaderInput
+{
+    float4 projectedPosition : SV_Position;
+};
+
+
+float4 main(SpringPixelShaderInput input) : SV_Target
+{
+    return float4(1.0f, 1.0f, 1.0f, 1.0f);
+}
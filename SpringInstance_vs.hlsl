@@ -0,0 +1,46 @@
+//--------------------------------------------------------------------------------------
+// Spring and Node Instancing Vertex Shader
+//--------------------------------------------------------------------------------------
+// Draws the same mesh many times in one call. Each instance brings its own world matrix from a
+// second vertex buffer instead of using the per-model constant buffer.
+
+#include "Common.hlsli" // Shaders can also use include files - note the extension
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+struct InstancedVertex
+{
+    float3 position : Position;
+    float3 normal   : Normal;
+    float2 uv       : UV;
+
+    // The instance's world matrix a row at a time, as CMatrix4x4 stores it (position in the last row)
+    float4 world0   : InstanceWorld0;
+    float4 world1   : InstanceWorld1;
+    float4 world2   : InstanceWorld2;
+    float4 world3   : InstanceWorld3;
+};
+
+struct SpringPixelShaderInput
+{
+    float4 projectedPosition : SV_Position;
+};
+
+
+SpringPixelShaderInput main(InstancedVertex modelVertex)
+{
+    SpringPixelShaderInput output;
+
+    // The rows are built straight from the vertex data so they are not transposed like constant buffer matrices,
+    // hence the position goes on the left of the multiply here
+    float4x4 worldMatrix = float4x4(modelVertex.world0, modelVertex.world1, modelVertex.world2, modelVertex.world3);
+
+    float4 worldPosition = mul(float4(modelVertex.position, 1), worldMatrix);
+    float4 viewPosition  = mul(gViewMatrix, worldPosition);
+    output.projectedPosition = mul(gProjectionMatrix, viewPosition);
+
+    return output;
+}
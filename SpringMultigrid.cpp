@@ -0,0 +1,485 @@
+//--------------------------------------------------------------------------------------
+// Multigrid solver for the linear system of an implicit spring step
+//--------------------------------------------------------------------------------------
+
+#include "SpringMultigrid.h"
+#include "TaskPool.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+const int MULTIGRID_FALLBACK_SWEEPS = 20; //Jacobi sweeps on the smallest level if it's too big to solve exactly
+
+
+// One off-diagonal entry of a level's matrix, before they're sorted into rows
+struct MatrixEntry
+{
+    int row;
+    int column;
+    float value;
+};
+
+
+// Sorts entries into compressed rows, adding together any for the same row and column
+static void BuildRows(std::vector<MatrixEntry>& entries, int rowCount, std::vector<int>& rowOffsets, std::vector<int>& columns, std::vector<float>& values)
+{
+    std::sort(entries.begin(), entries.end(), [](const MatrixEntry& a, const MatrixEntry& b)
+    {
+        return (a.row != b.row) ? (a.row < b.row) : (a.column < b.column);
+    });
+
+    rowOffsets.assign(rowCount + 1, 0);
+    columns.clear();
+    values.clear();
+    for (int e = 0; e < entries.size(); ++e)
+    {
+        if (e > 0 && entries[e].row == entries[e - 1].row && entries[e].column == entries[e - 1].column)
+        {
+            values.back() += entries[e].value;
+            continue;
+        }
+        columns.push_back(entries[e].column);
+        values.push_back(entries[e].value);
+        ++rowOffsets[entries[e].row + 1];
+    }
+    for (int r = 0; r < rowCount; ++r)
+    {
+        rowOffsets[r + 1] += rowOffsets[r];
+    }
+}
+
+
+void SpringMultigrid::Build(const std::vector<float>& masses, const std::vector<int>& springEnds, const std::vector<float>& stiffness)
+{
+    mLevels.clear();
+    mTimeStep = 0;
+
+    const int count = static_cast<int>(masses.size());
+    mLevels.emplace_back();
+    mLevels[0].mass = masses;
+    mLevels[0].springDiagonal.assign(count, 0.0f);
+
+    std::vector<MatrixEntry> entries;
+    entries.reserve(springEnds.size());
+    for (int s = 0; s < stiffness.size(); ++s)
+    {
+        int i = springEnds[s * 2], j = springEnds[s * 2 + 1];
+        if (i == j)  continue; //Both ends welded to the same particle, it can't stretch
+
+        mLevels[0].springDiagonal[i] += stiffness[s];
+        mLevels[0].springDiagonal[j] += stiffness[s];
+        entries.push_back({ i, j, -stiffness[s] });
+        entries.push_back({ j, i, -stiffness[s] });
+    }
+    BuildRows(entries, count, mLevels[0].rowOffsets, mLevels[0].columns, mLevels[0].values);
+
+    //Coarsen until the smallest level can be solved exactly, or grouping stops making it much smaller
+    while (mLevels.size() < MULTIGRID_MAX_LEVELS && mLevels.back().mass.size() > MULTIGRID_DIRECT_SIZE)
+    {
+        Level coarse;
+        Coarsen(mLevels.back(), coarse);
+        if (coarse.mass.size() > mLevels.back().mass.size() * MULTIGRID_MIN_REDUCTION)
+        {
+            mLevels.back().aggregate.clear();
+            break;
+        }
+        mLevels.push_back(std::move(coarse));
+    }
+
+    for (Level& level : mLevels)
+    {
+        level.x.resize(level.mass.size());
+        level.b.resize(level.mass.size());
+        level.product.resize(level.mass.size());
+        level.inverseDiagonal.resize(level.mass.size());
+    }
+    mResidual.resize(count);
+    mDirection.resize(count);
+    mPreconditioned.resize(count);
+    mProduct.resize(count);
+    mBlockSums.resize((count + MULTIGRID_GRAIN - 1) / MULTIGRID_GRAIN);
+}
+
+
+// Groups each particle whose neighbours are all still free with those neighbours, then adds every particle left
+// over to the group it's most strongly connected to
+void SpringMultigrid::Coarsen(Level& fine, Level& coarse)
+{
+    const int count = static_cast<int>(fine.mass.size());
+    fine.aggregate.assign(count, -1);
+    int groupCount = 0;
+
+    for (int i = 0; i < count; ++i)
+    {
+        if (fine.aggregate[i] >= 0)  continue;
+
+        bool isFree = true;
+        for (int e = fine.rowOffsets[i]; e < fine.rowOffsets[i + 1] && isFree; ++e)
+        {
+            isFree = (fine.aggregate[fine.columns[e]] < 0);
+        }
+        if (!isFree)  continue;
+
+        fine.aggregate[i] = groupCount;
+        for (int e = fine.rowOffsets[i]; e < fine.rowOffsets[i + 1]; ++e)
+        {
+            fine.aggregate[fine.columns[e]] = groupCount;
+        }
+        ++groupCount;
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+        if (fine.aggregate[i] >= 0)  continue;
+
+        int strongest = -1;
+        for (int e = fine.rowOffsets[i]; e < fine.rowOffsets[i + 1]; ++e)
+        {
+            if (fine.aggregate[fine.columns[e]] >= 0 && (strongest < 0 || fine.values[e] < fine.values[strongest]))
+            {
+                strongest = e;
+            }
+        }
+        fine.aggregate[i] = (strongest >= 0) ? fine.aggregate[fine.columns[strongest]] : groupCount++;
+    }
+
+    fine.memberOffsets.assign(groupCount + 1, 0);
+    for (int i = 0; i < count; ++i)
+    {
+        ++fine.memberOffsets[fine.aggregate[i] + 1];
+    }
+    for (int g = 0; g < groupCount; ++g)
+    {
+        fine.memberOffsets[g + 1] += fine.memberOffsets[g];
+    }
+    fine.members.resize(count);
+    std::vector<int> fill(fine.memberOffsets.begin(), fine.memberOffsets.end() - 1);
+    for (int i = 0; i < count; ++i)
+    {
+        fine.members[fill[fine.aggregate[i]]++] = i;
+    }
+
+    //Springs inside a group only add to its diagonal, the rest join groups
+    coarse.mass.assign(groupCount, 0.0f);
+    coarse.springDiagonal.assign(groupCount, 0.0f);
+    std::vector<MatrixEntry> entries;
+    for (int i = 0; i < count; ++i)
+    {
+        const int group = fine.aggregate[i];
+        coarse.mass[group] += fine.mass[i];
+        coarse.springDiagonal[group] += fine.springDiagonal[i];
+        for (int e = fine.rowOffsets[i]; e < fine.rowOffsets[i + 1]; ++e)
+        {
+            const int otherGroup = fine.aggregate[fine.columns[e]];
+            if (otherGroup == group)
+            {
+                coarse.springDiagonal[group] += fine.values[e];
+            }
+            else
+            {
+                entries.push_back({ group, otherGroup, fine.values[e] });
+            }
+        }
+    }
+    BuildRows(entries, groupCount, coarse.rowOffsets, coarse.columns, coarse.values);
+}
+
+
+// The mass part of every level's diagonal and the smallest level's factor depend on the time step
+void SpringMultigrid::SetTimeStep(float updateTime)
+{
+    if (updateTime == mTimeStep)  return;
+    mTimeStep = updateTime;
+
+    const float massScale = 1.0f / (updateTime * updateTime);
+    for (Level& level : mLevels)
+    {
+        for (int i = 0; i < level.mass.size(); ++i)
+        {
+            level.inverseDiagonal[i] = 1.0f / (level.mass[i] * massScale + level.springDiagonal[i]);
+        }
+    }
+
+    const Level& last = mLevels.back();
+    const int size = static_cast<int>(last.mass.size());
+    mDirectFactor.clear();
+    if (size > MULTIGRID_DIRECT_SIZE)  return;
+
+    std::vector<double>& a = mDirectFactor;
+    a.assign(size * size, 0.0);
+    for (int r = 0; r < size; ++r)
+    {
+        a[r * size + r] = last.mass[r] * massScale + last.springDiagonal[r];
+        for (int e = last.rowOffsets[r]; e < last.rowOffsets[r + 1]; ++e)
+        {
+            a[r * size + last.columns[e]] = last.values[e];
+        }
+    }
+
+    //Cholesky, the lower triangle becomes L where A = L L^T. The mass term keeps the matrix positive definite.
+    for (int c = 0; c < size; ++c)
+    {
+        double diagonal = a[c * size + c];
+        for (int k = 0; k < c; ++k)
+        {
+            diagonal -= a[c * size + k] * a[c * size + k];
+        }
+        diagonal = sqrt(diagonal);
+        a[c * size + c] = diagonal;
+
+        for (int r = c + 1; r < size; ++r)
+        {
+            double value = a[r * size + c];
+            for (int k = 0; k < c; ++k)
+            {
+                value -= a[r * size + k] * a[c * size + k];
+            }
+            a[r * size + c] = value / diagonal;
+        }
+    }
+}
+
+
+float SpringMultigrid::Solve(float updateTime, const std::vector<CVector3>& rightHandSide, std::vector<CVector3>& x, int iterations)
+{
+    if (mLevels.empty())  return 0;
+
+    SetTimeStep(updateTime);
+    TaskPool& pool = GetTaskPool();
+    const int count = static_cast<int>(x.size());
+    Level& top = mLevels[0];
+
+    Multiply(top, x, mProduct);
+    pool.ParallelFor(count, MULTIGRID_GRAIN, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            mResidual[i] = rightHandSide[i] - mProduct[i];
+        }
+    });
+
+    auto Precondition = [&]()
+    {
+        top.b = mResidual;
+        VCycle(0);
+        mPreconditioned = top.x;
+    };
+
+    Precondition();
+    mDirection = mPreconditioned;
+    CVector3 residualDotPreconditioned = SumProducts(mResidual, mPreconditioned);
+    CVector3 startResidual = SumProducts(mResidual, mResidual);
+    const float startNorm = startResidual.x + startResidual.y + startResidual.z;
+    if (startNorm == 0)  return 0;
+
+    //x, y and z are three separate systems that share the matrix, so each has its own step lengths
+    for (int iteration = 0; iteration < iterations; ++iteration)
+    {
+        Multiply(top, mDirection, mProduct);
+        CVector3 curvature = SumProducts(mDirection, mProduct);
+        CVector3 stepLength((curvature.x > 0) ? residualDotPreconditioned.x / curvature.x : 0,
+                            (curvature.y > 0) ? residualDotPreconditioned.y / curvature.y : 0,
+                            (curvature.z > 0) ? residualDotPreconditioned.z / curvature.z : 0);
+
+        pool.ParallelFor(count, MULTIGRID_GRAIN, [&](int begin, int end)
+        {
+            for (int i = begin; i < end; ++i)
+            {
+                x[i].x += stepLength.x * mDirection[i].x;  mResidual[i].x -= stepLength.x * mProduct[i].x;
+                x[i].y += stepLength.y * mDirection[i].y;  mResidual[i].y -= stepLength.y * mProduct[i].y;
+                x[i].z += stepLength.z * mDirection[i].z;  mResidual[i].z -= stepLength.z * mProduct[i].z;
+            }
+        });
+        if (iteration + 1 == iterations)  break;
+
+        Precondition();
+        CVector3 nextDot = SumProducts(mResidual, mPreconditioned);
+        CVector3 blend((residualDotPreconditioned.x != 0) ? nextDot.x / residualDotPreconditioned.x : 0,
+                       (residualDotPreconditioned.y != 0) ? nextDot.y / residualDotPreconditioned.y : 0,
+                       (residualDotPreconditioned.z != 0) ? nextDot.z / residualDotPreconditioned.z : 0);
+        residualDotPreconditioned = nextDot;
+
+        pool.ParallelFor(count, MULTIGRID_GRAIN, [&](int begin, int end)
+        {
+            for (int i = begin; i < end; ++i)
+            {
+                mDirection[i].x = mPreconditioned[i].x + blend.x * mDirection[i].x;
+                mDirection[i].y = mPreconditioned[i].y + blend.y * mDirection[i].y;
+                mDirection[i].z = mPreconditioned[i].z + blend.z * mDirection[i].z;
+            }
+        });
+    }
+
+    CVector3 endResidual = SumProducts(mResidual, mResidual);
+    return sqrt((endResidual.x + endResidual.y + endResidual.z) / startNorm);
+}
+
+
+void SpringMultigrid::Multiply(const Level& level, const std::vector<CVector3>& x, std::vector<CVector3>& output)
+{
+    const float massScale = 1.0f / (mTimeStep * mTimeStep);
+    GetTaskPool().ParallelFor(static_cast<int>(x.size()), MULTIGRID_GRAIN, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            CVector3 sum = x[i] * (level.mass[i] * massScale + level.springDiagonal[i]);
+            for (int e = level.rowOffsets[i]; e < level.rowOffsets[i + 1]; ++e)
+            {
+                sum += x[level.columns[e]] * level.values[e];
+            }
+            output[i] = sum;
+        }
+    });
+}
+
+
+// Weighted Jacobi on the level's x for its b, starting from zero if isZeroStart
+void SpringMultigrid::Smooth(Level& level, bool isZeroStart)
+{
+    const int count = static_cast<int>(level.mass.size());
+    if (isZeroStart)
+    {
+        GetTaskPool().ParallelFor(count, MULTIGRID_GRAIN, [&](int begin, int end)
+        {
+            for (int i = begin; i < end; ++i)
+            {
+                level.x[i] = level.b[i] * (MULTIGRID_JACOBI_WEIGHT * level.inverseDiagonal[i]);
+            }
+        });
+        return;
+    }
+
+    Multiply(level, level.x, level.product);
+    GetTaskPool().ParallelFor(count, MULTIGRID_GRAIN, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            level.x[i] += (level.b[i] - level.product[i]) * (MULTIGRID_JACOBI_WEIGHT * level.inverseDiagonal[i]);
+        }
+    });
+}
+
+
+// Approximately solves level's system for its b into its x, correcting the smoothed result with the
+// next level's solution for what's left over
+void SpringMultigrid::VCycle(int levelIndex)
+{
+    Level& level = mLevels[levelIndex];
+    TaskPool& pool = GetTaskPool();
+
+    if (levelIndex + 1 == mLevels.size())
+    {
+        if (!mDirectFactor.empty())
+        {
+            SolveDirect();
+            return;
+        }
+        Smooth(level, true);
+        for (int sweep = 1; sweep < MULTIGRID_FALLBACK_SWEEPS; ++sweep)
+        {
+            Smooth(level, false);
+        }
+        return;
+    }
+
+    Smooth(level, true);
+    for (int sweep = 1; sweep < MULTIGRID_SMOOTHING; ++sweep)
+    {
+        Smooth(level, false);
+    }
+
+    Multiply(level, level.x, level.product);
+    Level& coarse = mLevels[levelIndex + 1];
+    pool.ParallelFor(static_cast<int>(coarse.mass.size()), MULTIGRID_GRAIN, [&](int begin, int end)
+    {
+        for (int g = begin; g < end; ++g)
+        {
+            CVector3 sum(0, 0, 0);
+            for (int m = level.memberOffsets[g]; m < level.memberOffsets[g + 1]; ++m)
+            {
+                sum += level.b[level.members[m]] - level.product[level.members[m]];
+            }
+            coarse.b[g] = sum;
+        }
+    });
+
+    VCycle(levelIndex + 1);
+
+    pool.ParallelFor(static_cast<int>(level.mass.size()), MULTIGRID_GRAIN, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            level.x[i] += coarse.x[level.aggregate[i]];
+        }
+    });
+
+    for (int sweep = 0; sweep < MULTIGRID_SMOOTHING; ++sweep)
+    {
+        Smooth(level, false);
+    }
+}
+
+
+// Forward and back substitution with the smallest level's Cholesky factor
+void SpringMultigrid::SolveDirect()
+{
+    Level& level = mLevels.back();
+    const int size = static_cast<int>(level.mass.size());
+    const std::vector<double>& a = mDirectFactor;
+
+    std::vector<double> solution(size * 3);
+    for (int r = 0; r < size; ++r)
+    {
+        double sum[3] = { level.b[r].x, level.b[r].y, level.b[r].z };
+        for (int k = 0; k < r; ++k)
+        {
+            for (int c = 0; c < 3; ++c)  sum[c] -= a[r * size + k] * solution[k * 3 + c];
+        }
+        for (int c = 0; c < 3; ++c)  solution[r * 3 + c] = sum[c] / a[r * size + r];
+    }
+    for (int r = size - 1; r >= 0; --r)
+    {
+        double sum[3] = { solution[r * 3], solution[r * 3 + 1], solution[r * 3 + 2] };
+        for (int k = r + 1; k < size; ++k)
+        {
+            for (int c = 0; c < 3; ++c)  sum[c] -= a[k * size + r] * solution[k * 3 + c];
+        }
+        for (int c = 0; c < 3; ++c)  solution[r * 3 + c] = sum[c] / a[r * size + r];
+    }
+
+    for (int r = 0; r < size; ++r)
+    {
+        level.x[r] = CVector3(static_cast<float>(solution[r * 3]), static_cast<float>(solution[r * 3 + 1]), static_cast<float>(solution[r * 3 + 2]));
+    }
+}
+
+
+// Per component dot product. Summed in fixed blocks and then in block order so it doesn't depend on the thread count.
+CVector3 SpringMultigrid::SumProducts(const std::vector<CVector3>& a, const std::vector<CVector3>& b)
+{
+    const int count = static_cast<int>(a.size());
+    GetTaskPool().ParallelFor(count, MULTIGRID_GRAIN, [&](int begin, int end)
+    {
+        //ParallelFor runs everything as one block when there's nobody to share it with
+        for (int blockBegin = begin; blockBegin < end; blockBegin += MULTIGRID_GRAIN)
+        {
+            const int blockEnd = std::min(end, blockBegin + MULTIGRID_GRAIN);
+            CVector3 sum(0, 0, 0);
+            for (int i = blockBegin; i < blockEnd; ++i)
+            {
+                sum.x += a[i].x * b[i].x;
+                sum.y += a[i].y * b[i].y;
+                sum.z += a[i].z * b[i].z;
+            }
+            mBlockSums[blockBegin / MULTIGRID_GRAIN] = sum;
+        }
+    });
+
+    CVector3 total(0, 0, 0);
+    for (int block = 0; block < (count + MULTIGRID_GRAIN - 1) / MULTIGRID_GRAIN; ++block)
+    {
+        total += mBlockSums[block];
+    }
+    return total;
+}
@@ -0,0 +1,92 @@
+//--------------------------------------------------------------------------------------
+// Multigrid solver for the linear system of an implicit spring step
+//--------------------------------------------------------------------------------------
+// Stepping the springs implicitly (see SoftBodyWorld's hierarchical solver) means solving
+//   (M / h^2 + L) x = b
+// each step, where M holds the particle masses, h is the time step and L is the spring graph
+// weighted by stiffness (a graph Laplacian). The matrix is the same for x, y and z so the three
+// are solved together.
+//
+// Plain iterations such as Jacobi also only pass information one spring per sweep, which is the
+// problem the implicit step is meant to fix. So the spring graph is coarsened into levels at
+// Build: each level groups every particle with its unclaimed neighbours (aggregation) and the
+// springs between groups become the next level's springs, summed (a Galerkin product), until
+// only a few particles are left. The smallest level is solved exactly. Solve runs conjugate
+// gradients with one V-cycle over the levels as the preconditioner, so a correction reaches the
+// whole body in each iteration and the iterations needed hardly grow with the mesh resolution.
+//
+// Only the mass term depends on the time step, so a Build lasts until the springs or their
+// strengths change. Every pass is split over the TaskPool in fixed blocks and sums are added in
+// block order, so the result is the same on any thread count.
+
+#include "Common.h"
+
+#include <vector>
+
+#ifndef _SPRING_MULTIGRID_H_INCLUDED_
+#define _SPRING_MULTIGRID_H_INCLUDED_
+
+constexpr int   MULTIGRID_MAX_LEVELS = 12;
+constexpr int   MULTIGRID_DIRECT_SIZE = 128;   //A level this small or smaller is solved exactly
+constexpr float MULTIGRID_MIN_REDUCTION = 0.8f; //A level must have at most this fraction of the particles of the one before
+constexpr int   MULTIGRID_SMOOTHING = 1;       //Jacobi sweeps before and after each coarse correction
+constexpr float MULTIGRID_JACOBI_WEIGHT = 0.6f;
+constexpr int   MULTIGRID_GRAIN = 512;         //Particles per block handed to a thread
+
+
+class SpringMultigrid
+{
+public:
+    // masses has one entry per particle. Spring s joins particles springEnds[s * 2] and springEnds[s * 2 + 1] with stiffness[s].
+    void Build(const std::vector<float>& masses, const std::vector<int>& springEnds, const std::vector<float>& stiffness);
+
+    // Improves x, one per particle, towards the solution for rightHandSide with the given time step. Returns the
+    // remaining residual relative to the first one.
+    float Solve(float updateTime, const std::vector<CVector3>& rightHandSide, std::vector<CVector3>& x, int iterations);
+
+    int GetLevelCount() { return static_cast<int>(mLevels.size()); }
+    int GetLevelSize(int level) { return static_cast<int>(mLevels[level].mass.size()); }
+
+private:
+    struct Level
+    {
+        // Off-diagonal springs in compressed rows, the diagonal kept apart as only the mass part changes with the time step
+        std::vector<int>   rowOffsets;
+        std::vector<int>   columns;
+        std::vector<float> values;
+        std::vector<float> springDiagonal;
+        std::vector<float> mass;
+
+        std::vector<float> inverseDiagonal; //Of the whole matrix, for the current time step
+
+        // Groups of this level's particles that make up the next level's. Particle i is in group aggregate[i], and
+        // group g's particles are members[memberOffsets[g]] to [memberOffsets[g + 1]].
+        std::vector<int> aggregate;
+        std::vector<int> memberOffsets;
+        std::vector<int> members;
+
+        // Scratch vectors for the V-cycle
+        std::vector<CVector3> x, b, product;
+    };
+
+    void Coarsen(Level& fine, Level& coarse);
+    void SetTimeStep(float updateTime);
+    void Multiply(const Level& level, const std::vector<CVector3>& x, std::vector<CVector3>& output);
+    void Smooth(Level& level, bool isZeroStart);
+    void VCycle(int level);
+    void SolveDirect();
+    CVector3 SumProducts(const std::vector<CVector3>& a, const std::vector<CVector3>& b);
+
+    std::vector<Level> mLevels;
+    float mTimeStep = 0;
+
+    // Cholesky factor of the smallest level's whole matrix, row major, for the current time step
+    std::vector<double> mDirectFactor;
+
+    // Conjugate gradient vectors, per particle
+    std::vector<CVector3> mResidual, mDirection, mPreconditioned, mProduct;
+    std::vector<CVector3> mBlockSums;
+};
+
+
+#endif //_SPRING_MULTIGRID_H_INCLUDED_
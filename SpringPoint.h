@@ -39,10 +39,8 @@ public:
 	}
 
 	//Note: Likely need to store original places in order to calculate volume, i.e. It has moved X much so increase outwards-push by X.
-	~SpringPoint()
-	{
-		delete this;
-	}
+	//The owner deletes the spring, it only points at nodes it does not own.
+	~SpringPoint() {}
 
 	int getBoundParentCount()
 	{
@@ -0,0 +1,164 @@
+//--------------------------------------------------------------------------------------
+// Draws a soft body's nodes and springs with one instanced draw call
+//--------------------------------------------------------------------------------------
+
+#include "SpringVisualiser.h"
+#include "TaskPool.h"
+#include "Profiler.h"
+#include "Shader.h"
+#include "GraphicsDevice.h"
+
+#include <cstring>
+
+
+namespace
+{
+    // Scale, then turn to face along direction, then move to position. Matches a Model using FaceTarget.
+    CMatrix4x4 FacingMatrix(CVector3 position, CVector3 direction, CVector3 scale)
+    {
+        CVector3 axisX = { 1, 0, 0 };
+        CVector3 axisY = { 0, 1, 0 };
+        CVector3 axisZ = { 0, 0, 1 };
+
+        //FaceTarget leaves the matrix unturned for straight up/down, use the x axis as up then so vertical springs still line up
+        CVector3 facing = Normalise(direction);
+        CVector3 side = Normalise(Cross(CVector3(0, 1, 0), facing));
+        if (Length(side) == 0)
+        {
+            side = Normalise(Cross(CVector3(1, 0, 0), facing));
+        }
+        if (Length(facing) > 0 && Length(side) > 0)
+        {
+            axisZ = facing;
+            axisX = side;
+            axisY = Cross(axisZ, axisX);
+        }
+
+        CMatrix4x4 m;
+        m.e00 = axisX.x * scale.x;  m.e01 = axisX.y * scale.x;  m.e02 = axisX.z * scale.x;  m.e03 = 0;
+        m.e10 = axisY.x * scale.y;  m.e11 = axisY.y * scale.y;  m.e12 = axisY.z * scale.y;  m.e13 = 0;
+        m.e20 = axisZ.x * scale.z;  m.e21 = axisZ.y * scale.z;  m.e22 = axisZ.z * scale.z;  m.e23 = 0;
+        m.e30 = position.x;         m.e31 = position.y;         m.e32 = position.z;         m.e33 = 1;
+        return m;
+    }
+}
+
+
+int BuildSpringInstances(Mesh* mesh, CVector3 position, CVector3 scale, bool showNodes, int springCount, std::vector<CMatrix4x4>& transforms)
+{
+    int nodeCount = showNodes ? mesh->VertexData.getSize() : 0;
+    if (springCount > mesh->getSpringSize())  springCount = mesh->getSpringSize();
+    if (springCount < 0)  springCount = 0;
+
+    int instanceCount = nodeCount + springCount;
+    transforms.resize(instanceCount);
+
+    GetTaskPool().ParallelFor(instanceCount, VISUALISER_GRAIN, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            if (i < nodeCount)
+            {
+                CVector3 node = mesh->VertexData.getPosition(i);
+                CVector3 nodePosition = position + CVector3(node.x * scale.x, node.y * scale.y, node.z * scale.z);
+                transforms[i] = FacingMatrix(nodePosition, CVector3(0, 0, 0), CVector3(NodeScale, NodeScale, NodeScale));
+            }
+            else
+            {
+                //Springs sit halfway between their parents, facing parent 0 and stretched to reach both
+                int spring = i - nodeCount;
+                CVector3 parent0 = *mesh->getSpringParent(spring, 0);
+                CVector3 parent1 = *mesh->getSpringParent(spring, 1);
+                CVector3 springPosition = position + (parent0 + parent1) / 2.0f;
+                float length = Distance(parent0, parent1);
+
+                transforms[i] = FacingMatrix(springPosition, (position + parent0) - springPosition,
+                                             CVector3(NodeScale * 0.1f, NodeScale * 0.1f, length * SpringScale));
+            }
+        }
+    });
+
+    return instanceCount;
+}
+
+
+bool SpringVisualiser::Init(Mesh* instanceMesh)
+{
+    mInstanceMesh = instanceMesh;
+
+    //The mesh's own vertex data first, then a world matrix per instance in the slot after it
+    std::vector<D3D11_INPUT_ELEMENT_DESC> elements = instanceMesh->GetVertexElements();
+    const UINT instanceSlot = instanceMesh->GetStreamCount();
+    for (unsigned int row = 0; row < 4; ++row)
+    {
+        elements.push_back({ "InstanceWorld", row, DXGI_FORMAT_R32G32B32A32_FLOAT, instanceSlot, row * 16, D3D11_INPUT_PER_INSTANCE_DATA, 1 });
+    }
+
+    auto shaderSignature = CreateSignatureForVertexLayout(elements.data(), static_cast<int>(elements.size()));
+    HRESULT hr = gGraphics->CreateInputLayout(elements.data(), static_cast<UINT>(elements.size()),
+                                               shaderSignature->GetBufferPointer(), shaderSignature->GetBufferSize(),
+                                               &mInstanceLayout);
+    if (shaderSignature)  shaderSignature->Release();
+    if (FAILED(hr))
+    {
+        gLastError = "Failure creating input layout for spring instances";
+        return false;
+    }
+    return true;
+}
+
+
+void SpringVisualiser::Release()
+{
+    if (mInstanceBuffer)  mInstanceBuffer->Release();
+    if (mInstanceLayout)  mInstanceLayout->Release();
+    mInstanceBuffer = nullptr;
+    mInstanceLayout = nullptr;
+    mInstanceCapacity = 0;
+}
+
+
+// Grows the instance buffer to hold at least count instances
+bool SpringVisualiser::ReserveInstances(int count)
+{
+    if (count <= mInstanceCapacity)  return true;
+
+    int capacity = (mInstanceCapacity > 0) ? mInstanceCapacity : 1024;
+    while (capacity < count)  capacity *= 2;
+
+    if (mInstanceBuffer)  mInstanceBuffer->Release();
+    mInstanceBuffer = nullptr;
+    mInstanceCapacity = 0;
+
+    D3D11_BUFFER_DESC bufferDesc;
+    bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+    bufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+    bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    bufferDesc.ByteWidth = capacity * sizeof(CMatrix4x4);
+    bufferDesc.MiscFlags = 0;
+    if (FAILED(gGraphics->CreateBuffer(&bufferDesc, nullptr, &mInstanceBuffer)))  return false;
+
+    mInstanceCapacity = capacity;
+    return true;
+}
+
+
+void SpringVisualiser::Prepare(Mesh* mesh, CVector3 position, CVector3 scale, bool showNodes, int springCount)
+{
+    PROFILE_SCOPE("Spring visualiser");
+    mInstanceCount = BuildSpringInstances(mesh, position, scale, showNodes, springCount, mTransforms);
+}
+
+
+void SpringVisualiser::Render()
+{
+    int instanceCount = mInstanceCount;
+    if (instanceCount == 0 || mInstanceLayout == nullptr || !ReserveInstances(instanceCount))  return;
+
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    if (FAILED(gGraphics->Map(mInstanceBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))  return;
+    memcpy(mapped.pData, mTransforms.data(), instanceCount * sizeof(CMatrix4x4));
+    gGraphics->Unmap(mInstanceBuffer, 0);
+
+    mInstanceMesh->RenderInstanced(mInstanceLayout, mInstanceBuffer, sizeof(CMatrix4x4), instanceCount);
+}
@@ -0,0 +1,61 @@
+//--------------------------------------------------------------------------------------
+// Draws a soft body's nodes and springs with one instanced draw call
+//--------------------------------------------------------------------------------------
+// Every node is shown as a small cube and every spring as a thin cube stretched between its
+// two ends. Rather than one Model (and one constant buffer update and draw call) for each,
+// the world matrix of every instance is built in one parallel pass into a single instance
+// buffer, and the cube mesh is drawn once with that buffer.
+//
+// BuildSpringInstances only does the maths so it can be run and checked without a GPU.
+// The instance matrices are laid out as CMatrix4x4 is, a row at a time with the position in the
+// last row, so SpringInstance_vs.hlsl multiplies with mul(position, world).
+
+#include "Mesh.h"
+#include "CMatrix4x4.h"
+
+#include <vector>
+
+#ifndef _SPRING_VISUALISER_H_INCLUDED_
+#define _SPRING_VISUALISER_H_INCLUDED_
+
+constexpr float NodeScale = 0.0085f;
+constexpr float SpringScale = 0.1f; //Cubes have a size of (10,10,10)
+
+constexpr int VISUALISER_GRAIN = 512; //Instances per block when building in parallel
+
+
+// Fills transforms with a world matrix for each node of the mesh, if showNodes, followed by one for each
+// of the first springCount springs. position and scale are those of the soft body's model.
+// Returns the number of instances written.
+int BuildSpringInstances(Mesh* mesh, CVector3 position, CVector3 scale, bool showNodes, int springCount, std::vector<CMatrix4x4>& transforms);
+
+
+class SpringVisualiser
+{
+public:
+    // instanceMesh is the mesh drawn for every node and spring
+    // Returns false on failure, with gLastError set
+    bool Init(Mesh* instanceMesh);
+    void Release();
+
+    // Builds the instances for the given soft body on the CPU. Reads the nodes, so with the simulation on its own
+    // thread this must be called while it isn't stepping.
+    void Prepare(Mesh* mesh, CVector3 position, CVector3 scale, bool showNodes, int springCount);
+
+    // Draws the instances from the last Prepare. Shaders, textures and states must be set already.
+    void Render();
+
+private:
+    bool ReserveInstances(int count);
+
+    Mesh* mInstanceMesh = nullptr;
+    ID3D11InputLayout* mInstanceLayout = nullptr;
+    ID3D11Buffer* mInstanceBuffer = nullptr;
+    int mInstanceCapacity = 0;
+
+    std::vector<CMatrix4x4> mTransforms;
+    int mInstanceCount = 0;
+};
+
+
+#endif //_SPRING_VISUALISER_H_INCLUDED_
@@ -7,6 +7,7 @@
 //--------------------------------------------------------------------------------------
 
 #include "State.h"
+#include "GraphicsDevice.h"
 
 
 //--------------------------------------------------------------------------------------
@@ -67,7 +68,7 @@ bool CreateStates()
 	samplerDesc.MinLOD = 0;                 // --"--
 
 	// Then create a DirectX object for your description that can be used by a shader
-	if (FAILED(gD3DDevice->CreateSamplerState(&samplerDesc, &gPointSampler)))
+	if (FAILED(gGraphics->CreateSamplerState(&samplerDesc, &gPointSampler)))
 	{
 		gLastError = "Error creating point sampler";
 		return false;
@@ -85,7 +86,7 @@ bool CreateStates()
 	samplerDesc.MinLOD = 0;                 // --"--
 
 	// Then create a DirectX object for your description that can be used by a shader
-	if (FAILED(gD3DDevice->CreateSamplerState(&samplerDesc, &gTrilinearSampler)))
+	if (FAILED(gGraphics->CreateSamplerState(&samplerDesc, &gTrilinearSampler)))
 	{
 		gLastError = "Error creating point sampler";
 		return false;
@@ -103,7 +104,7 @@ bool CreateStates()
 	samplerDesc.MinLOD = 0;                 // --"--
 
 	// Then create a DirectX object for your description that can be used by a shader
-	if (FAILED(gD3DDevice->CreateSamplerState(&samplerDesc, &gAnisotropic4xSampler)))
+	if (FAILED(gGraphics->CreateSamplerState(&samplerDesc, &gAnisotropic4xSampler)))
 	{
 		gLastError = "Error creating anisotropic 4x sampler";
 		return false;
@@ -125,7 +126,7 @@ bool CreateStates()
     rasterizerDesc.DepthClipEnable       = TRUE; // Advanced setting - only used in rare cases
 
     // Create a DirectX object for the description above that can be used by a shader
-    if (FAILED(gD3DDevice->CreateRasterizerState(&rasterizerDesc, &gCullBackState)))
+    if (FAILED(gGraphics->CreateRasterizerState(&rasterizerDesc, &gCullBackState)))
     {
         gLastError = "Error creating cull-back state";
         return false;
@@ -139,7 +140,7 @@ bool CreateStates()
     rasterizerDesc.DepthClipEnable       = TRUE; // Advanced setting - only used in rare cases
 
     // Create a DirectX object for the description above that can be used by a shader
-    if (FAILED(gD3DDevice->CreateRasterizerState(&rasterizerDesc, &gCullFrontState)))
+    if (FAILED(gGraphics->CreateRasterizerState(&rasterizerDesc, &gCullFrontState)))
     {
         gLastError = "Error creating cull-front state";
         return false;
@@ -153,7 +154,7 @@ bool CreateStates()
     rasterizerDesc.DepthClipEnable       = TRUE; // Advanced setting - only used in rare cases
 
     // Create a DirectX object for the description above that can be used by a shader
-    if (FAILED(gD3DDevice->CreateRasterizerState(&rasterizerDesc, &gCullNoneState)))
+    if (FAILED(gGraphics->CreateRasterizerState(&rasterizerDesc, &gCullNoneState)))
     {
         gLastError = "Error creating cull-none state";
         return false;
@@ -180,7 +181,7 @@ bool CreateStates()
     blendDesc.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
 
     // Then create a DirectX object for the description that can be used by a shader
-    if (FAILED(gD3DDevice->CreateBlendState(&blendDesc, &gNoBlendingState)))
+    if (FAILED(gGraphics->CreateBlendState(&blendDesc, &gNoBlendingState)))
     {
         gLastError = "Error creating no-blend state";
         return false;
@@ -201,7 +202,7 @@ bool CreateStates()
     blendDesc.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
 
     // Then create a DirectX object for the description that can be used by a shader
-    if (FAILED(gD3DDevice->CreateBlendState(&blendDesc, &gAdditiveBlendingState)))
+    if (FAILED(gGraphics->CreateBlendState(&blendDesc, &gAdditiveBlendingState)))
     {
         gLastError = "Error creating additive blending state";
         return false;
@@ -220,7 +221,7 @@ bool CreateStates()
     AlphaBlendDesk.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
 
     // Then create a DirectX object for the description that can be used by a shader
-    if (FAILED(gD3DDevice->CreateBlendState(&AlphaBlendDesk, &Transparency)))
+    if (FAILED(gGraphics->CreateBlendState(&AlphaBlendDesk, &Transparency)))
     {
         gLastError = "Error creating alpha-blend state";
         return false;
@@ -241,7 +242,7 @@ bool CreateStates()
     SubtractBlendDesk.RenderTarget[0].RenderTargetWriteMask = D3D11_COLOR_WRITE_ENABLE_ALL;
 
     // Then create a DirectX object for the description that can be used by a shader
-    if (FAILED(gD3DDevice->CreateBlendState(&SubtractBlendDesk, &gSubtractiveBlendState)))
+    if (FAILED(gGraphics->CreateBlendState(&SubtractBlendDesk, &gSubtractiveBlendState)))
     {
         gLastError = "Error creating Subtract-blend state";
         return false;
@@ -263,7 +264,7 @@ bool CreateStates()
     depthStencilDesc.StencilEnable    = FALSE;
 
     // Create a DirectX object for the description above that can be used by a shader
-    if (FAILED(gD3DDevice->CreateDepthStencilState(&depthStencilDesc, &gUseDepthBufferState)))
+    if (FAILED(gGraphics->CreateDepthStencilState(&depthStencilDesc, &gUseDepthBufferState)))
     {
         gLastError = "Error creating use-depth-buffer state";
         return false;
@@ -278,7 +279,7 @@ bool CreateStates()
     depthStencilDesc.StencilEnable    = FALSE;
 
     // Create a DirectX object for the description above that can be used by a shader
-    if (FAILED(gD3DDevice->CreateDepthStencilState(&depthStencilDesc, &gDepthReadOnlyState)))
+    if (FAILED(gGraphics->CreateDepthStencilState(&depthStencilDesc, &gDepthReadOnlyState)))
     {
         gLastError = "Error creating depth-read-only state";
         return false;
@@ -292,7 +293,7 @@ bool CreateStates()
     depthStencilDesc.StencilEnable    = FALSE;
 
     // Create a DirectX object for the description above that can be used by a shader
-    if (FAILED(gD3DDevice->CreateDepthStencilState(&depthStencilDesc, &gNoDepthBufferState)))
+    if (FAILED(gGraphics->CreateDepthStencilState(&depthStencilDesc, &gNoDepthBufferState)))
     {
         gLastError = "Error creating no-depth-buffer state";
         return false;
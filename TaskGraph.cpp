@@ -0,0 +1,161 @@
+//--------------------------------------------------------------------------------------
+// Tasks with dependencies between them, run on the TaskPool
+//--------------------------------------------------------------------------------------
+
+#include "TaskGraph.h"
+#include "TaskPool.h"
+#include "Profiler.h"
+#include "imgui.h"
+
+#include <string>
+#include <algorithm>
+
+
+void TaskGraph::Clear()
+{
+    mTasks.clear();
+    mStart.clear();
+    mEnd.clear();
+    mCriticalPath.clear();
+    mRunTime = 0;
+}
+
+
+int TaskGraph::AddTask(const char* name, std::function<void()> work)
+{
+    Task task;
+    task.name = name;
+    task.work = std::move(work);
+    mTasks.push_back(std::move(task));
+    return GetTaskCount() - 1;
+}
+
+
+bool TaskGraph::AddDependency(int before, int after)
+{
+    if (before < 0 || before >= after || after >= GetTaskCount())  return false;
+
+    mTasks[before].dependents.push_back(after);
+    mTasks[after].dependencies.push_back(before);
+    return true;
+}
+
+
+void TaskGraph::Run()
+{
+    const int taskCount = GetTaskCount();
+    mStart.assign(taskCount, 0);
+    mEnd.assign(taskCount, 0);
+    if (taskCount == 0)
+    {
+        mRunTime = 0;
+        mCriticalPath.clear();
+        return;
+    }
+
+    if (mWaitingOnCapacity < taskCount)
+    {
+        mWaitingOn.reset(new std::atomic<int>[taskCount]);
+        mWaitingOnCapacity = taskCount;
+    }
+    for (int t = 0; t < taskCount; ++t)
+    {
+        mWaitingOn[t].store(static_cast<int>(mTasks[t].dependencies.size()));
+    }
+
+    mRunStart = Profiler::Now();
+
+    TaskPool& pool = GetTaskPool();
+    std::atomic<int> pending{ 0 };
+    for (int t = 0; t < taskCount; ++t)
+    {
+        if (mTasks[t].dependencies.empty())
+        {
+            pool.Submit([this, t, &pending]() { RunTask(t, pending); }, pending);
+        }
+    }
+    pool.Wait(pending);
+
+    mRunTime = Profiler::Now() - mRunStart;
+    FindCriticalPath();
+}
+
+
+// Queues the dependents it was the last to wait on before it counts as finished, so pending never
+// drops to 0 while there is still work to come
+void TaskGraph::RunTask(int task, std::atomic<int>& pending)
+{
+    mStart[task] = Profiler::Now() - mRunStart;
+    {
+        PROFILE_SCOPE(mTasks[task].name);
+        mTasks[task].work();
+    }
+    mEnd[task] = Profiler::Now() - mRunStart;
+
+    for (int dependent : mTasks[task].dependents)
+    {
+        if (mWaitingOn[dependent].fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            GetTaskPool().Submit([this, dependent, &pending]() { RunTask(dependent, pending); }, pending);
+        }
+    }
+}
+
+
+void TaskGraph::FindCriticalPath()
+{
+    mCriticalPath.clear();
+
+    int task = static_cast<int>(std::max_element(mEnd.begin(), mEnd.end()) - mEnd.begin());
+    while (task >= 0)
+    {
+        mCriticalPath.push_back(task);
+
+        int lastFinished = -1;
+        for (int dependency : mTasks[task].dependencies)
+        {
+            if (lastFinished < 0 || mEnd[dependency] > mEnd[lastFinished])  lastFinished = dependency;
+        }
+        task = lastFinished;
+    }
+    std::reverse(mCriticalPath.begin(), mCriticalPath.end());
+}
+
+
+void TaskGraph::ShowPanel(const char* title)
+{
+    ImGui::Begin(title, 0, ImGuiWindowFlags_AlwaysAutoResize);
+    if (mTasks.empty() || mStart.size() != mTasks.size())
+    {
+        ImGui::Text("Not run yet");
+        ImGui::End();
+        return;
+    }
+
+    //Time spent in the critical path's tasks, the rest of the run was them waiting for a thread
+    long long criticalWork = 0;
+    std::vector<bool> isCritical(mTasks.size(), false);
+    for (int task : mCriticalPath)
+    {
+        criticalWork += mEnd[task] - mStart[task];
+        isCritical[task] = true;
+    }
+    ImGui::Text("Run %.3f ms, critical path %.3f ms over %d of %d tasks (#)",
+                mRunTime * 1e-6, criticalWork * 1e-6, static_cast<int>(mCriticalPath.size()), GetTaskCount());
+
+    ImGui::Separator();
+    ImGui::Text("Task                  start ms  time ms");
+    const double columnsPerNs = (mRunTime > 0) ? static_cast<double>(TASK_GRAPH_TIMELINE_WIDTH) / mRunTime : 0.0;
+    for (int t = 0; t < GetTaskCount(); ++t)
+    {
+        int first = static_cast<int>(mStart[t] * columnsPerNs);
+        int last = static_cast<int>(mEnd[t] * columnsPerNs);
+        first = std::min(first, TASK_GRAPH_TIMELINE_WIDTH - 1);
+        last = std::min(std::max(last, first + 1), TASK_GRAPH_TIMELINE_WIDTH);
+
+        std::string timeline(TASK_GRAPH_TIMELINE_WIDTH, ' ');
+        std::fill(timeline.begin() + first, timeline.begin() + last, isCritical[t] ? '#' : '=');
+        ImGui::Text("%-20s %8.3f %8.3f |%s|", mTasks[t].name, mStart[t] * 1e-6, (mEnd[t] - mStart[t]) * 1e-6, timeline.c_str());
+    }
+    ImGui::End();
+}
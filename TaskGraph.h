@@ -0,0 +1,85 @@
+//--------------------------------------------------------------------------------------
+// Tasks with dependencies between them, run on the TaskPool
+//--------------------------------------------------------------------------------------
+// A frame is split into tasks (step the world, build a body's full mesh, test a body for collisions,
+// pack vertices, cull...) with an edge from each task to the ones that read what it writes. Run
+// queues every task with nothing to wait for and each task, as it finishes, queues those that were
+// only waiting on it. Independent tasks run on different threads at once and a task is free to use
+// ParallelFor inside itself, the pool shares both out.
+//
+// Each run records when every task started and finished. The critical path is the chain of tasks the
+// run actually waited on, found by walking back from the last task to finish through whichever of its
+// dependencies finished last. Speeding up anything off that chain doesn't make the frame shorter.
+// ShowPanel draws the run as a timeline with the chain marked, and every task is a profiler scope so
+// the Chrome trace shows which thread ran it.
+//
+// A task can only depend on tasks added before it, so a graph can never wait on itself.
+
+#include <vector>
+#include <functional>
+#include <memory>
+#include <atomic>
+
+#ifndef _TASK_GRAPH_H_INCLUDED_
+#define _TASK_GRAPH_H_INCLUDED_
+
+constexpr int TASK_GRAPH_TIMELINE_WIDTH = 48; //Characters across the timeline in ShowPanel
+
+
+class TaskGraph
+{
+public:
+    // Removes every task, and the last run's timings, so the graph can be built again
+    void Clear();
+
+    // Returns the handle of a new task. name must be a string literal (or otherwise live forever), see Profiler.
+    int AddTask(const char* name, std::function<void()> work);
+
+    // Makes after wait until before has finished. Returns false, adding nothing, unless before was added first.
+    bool AddDependency(int before, int after);
+
+    // Runs every task on GetTaskPool() and returns once they've all finished. The calling thread works on
+    // them too. Can be run again without being rebuilt.
+    void Run();
+
+    int GetTaskCount() const { return static_cast<int>(mTasks.size()); }
+
+    // Of the last run, in nanoseconds from when Run was called
+    long long GetRunTime() const { return mRunTime; }
+    long long GetTaskStart(int task) const { return mStart[task]; }
+    long long GetTaskEnd(int task) const { return mEnd[task]; }
+
+    // Tasks the last run waited on, first to last
+    const std::vector<int>& GetCriticalPath() const { return mCriticalPath; }
+
+    // The last run as a timeline, a row per task with the critical path marked. Call inside an ImGui frame.
+    void ShowPanel(const char* title);
+
+private:
+    struct Task
+    {
+        const char* name;
+        std::function<void()> work;
+        std::vector<int> dependents;   //Tasks waiting on this one
+        std::vector<int> dependencies; //Tasks this one waits on
+    };
+
+    void RunTask(int task, std::atomic<int>& pending);
+    void FindCriticalPath();
+
+    std::vector<Task> mTasks;
+
+    // Dependencies still to finish for each task this run, counted down as they do
+    std::unique_ptr<std::atomic<int>[]> mWaitingOn;
+    int mWaitingOnCapacity = 0;
+
+    // Of the last run
+    long long mRunStart = 0;
+    long long mRunTime = 0;
+    std::vector<long long> mStart;
+    std::vector<long long> mEnd;
+    std::vector<int> mCriticalPath;
+};
+
+
+#endif //_TASK_GRAPH_H_INCLUDED_
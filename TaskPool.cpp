@@ -0,0 +1,208 @@
+//--------------------------------------------------------------------------------------
+// Pool of worker threads for splitting loops across cores
+//--------------------------------------------------------------------------------------
+
+#include "TaskPool.h"
+#include "Profiler.h"
+
+#include <algorithm>
+
+namespace
+{
+    // Which pool, if any, the calling thread works for and the queue it owns there
+    struct WorkerIdentity
+    {
+        const TaskPool* pool = nullptr;
+        int queueIndex = 0;
+    };
+    thread_local WorkerIdentity tWorker;
+}
+
+
+TaskPool::TaskPool(int threadCount /*= 0*/)
+{
+    if (threadCount <= 0)
+    {
+        threadCount = static_cast<int>(std::thread::hardware_concurrency()) - 1;
+    }
+    if (threadCount < 0)  threadCount = 0;
+
+    mQueueCount = threadCount + 1;
+    mQueues.reset(new WorkQueue[mQueueCount]);
+
+    for (int i = 0; i < threadCount; ++i)
+    {
+        mThreads.emplace_back(&TaskPool::WorkerLoop, this, i);
+    }
+}
+
+
+TaskPool::~TaskPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mSleepMutex);
+        mQuit = true;
+    }
+    mWakeCondition.notify_all();
+
+    for (auto& thread : mThreads)
+    {
+        thread.join();
+    }
+}
+
+
+void TaskPool::ParallelFor(int count, int grainSize, const std::function<void(int, int)>& func)
+{
+    if (count <= 0)  return;
+    if (grainSize < 1)  grainSize = 1;
+
+    //Not worth waking anyone for a single block
+    if (count <= grainSize || mThreads.empty())
+    {
+        func(0, count);
+        return;
+    }
+
+    //Every helper takes blocks until there are none left, so a helper that starts late just finds nothing to do
+    std::atomic<int> nextBlock{ 0 };
+    auto runBlocks = [&]()
+    {
+        while (true)
+        {
+            int begin = nextBlock.fetch_add(grainSize);
+            if (begin >= count)  break;
+
+            func(begin, std::min(begin + grainSize, count));
+        }
+    };
+
+    const int blockCount = (count + grainSize - 1) / grainSize;
+    const int helperCount = std::min(static_cast<int>(mThreads.size()), blockCount - 1);
+    std::atomic<int> pending{ 0 };
+    for (int i = 0; i < helperCount; ++i)
+    {
+        Submit(runBlocks, pending);
+    }
+
+    runBlocks();
+
+    //The helpers use the locals above so every one must have run before returning
+    Wait(pending);
+}
+
+
+void TaskPool::Submit(std::function<void()> task, std::atomic<int>& pending)
+{
+    pending.fetch_add(1);
+
+    WorkQueue& queue = mQueues[GetQueueIndex()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back({ std::move(task), &pending });
+    }
+    mQueuedTasks.fetch_add(1);
+
+    //Taking the lock means a worker is either asleep or yet to check mQueuedTasks, so the wake isn't missed
+    {
+        std::lock_guard<std::mutex> lock(mSleepMutex);
+    }
+    mWakeCondition.notify_one();
+}
+
+
+void TaskPool::Wait(const std::atomic<int>& pending)
+{
+    const int queueIndex = GetQueueIndex();
+    const std::atomic<int>* onlyFor = (tWorker.pool == this) ? nullptr : &pending;
+    while (pending.load(std::memory_order_acquire) > 0)
+    {
+        //What's left is running on other threads
+        if (!RunOneTask(queueIndex, onlyFor))  std::this_thread::yield();
+    }
+}
+
+
+int TaskPool::GetQueueIndex() const
+{
+    return (tWorker.pool == this) ? tWorker.queueIndex : mQueueCount - 1;
+}
+
+
+bool TaskPool::RunOneTask(int queueIndex, const std::atomic<int>* onlyFor /*= nullptr*/)
+{
+    Task task;
+    bool found = false;
+
+    //Own queue newest first, as its data is most likely still in cache, then the others' oldest first
+    for (int i = 0; i < mQueueCount && !found; ++i)
+    {
+        WorkQueue& queue = mQueues[(queueIndex + i) % mQueueCount];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty())  continue;
+
+        if (onlyFor == nullptr)
+        {
+            if (i == 0)
+            {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            }
+            else
+            {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+            found = true;
+            continue;
+        }
+
+        //Same ends first, looking past tasks for other jobs
+        const int taskCount = static_cast<int>(queue.tasks.size());
+        for (int t = 0; t < taskCount && !found; ++t)
+        {
+            auto match = queue.tasks.begin() + ((i == 0) ? taskCount - 1 - t : t);
+            if (match->pending != onlyFor)  continue;
+
+            task = std::move(*match);
+            queue.tasks.erase(match);
+            found = true;
+        }
+    }
+    if (!found)  return false;
+
+    mQueuedTasks.fetch_sub(1);
+    task.work();
+
+    //Whoever is waiting can free everything the task used as soon as the count drops
+    std::atomic<int>* pending = task.pending;
+    task.work = nullptr;
+    pending->fetch_sub(1, std::memory_order_release);
+    return true;
+}
+
+
+void TaskPool::WorkerLoop(int queueIndex)
+{
+#if PROFILING_ENABLED
+    Profiler::SetThreadName("Task worker");
+#endif
+    tWorker.pool = this;
+    tWorker.queueIndex = queueIndex;
+
+    while (true)
+    {
+        if (RunOneTask(queueIndex))  continue;
+
+        std::unique_lock<std::mutex> lock(mSleepMutex);
+        mWakeCondition.wait(lock, [this]() { return mQuit || mQueuedTasks.load() > 0; });
+        if (mQuit)  return;
+    }
+}
+
+
+TaskPool& GetTaskPool()
+{
+    static TaskPool pool;
+    return pool;
+}
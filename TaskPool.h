@@ -0,0 +1,88 @@
+//--------------------------------------------------------------------------------------
+// Pool of worker threads for splitting loops across cores
+//--------------------------------------------------------------------------------------
+// The threads are made once and sleep between jobs, so a ParallelFor can be issued several
+// times a frame. The calling thread works on the job too and only returns once every part is done.
+//
+// Any thread may call ParallelFor, Submit and Wait while others are doing the same, and a task may
+// start a ParallelFor of its own. Work is shared out by stealing. Each worker has its own queue of
+// tasks and threads outside the pool share one more. A thread takes the newest task from its own
+// queue and, when that's empty, steals the oldest from another. Waiting runs queued tasks rather
+// than sleeping, so a task that starts a ParallelFor can't stall the pool. A worker that waits runs
+// any task, but a thread outside the pool only runs the tasks of the job it's waiting for, so it
+// isn't held up by a long task someone else queued.
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+#ifndef _TASK_POOL_H_INCLUDED_
+#define _TASK_POOL_H_INCLUDED_
+
+
+class TaskPool
+{
+public:
+    // threadCount is the number of extra threads, 0 uses one less than the number of cores.
+    TaskPool(int threadCount = 0);
+    ~TaskPool();
+
+    // Calls func(begin, end) over [0, count) in blocks of grainSize, spread across the pool.
+    // Which thread runs which block varies, so func must only write to data owned by its block.
+    void ParallelFor(int count, int grainSize, const std::function<void(int, int)>& func);
+
+    // Queues a task to run on whichever thread gets to it first. pending goes up by one now and down
+    // by one once the task has run, so several tasks can share a counter and be waited for together.
+    void Submit(std::function<void()> task, std::atomic<int>& pending);
+
+    // Runs queued tasks until pending reaches 0. Outside the pool only tasks submitted with this
+    // pending are run.
+    void Wait(const std::atomic<int>& pending);
+
+    // Threads that work on a ParallelFor, including the caller
+    int GetThreadCount() const { return static_cast<int>(mThreads.size()) + 1; }
+
+private:
+    struct Task
+    {
+        std::function<void()> work;
+        std::atomic<int>* pending;
+    };
+
+    struct WorkQueue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks; //Owner pushes and takes at the back, thieves take from the front
+    };
+
+    void WorkerLoop(int queueIndex);
+
+    // Queue of the calling thread, its own for a worker, otherwise the shared one
+    int GetQueueIndex() const;
+
+    // Takes a task from queueIndex, or steals one from another queue, and runs it. If onlyFor
+    // isn't null only a task submitted with that pending is taken. False if there was none.
+    bool RunOneTask(int queueIndex, const std::atomic<int>* onlyFor = nullptr);
+
+    std::vector<std::thread> mThreads;
+    std::unique_ptr<WorkQueue[]> mQueues; // One per worker, then the shared one
+    int mQueueCount = 0;
+
+    std::atomic<int> mQueuedTasks{ 0 }; // Across every queue, so sleeping workers know when to wake
+
+    std::mutex mSleepMutex;
+    std::condition_variable mWakeCondition;
+    bool mQuit = false;
+};
+
+
+// Shared pool, made on first use
+TaskPool& GetTaskPool();
+
+
+#endif //_TASK_POOL_H_INCLUDED_
@@ -0,0 +1,454 @@
+//--------------------------------------------------------------------------------------
+// Trajectory recording
+//--------------------------------------------------------------------------------------
+
+#include "TrajectoryRecorder.h"
+
+#include <cstring>
+#include <algorithm>
+#include <cmath>
+
+constexpr float QUANTISE_RANGE = 65535.0f;
+
+
+//--------------------------------------------------------------------------------------
+// Frame encoding
+//--------------------------------------------------------------------------------------
+
+namespace
+{
+    void WriteBytes(std::vector<unsigned char>& output, const void* data, size_t size)
+    {
+        size_t writePos = output.size();
+        output.resize(writePos + size);
+        memcpy(output.data() + writePos, data, size);
+    }
+
+    // Zig-zag maps small negative and positive differences to small unsigned values, which then take 1 byte as a varint.
+    void WriteVarint(std::vector<unsigned char>& output, int value)
+    {
+        unsigned int zigZag = (static_cast<unsigned int>(value) << 1) ^ static_cast<unsigned int>(value >> 31);
+        while (zigZag >= 0x80)
+        {
+            output.push_back(static_cast<unsigned char>(zigZag | 0x80));
+            zigZag >>= 7;
+        }
+        output.push_back(static_cast<unsigned char>(zigZag));
+    }
+
+    bool ReadVarint(const unsigned char*& input, const unsigned char* inputEnd, int& value)
+    {
+        unsigned int zigZag = 0;
+        int shift = 0;
+        while (input != inputEnd && shift < 35)
+        {
+            unsigned char byte = *input++;
+            zigZag |= static_cast<unsigned int>(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0)
+            {
+                value = static_cast<int>(zigZag >> 1) ^ -static_cast<int>(zigZag & 1);
+                return true;
+            }
+            shift += 7;
+        }
+        return false;
+    }
+}
+
+
+void TrajectoryCodec::EncodeFrame(const std::vector<std::vector<CVector3>>& bodies, std::vector<std::vector<unsigned short>>& previous, bool isKeyFrame, std::vector<unsigned char>& output)
+{
+    previous.resize(bodies.size());
+    for (int body = 0; body < bodies.size(); ++body)
+    {
+        const std::vector<CVector3>& positions = bodies[body];
+        std::vector<unsigned short>& quantised = previous[body];
+        quantised.resize(positions.size() * 3);
+
+        //Bounding box of this body for this frame. Each axis is quantised over its own extent.
+        CVector3 boxMin = positions.empty() ? CVector3(.0f, .0f, .0f) : positions[0];
+        CVector3 boxMax = boxMin;
+        for (int i = 1; i < positions.size(); ++i)
+        {
+            boxMin.x = std::min(boxMin.x, positions[i].x);  boxMax.x = std::max(boxMax.x, positions[i].x);
+            boxMin.y = std::min(boxMin.y, positions[i].y);  boxMax.y = std::max(boxMax.y, positions[i].y);
+            boxMin.z = std::min(boxMin.z, positions[i].z);  boxMax.z = std::max(boxMax.z, positions[i].z);
+        }
+        CVector3 extent = boxMax - boxMin;
+        WriteBytes(output, &boxMin, sizeof(CVector3));
+        WriteBytes(output, &extent, sizeof(CVector3));
+
+        const float scale[3] =
+        {
+            extent.x > .0f ? QUANTISE_RANGE / extent.x : .0f,
+            extent.y > .0f ? QUANTISE_RANGE / extent.y : .0f,
+            extent.z > .0f ? QUANTISE_RANGE / extent.z : .0f
+        };
+
+        for (int i = 0; i < positions.size(); ++i)
+        {
+            const float offset[3] = { positions[i].x - boxMin.x, positions[i].y - boxMin.y, positions[i].z - boxMin.z };
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                unsigned short value = static_cast<unsigned short>(std::min(offset[axis] * scale[axis] + 0.5f, QUANTISE_RANGE));
+                unsigned short& last = quantised[i * 3 + axis];
+
+                if (isKeyFrame)
+                {
+                    WriteBytes(output, &value, sizeof(unsigned short));
+                }
+                else
+                {
+                    WriteVarint(output, static_cast<int>(value) - static_cast<int>(last));
+                }
+                last = value;
+            }
+        }
+    }
+}
+
+
+bool TrajectoryCodec::DecodeFrame(const unsigned char*& input, const unsigned char* inputEnd, const std::vector<int>& particleCounts,
+                                  std::vector<std::vector<unsigned short>>& previous, bool isKeyFrame, std::vector<std::vector<CVector3>>& bodies)
+{
+    previous.resize(particleCounts.size());
+    bodies.resize(particleCounts.size());
+    for (int body = 0; body < particleCounts.size(); ++body)
+    {
+        std::vector<unsigned short>& quantised = previous[body];
+        std::vector<CVector3>& positions = bodies[body];
+        quantised.resize(particleCounts[body] * 3);
+        positions.resize(particleCounts[body]);
+
+        CVector3 boxMin;
+        CVector3 extent;
+        if (inputEnd - input < 2 * sizeof(CVector3))
+        {
+            return false;
+        }
+        memcpy(&boxMin, input, sizeof(CVector3));  input += sizeof(CVector3);
+        memcpy(&extent, input, sizeof(CVector3));  input += sizeof(CVector3);
+
+        const float scale[3] = { extent.x / QUANTISE_RANGE, extent.y / QUANTISE_RANGE, extent.z / QUANTISE_RANGE };
+
+        for (int i = 0; i < particleCounts[body]; ++i)
+        {
+            float position[3];
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                unsigned short& value = quantised[i * 3 + axis];
+                if (isKeyFrame)
+                {
+                    if (inputEnd - input < sizeof(unsigned short))
+                    {
+                        return false;
+                    }
+                    memcpy(&value, input, sizeof(unsigned short));
+                    input += sizeof(unsigned short);
+                }
+                else
+                {
+                    int delta;
+                    if (!ReadVarint(input, inputEnd, delta))
+                    {
+                        return false;
+                    }
+                    value = static_cast<unsigned short>(value + delta);
+                }
+                position[axis] = value * scale[axis];
+            }
+            positions[i] = boxMin + CVector3(position[0], position[1], position[2]);
+        }
+    }
+    return true;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Recorder
+//--------------------------------------------------------------------------------------
+
+bool TrajectoryRecorder::Start(const std::string& fileName, Mesh* const* meshes, int meshCount)
+{
+    Stop();
+
+    mFile.open(fileName, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!mFile.is_open())
+    {
+        return false;
+    }
+
+    mParticleCounts.resize(meshCount);
+    for (int i = 0; i < meshCount; ++i)
+    {
+        mParticleCounts[i] = meshes[i]->VertexData.getRootSize();
+    }
+
+    TrajectoryFileHeader header = { TRAJECTORY_FILE_MAGIC, TRAJECTORY_VERSION, static_cast<unsigned int>(meshCount), TRAJECTORY_FRAMES_PER_CHUNK };
+    mFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    mFile.write(reinterpret_cast<const char*>(mParticleCounts.data()), mParticleCounts.size() * sizeof(int));
+
+    mIndex.clear();
+    mChunkData.clear();
+    mPreviousFrame.clear();
+    mChunkFirstFrame = 0;
+    mChunkFrameCount = 0;
+    mFramesWritten = 0;
+    mFramesAdded = 0;
+    mFramesDropped = 0;
+
+    mStopWriter = false;
+    mIsRecording = true;
+    mWriterThread = std::thread(&TrajectoryRecorder::WriterLoop, this);
+    return true;
+}
+
+
+void TrajectoryRecorder::AddFrame(Mesh* const* meshes, int meshCount)
+{
+    if (!mIsRecording || meshCount != mParticleCounts.size())
+    {
+        return;
+    }
+
+    Frame* frame = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mQueueLock);
+        if (mQueuedFrames.size() >= TRAJECTORY_MAX_QUEUED_FRAMES)
+        {
+            ++mFramesDropped;
+            return;
+        }
+        if (!mFreeFrames.empty())
+        {
+            frame = mFreeFrames.back();
+            mFreeFrames.pop_back();
+        }
+    }
+    if (frame == nullptr)
+    {
+        frame = new Frame();
+    }
+
+    //Copy outside of the lock, this is the only work the simulation thread does for a frame.
+    frame->resize(meshCount);
+    for (int body = 0; body < meshCount; ++body)
+    {
+        Node& nodes = meshes[body]->VertexData;
+        CVector3 origin = nodes.getOriginPoint();
+        std::vector<CVector3>& positions = (*frame)[body];
+        positions.clear();
+
+        for (int i = 0; i < nodes.getSize(); ++i)
+        {
+            if (nodes.isRoot(i))
+            {
+                positions.push_back(origin + nodes.getPosition(i));
+            }
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mQueueLock);
+        mQueuedFrames.push_back(frame);
+    }
+    mQueueSignal.notify_one();
+    ++mFramesAdded;
+}
+
+
+void TrajectoryRecorder::Stop()
+{
+    if (!mIsRecording)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mQueueLock);
+        mStopWriter = true;
+    }
+    mQueueSignal.notify_one();
+    mWriterThread.join();
+
+    //Whatever is left after the last full chunk, then the index so readers can seek.
+    WriteChunk();
+
+    TrajectoryFileFooter footer;
+    footer.indexOffset = static_cast<unsigned long long>(mFile.tellp());
+    footer.chunkCount = static_cast<unsigned int>(mIndex.size());
+    footer.magic = TRAJECTORY_FILE_MAGIC;
+    mFile.write(reinterpret_cast<const char*>(mIndex.data()), mIndex.size() * sizeof(TrajectoryChunkIndex));
+    mFile.write(reinterpret_cast<const char*>(&footer), sizeof(footer));
+    mFile.close();
+
+    for (int i = 0; i < mFreeFrames.size(); ++i)
+    {
+        delete mFreeFrames[i];
+    }
+    mFreeFrames.clear();
+    mIsRecording = false;
+}
+
+
+void TrajectoryRecorder::WriterLoop()
+{
+    while (true)
+    {
+        Frame* frame;
+        {
+            std::unique_lock<std::mutex> lock(mQueueLock);
+            mQueueSignal.wait(lock, [this] { return mStopWriter || !mQueuedFrames.empty(); });
+            if (mQueuedFrames.empty())
+            {
+                return; //Only reached once stopping and everything has been written
+            }
+            frame = mQueuedFrames.front();
+            mQueuedFrames.pop_front();
+        }
+
+        TrajectoryCodec::EncodeFrame(*frame, mPreviousFrame, mChunkFrameCount == 0, mChunkData);
+        ++mChunkFrameCount;
+        ++mFramesWritten;
+        if (mChunkFrameCount == TRAJECTORY_FRAMES_PER_CHUNK)
+        {
+            WriteChunk();
+        }
+
+        std::lock_guard<std::mutex> lock(mQueueLock);
+        mFreeFrames.push_back(frame);
+    }
+}
+
+
+void TrajectoryRecorder::WriteChunk()
+{
+    if (mChunkFrameCount == 0)
+    {
+        return;
+    }
+
+    TrajectoryChunkIndex index;
+    index.firstFrame = mChunkFirstFrame;
+    index.frameCount = mChunkFrameCount;
+    index.fileOffset = static_cast<unsigned long long>(mFile.tellp());
+    mIndex.push_back(index);
+
+    TrajectoryChunkHeader header = { TRAJECTORY_CHUNK_MAGIC, mChunkFirstFrame, mChunkFrameCount, static_cast<unsigned int>(mChunkData.size()) };
+    mFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    mFile.write(reinterpret_cast<const char*>(mChunkData.data()), mChunkData.size());
+
+    mChunkData.clear();
+    mChunkFirstFrame = mFramesWritten;
+    mChunkFrameCount = 0;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Reader
+//--------------------------------------------------------------------------------------
+
+bool TrajectoryReader::Open(const std::string& fileName)
+{
+    mFile.close();
+    mFile.clear();
+    mFile.open(fileName, std::ios::in | std::ios::binary);
+    if (!mFile.is_open())
+    {
+        return false;
+    }
+
+    TrajectoryFileHeader header;
+    mFile.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (mFile.fail() || header.magic != TRAJECTORY_FILE_MAGIC || header.version != TRAJECTORY_VERSION)
+    {
+        return false;
+    }
+    mParticleCounts.resize(header.bodyCount);
+    mFile.read(reinterpret_cast<char*>(mParticleCounts.data()), mParticleCounts.size() * sizeof(int));
+
+    //The footer is only written when recording stops, a file without one was cut short.
+    TrajectoryFileFooter footer;
+    mFile.seekg(-static_cast<std::streamoff>(sizeof(footer)), std::ios::end);
+    mFile.read(reinterpret_cast<char*>(&footer), sizeof(footer));
+    if (mFile.fail() || footer.magic != TRAJECTORY_FILE_MAGIC)
+    {
+        return false;
+    }
+
+    mIndex.resize(footer.chunkCount);
+    mFile.seekg(static_cast<std::streamoff>(footer.indexOffset), std::ios::beg);
+    mFile.read(reinterpret_cast<char*>(mIndex.data()), mIndex.size() * sizeof(TrajectoryChunkIndex));
+    if (mFile.fail())
+    {
+        return false;
+    }
+
+    mFrameCount = mIndex.empty() ? 0 : mIndex.back().firstFrame + mIndex.back().frameCount;
+    mLoadedChunk = -1;
+    mDecodedFrame = -1;
+    return true;
+}
+
+
+bool TrajectoryReader::LoadChunk(int chunk)
+{
+    TrajectoryChunkHeader header;
+    mFile.clear();
+    mFile.seekg(static_cast<std::streamoff>(mIndex[chunk].fileOffset), std::ios::beg);
+    mFile.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (mFile.fail() || header.magic != TRAJECTORY_CHUNK_MAGIC)
+    {
+        return false;
+    }
+
+    mChunkData.resize(header.byteSize);
+    mFile.read(reinterpret_cast<char*>(mChunkData.data()), header.byteSize);
+    if (mFile.fail())
+    {
+        return false;
+    }
+
+    mLoadedChunk = chunk;
+    mDecodedFrame = -1;
+    mRead = mChunkData.data();
+    return true;
+}
+
+
+bool TrajectoryReader::ReadFrame(int frame, std::vector<std::vector<CVector3>>& bodies)
+{
+    if (frame < 0 || frame >= mFrameCount)
+    {
+        return false;
+    }
+
+    //Find the chunk holding this frame. Chunks are in frame order so a binary search will do.
+    int chunk = static_cast<int>(std::upper_bound(mIndex.begin(), mIndex.end(), static_cast<unsigned int>(frame),
+        [](unsigned int value, const TrajectoryChunkIndex& index) { return value < index.firstFrame; }) - mIndex.begin()) - 1;
+
+    int frameInChunk = frame - mIndex[chunk].firstFrame;
+    if (chunk != mLoadedChunk || frameInChunk < mDecodedFrame)
+    {
+        if (!LoadChunk(chunk))
+        {
+            return false;
+        }
+    }
+
+    //Every frame after the key frame is a difference, so decode forwards from wherever we got to.
+    const unsigned char* readEnd = mChunkData.data() + mChunkData.size();
+    while (mDecodedFrame < frameInChunk)
+    {
+        bool isKeyFrame = (mDecodedFrame == -1);
+        if (!TrajectoryCodec::DecodeFrame(mRead, readEnd, mParticleCounts, mPreviousFrame, isKeyFrame, mCurrentFrame))
+        {
+            mLoadedChunk = -1;
+            return false;
+        }
+        ++mDecodedFrame;
+    }
+
+    bodies = mCurrentFrame;
+    return true;
+}
@@ -0,0 +1,167 @@
+//--------------------------------------------------------------------------------------
+// Trajectory recording
+//--------------------------------------------------------------------------------------
+// Writes the particle positions of a set of soft bodies to disk every step so long runs can be
+// reviewed offline. Raw float positions fill a disk quickly, so each frame is stored as:
+//  - The world bounding box of each body (6 floats)
+//  - Each particle position quantised to 16 bits per axis within that box
+// The first frame of every chunk is stored as is (a key frame), every other frame stores the
+// difference to the previous frame's quantised values as zig-zag varints, which are mostly 1 byte.
+//
+// Encoding and file writes happen on a background thread. AddFrame only copies the positions
+// and hands them over, so the simulation never waits on the disk.
+//
+// File layout:
+//   FileHeader, body count * int particle count
+//   Chunks    - ChunkHeader then frame count * encoded frames
+//   Index     - ChunkIndex per chunk
+//   FileFooter
+// TrajectoryReader uses the index to jump to the chunk holding any frame.
+
+#include "Mesh.h"
+
+#include <vector>
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <fstream>
+
+#ifndef _TRAJECTORY_RECORDER_H_INCLUDED_
+#define _TRAJECTORY_RECORDER_H_INCLUDED_
+
+constexpr unsigned int TRAJECTORY_FILE_MAGIC  = 0x52544253; //"SBTR"
+constexpr unsigned int TRAJECTORY_CHUNK_MAGIC = 0x4B4E4843; //"CHNK"
+constexpr unsigned int TRAJECTORY_VERSION = 1;
+constexpr int TRAJECTORY_FRAMES_PER_CHUNK = 64; //Larger chunks compress slightly better, smaller chunks seek faster.
+constexpr int TRAJECTORY_MAX_QUEUED_FRAMES = 256; //Frames are dropped rather than blocking the simulation if the writer falls this far behind.
+
+
+struct TrajectoryFileHeader
+{
+    unsigned int magic;
+    unsigned int version;
+    unsigned int bodyCount;
+    unsigned int framesPerChunk;
+};
+
+struct TrajectoryChunkHeader
+{
+    unsigned int magic;
+    unsigned int firstFrame;
+    unsigned int frameCount;
+    unsigned int byteSize; //Size of the encoded frames that follow this header
+};
+
+struct TrajectoryChunkIndex
+{
+    unsigned int firstFrame;
+    unsigned int frameCount;
+    unsigned long long fileOffset; //Offset of the ChunkHeader
+};
+
+struct TrajectoryFileFooter
+{
+    unsigned long long indexOffset;
+    unsigned int chunkCount;
+    unsigned int magic;
+};
+
+
+// Shared by the recorder and reader so the two can't drift apart.
+namespace TrajectoryCodec
+{
+    // Appends one frame. previous holds the quantised values of the last frame in the chunk and is updated. Pass isKeyFrame for the first frame of a chunk.
+    void EncodeFrame(const std::vector<std::vector<CVector3>>& bodies, std::vector<std::vector<unsigned short>>& previous, bool isKeyFrame, std::vector<unsigned char>& output);
+
+    // Decodes one frame written by EncodeFrame, moving input past it. Returns false if the data runs out.
+    bool DecodeFrame(const unsigned char*& input, const unsigned char* inputEnd, const std::vector<int>& particleCounts,
+                     std::vector<std::vector<unsigned short>>& previous, bool isKeyFrame, std::vector<std::vector<CVector3>>& bodies);
+}
+
+
+class TrajectoryRecorder
+{
+public:
+    ~TrajectoryRecorder() { Stop(); }
+
+    // Opens the file and starts the writer thread. The particle count of each mesh is fixed for the whole recording. Returns false on failure.
+    bool Start(const std::string& fileName, Mesh* const* meshes, int meshCount);
+
+    // Copies the current world positions of every root node. Only called from the simulation thread.
+    void AddFrame(Mesh* const* meshes, int meshCount);
+
+    // Flushes the remaining frames, writes the index and closes the file.
+    void Stop();
+
+    bool IsRecording() const { return mIsRecording; }
+    int GetFrameCount() const { return mFramesAdded; }
+    int GetDroppedFrameCount() const { return mFramesDropped; }
+
+private:
+    typedef std::vector<std::vector<CVector3>> Frame;
+
+    void WriterLoop();
+    void WriteChunk();
+
+    std::ofstream mFile;
+    std::thread   mWriterThread;
+    bool mIsRecording = false;
+
+    // Hand-over between the simulation and writer threads. Frames are recycled through mFreeFrames so recording doesn't allocate once running.
+    std::mutex mQueueLock;
+    std::condition_variable mQueueSignal;
+    std::deque<Frame*> mQueuedFrames;
+    std::vector<Frame*> mFreeFrames;
+    bool mStopWriter = false;
+
+    // Added to by the simulation thread and read by the GUI
+    std::atomic<int> mFramesAdded{ 0 };
+    std::atomic<int> mFramesDropped{ 0 };
+
+    // Only used by the writer thread
+    std::vector<int> mParticleCounts;
+    std::vector<std::vector<unsigned short>> mPreviousFrame;
+    std::vector<unsigned char> mChunkData;
+    std::vector<TrajectoryChunkIndex> mIndex;
+    unsigned int mChunkFirstFrame = 0;
+    unsigned int mChunkFrameCount = 0;
+    unsigned int mFramesWritten = 0;
+};
+
+
+class TrajectoryReader
+{
+public:
+    // Reads the header and chunk index. Returns false if the file is missing or not a complete recording.
+    bool Open(const std::string& fileName);
+
+    int GetFrameCount() const { return mFrameCount; }
+    int GetBodyCount() const { return static_cast<int>(mParticleCounts.size()); }
+    int GetParticleCount(int body) const { return mParticleCounts[body]; }
+
+    // Fills bodies with the world positions of every particle at the given frame. Reading forwards
+    // through a chunk reuses the frames already decoded, any other frame starts from its chunk's key frame.
+    bool ReadFrame(int frame, std::vector<std::vector<CVector3>>& bodies);
+
+private:
+    bool LoadChunk(int chunk);
+
+    std::ifstream mFile;
+    std::vector<int> mParticleCounts;
+    std::vector<TrajectoryChunkIndex> mIndex;
+    int mFrameCount = 0;
+
+    // Decoding position within the loaded chunk
+    int mLoadedChunk = -1;
+    int mDecodedFrame = -1;
+    std::vector<unsigned char> mChunkData;
+    const unsigned char* mRead = nullptr;
+    std::vector<std::vector<unsigned short>> mPreviousFrame;
+    std::vector<std::vector<CVector3>> mCurrentFrame;
+};
+
+
+#endif //_TRAJECTORY_RECORDER_H_INCLUDED_
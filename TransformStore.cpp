@@ -0,0 +1,180 @@
+//--------------------------------------------------------------------------------------
+// Positions, rotations and scales of every model, with their world matrices built in batches
+//--------------------------------------------------------------------------------------
+
+#include "TransformStore.h"
+#include "TaskPool.h"
+#include "Profiler.h"
+
+#include <xmmintrin.h>
+#include <algorithm>
+#include <cmath>
+
+
+int TransformStore::Add(const CVector3& position, const CVector3& rotation, const CVector3& scale)
+{
+    int transform;
+    if (!mFree.empty())
+    {
+        transform = mFree.back();
+        mFree.pop_back();
+    }
+    else
+    {
+        transform = GetCount();
+        mPositionX.push_back(0);  mPositionY.push_back(0);  mPositionZ.push_back(0);
+        mRotationX.push_back(0);  mRotationY.push_back(0);  mRotationZ.push_back(0);
+        mScaleX.push_back(1);     mScaleY.push_back(1);     mScaleZ.push_back(1);
+        mIsDirty.push_back(1);
+        mWorldMatrices.emplace_back();
+    }
+
+    SetPosition(transform, position);
+    SetRotation(transform, rotation);
+    SetScale(transform, scale);
+    return transform;
+}
+
+
+void TransformStore::Remove(int transform)
+{
+    mIsDirty[transform] = 0; //So UpdateAll skips it
+    mFree.push_back(transform);
+}
+
+
+void TransformStore::SetPosition(int transform, const CVector3& position)
+{
+    mPositionX[transform] = position.x;
+    mPositionY[transform] = position.y;
+    mPositionZ[transform] = position.z;
+    mIsDirty[transform] = 1;
+}
+
+void TransformStore::SetRotation(int transform, const CVector3& rotation)
+{
+    mRotationX[transform] = rotation.x;
+    mRotationY[transform] = rotation.y;
+    mRotationZ[transform] = rotation.z;
+    mIsDirty[transform] = 1;
+}
+
+void TransformStore::SetScale(int transform, const CVector3& scale)
+{
+    mScaleX[transform] = scale.x;
+    mScaleY[transform] = scale.y;
+    mScaleZ[transform] = scale.z;
+    mIsDirty[transform] = 1;
+}
+
+
+// scale * rotZ * rotX * rotY * translation multiplied out, with cx/sx the cosine/sine of the x angle and so on:
+//   row 0:  scale.x * ( cz*cy + sz*sx*sy,   sz*cx,   sz*sx*cy - cz*sy )
+//   row 1:  scale.y * ( cz*sx*sy - sz*cy,   cz*cx,   sz*sy + cz*sx*cy )
+//   row 2:  scale.z * ( cx*sy,              -sx,     cx*cy )
+//   row 3:  position
+// Worked out in the same order as BuildBatch so both round the same.
+void TransformStore::BuildOne(int transform)
+{
+    const float sinX = std::sin(mRotationX[transform]), cosX = std::cos(mRotationX[transform]);
+    const float sinY = std::sin(mRotationY[transform]), cosY = std::cos(mRotationY[transform]);
+    const float sinZ = std::sin(mRotationZ[transform]), cosZ = std::cos(mRotationZ[transform]);
+    const float sinXsinY = sinX * sinY;
+    const float sinXcosY = sinX * cosY;
+    const float scaleX = mScaleX[transform], scaleY = mScaleY[transform], scaleZ = mScaleZ[transform];
+
+    CMatrix4x4& m = mWorldMatrices[transform];
+    m.e00 = (cosZ * cosY + sinZ * sinXsinY) * scaleX;
+    m.e01 = (sinZ * cosX) * scaleX;
+    m.e02 = (sinZ * sinXcosY - cosZ * sinY) * scaleX;
+    m.e03 = 0;
+    m.e10 = (cosZ * sinXsinY - sinZ * cosY) * scaleY;
+    m.e11 = (cosZ * cosX) * scaleY;
+    m.e12 = (sinZ * sinY + cosZ * sinXcosY) * scaleY;
+    m.e13 = 0;
+    m.e20 = (cosX * sinY) * scaleZ;
+    m.e21 = -sinX * scaleZ;
+    m.e22 = (cosX * cosY) * scaleZ;
+    m.e23 = 0;
+    m.e30 = mPositionX[transform];
+    m.e31 = mPositionY[transform];
+    m.e32 = mPositionZ[transform];
+    m.e33 = 1;
+
+    mIsDirty[transform] = 0;
+}
+
+
+// Four transforms in the lanes of each register. A short last batch repeats its final transform to fill the lanes.
+void TransformStore::BuildBatch(const int* transforms, int count)
+{
+    alignas(16) float sinX[4], cosX[4], sinY[4], cosY[4], sinZ[4], cosZ[4], scaleX[4], scaleY[4], scaleZ[4];
+    for (int lane = 0; lane < 4; ++lane)
+    {
+        const int t = transforms[lane < count ? lane : count - 1];
+        sinX[lane] = std::sin(mRotationX[t]);  cosX[lane] = std::cos(mRotationX[t]);
+        sinY[lane] = std::sin(mRotationY[t]);  cosY[lane] = std::cos(mRotationY[t]);
+        sinZ[lane] = std::sin(mRotationZ[t]);  cosZ[lane] = std::cos(mRotationZ[t]);
+        scaleX[lane] = mScaleX[t];  scaleY[lane] = mScaleY[t];  scaleZ[lane] = mScaleZ[t];
+    }
+
+    const __m128 sx = _mm_load_ps(sinX), cx = _mm_load_ps(cosX);
+    const __m128 sy = _mm_load_ps(sinY), cy = _mm_load_ps(cosY);
+    const __m128 sz = _mm_load_ps(sinZ), cz = _mm_load_ps(cosZ);
+    const __m128 scx = _mm_load_ps(scaleX), scy = _mm_load_ps(scaleY), scz = _mm_load_ps(scaleZ);
+    const __m128 sxsy = _mm_mul_ps(sx, sy);
+    const __m128 sxcy = _mm_mul_ps(sx, cy);
+
+    alignas(16) float e[9][4];
+    _mm_store_ps(e[0], _mm_mul_ps(_mm_add_ps(_mm_mul_ps(cz, cy), _mm_mul_ps(sz, sxsy)), scx));
+    _mm_store_ps(e[1], _mm_mul_ps(_mm_mul_ps(sz, cx), scx));
+    _mm_store_ps(e[2], _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(sz, sxcy), _mm_mul_ps(cz, sy)), scx));
+    _mm_store_ps(e[3], _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(cz, sxsy), _mm_mul_ps(sz, cy)), scy));
+    _mm_store_ps(e[4], _mm_mul_ps(_mm_mul_ps(cz, cx), scy));
+    _mm_store_ps(e[5], _mm_mul_ps(_mm_add_ps(_mm_mul_ps(sz, sy), _mm_mul_ps(cz, sxcy)), scy));
+    _mm_store_ps(e[6], _mm_mul_ps(_mm_mul_ps(cx, sy), scz));
+    _mm_store_ps(e[7], _mm_mul_ps(_mm_sub_ps(_mm_setzero_ps(), sx), scz));
+    _mm_store_ps(e[8], _mm_mul_ps(_mm_mul_ps(cx, cy), scz));
+
+    for (int lane = 0; lane < count; ++lane)
+    {
+        const int t = transforms[lane];
+        CMatrix4x4& m = mWorldMatrices[t];
+        m.e00 = e[0][lane];  m.e01 = e[1][lane];  m.e02 = e[2][lane];  m.e03 = 0;
+        m.e10 = e[3][lane];  m.e11 = e[4][lane];  m.e12 = e[5][lane];  m.e13 = 0;
+        m.e20 = e[6][lane];  m.e21 = e[7][lane];  m.e22 = e[8][lane];  m.e23 = 0;
+        m.e30 = mPositionX[t];  m.e31 = mPositionY[t];  m.e32 = mPositionZ[t];  m.e33 = 1;
+        mIsDirty[t] = 0;
+    }
+}
+
+
+void TransformStore::UpdateAll()
+{
+    PROFILE_SCOPE("Transforms");
+
+    mDirtyList.clear();
+    for (int t = 0; t < GetCount(); ++t)
+    {
+        if (mIsDirty[t])  mDirtyList.push_back(t);
+    }
+    PROFILE_COUNTER("Transforms rebuilt", mDirtyList.size());
+
+    const int dirtyCount = static_cast<int>(mDirtyList.size());
+    const int batchCount = (dirtyCount + 3) / 4;
+    GetTaskPool().ParallelFor(batchCount, TRANSFORM_GRAIN / 4, [&](int begin, int end)
+    {
+        for (int batch = begin; batch < end; ++batch)
+        {
+            const int first = batch * 4;
+            BuildBatch(&mDirtyList[first], std::min(4, dirtyCount - first));
+        }
+    });
+}
+
+
+TransformStore& GetTransformStore()
+{
+    static TransformStore store;
+    return store;
+}
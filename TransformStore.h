@@ -0,0 +1,76 @@
+//--------------------------------------------------------------------------------------
+// Positions, rotations and scales of every model, with their world matrices built in batches
+//--------------------------------------------------------------------------------------
+// Model used to build scale * rotZ * rotX * rotY * translation from scratch every time it was drawn,
+// culled, moved or asked for its matrix, several times a frame per model even when it hadn't moved.
+// Instead each model holds a handle into this store. Changing a transform marks it dirty and its
+// world matrix is only rebuilt once it's needed again.
+//
+// The transforms are kept an array per component so UpdateAll, run once a frame before anything
+// reads the matrices, can build the dirty ones four at a time with SSE. The angles' sines and cosines
+// are taken one at a time, the rest of the matrix is worked out for all four together.
+// GetWorldMatrix rebuilds a single dirty matrix on its own with the same maths, so it gives the same
+// result either way.
+//
+// Add and Remove can move the arrays, so only call them while nothing else is using the store
+// (models are made during setup). Different transforms can be read and rebuilt from different threads.
+
+#include "CVector3.h"
+#include "CMatrix4x4.h"
+
+#include <vector>
+
+#ifndef _TRANSFORM_STORE_H_INCLUDED_
+#define _TRANSFORM_STORE_H_INCLUDED_
+
+constexpr int TRANSFORM_GRAIN = 256; //Transforms per block when building in parallel
+
+
+class TransformStore
+{
+public:
+    // Returns the handle of a new transform. Handles of removed transforms are reused.
+    int Add(const CVector3& position, const CVector3& rotation, const CVector3& scale);
+    void Remove(int transform);
+
+    CVector3 GetPosition(int transform) const { return { mPositionX[transform], mPositionY[transform], mPositionZ[transform] }; }
+    CVector3 GetRotation(int transform) const { return { mRotationX[transform], mRotationY[transform], mRotationZ[transform] }; }
+    CVector3 GetScale(int transform) const    { return { mScaleX[transform],    mScaleY[transform],    mScaleZ[transform] }; }
+
+    void SetPosition(int transform, const CVector3& position);
+    void SetRotation(int transform, const CVector3& rotation);
+    void SetScale(int transform, const CVector3& scale);
+
+    // Rotation is in radians, applied around Z, then X, then Y, as MatrixRotationZ * MatrixRotationX * MatrixRotationY
+    const CMatrix4x4& GetWorldMatrix(int transform)
+    {
+        if (mIsDirty[transform])  BuildOne(transform);
+        return mWorldMatrices[transform];
+    }
+
+    // Rebuilds every dirty world matrix
+    void UpdateAll();
+
+    bool IsDirty(int transform) const { return mIsDirty[transform] != 0; }
+    int GetCount() const { return static_cast<int>(mIsDirty.size()); }
+
+private:
+    void BuildOne(int transform);
+    void BuildBatch(const int* transforms, int count);
+
+    std::vector<float> mPositionX, mPositionY, mPositionZ;
+    std::vector<float> mRotationX, mRotationY, mRotationZ;
+    std::vector<float> mScaleX,    mScaleY,    mScaleZ;
+    std::vector<unsigned char> mIsDirty; //Not bool, so flags next to each other can be written from different threads
+    std::vector<CMatrix4x4> mWorldMatrices;
+
+    std::vector<int> mFree;
+    std::vector<int> mDirtyList; //Scratch space for UpdateAll
+};
+
+
+// Shared store every Model is in, made on first use
+TransformStore& GetTransformStore();
+
+
+#endif //_TRANSFORM_STORE_H_INCLUDED_
@@ -0,0 +1,56 @@
+//--------------------------------------------------------------------------------------
+// Hands data from one thread to another without either waiting
+//--------------------------------------------------------------------------------------
+// Three copies of T: the writer fills one, the reader holds one and the third is the latest
+// finished copy waiting to be picked up. Publish and Acquire each swap their copy with the
+// waiting one in a single atomic exchange, so neither side ever blocks or sees a copy that's
+// still being written. If the writer publishes twice before the reader looks, the older copy
+// is simply skipped.
+//
+// Only one thread may write and one thread may read.
+
+#include <atomic>
+
+#ifndef _TRIPLE_BUFFER_H_INCLUDED_
+#define _TRIPLE_BUFFER_H_INCLUDED_
+
+
+template <class T>
+class TripleBuffer
+{
+public:
+    // Writer side. The copy to fill, which still holds whatever was in it last time it was written.
+    T& GetWriteBuffer() { return mBuffers[mWrite]; }
+
+    // Writer side. Makes the write buffer the latest copy and takes the waiting one to write next.
+    void Publish()
+    {
+        int waiting = mWaiting.exchange(mWrite | FRESH_BIT, std::memory_order_acq_rel);
+        mWrite = waiting & INDEX_MASK;
+    }
+
+    // Reader side. Takes the latest copy if one was published since the last call, returns false if not.
+    bool Acquire()
+    {
+        if ((mWaiting.load(std::memory_order_relaxed) & FRESH_BIT) == 0)  return false;
+
+        int waiting = mWaiting.exchange(mRead, std::memory_order_acq_rel);
+        mRead = waiting & INDEX_MASK;
+        return true;
+    }
+
+    // Reader side. The copy taken by the last successful Acquire.
+    const T& GetReadBuffer() const { return mBuffers[mRead]; }
+
+private:
+    static constexpr int INDEX_MASK = 3;
+    static constexpr int FRESH_BIT = 4; //Set in mWaiting when it holds a copy the reader hasn't taken
+
+    T mBuffers[3];
+    int mWrite = 0;
+    std::atomic<int> mWaiting{ 1 };
+    int mRead = 2;
+};
+
+
+#endif //_TRIPLE_BUFFER_H_INCLUDED_
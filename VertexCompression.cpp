@@ -0,0 +1,81 @@
+//--------------------------------------------------------------------------------------
+// Compact vertex format streamed to the GPU for soft bodies
+//--------------------------------------------------------------------------------------
+
+#include "VertexCompression.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+float CompactPositionScale(const CVector3& boundsMin, const CVector3& boundsMax)
+{
+    const float scale = std::max({ boundsMax.x - boundsMin.x, boundsMax.y - boundsMin.y, boundsMax.z - boundsMin.z });
+    return (scale > 0.0f) ? scale : 1.0f;
+}
+
+
+void PackCompactVertices(const BasicNode* nodes, int count, const CVector3& boundsMin, const CVector3& boundsMax, CompactVertex* output)
+{
+    const float toSteps = COMPACT_POSITION_STEPS / CompactPositionScale(boundsMin, boundsMax);
+
+    auto PositionStep = [toSteps](float value, float low)
+    {
+        const float step = std::min(std::max((value - low) * toSteps, 0.0f), COMPACT_POSITION_STEPS);
+        return static_cast<unsigned short>(step + 0.5f);
+    };
+    auto NormalStep = [](float value)
+    {
+        const float step = std::min(std::max(value, -1.0f), 1.0f) * COMPACT_NORMAL_STEPS;
+        return static_cast<signed char>(std::lround(step));
+    };
+
+    for (int i = 0; i < count; ++i)
+    {
+        const BasicNode& node = nodes[i];
+        CompactVertex& vertex = output[i];
+        vertex.position[0] = PositionStep(node.Position.x, boundsMin.x);
+        vertex.position[1] = PositionStep(node.Position.y, boundsMin.y);
+        vertex.position[2] = PositionStep(node.Position.z, boundsMin.z);
+        vertex.position[3] = static_cast<unsigned short>(COMPACT_POSITION_STEPS);
+        vertex.normal[0] = NormalStep(node.Normal.x);
+        vertex.normal[1] = NormalStep(node.Normal.y);
+        vertex.normal[2] = NormalStep(node.Normal.z);
+        vertex.normal[3] = 0;
+    }
+}
+
+
+CVector3 UnpackCompactPosition(const CompactVertex& vertex, const CVector3& boundsMin, const CVector3& boundsMax)
+{
+    const float scale = CompactPositionScale(boundsMin, boundsMax) / COMPACT_POSITION_STEPS;
+    return CVector3(boundsMin.x + vertex.position[0] * scale,
+                    boundsMin.y + vertex.position[1] * scale,
+                    boundsMin.z + vertex.position[2] * scale);
+}
+
+
+// As the GPU reads SNORM, the lowest step is clamped so -128 and -127 are both -1
+CVector3 UnpackCompactNormal(const CompactVertex& vertex)
+{
+    return CVector3(std::max(vertex.normal[0] / COMPACT_NORMAL_STEPS, -1.0f),
+                    std::max(vertex.normal[1] / COMPACT_NORMAL_STEPS, -1.0f),
+                    std::max(vertex.normal[2] / COMPACT_NORMAL_STEPS, -1.0f));
+}
+
+
+CMatrix4x4 CompactPositionMatrix(const CVector3& boundsMin, const CVector3& boundsMax)
+{
+    const float scale = CompactPositionScale(boundsMin, boundsMax);
+    return MatrixScaling(CVector3(scale, scale, scale)) * MatrixTranslation(boundsMin);
+}
+
+
+std::vector<D3D11_INPUT_ELEMENT_DESC> CompactVertexElements()
+{
+    std::vector<D3D11_INPUT_ELEMENT_DESC> vertexElements;
+    vertexElements.push_back({ "Position", 0, DXGI_FORMAT_R16G16B16A16_UNORM, 0, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 });
+    vertexElements.push_back({ "Normal",   0, DXGI_FORMAT_R8G8B8A8_SNORM,     0, 8, D3D11_INPUT_PER_VERTEX_DATA, 0 });
+    vertexElements.push_back({ "UV",       0, DXGI_FORMAT_R32G32_FLOAT,       1, 0, D3D11_INPUT_PER_VERTEX_DATA, 0 });
+    return vertexElements;
+}
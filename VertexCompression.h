@@ -0,0 +1,52 @@
+//--------------------------------------------------------------------------------------
+// Compact vertex format streamed to the GPU for soft bodies
+//--------------------------------------------------------------------------------------
+// A soft body's vertices are uploaded every frame it moves. As BasicNodes that's 32 bytes a vertex,
+// most of it full precision the GPU doesn't need. The compact format is 12 bytes:
+//  - Positions are 16 bit, across the box around the body as it was packed. Every axis uses the box's
+//    largest side so the scale is the same on each. The input assembler reads them back as 0 to 1
+//    (R16G16B16A16_UNORM) and CompactPositionMatrix, put before the world matrix, takes them back to
+//    the mesh's local space. As the scale is uniform, normals through the same matrix only change length.
+//  - Normals are 8 bits a component (R8G8B8A8_SNORM), read back as -1 to 1 with no work in the shaders.
+//  - UVs never change, so they're kept in a second buffer made once, see CompactVertexElements.
+//
+// Packing is CPU only, so the round trip can be checked without a device with UnpackCompactPosition/Normal.
+
+#include "Common.h"
+
+#include <vector>
+
+#ifndef _VERTEX_COMPRESSION_H_INCLUDED_
+#define _VERTEX_COMPRESSION_H_INCLUDED_
+
+constexpr unsigned int MAX_16_BIT_INDEX_VERTICES = 65536; //Meshes with more vertices than this need 32 bit indices
+
+constexpr float COMPACT_POSITION_STEPS = 65535.0f;
+constexpr float COMPACT_NORMAL_STEPS = 127.0f;
+
+
+struct CompactVertex
+{
+    unsigned short position[4]; //x, y, z across the box's largest side. w is always the top step, so reads as 1
+    signed char    normal[4];   //x, y, z. w is unused
+};
+
+
+// The side of the box every axis is quantised across. Never 0, so a flat or empty box still packs.
+float CompactPositionScale(const CVector3& boundsMin, const CVector3& boundsMax);
+
+// Packs count nodes into output. Positions outside the box are clamped to it.
+void PackCompactVertices(const BasicNode* nodes, int count, const CVector3& boundsMin, const CVector3& boundsMax, CompactVertex* output);
+
+// The position and normal the GPU will read back, in the mesh's local space
+CVector3 UnpackCompactPosition(const CompactVertex& vertex, const CVector3& boundsMin, const CVector3& boundsMax);
+CVector3 UnpackCompactNormal(const CompactVertex& vertex);
+
+// Takes the 0 to 1 positions the input assembler reads back to local space. Multiply it before the world matrix.
+CMatrix4x4 CompactPositionMatrix(const CVector3& boundsMin, const CVector3& boundsMax);
+
+// Positions and normals from slot 0 (CompactVertex), UVs from slot 1 (CVector2)
+std::vector<D3D11_INPUT_ELEMENT_DESC> CompactVertexElements();
+
+
+#endif //_VERTEX_COMPRESSION_H_INCLUDED_